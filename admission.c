@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Admission control of the launches per target identity, shared by all the
+ * instances of the host through a mapped file: maximum concurrent runs, with a
+ * FIFO queue, and maximum launch rate.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+
+#include "admission.h"
+
+#define ADMISSION_PID_BITS  22
+#define ADMISSION_PID_MASK  ((1ULL << ADMISSION_PID_BITS) - 1)
+#define ADMISSION_STALL_NS  1000000000LL    /* head ticket never registered (waiter killed) */
+
+static uint64_t admission_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void admission_sleep(uint64_t ns) {
+    struct timespec ts = { (time_t) (ns / 1000000000ULL), (long) (ns % 1000000000ULL) };
+
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+static int admission_dead(pid_t pid) {
+    return pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+}
+
+int admission_parse_rate(const char * str, double * rate) {
+    char * end = NULL;
+
+    errno = 0;
+    *rate = strtod(str, &end);
+    if (errno != 0 || end == str || *rate <= 0)
+        return -1;
+    if (*end == 0 || strcmp(end, "/s") == 0)
+        return 0;
+    if (strcmp(end, "/m") == 0) {
+        *rate /= 60.0;
+        return 0;
+    }
+    return -1;
+}
+
+static int admission_open(admission_t * ad) {
+    struct stat st;
+    void *      p;
+    uint64_t    magic = 0;
+    int         fd, errno_bak;
+
+    if (ad->path == NULL && (ad->path = ad->defpath)
+    &&  fleetstat_default_path("admission", ad->defpath, sizeof(ad->defpath)) != 0)
+        return -1;
+    if ((fd = open(ad->path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0644)) < 0)
+        return -1;
+    /* a file of root or of ours, that nobody else can write to. A smaller file is
+     * extended with zeros, the data of another instance is kept */
+    if (fstat(fd, &st) != 0
+    || ((!S_ISREG(st.st_mode) || (st.st_uid != 0 && st.st_uid != geteuid())
+         || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) && (errno = EPERM))
+    || ((size_t) st.st_size < sizeof(*ad->file) && ftruncate(fd, sizeof(*ad->file)) != 0)
+    || (p = mmap(NULL, sizeof(*ad->file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        errno_bak = errno;
+        close(fd);
+        errno = errno_bak;
+        return -1;
+    }
+    close(fd);
+    ad->file = p;
+    if (__atomic_compare_exchange_n(&ad->file->magic, &magic, ADMISSION_MAGIC, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        ad->file->size = sizeof(*ad->file);
+        ad->file->nslots = ADMISSION_IDENTITIES;
+    } else if (magic != ADMISSION_MAGIC) {
+        munmap(ad->file, sizeof(*ad->file));
+        ad->file = NULL;
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static admission_slot_data_t * admission_slot(admission_t * ad, uid_t uid) {
+    uint32_t uid1 = (uint32_t) uid + 1;
+
+    for (unsigned int n = 0, i = uid % ADMISSION_IDENTITIES; n < ADMISSION_IDENTITIES;
+         ++n, i = (i + 1) % ADMISSION_IDENTITIES) {
+        admission_slot_data_t * slot = &ad->file->slots[i].d;
+        uint32_t                owner = 0;
+
+        if (__atomic_compare_exchange_n(&slot->uid1, &owner, uid1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+        ||  owner == uid1)
+            return slot;
+    }
+    errno = ENOSPC;
+    return NULL;
+}
+
+/* take a free run, or the one of an instance which died. All the runs are counted,
+ * as some may be held above the limit, if it was lowered since. @return index or -1 */
+static int admission_take_run(admission_t * ad) {
+    unsigned int    max = __atomic_load_n(&ad->slot->max_concurrent, __ATOMIC_ACQUIRE);
+    unsigned int    running = 0, first = ADMISSION_MAX_CONCURRENT;
+    int32_t         pid = (int32_t) getpid(), holder;
+
+    for (unsigned int i = 0; i < ADMISSION_MAX_CONCURRENT; ++i) {
+        holder = __atomic_load_n(&ad->slot->runs[i], __ATOMIC_ACQUIRE);
+        if (holder != 0 && !admission_dead(holder))
+            ++running;
+        else if (i < max && first == ADMISSION_MAX_CONCURRENT)
+            first = i;
+    }
+    if (running >= max || first >= max)
+        return -1;
+    holder = __atomic_load_n(&ad->slot->runs[first], __ATOMIC_ACQUIRE);
+    if ((holder != 0 && !admission_dead(holder))
+    ||  !__atomic_compare_exchange_n(&ad->slot->runs[first], &holder, pid, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return -1;
+    ad->owner = pid;
+    return ad->run = (int) first;
+}
+
+/* merge the limits requested with the ones of the identity, keeping the strictest,
+ * then take them as the limits of this run */
+static void admission_limits(admission_t * ad) {
+    admission_slot_data_t * slot = ad->slot;
+    uint32_t                max = __atomic_load_n(&slot->max_concurrent, __ATOMIC_ACQUIRE);
+    uint64_t                interval = __atomic_load_n(&slot->interval, __ATOMIC_ACQUIRE);
+    uint64_t                wanted = ad->rate > 0 ? (uint64_t) (1e9 / ad->rate) : 0;
+
+    while (ad->max_concurrent > 0 && (max == 0 || ad->max_concurrent < max)
+    &&     !__atomic_compare_exchange_n(&slot->max_concurrent, &max, ad->max_concurrent, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        ; /* nothing */
+    while (wanted > interval
+    &&     !__atomic_compare_exchange_n(&slot->interval, &interval, wanted, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        ; /* nothing */
+    ad->max_concurrent = __atomic_load_n(&slot->max_concurrent, __ATOMIC_ACQUIRE);
+    interval = __atomic_load_n(&slot->interval, __ATOMIC_ACQUIRE);
+    ad->rate = interval > 0 ? 1e9 / interval : 0.0;
+}
+
+/* skip the waiter at the head of the queue if it died. @return 1 if skipped, else 0 */
+static int admission_skip_dead(admission_slot_data_t * slot, uint64_t head) {
+    uint64_t entry = __atomic_load_n(&slot->queue[head % ADMISSION_QUEUE], __ATOMIC_ACQUIRE);
+
+    if ((entry >> ADMISSION_PID_BITS) != (head & (UINT64_MAX >> ADMISSION_PID_BITS))
+    ||  !admission_dead((pid_t) (entry & ADMISSION_PID_MASK)))
+        return 0;
+    __atomic_compare_exchange_n(&slot->head, &head, head + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    return 1;
+}
+
+/* wait for the turn of a new ticket in the FIFO queue, then for a free run */
+static int admission_queue(admission_t * ad) {
+    admission_slot_data_t * slot = ad->slot;
+    uint64_t                ticket, stalled = 0, since = 0;
+
+    if (ad->nowait) {
+        uint64_t head;
+
+        /* nobody waiting before us but dead waiters, and a run free now */
+        for (unsigned int n = 0; (head = __atomic_load_n(&slot->head, __ATOMIC_ACQUIRE))
+                                 != __atomic_load_n(&slot->next, __ATOMIC_ACQUIRE); ++n) {
+            if (n >= ADMISSION_QUEUE || !admission_skip_dead(slot, head)) {
+                errno = EAGAIN;
+                return -1;
+            }
+        }
+        if (admission_take_run(ad) < 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        return 0;
+    }
+    ticket = __atomic_fetch_add(&slot->next, 1, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&slot->queue[ticket % ADMISSION_QUEUE],
+                     (ticket << ADMISSION_PID_BITS) | (uint64_t) getpid(), __ATOMIC_RELEASE);
+    while (1) {
+        uint64_t head = __atomic_load_n(&slot->head, __ATOMIC_ACQUIRE);
+        uint64_t entry;
+
+        if (head == ticket) {
+            if (admission_take_run(ad) >= 0) {
+                __atomic_store_n(&slot->head, ticket + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if (ticket - head < ADMISSION_QUEUE) {
+            /* the waiter at the head died: skip it */
+            entry = __atomic_load_n(&slot->queue[head % ADMISSION_QUEUE], __ATOMIC_ACQUIRE);
+            if ((entry >> ADMISSION_PID_BITS) == (head & (UINT64_MAX >> ADMISSION_PID_BITS))) {
+                admission_skip_dead(slot, head);
+            } else if (stalled != head + 1) {
+                stalled = head + 1;
+                since = admission_now();
+            } else if (admission_now() - since > ADMISSION_STALL_NS) {
+                __atomic_compare_exchange_n(&slot->head, &head, head + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            }
+        }
+        admission_sleep(ADMISSION_POLL_MS * 1000000ULL);
+    }
+}
+
+/* reserve the next launch time of the rate (generic cell rate algorithm), with a
+ * burst of the launches of one second. @param reserved receives the new tat */
+static int admission_rate(admission_t * ad, uint64_t * reserved) {
+    uint64_t    interval = (uint64_t) (1e9 / ad->rate);
+    uint64_t    tolerance = ad->rate > 1.0 ? (uint64_t) (ad->rate - 1.0) * interval : 0;
+    uint64_t    tat, now, start;
+
+    tat = __atomic_load_n(&ad->slot->tat, __ATOMIC_ACQUIRE);
+    do {
+        now = admission_now();
+        start = tat > now ? tat : now;
+        if (start > now + tolerance && ad->nowait) {
+            errno = EAGAIN;
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&ad->slot->tat, &tat, start + interval, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    *reserved = start + interval;
+    if (start > now + tolerance)
+        admission_sleep(start - tolerance - now);
+    return 0;
+}
+
+int admission_acquire(admission_t * ad, uid_t uid) {
+    struct timespec t0, t1;
+    uint64_t        tat = 0;
+    int             ret = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ad->uid = uid;
+    if (ad->file == NULL && admission_open(ad) != 0)
+        return -1;
+    if ((ad->slot = admission_slot(ad, uid)) == NULL)
+        return -1;
+    admission_limits(ad);
+    /* the rate first, so that no run is held while waiting for it */
+    if (ad->rate > 0 && admission_rate(ad, &tat) != 0)
+        ret = -1;
+    if (ret == 0 && ad->max_concurrent > 0 && admission_queue(ad) != 0) {
+        ret = -1;
+        /* not launched: give back the launch time reserved, unless another one was since */
+        if (ad->rate > 0)
+            __atomic_compare_exchange_n(&ad->slot->tat, &tat, tat - (uint64_t) (1e9 / ad->rate), 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ad->waited.tv_sec = t1.tv_sec - t0.tv_sec;
+    if ((ad->waited.tv_nsec = t1.tv_nsec - t0.tv_nsec) < 0) {
+        --ad->waited.tv_sec;
+        ad->waited.tv_nsec += 1000000000L;
+    }
+    return ret;
+}
+
+void admission_report(FILE * out, const admission_t * ad) {
+    unsigned int running = 0;
+
+    if (ad->slot == NULL)
+        return ;
+    for (unsigned int i = 0; i < ADMISSION_MAX_CONCURRENT; ++i)
+        running += ad->slot->runs[i] != 0;
+    fprintf(out, "admission% 3ld.%09ld (seconds waited before launch as uid %lu",
+            (long) ad->waited.tv_sec, ad->waited.tv_nsec, (unsigned long) ad->uid);
+    if (ad->max_concurrent > 0)
+        fprintf(out, ", %u running of max %u", running, ad->max_concurrent);
+    if (ad->rate > 0)
+        fprintf(out, ", max %.2f launches/s", ad->rate);
+    fprintf(out, ")\n");
+}
+
+void admission_free(admission_t * ad) {
+    /* the child of the fork does not own the run */
+    if (ad->slot != NULL && ad->run >= 0 && ad->owner == getpid()) {
+        int32_t pid = (int32_t) ad->owner;
+        __atomic_compare_exchange_n(&ad->slot->runs[ad->run], &pid, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+    ad->run = -1;
+    ad->slot = NULL;
+    if (ad->file != NULL)
+        munmap(ad->file, sizeof(*ad->file));
+    ad->file = NULL;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Admission control of the launches per target identity, shared by all the
+ * instances of the host through a mapped file: maximum concurrent runs, with a
+ * FIFO queue, and maximum launch rate.
+ */
+#ifndef VRUNAS_ADMISSION_H
+#define VRUNAS_ADMISSION_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "fleetstat.h"
+
+#define ADMISSION_DEFAULT_PATH  VRUNAS_RUNDIR "/admission" /* see fleetstat_default_path() */
+#define ADMISSION_MAGIC         0x7672756e61736132ULL   /* "vrunasa2" */
+#define ADMISSION_IDENTITIES    128
+#define ADMISSION_MAX_CONCURRENT 64
+#define ADMISSION_QUEUE         128     /* waiters watched for death, per identity */
+#define ADMISSION_POLL_MS       10
+
+typedef struct {
+    volatile uint32_t   uid1;           /* uid + 1, 0 if free */
+    volatile uint32_t   max_concurrent; /* limits of the identity, the strictest requested */
+    volatile uint64_t   interval;       /* rate: ns between launches, 0 if not limited */
+    volatile uint64_t   tat;            /* rate: theoretical arrival time of next launch (ns, CLOCK_MONOTONIC) */
+    volatile uint64_t   next;           /* concurrency: next ticket of the queue */
+    volatile uint64_t   head;           /* ticket allowed to take a run */
+    volatile uint64_t   queue[ADMISSION_QUEUE];             /* ticket << 22 | pid of the waiters */
+    volatile int32_t    runs[ADMISSION_MAX_CONCURRENT];     /* pid of the instances running, 0 if free */
+} admission_slot_data_t;
+
+typedef union {
+    admission_slot_data_t   d;
+    char                    pad[(sizeof(admission_slot_data_t) + 63) & ~(size_t) 63];
+} admission_slot_t;
+
+typedef struct {
+    volatile uint64_t   magic;
+    uint32_t            size;
+    uint32_t            nslots;
+    char                reserved[48];
+    admission_slot_t    slots[ADMISSION_IDENTITIES];
+} admission_file_t;
+
+typedef struct {
+    const char *        path;           /* NULL for the default one */
+    unsigned int        max_concurrent; /* 0 if not limited, then the limit of the identity */
+    double              rate;           /* launches per second, 0 if not limited, same */
+    int                 nowait;         /* fail instead of waiting */
+    admission_file_t *  file;
+    admission_slot_data_t * slot;
+    uid_t               uid;
+    int                 run;            /* index in runs of the slot, -1 if none */
+    pid_t               owner;          /* process holding run */
+    struct timespec     waited;
+    char                defpath[64];
+} admission_t;
+
+#define ADMISSION_INITIALIZER { NULL, 0, 0.0, 0, NULL, NULL, 0, -1, 0, { 0, 0 }, { 0, } }
+
+/** admission_parse_rate() : parse a rate 'R', 'R/s' or 'R/m' (launches per second or minute).
+ * @return 0 or -1 on error */
+int admission_parse_rate(const char * str, double * rate);
+
+/** admission_acquire() : wait until uid may launch a program (or fail with nowait): first the
+ * launch rate, then its turn in the queue of uid and a free run. Instances which died are
+ * removed from the queue and runs. The file (ad->path, or the default one of the effective
+ * user if NULL, as fleetstat_default_path()) must be a regular file of root or
+ * of the effective user, not writable by group and others (else EPERM).
+ * The limits are kept per identity in the file: a run enforces the strictest ones requested
+ * for uid so far (its own included), a looser request does not raise them. They are reset
+ * by removing the file.
+ * @return 0 on success, -1 on error (errno set, EAGAIN if over the limits with nowait) */
+int admission_acquire(admission_t * ad, uid_t uid);
+
+/** admission_report() : print the time waited for admission (extended timings format) */
+void admission_report(FILE * out, const admission_t * ad);
+
+/** admission_free() : release the run taken by this process, and the resources of ad */
+void admission_free(admission_t * ad);
+
+#endif /* ! ifndef VRUNAS_ADMISSION_H */
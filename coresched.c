@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Core scheduling of a run (linux PR_SCHED_CORE): the process tree of the program
+ * gets its own cookie, so that no other task runs on the SMT siblings of its cpus,
+ * and optionally uses one cpu of each core.
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef __linux__
+# include <sys/prctl.h>
+#endif
+
+#include "coresched.h"
+
+/* linux 5.14 */
+#ifndef PR_SCHED_CORE
+# define PR_SCHED_CORE                      62
+# define PR_SCHED_CORE_GET                  0
+# define PR_SCHED_CORE_CREATE               1
+#endif
+#ifndef PR_SCHED_CORE_SCOPE_THREAD
+# define PR_SCHED_CORE_SCOPE_THREAD         0
+# define PR_SCHED_CORE_SCOPE_THREAD_GROUP   1
+#endif
+
+static int coresched_read(const char * path, char * buf, size_t size) {
+    ssize_t n;
+    int     fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n <= 0)
+        return -1;
+    buf[n] = 0;
+    return 0;
+}
+
+#ifdef __linux__
+/* cpu list '0-1,8-9' of sysfs */
+static int coresched_cpulist(const char * str, cpu_set_t * set) {
+    char *  end;
+
+    CPU_ZERO(set);
+    while (*str >= '0' && *str <= '9') {
+        unsigned long first = strtoul(str, &end, 10), last = first;
+
+        if (*end == '-')
+            last = strtoul(end + 1, &end, 10);
+        for (unsigned long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, set);
+        str = *end == ',' ? end + 1 : end;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+#endif
+
+int coresched_init(coresched_t * cs) {
+#ifdef __linux__
+    char        path[256], buf[1024];
+    cpu_set_t   allowed, siblings;
+    void *      p;
+
+    snprintf(path, sizeof(path), "%s/devices/system/cpu/smt/active", cs->sysfs);
+    cs->smt = coresched_read(path, buf, sizeof(buf)) == 0 ? *buf == '1' : -1;
+
+    if (cs->reserve) {
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0
+        ||  (cs->cpus = calloc(CPU_COUNT(&allowed), sizeof(*cs->cpus))) == NULL)
+            return -1;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            int first = 1;
+
+            if (!CPU_ISSET(cpu, &allowed))
+                continue ;
+            /* the cpus of unknown topology are kept */
+            snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+                     cs->sysfs, cpu);
+            if (coresched_read(path, buf, sizeof(buf)) == 0 && coresched_cpulist(buf, &siblings) == 0) {
+                for (int sib = 0; sib < cpu && first; ++sib)
+                    first = !(CPU_ISSET(sib, &siblings) && CPU_ISSET(sib, &allowed));
+            }
+            if (first)
+                cs->cpus[cs->ncpus++] = cpu;
+            else
+                ++cs->nsiblings;
+        }
+    }
+    if ((p = mmap(NULL, sizeof(*cs->shared), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        return -1;
+    cs->shared = p;
+    return 0;
+#else
+    (void) cs;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int coresched_child(coresched_t * cs) {
+#ifdef __linux__
+    coresched_shared_t  local = { 0, 0, 0, 0 };
+    coresched_shared_t *sh = cs->shared != NULL ? cs->shared : &local;
+    int                 errno_bak = 0;
+
+    /* a cookie of its own for the thread group, inherited on fork() and kept on execve() */
+    if (prctl(PR_SCHED_CORE, PR_SCHED_CORE_CREATE, 0, PR_SCHED_CORE_SCOPE_THREAD_GROUP, 0) == 0) {
+        sh->created = 1;
+        if (prctl(PR_SCHED_CORE, PR_SCHED_CORE_GET, 0, PR_SCHED_CORE_SCOPE_THREAD, &sh->cookie) != 0)
+            sh->cookie = 0;
+    } else {
+        errno_bak = sh->error = errno;
+    }
+    if (cs->reserve && cs->ncpus > 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        for (unsigned int i = 0; i < cs->ncpus; ++i)
+            CPU_SET(cs->cpus[i], &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == 0)
+            sh->reserved = 1;
+        else if (errno_bak == 0)
+            errno_bak = errno;
+    }
+    if (errno_bak != 0) {
+        errno = errno_bak;
+        return -1;
+    }
+    return 0;
+#else
+    (void) cs;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void coresched_report(FILE * out, const coresched_t * cs) {
+    const coresched_shared_t *  sh = cs->shared;
+    char                        reserve[64] = "";
+
+    if (!cs->enabled || sh == NULL)
+        return ;
+    if (cs->reserve) {
+        snprintf(reserve, sizeof(reserve), ", %u sibling cpu%s %sreserved", cs->nsiblings,
+                 cs->nsiblings != 1 ? "s" : "", sh->reserved ? "" : "not ");
+    }
+    if (sh->created && cs->smt != 0) {
+        fprintf(out, "coresched%13s (smt isolation of the program: core scheduling cookie 0x%" PRIx64 " of its "
+                                    "process tree only%s)\n", "active", sh->cookie, reserve);
+    } else {
+        fprintf(out, "coresched%13s (smt isolation of the program: %s%s)\n", "inactive",
+                cs->smt == 0 || sh->error == ENODEV ? "no smt on the host"
+                : sh->error == EINVAL ? "no core scheduling in the kernel" : strerror(sh->error), reserve);
+    }
+}
+
+void coresched_free(coresched_t * cs) {
+    free(cs->cpus);
+    cs->cpus = NULL;
+    cs->ncpus = 0;
+    if (cs->shared != NULL)
+        munmap(cs->shared, sizeof(*cs->shared));
+    cs->shared = NULL;
+}
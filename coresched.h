@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Core scheduling of a run (linux PR_SCHED_CORE): the process tree of the program
+ * gets its own cookie, so that no other task runs on the SMT siblings of its cpus,
+ * and optionally uses one cpu of each core.
+ */
+#ifndef VRUNAS_CORESCHED_H
+#define VRUNAS_CORESCHED_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/* what the child applied before its execve() */
+typedef struct {
+    int                 created;        /* the cookie of the program was created */
+    int                 error;          /* errno of the creation, 0 if none */
+    uint64_t            cookie;         /* written as a u64 by PR_SCHED_CORE_GET */
+    int                 reserved;       /* the affinity was restricted to cs->cpus */
+} coresched_shared_t;
+
+typedef struct {
+    int                 enabled;        /* --core-sched */
+    int                 reserve;        /* one cpu of each core, its siblings left to the cookie */
+    const char *        sysfs;          /* root of sysfs */
+    int                 smt;            /* SMT active on the host: 1, 0, -1 if unknown */
+    int *               cpus;           /* cpus of the program with reserve */
+    unsigned int        ncpus;
+    unsigned int        nsiblings;      /* allowed cpus left idle with reserve */
+    coresched_shared_t *shared;
+} coresched_t;
+
+#define CORESCHED_INITIALIZER { 0, 0, "/sys", -1, NULL, 0, 0, NULL }
+
+/** coresched_init() : get the SMT state of the host and, with reserve, the first
+ * allowed cpu of each core, and create the state shared with the child.
+ * To be called before fork().
+ * @return 0 on success, -1 on error (errno set) */
+int coresched_init(coresched_t * cs);
+
+/** coresched_child() : create the cookie of the process which is going to execute
+ * the program, inherited by its children, and restrict its affinity with reserve.
+ * @return 0 on success, -1 on error (errno set, ENODEV without SMT, EINVAL if
+ *         the kernel has no core scheduling) */
+int coresched_child(coresched_t * cs);
+
+/** coresched_report() : print whether the SMT isolation was active (extended timings format) */
+void coresched_report(FILE * out, const coresched_t * cs);
+
+/** coresched_free() : release resources of cs (not cs itself) */
+void coresched_free(coresched_t * cs);
+
+#endif /* ! ifndef VRUNAS_CORESCHED_H */
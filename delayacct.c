@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Delay accounting of a process tree with linux taskstats (netlink).
+ */
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+
+#ifdef __linux__
+# include <sys/socket.h>
+# include <sys/prctl.h>
+# include <linux/netlink.h>
+# include <linux/genetlink.h>
+# include <linux/taskstats.h>
+#endif
+
+#include "delayacct.h"
+
+#ifndef __linux__
+
+int delayacct_init(delayacct_t * dac) {
+    (void) dac;
+    errno = ENOSYS;
+    return -1;
+}
+
+int delayacct_start(delayacct_t * dac, pid_t pid) {
+    (void) dac;
+    (void) pid;
+    errno = ENOSYS;
+    return -1;
+}
+
+void delayacct_stop(delayacct_t * dac) {
+    (void) dac;
+}
+
+#else /* __linux__ */
+
+#define DELAYACCT_SYSCTL    "/proc/sys/kernel/task_delayacct"
+#define DELAYACCT_CPUS      "/sys/devices/system/cpu/possible"
+#define DELAYACCT_RCVBUF    (8 * 1024 * 1024)
+#define DELAYACCT_BUFSZ     16384
+
+typedef struct {
+    struct nlmsghdr     n;
+    struct genlmsghdr   g;
+    char                buf[512];
+} delayacct_msg_t;
+
+#define DELAYACCT_NLA_DATA(na)      ((void *) ((char *) (na) + NLA_HDRLEN))
+#define DELAYACCT_NLA_OK(na, len)   ((len) >= (int) sizeof(struct nlattr) \
+                                     && (na)->nla_len >= sizeof(struct nlattr) \
+                                     && (na)->nla_len <= (len))
+#define DELAYACCT_NLA_NEXT(na, len) ((len) -= NLA_ALIGN((na)->nla_len), \
+                                     (struct nlattr *) ((char *) (na) + NLA_ALIGN((na)->nla_len)))
+
+static int delayacct_send(delayacct_t * dac, uint16_t type, uint8_t cmd,
+                          uint16_t attr, const void * data, size_t len) {
+    delayacct_msg_t     msg;
+    struct nlattr *     na;
+    struct sockaddr_nl  addr;
+    ssize_t             n;
+
+    if (len > sizeof(msg.buf) - NLA_HDRLEN) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    msg.n.nlmsg_type = type;
+    msg.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    msg.g.cmd = cmd;
+    msg.g.version = 1;
+    na = (struct nlattr *) ((char *) &msg + NLMSG_ALIGN(msg.n.nlmsg_len));
+    na->nla_type = attr;
+    na->nla_len = NLA_HDRLEN + len;
+    memcpy(DELAYACCT_NLA_DATA(na), data, len);
+    msg.n.nlmsg_len = NLMSG_ALIGN(msg.n.nlmsg_len) + NLA_ALIGN(na->nla_len);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    while ((n = sendto(dac->sock, &msg, msg.n.nlmsg_len, 0,
+                       (struct sockaddr *) &addr, sizeof(addr))) < 0 && errno == EINTR)
+        ; /* nothing */
+    return n < 0 ? -1 : 0;
+}
+
+/* wait for the acknowledgement of the last request, getting the family id from the
+ * reply of CTRL_CMD_GETFAMILY if family is not NULL. Other messages are ignored. */
+static int delayacct_ack(delayacct_t * dac, uint16_t * family) {
+    static char buf[DELAYACCT_BUFSZ];
+
+    while (1) {
+        struct nlmsghdr *   nh;
+        int                 len;
+
+        if ((len = recv(dac->sock, buf, sizeof(buf), 0)) < 0) {
+            if (errno == EINTR || errno == ENOBUFS)
+                continue ;
+            return -1;
+        }
+        for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, (unsigned int) len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr * err = NLMSG_DATA(nh);
+                if (err->error == 0)
+                    return 0;
+                errno = -err->error;
+                return -1;
+            }
+            if (nh->nlmsg_type == GENL_ID_CTRL && family != NULL) {
+                struct nlattr * na = (struct nlattr *) ((char *) NLMSG_DATA(nh) + GENL_HDRLEN);
+                int             alen = nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+
+                for ( ; DELAYACCT_NLA_OK(na, alen); na = DELAYACCT_NLA_NEXT(na, alen)) {
+                    if (na->nla_type == CTRL_ATTR_FAMILY_ID)
+                        *family = *(uint16_t *) DELAYACCT_NLA_DATA(na);
+                }
+            }
+        }
+    }
+}
+
+static int delayacct_cpumask(delayacct_t * dac, int cmd) {
+    if (delayacct_send(dac, dac->family, TASKSTATS_CMD_GET, cmd,
+                       dac->cpumask, strlen(dac->cpumask) + 1) != 0)
+        return -1;
+    return delayacct_ack(dac, NULL);
+}
+
+static int delayacct_sysctl(int * value, int set) {
+    char    buf[16];
+    int     fd, ret = 0;
+
+    if ((fd = open(DELAYACCT_SYSCTL, set ? O_WRONLY : O_RDONLY)) < 0)
+        return -1;
+    if (set) {
+        int n = snprintf(buf, sizeof(buf), "%d\n", *value);
+        if (write(fd, buf, n) != n)
+            ret = -1;
+    } else {
+        ssize_t n = read(fd, buf, sizeof(buf) - 1);
+        if (n <= 0)
+            ret = -1;
+        else {
+            buf[n] = 0;
+            *value = strtol(buf, NULL, 10);
+        }
+    }
+    close(fd);
+    return ret;
+}
+
+int delayacct_init(delayacct_t * dac) {
+    struct sockaddr_nl  addr;
+    int                 rcvbuf = DELAYACCT_RCVBUF, value;
+    FILE *              f;
+
+    if ((dac->sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC)) < 0)
+        return -1;
+    dac->owner = getpid();
+    /* exits of all tasks of the system are received: make room for bursts */
+    if (setsockopt(dac->sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) != 0)
+        setsockopt(dac->sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    if (bind(dac->sock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+        goto error;
+
+    if (delayacct_send(dac, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME,
+                       TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME)) != 0
+    ||  delayacct_ack(dac, &dac->family) != 0)
+        goto error;
+    if (dac->family == 0) {
+        errno = ENOENT;
+        goto error;
+    }
+
+    /* listen to exits on all cpus the tasks could run on */
+    if ((f = fopen(DELAYACCT_CPUS, "r")) != NULL) {
+        if (fgets(dac->cpumask, sizeof(dac->cpumask), f) == NULL)
+            *dac->cpumask = 0;
+        dac->cpumask[strcspn(dac->cpumask, " \t\r\n")] = 0;
+        fclose(f);
+    }
+    if (*dac->cpumask == 0)
+        snprintf(dac->cpumask, sizeof(dac->cpumask), "0-%ld", sysconf(_SC_NPROCESSORS_CONF) - 1);
+    if (delayacct_cpumask(dac, TASKSTATS_CMD_ATTR_REGISTER_CPUMASK) != 0)
+        goto error;
+
+    /* delays are only accounted when enabled (linux 5.14: disabled by default) */
+    if (delayacct_sysctl(&value, 0) == 0 && value == 0) {
+        value = 1;
+        if (delayacct_sysctl(&value, 1) == 0)
+            dac->sysctl_old = 0;
+    }
+    return 0;
+
+error:
+    value = errno;
+    close(dac->sock);
+    dac->sock = -1;
+    errno = value;
+    return -1;
+}
+
+/* add a delay of a task, ignoring the impossible ones (delay accounting enabled
+ * while the task was waiting gives the time since boot) */
+static void delayacct_add_delay(delayacct_t * dac, uint64_t elapsed, uint64_t * sum, uint64_t delay,
+                                uint64_t * count, uint64_t n) {
+    if (delay > elapsed) {
+        ++dac->ninvalid;
+        return ;
+    }
+    *sum += delay;
+    if (count != NULL)
+        *count += n;
+}
+
+static void delayacct_add(delayacct_t * dac, const struct taskstats * ts) {
+    delayacct_stats_t * st = &dac->stats;
+    uint64_t            elapsed = ts->ac_etime * 1000ULL;
+    int                 in;
+
+    if ((in = proctree_contains(&dac->tree, ts->ac_ppid)) <= 0) {
+        if (in < 0)
+            ++dac->ndropped;
+        else
+            ++dac->nforeign;
+        return ;
+    }
+    proctree_add(&dac->tree, ts->ac_pid);
+    ++st->ntasks;
+    st->elapsed += elapsed;
+    delayacct_add_delay(dac, elapsed, &st->cpu_run, ts->cpu_run_real_total, NULL, 0);
+    delayacct_add_delay(dac, elapsed, &st->cpu_delay, ts->cpu_delay_total, &st->cpu_count, ts->cpu_count);
+    delayacct_add_delay(dac, elapsed, &st->blkio_delay, ts->blkio_delay_total,
+                        &st->blkio_count, ts->blkio_count);
+    delayacct_add_delay(dac, elapsed, &st->swapin_delay, ts->swapin_delay_total,
+                        &st->swapin_count, ts->swapin_count);
+    delayacct_add_delay(dac, elapsed, &st->reclaim_delay, ts->freepages_delay_total,
+                        &st->reclaim_count, ts->freepages_count);
+#if TASKSTATS_VERSION >= 10
+    if (ts->version >= 10)
+        delayacct_add_delay(dac, elapsed, &st->thrashing_delay, ts->thrashing_delay_total,
+                            &st->thrashing_count, ts->thrashing_count);
+#endif
+#if TASKSTATS_VERSION >= 11
+    if (ts->version >= 11)
+        delayacct_add_delay(dac, elapsed, &st->compact_delay, ts->compact_delay_total,
+                            &st->compact_count, ts->compact_count);
+#endif
+}
+
+static void delayacct_parse(delayacct_t * dac, char * buf, int len) {
+    struct nlmsghdr * nh;
+
+    for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, (unsigned int) len); nh = NLMSG_NEXT(nh, len)) {
+        struct genlmsghdr * gh = NLMSG_DATA(nh);
+        struct nlattr *     na;
+        int                 alen;
+
+        if (nh->nlmsg_type != dac->family || gh->cmd != TASKSTATS_CMD_NEW)
+            continue ;
+        na = (struct nlattr *) ((char *) gh + GENL_HDRLEN);
+        alen = nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+        for ( ; DELAYACCT_NLA_OK(na, alen); na = DELAYACCT_NLA_NEXT(na, alen)) {
+            struct nlattr * nested;
+            int             nlen;
+
+            /* the thread group exit (AGGR_TGID) only sums its threads: skip it */
+            if (na->nla_type != TASKSTATS_TYPE_AGGR_PID)
+                continue ;
+            nested = DELAYACCT_NLA_DATA(na);
+            nlen = na->nla_len - NLA_HDRLEN;
+            for ( ; DELAYACCT_NLA_OK(nested, nlen); nested = DELAYACCT_NLA_NEXT(nested, nlen)) {
+                struct taskstats    ts;
+                size_t              size = nested->nla_len - NLA_HDRLEN;
+
+                if (nested->nla_type != TASKSTATS_TYPE_STATS)
+                    continue ;
+                /* the kernel structure can be older or newer than ours */
+                memset(&ts, 0, sizeof(ts));
+                memcpy(&ts, DELAYACCT_NLA_DATA(nested), size < sizeof(ts) ? size : sizeof(ts));
+                delayacct_add(dac, &ts);
+            }
+        }
+    }
+}
+
+static void * delayacct_thread(void * data) {
+    static char     buf[DELAYACCT_BUFSZ];
+    delayacct_t *   dac = data;
+    struct pollfd   pfd;
+
+    pfd.fd = dac->sock;
+    pfd.events = POLLIN;
+    while (1) {
+        int     stop = dac->stop;
+        ssize_t n;
+
+        /* drain the socket once more after the stop request */
+        while ((n = recv(dac->sock, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+            delayacct_parse(dac, buf, n);
+        if (n < 0 && errno == ENOBUFS) {
+            ++dac->ndropped;
+            continue ;
+        }
+        if (stop)
+            break ;
+        poll(&pfd, 1, 100);
+    }
+    return NULL;
+}
+
+int delayacct_start(delayacct_t * dac, pid_t pid) {
+    if (dac->sock < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    /* orphans are adopted by us instead of init, and stay in the tree.
+     * our pid is in the tree for them, and for the threads of pid (ac_ppid is ours) */
+    prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0);
+    if (proctree_add(&dac->tree, getpid()) != 0 || proctree_add(&dac->tree, pid) != 0)
+        return -1;
+    dac->stop = 0;
+    if ((errno = pthread_create(&dac->thread, NULL, delayacct_thread, dac)) != 0)
+        return -1;
+    dac->running = 1;
+    return 0;
+}
+
+void delayacct_stop(delayacct_t * dac) {
+    if (dac->running) {
+        dac->stop = 1;
+        pthread_join(dac->thread, NULL);
+        dac->running = 0;
+    }
+    if (dac->sock >= 0) {
+        /* a forked child must not deregister the socket it shares with its father */
+        if (dac->owner == getpid())
+            delayacct_cpumask(dac, TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK);
+        close(dac->sock);
+        dac->sock = -1;
+    }
+    if (dac->sysctl_old >= 0 && dac->owner == getpid()) {
+        delayacct_sysctl(&dac->sysctl_old, 1);
+        dac->sysctl_old = -1;
+    }
+}
+
+#endif /* __linux__ */
+
+static void delayacct_print(FILE * out, const char * name, uint64_t ns, uint64_t elapsed,
+                            const char * desc, uint64_t count) {
+    fprintf(out, "%-8s % 3ld.%09ld (%5.1f%%, %s",
+            name, (long) (ns / 1000000000ULL), (long) (ns % 1000000000ULL),
+            elapsed ? 100.0 * ns / elapsed : 0.0, desc);
+    if (count != (uint64_t) -1)
+        fprintf(out, ", %llu times", (unsigned long long) count);
+    fprintf(out, ")\n");
+}
+
+void delayacct_report(FILE * out, const delayacct_t * dac) {
+    const delayacct_stats_t *   st = &dac->stats;
+    uint64_t                    memory, waits, sleeping;
+
+    fprintf(out, "delays   %13lu (tasks of the tree accounted at exit", st->ntasks);
+    if (dac->nforeign || dac->ndropped)
+        fprintf(out, ", %lu others, %lu lost or unknown", dac->nforeign, dac->ndropped);
+    if (dac->ninvalid)
+        fprintf(out, ", %lu invalid delays ignored", dac->ninvalid);
+    fprintf(out, ")\n");
+    if (st->ntasks == 0)
+        return ;
+    memory = st->swapin_delay + st->reclaim_delay + st->thrashing_delay + st->compact_delay;
+    waits = st->cpu_run + st->cpu_delay + st->blkio_delay + memory;
+    sleeping = st->elapsed > waits ? st->elapsed - waits : 0;
+
+    delayacct_print(out, "tasktime", st->elapsed, st->elapsed, "elapsed time of tasks", -1);
+    delayacct_print(out, "oncpu", st->cpu_run, st->elapsed, "running", -1);
+    delayacct_print(out, "runqueue", st->cpu_delay, st->elapsed, "waiting for a cpu", st->cpu_count);
+    delayacct_print(out, "blkio", st->blkio_delay, st->elapsed, "waiting for block I/O", st->blkio_count);
+    delayacct_print(out, "memory", memory, st->elapsed, "swapin, reclaim, thrashing, compaction", -1);
+    delayacct_print(out, "swapin", st->swapin_delay, st->elapsed, "waiting for swapin", st->swapin_count);
+    delayacct_print(out, "reclaim", st->reclaim_delay, st->elapsed, "memory reclaim", st->reclaim_count);
+    delayacct_print(out, "thrash", st->thrashing_delay, st->elapsed, "thrashing", st->thrashing_count);
+    delayacct_print(out, "compact", st->compact_delay, st->elapsed, "memory compaction", st->compact_count);
+    delayacct_print(out, "sleeping", sleeping, st->elapsed, "other waits: sleep, locks, pipes, network", -1);
+}
+
+void delayacct_free(delayacct_t * dac) {
+    if (dac == NULL)
+        return ;
+    delayacct_stop(dac);
+    proctree_free(&dac->tree);
+}
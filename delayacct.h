@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Delay accounting of a process tree with linux taskstats (netlink).
+ */
+#ifndef VRUNAS_DELAYACCT_H
+#define VRUNAS_DELAYACCT_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "proctree.h"
+
+/** delays and times of the tasks of the tree, in ns */
+typedef struct {
+    unsigned long       ntasks;         /* threads and processes which exited */
+    uint64_t            elapsed;        /* sum of elapsed time of tasks */
+    uint64_t            cpu_run;        /* on cpu */
+    uint64_t            cpu_delay;      /* waiting for a cpu (runqueue) */
+    uint64_t            blkio_delay;    /* waiting for block I/O */
+    uint64_t            swapin_delay;   /* waiting for swapin */
+    uint64_t            reclaim_delay;  /* memory reclaim (freepages) */
+    uint64_t            thrashing_delay;
+    uint64_t            compact_delay;
+    uint64_t            cpu_count;
+    uint64_t            blkio_count;
+    uint64_t            swapin_count;
+    uint64_t            reclaim_count;
+    uint64_t            thrashing_count;
+    uint64_t            compact_count;
+} delayacct_stats_t;
+
+typedef struct {
+    int                 sock;           /* generic netlink socket */
+    pid_t               owner;          /* process which registered, the only one to deregister */
+    uint16_t            family;         /* TASKSTATS family id */
+    char                cpumask[256];   /* cpus listened for task exits */
+    int                 sysctl_old;     /* kernel.task_delayacct before init, -1 if unchanged */
+    int                 running;
+    volatile int        stop;
+    proctree_t          tree;
+    delayacct_stats_t   stats;
+    unsigned long       nforeign;       /* exits of tasks not in the tree */
+    unsigned long       ndropped;       /* messages lost (socket buffer full) or not attributed */
+    unsigned long       ninvalid;       /* delays ignored because longer than the task life */
+    pthread_t           thread;
+} delayacct_t;
+
+#define DELAYACCT_INITIALIZER { -1, 0, 0, "", -1, 0, 0, PROCTREE_INITIALIZER, { 0, }, 0, 0, 0, }
+
+/** delayacct_init() : listen to task exits with taskstats, enabling delay accounting
+ * if needed (kernel.task_delayacct). To be called before fork(), requires CAP_NET_ADMIN.
+ * @return 0 on success, -1 on error (errno set) */
+int delayacct_init(delayacct_t * dac);
+
+/** delayacct_start() : start collecting stats of exiting tasks of the tree of pid */
+int delayacct_start(delayacct_t * dac, pid_t pid);
+
+/** delayacct_stop() : to be called once pid is terminated: get remaining stats, stop
+ * listening and restore kernel.task_delayacct */
+void delayacct_stop(delayacct_t * dac);
+
+/** delayacct_report() : print delays and derived percentages (extended timings format) */
+void delayacct_report(FILE * out, const delayacct_t * dac);
+
+/** delayacct_free() : release resources of dac (not dac itself) */
+void delayacct_free(delayacct_t * dac);
+
+#endif /* ! ifndef VRUNAS_DELAYACCT_H */
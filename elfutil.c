@@ -0,0 +1,564 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * ELF helpers: program lookup in PATH, shared library dependencies, symbols.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#ifdef __linux__
+# include <elf.h>
+# include <link.h>
+#endif
+
+#include "elfutil.h"
+
+#ifndef PATH_MAX
+# define PATH_MAX 4096
+#endif
+
+int elf_find_program(const char * program, char * path, size_t size) {
+    const char *    paths;
+    const char *    next;
+    struct stat     st;
+    size_t          len;
+
+    if (program == NULL || *program == 0 || path == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (strchr(program, '/') != NULL) {
+        if ((size_t) snprintf(path, size, "%s", program) >= size) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        return access(path, X_OK);
+    }
+    if ((paths = getenv("PATH")) == NULL)
+        paths = "/bin:/usr/bin";
+    for ( ; paths != NULL; paths = next) {
+        if ((next = strchr(paths, ':')) != NULL) {
+            len = next - paths;
+            ++next;
+        } else {
+            len = strlen(paths);
+        }
+        /* empty PATH element means current directory */
+        if ((size_t) snprintf(path, size, "%.*s/%s", (int) len, len ? paths : ".", program) >= size)
+            continue ;
+        if (access(path, X_OK) == 0 && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            return 0;
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+#ifndef __linux__
+
+int elf_foreach_dependency(const char * path, elf_dep_callback_t callback, void * user_data) {
+    (void) path;
+    (void) callback;
+    (void) user_data;
+    return 0;
+}
+
+elf_symtab_t * elf_symtab_load(const char * path) {
+    (void) path;
+    errno = ENOSYS;
+    return NULL;
+}
+
+const char * elf_symtab_lookup(const elf_symtab_t * symtab, uint64_t offset) {
+    (void) symtab;
+    (void) offset;
+    return NULL;
+}
+
+void elf_symtab_free(elf_symtab_t * symtab) {
+    (void) symtab;
+}
+
+#else /* __linux__ */
+
+#define ELF_LDSO_CACHE          "/etc/ld.so.cache"
+#define ELF_LDSO_CACHE_MAGIC    "glibc-ld.so.cache1.1"
+#define ELF_LDSO_CACHE_OLDMAGIC "ld.so-1.7.0"
+#define ELF_DEFAULT_LIBDIRS     "/lib64:/usr/lib64:/lib:/usr/lib"
+
+typedef struct {
+    void *              map;
+    size_t              size;
+    const ElfW(Ehdr) *  ehdr;
+    const ElfW(Phdr) *  phdr;
+} elf_file_t;
+
+typedef struct {
+    char **             paths;          /* resolved dependencies, each one once */
+    unsigned int        count;
+    unsigned int        capacity;
+    unsigned char       elfclass;       /* class and machine of main program, */
+    ElfW(Half)          machine;        /* only compatible libs are taken */
+    const char *        cache;          /* mmap'ed ld.so.cache or NULL */
+    size_t              cachesize;
+    const char *        exe_rpath;      /* DT_RPATH of the main program */
+    char                exe_origin[PATH_MAX];
+} elf_deps_t;
+
+static void elf_close(elf_file_t * ef) {
+    if (ef->map != NULL && ef->map != MAP_FAILED)
+        munmap(ef->map, ef->size);
+    ef->map = NULL;
+}
+
+static int elf_open(const char * path, elf_file_t * ef) {
+    struct stat st;
+    int         fd;
+
+    memset(ef, 0, sizeof(*ef));
+    /* O_NONBLOCK: a fifo given as object must not block the open */
+    if ((fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || (size_t) st.st_size < sizeof(ElfW(Ehdr))) {
+        close(fd);
+        errno = ENOEXEC;
+        return -1;
+    }
+    ef->size = st.st_size;
+    ef->map = mmap(NULL, ef->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ef->map == MAP_FAILED) {
+        ef->map = NULL;
+        return -1;
+    }
+    ef->ehdr = (const ElfW(Ehdr) *) ef->map;
+    if (memcmp(ef->ehdr->e_ident, ELFMAG, SELFMAG) != 0
+    ||  ef->ehdr->e_ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32)
+    ||  ef->ehdr->e_phoff + (size_t) ef->ehdr->e_phnum * sizeof(ElfW(Phdr)) > ef->size) {
+        elf_close(ef);
+        errno = ENOEXEC;
+        return -1;
+    }
+    ef->phdr = (const ElfW(Phdr) *) ((const char *) ef->map + ef->ehdr->e_phoff);
+    return 0;
+}
+
+/* translate a virtual address of the object to an offset in file, 0 if not found */
+static size_t elf_vaddr_offset(const elf_file_t * ef, ElfW(Addr) vaddr) {
+    for (unsigned int i = 0; i < ef->ehdr->e_phnum; ++i) {
+        const ElfW(Phdr) * ph = &ef->phdr[i];
+        if (ph->p_type == PT_LOAD && vaddr >= ph->p_vaddr && vaddr < ph->p_vaddr + ph->p_filesz) {
+            size_t off = ph->p_offset + (vaddr - ph->p_vaddr);
+            return off < ef->size ? off : 0;
+        }
+    }
+    return 0;
+}
+
+/* check that the file is an ELF object compatible with the main program */
+static int elf_compatible(const char * path, elf_deps_t * deps) {
+    ElfW(Ehdr)  ehdr;
+    int         fd, ret;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 0;
+    ret = read(fd, &ehdr, sizeof(ehdr)) == (ssize_t) sizeof(ehdr)
+          && memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0
+          && ehdr.e_ident[EI_CLASS] == deps->elfclass
+          && ehdr.e_machine == deps->machine;
+    close(fd);
+    return ret;
+}
+
+static int elf_deps_add(elf_deps_t * deps, const char * path) {
+    char    real[PATH_MAX];
+    char ** paths;
+
+    /* several paths of a same library are common (/lib64 -> /usr/lib) */
+    if (realpath(path, real) != NULL)
+        path = real;
+    for (unsigned int i = 0; i < deps->count; ++i) {
+        if (strcmp(deps->paths[i], path) == 0)
+            return 0;
+    }
+    if (deps->count >= deps->capacity) {
+        unsigned int capacity = deps->capacity ? deps->capacity * 2 : 16;
+        if ((paths = realloc(deps->paths, capacity * sizeof(*paths))) == NULL)
+            return -1;
+        deps->paths = paths;
+        deps->capacity = capacity;
+    }
+    if ((deps->paths[deps->count] = strdup(path)) == NULL)
+        return -1;
+    ++deps->count;
+    return 1;
+}
+
+/* search name in a ':' separated list of directories, expanding $ORIGIN */
+static int elf_search_dirs(const char * dirs, const char * origin, const char * name,
+                           elf_deps_t * deps, char * path, size_t size) {
+    const char * next;
+
+    for ( ; dirs != NULL && *dirs; dirs = next) {
+        char    dir[PATH_MAX];
+        size_t  len;
+        const char * var;
+
+        if ((next = strchr(dirs, ':')) != NULL) {
+            len = next - dirs;
+            ++next;
+        } else {
+            len = strlen(dirs);
+        }
+        if (len == 0 || len >= sizeof(dir))
+            continue ;
+        if ((var = strstr(dirs, "$ORIGIN")) != NULL && var < dirs + len) {
+            snprintf(dir, sizeof(dir), "%.*s%s%.*s", (int) (var - dirs), dirs, origin,
+                     (int) (len - (var - dirs) - 7), var + 7);
+        } else if ((var = strstr(dirs, "${ORIGIN}")) != NULL && var < dirs + len) {
+            snprintf(dir, sizeof(dir), "%.*s%s%.*s", (int) (var - dirs), dirs, origin,
+                     (int) (len - (var - dirs) - 9), var + 9);
+        } else {
+            snprintf(dir, sizeof(dir), "%.*s", (int) len, dirs);
+        }
+        if ((size_t) snprintf(path, size, "%s/%s", dir, name) < size && elf_compatible(path, deps))
+            return 0;
+    }
+    return -1;
+}
+
+/* lookup name in ld.so.cache (new glibc format, possibly following the old one) */
+static int elf_search_cache(const char * name, elf_deps_t * deps, char * path, size_t size) {
+    const char *    cache = deps->cache;
+    size_t          cachesize = deps->cachesize;
+    uint32_t        nlibs;
+
+    if (cache == NULL)
+        return -1;
+    if (cachesize >= 16 && memcmp(cache, ELF_LDSO_CACHE_OLDMAGIC, sizeof(ELF_LDSO_CACHE_OLDMAGIC) - 1) == 0) {
+        /* old format: magic[12], nlibs, entries of 3 x 32 bits, new format aligned on 8 */
+        size_t off;
+        memcpy(&nlibs, cache + 12, sizeof(nlibs));
+        off = 16 + (size_t) nlibs * 12;
+        off = (off + 7) & ~((size_t) 7);
+        if (off >= cachesize)
+            return -1;
+        cache += off;
+        cachesize -= off;
+    }
+    if (cachesize < 48 || memcmp(cache, ELF_LDSO_CACHE_MAGIC, sizeof(ELF_LDSO_CACHE_MAGIC) - 1) != 0)
+        return -1;
+    memcpy(&nlibs, cache + 20, sizeof(nlibs));
+    for (uint32_t i = 0; i < nlibs && 48 + (size_t) (i + 1) * 24 <= cachesize; ++i) {
+        /* entry: int32 flags, uint32 key, uint32 value, uint32 osversion, uint64 hwcap */
+        const char *    entry = cache + 48 + (size_t) i * 24;
+        uint32_t        key, value;
+
+        memcpy(&key, entry + 4, sizeof(key));
+        memcpy(&value, entry + 8, sizeof(value));
+        if (key >= cachesize || value >= cachesize
+        ||  strncmp(cache + key, name, cachesize - key) != 0)
+            continue ;
+        if ((size_t) snprintf(path, size, "%.*s", (int) strnlen(cache + value, cachesize - value),
+                              cache + value) < size && elf_compatible(path, deps))
+            return 0;
+    }
+    return -1;
+}
+
+static int elf_resolve(const char * name, const char * rpath, const char * runpath,
+                       const char * origin, elf_deps_t * deps, char * path, size_t size) {
+    if (strchr(name, '/') != NULL) {
+        if ((size_t) snprintf(path, size, "%s", name) >= size || !elf_compatible(path, deps))
+            return -1;
+        return 0;
+    }
+    if (runpath == NULL) {
+        if (elf_search_dirs(rpath, origin, name, deps, path, size) == 0
+        ||  elf_search_dirs(deps->exe_rpath, deps->exe_origin, name, deps, path, size) == 0)
+            return 0;
+    }
+    if (elf_search_dirs(getenv("LD_LIBRARY_PATH"), origin, name, deps, path, size) == 0
+    ||  elf_search_dirs(runpath, origin, name, deps, path, size) == 0
+    ||  elf_search_cache(name, deps, path, size) == 0
+    ||  elf_search_dirs(ELF_DEFAULT_LIBDIRS, origin, name, deps, path, size) == 0)
+        return 0;
+    return -1;
+}
+
+/* add interpreter and DT_NEEDED libraries of object path to deps */
+static int elf_scan_object(const char * path, int is_exe, elf_deps_t * deps) {
+    elf_file_t          ef;
+    const ElfW(Dyn) *   dyn = NULL;
+    size_t              ndyn = 0, strtab = 0, strsz = 0;
+    const char *        rpath = NULL;
+    const char *        runpath = NULL;
+    char                origin[PATH_MAX];
+    char                libpath[PATH_MAX];
+    const char *        slash;
+
+    if (elf_open(path, &ef) < 0)
+        return -1;
+    if (is_exe) {
+        deps->elfclass = ef.ehdr->e_ident[EI_CLASS];
+        deps->machine = ef.ehdr->e_machine;
+    }
+    if ((slash = strrchr(path, '/')) != NULL)
+        snprintf(origin, sizeof(origin), "%.*s", (int) (slash - path), path);
+    else
+        snprintf(origin, sizeof(origin), ".");
+
+    for (unsigned int i = 0; i < ef.ehdr->e_phnum; ++i) {
+        const ElfW(Phdr) * ph = &ef.phdr[i];
+        if (ph->p_type == PT_INTERP && ph->p_offset + ph->p_filesz <= ef.size) {
+            snprintf(libpath, sizeof(libpath), "%.*s", (int) strnlen((const char *) ef.map + ph->p_offset,
+                     ph->p_filesz), (const char *) ef.map + ph->p_offset);
+            if (elf_compatible(libpath, deps) && elf_deps_add(deps, libpath) < 0) {
+                elf_close(&ef);
+                return -1;
+            }
+        } else if (ph->p_type == PT_DYNAMIC && ph->p_offset + ph->p_filesz <= ef.size) {
+            dyn = (const ElfW(Dyn) *) ((const char *) ef.map + ph->p_offset);
+            ndyn = ph->p_filesz / sizeof(*dyn);
+        }
+    }
+    for (size_t i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; ++i) {
+        if (dyn[i].d_tag == DT_STRTAB)
+            strtab = elf_vaddr_offset(&ef, dyn[i].d_un.d_ptr);
+        else if (dyn[i].d_tag == DT_STRSZ)
+            strsz = dyn[i].d_un.d_val;
+    }
+    if (strtab == 0 || strtab + strsz > ef.size) {
+        elf_close(&ef);
+        return 0;
+    }
+    for (size_t i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; ++i) {
+        if (dyn[i].d_un.d_val >= strsz)
+            continue ;
+        if (dyn[i].d_tag == DT_RPATH)
+            rpath = (const char *) ef.map + strtab + dyn[i].d_un.d_val;
+        else if (dyn[i].d_tag == DT_RUNPATH)
+            runpath = (const char *) ef.map + strtab + dyn[i].d_un.d_val;
+    }
+    if (is_exe && rpath != NULL && runpath == NULL) {
+        deps->exe_rpath = strdup(rpath);
+        snprintf(deps->exe_origin, sizeof(deps->exe_origin), "%s", origin);
+    }
+    for (size_t i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; ++i) {
+        if (dyn[i].d_tag != DT_NEEDED || dyn[i].d_un.d_val >= strsz)
+            continue ;
+        if (elf_resolve((const char *) ef.map + strtab + dyn[i].d_un.d_val, rpath, runpath, origin,
+                        deps, libpath, sizeof(libpath)) == 0
+        &&  elf_deps_add(deps, libpath) < 0) {
+            elf_close(&ef);
+            return -1;
+        }
+    }
+    elf_close(&ef);
+    return 0;
+}
+
+int elf_foreach_dependency(const char * path, elf_dep_callback_t callback, void * user_data) {
+    elf_deps_t  deps;
+    struct stat st;
+    int         fd, ret;
+
+    memset(&deps, 0, sizeof(deps));
+    if ((fd = open(ELF_LDSO_CACHE, O_RDONLY)) >= 0) {
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            deps.cachesize = st.st_size;
+            if ((deps.cache = mmap(NULL, deps.cachesize, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+                deps.cache = NULL;
+        }
+        close(fd);
+    }
+    if (elf_scan_object(path, 1, &deps) < 0) {
+        /* not an ELF object of our class (script, ...): no dependencies */
+        ret = errno == ENOEXEC ? 0 : -1;
+    } else {
+        /* deps.count grows while libraries are scanned: breadth-first walk */
+        for (unsigned int i = 0; i < deps.count; ++i) {
+            elf_scan_object(deps.paths[i], 0, &deps);
+        }
+        for (unsigned int i = 0; i < deps.count; ++i) {
+            if (callback != NULL && callback(deps.paths[i], user_data) != 0)
+                break ;
+        }
+        ret = deps.count;
+    }
+    for (unsigned int i = 0; i < deps.count; ++i) {
+        free(deps.paths[i]);
+    }
+    if (deps.cache != NULL)
+        munmap((void *) deps.cache, deps.cachesize);
+    free(deps.paths);
+    free((void *) deps.exe_rpath);
+    return ret;
+}
+
+#define ELF_SYMTAB_MAX_LOADS    16
+
+typedef struct {
+    uint64_t            addr;
+    uint64_t            size;
+    uint32_t            name;           /* offset in strtab */
+} elf_sym_t;
+
+struct elf_symtab_s {
+    elf_sym_t *         syms;           /* sorted by address */
+    unsigned int        count;
+    char *              strtab;
+    struct {
+        uint64_t        offset;
+        uint64_t        filesz;
+        uint64_t        vaddr;
+    }                   loads[ELF_SYMTAB_MAX_LOADS];
+    unsigned int        nloads;
+};
+
+static int elf_sym_cmp(const void * a, const void * b) {
+    const elf_sym_t * sa = a, * sb = b;
+    return sa->addr < sb->addr ? -1 : (sa->addr > sb->addr ? 1 : 0);
+}
+
+static int elf_symtab_read(const elf_file_t * ef, elf_symtab_t * symtab, unsigned int type) {
+    const ElfW(Shdr) *  shdr = (const ElfW(Shdr) *) ((const char *) ef->map + ef->ehdr->e_shoff);
+    const ElfW(Shdr) *  sh = NULL, * strsh;
+    const ElfW(Sym) *   sym;
+    unsigned int        nsyms;
+
+    for (unsigned int i = 0; i < ef->ehdr->e_shnum; ++i) {
+        if (shdr[i].sh_type == type) {
+            sh = &shdr[i];
+            break ;
+        }
+    }
+    if (sh == NULL || sh->sh_link >= ef->ehdr->e_shnum
+    ||  sh->sh_offset + sh->sh_size > ef->size || sh->sh_entsize != sizeof(ElfW(Sym)))
+        return -1;
+    strsh = &shdr[sh->sh_link];
+    if (strsh->sh_offset + strsh->sh_size > ef->size || strsh->sh_size == 0)
+        return -1;
+    if ((symtab->strtab = malloc(strsh->sh_size + 1)) == NULL)
+        return -1;
+    memcpy(symtab->strtab, (const char *) ef->map + strsh->sh_offset, strsh->sh_size);
+    symtab->strtab[strsh->sh_size] = 0;
+
+    sym = (const ElfW(Sym) *) ((const char *) ef->map + sh->sh_offset);
+    nsyms = sh->sh_size / sizeof(*sym);
+    if ((symtab->syms = malloc(nsyms * sizeof(*symtab->syms))) == NULL)
+        return -1;
+    for (unsigned int i = 0; i < nsyms; ++i) {
+        if (ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC || sym[i].st_shndx == SHN_UNDEF
+        ||  sym[i].st_value == 0 || sym[i].st_name >= strsh->sh_size)
+            continue ;
+        symtab->syms[symtab->count].addr = sym[i].st_value;
+        symtab->syms[symtab->count].size = sym[i].st_size;
+        symtab->syms[symtab->count].name = sym[i].st_name;
+        ++symtab->count;
+    }
+    qsort(symtab->syms, symtab->count, sizeof(*symtab->syms), elf_sym_cmp);
+    return 0;
+}
+
+static void elf_symtab_clear(elf_symtab_t * symtab) {
+    free(symtab->syms);
+    free(symtab->strtab);
+    symtab->syms = NULL;
+    symtab->strtab = NULL;
+    symtab->count = 0;
+}
+
+elf_symtab_t * elf_symtab_load(const char * path) {
+    elf_symtab_t *  symtab;
+    elf_file_t      ef;
+
+    if (elf_open(path, &ef) != 0)
+        return NULL;
+    if ((symtab = calloc(1, sizeof(*symtab))) == NULL) {
+        elf_close(&ef);
+        return NULL;
+    }
+    for (unsigned int i = 0; i < ef.ehdr->e_phnum && symtab->nloads < ELF_SYMTAB_MAX_LOADS; ++i) {
+        const ElfW(Phdr) * ph = &ef.phdr[i];
+        if (ph->p_type == PT_LOAD) {
+            symtab->loads[symtab->nloads].offset = ph->p_offset;
+            symtab->loads[symtab->nloads].filesz = ph->p_filesz;
+            symtab->loads[symtab->nloads].vaddr = ph->p_vaddr;
+            ++symtab->nloads;
+        }
+    }
+    /* an object without symbols gives an empty table, lookups will fail */
+    if (ef.ehdr->e_shoff != 0 && ef.ehdr->e_shentsize == sizeof(ElfW(Shdr))
+    &&  ef.ehdr->e_shoff + (size_t) ef.ehdr->e_shnum * sizeof(ElfW(Shdr)) <= ef.size) {
+        if (elf_symtab_read(&ef, symtab, SHT_SYMTAB) != 0 || symtab->count == 0) {
+            elf_symtab_clear(symtab);
+            if (elf_symtab_read(&ef, symtab, SHT_DYNSYM) != 0)
+                elf_symtab_clear(symtab);
+        }
+    }
+    elf_close(&ef);
+    return symtab;
+}
+
+const char * elf_symtab_lookup(const elf_symtab_t * symtab, uint64_t offset) {
+    const elf_sym_t *   sym;
+    uint64_t            vaddr = 0;
+    unsigned int        i, lo, hi;
+
+    if (symtab == NULL || symtab->count == 0)
+        return NULL;
+    for (i = 0; i < symtab->nloads; ++i) {
+        if (offset >= symtab->loads[i].offset && offset < symtab->loads[i].offset + symtab->loads[i].filesz) {
+            vaddr = offset - symtab->loads[i].offset + symtab->loads[i].vaddr;
+            break ;
+        }
+    }
+    if (i == symtab->nloads)
+        return NULL;
+    /* last symbol starting at or before vaddr */
+    for (lo = 0, hi = symtab->count; hi - lo > 1; ) {
+        unsigned int mid = (lo + hi) / 2;
+        if (symtab->syms[mid].addr <= vaddr)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    sym = &symtab->syms[lo];
+    if (sym->addr > vaddr || (sym->size != 0 && vaddr >= sym->addr + sym->size))
+        return NULL;
+    return symtab->strtab + sym->name;
+}
+
+void elf_symtab_free(elf_symtab_t * symtab) {
+    if (symtab == NULL)
+        return ;
+    elf_symtab_clear(symtab);
+    free(symtab);
+}
+
+#endif /* __linux__ */
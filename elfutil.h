@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * ELF helpers: program lookup in PATH, shared library dependencies, symbols.
+ */
+#ifndef VRUNAS_ELFUTIL_H
+#define VRUNAS_ELFUTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** callback of elf_foreach_dependency(), return non-zero to stop iteration */
+typedef int (*elf_dep_callback_t)(const char * path, void * user_data);
+
+/** elf_find_program() : look for program in PATH the way execvp(3) does.
+ * @return 0 on success with path filled, -1 on error (errno set) */
+int elf_find_program(const char * program, char * path, size_t size);
+
+/** elf_foreach_dependency() : call callback on the ELF interpreter and on
+ * each shared library needed by path (recursively, each one once), resolved
+ * with RPATH, LD_LIBRARY_PATH, RUNPATH, ld.so.cache and default directories.
+ * path itself is not given to callback.
+ * @return number of dependencies found, or -1 on error (errno set).
+ *         On systems without ELF support, 0 is returned */
+int elf_foreach_dependency(const char * path, elf_dep_callback_t callback, void * user_data);
+
+/** function symbols of an ELF object, see elf_symtab_load() */
+typedef struct elf_symtab_s elf_symtab_t;
+
+/** elf_symtab_load() : load the function symbols of path (.symtab, or .dynsym if stripped).
+ * @return the symbol table to be freed with elf_symtab_free(), or NULL on error (errno set) */
+elf_symtab_t * elf_symtab_load(const char * path);
+
+/** elf_symtab_lookup() : find the function containing the given file offset of the object,
+ * as computed from a mapping: address - mapping start + mapping file offset.
+ * @return the symbol name or NULL if not found */
+const char * elf_symtab_lookup(const elf_symtab_t * symtab, uint64_t offset);
+
+/** elf_symtab_free() : release the symbol table */
+void elf_symtab_free(elf_symtab_t * symtab);
+
+#endif /* ! ifndef VRUNAS_ELFUTIL_H */
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Energy consumed during the run, from the RAPL domains of linux powercap
+ * (package, core, uncore, dram energy counters).
+ */
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "energy.h"
+
+#ifndef PATH_MAX
+# define PATH_MAX 4096
+#endif
+
+#define ENERGY_POWERCAP     "class/powercap"
+
+/* first line of <sysfs>/class/powercap/<zone>/<file> in buf, without newline */
+static int energy_read_file(const energy_t * en, const char * zone, const char * file, char * buf, size_t size) {
+    char    path[PATH_MAX];
+    ssize_t n;
+    int     fd;
+
+    if ((size_t) snprintf(path, sizeof(path), "%s/" ENERGY_POWERCAP "/%s/%s", en->sysfs, zone, file) >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+        return -1;
+    buf[n] = 0;
+    buf[strcspn(buf, "\n")] = 0;
+    return 0;
+}
+
+static int energy_read_counter(int fd, uint64_t * value) {
+    char    buf[32];
+    ssize_t n;
+
+    if ((n = pread(fd, buf, sizeof(buf) - 1, 0)) <= 0) {
+        if (n == 0)
+            errno = EIO;
+        return -1;
+    }
+    buf[n] = 0;
+    *value = strtoull(buf, NULL, 10);
+    return 0;
+}
+
+static int energy_cmp_zone(const void * a, const void * b) {
+    return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+/* add the RAPL zone, named '<package>/<domain>' if it is a subzone */
+static int energy_add_domain(energy_t * en, const char * zone) {
+    energy_domain_t *   domain = &en->domains[en->ndomains];
+    char                path[PATH_MAX];
+    char                name[sizeof(domain->name)];
+    char                parent[sizeof(domain->name)];
+    char                buf[32];
+    const char *        sep = strchr(zone, ':');
+
+    if (energy_read_file(en, zone, "name", name, sizeof(name)) != 0)
+        return -1;
+    if (sep != NULL && (sep = strchr(sep + 1, ':')) != NULL) {
+        snprintf(path, sizeof(path), "%.*s", (int) (sep - zone), zone);
+        if (energy_read_file(en, path, "name", parent, sizeof(parent)) != 0)
+            snprintf(parent, sizeof(parent), "%.*s", (int) sizeof(parent) - 1, path);
+        snprintf(domain->name, sizeof(domain->name), "%.31s/%.31s", parent, name);
+    } else {
+        snprintf(domain->name, sizeof(domain->name), "%s", name);
+    }
+    domain->range = energy_read_file(en, zone, "max_energy_range_uj", buf, sizeof(buf)) == 0
+                    ? strtoull(buf, NULL, 10) : 0;
+    if ((size_t) snprintf(path, sizeof(path), "%s/" ENERGY_POWERCAP "/%s/energy_uj", en->sysfs, zone) >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if ((domain->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+    if (energy_read_counter(domain->fd, &domain->last) != 0) {
+        close(domain->fd);
+        domain->fd = -1;
+        return -1;
+    }
+    domain->total = 0;
+    ++en->ndomains;
+    return 0;
+}
+
+int energy_init(energy_t * en) {
+    char            path[PATH_MAX];
+    char *          zones[ENERGY_MAX_DOMAINS];
+    unsigned int    nzones = 0;
+    struct dirent * ent;
+    DIR *           dir;
+    int             errno_bak = ENOENT;
+
+    if (en == NULL || en->sysfs == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((size_t) snprintf(path, sizeof(path), "%s/" ENERGY_POWERCAP, en->sysfs) >= sizeof(path)
+    ||  (dir = opendir(path)) == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    /* zones 'intel-rapl:<package>[:<domain>]' (also used on AMD). The 'intel-rapl-mmio'
+     * zones are the same counters as the packages, read from another interface */
+    while ((ent = readdir(dir)) != NULL && nzones < ENERGY_MAX_DOMAINS) {
+        if (strncmp(ent->d_name, "intel-rapl:", 11) != 0)
+            continue ;
+        if ((zones[nzones] = strdup(ent->d_name)) != NULL)
+            ++nzones;
+    }
+    closedir(dir);
+    /* packages before their domains */
+    qsort(zones, nzones, sizeof(*zones), energy_cmp_zone);
+    for (unsigned int i = 0; i < nzones; ++i) {
+        if (energy_add_domain(en, zones[i]) != 0 && errno_bak == ENOENT)
+            errno_bak = errno;
+        free(zones[i]);
+    }
+    if (en->ndomains == 0) {
+        errno = errno_bak;
+        return -1;
+    }
+    return 0;
+}
+
+/* add the energy consumed since the last sample, taking care of the wraparound */
+static void energy_sample(energy_t * en) {
+    pthread_mutex_lock(&en->mutex);
+    for (unsigned int i = 0; i < en->ndomains; ++i) {
+        energy_domain_t *   domain = &en->domains[i];
+        uint64_t            value;
+
+        if (energy_read_counter(domain->fd, &value) != 0)
+            continue ;
+        if (value >= domain->last)
+            domain->total += value - domain->last;
+        else if (domain->range > domain->last)
+            domain->total += domain->range - domain->last + value;
+        else
+            domain->total += value;
+        domain->last = value;
+    }
+    pthread_mutex_unlock(&en->mutex);
+}
+
+static void * energy_thread(void * data) {
+    energy_t *      en = data;
+    struct timespec ts;
+
+    pthread_mutex_lock(&en->mutex);
+    while (!en->stop) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ENERGY_INTERVAL_MS / 1000;
+        ts.tv_nsec += (ENERGY_INTERVAL_MS % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ++ts.tv_sec;
+            ts.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&en->cond, &en->mutex, &ts) == ETIMEDOUT && !en->stop) {
+            pthread_mutex_unlock(&en->mutex);
+            energy_sample(en);
+            pthread_mutex_lock(&en->mutex);
+        }
+    }
+    pthread_mutex_unlock(&en->mutex);
+    return NULL;
+}
+
+void energy_start(energy_t * en) {
+    /* the consumption before the run is not counted */
+    energy_sample(en);
+    for (unsigned int i = 0; i < en->ndomains; ++i)
+        en->domains[i].total = 0;
+    clock_gettime(CLOCK_MONOTONIC, &en->start);
+}
+
+int energy_watch(energy_t * en) {
+    en->stop = 0;
+    if ((errno = pthread_create(&en->thread, NULL, energy_thread, en)) != 0)
+        return -1;
+    en->running = 1;
+    return 0;
+}
+
+void energy_stop(energy_t * en) {
+    struct timespec ts;
+
+    if (en->running) {
+        pthread_mutex_lock(&en->mutex);
+        en->stop = 1;
+        pthread_cond_signal(&en->cond);
+        pthread_mutex_unlock(&en->mutex);
+        pthread_join(en->thread, NULL);
+        en->running = 0;
+    }
+    energy_sample(en);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    en->duration.tv_sec = ts.tv_sec - en->start.tv_sec;
+    en->duration.tv_nsec = ts.tv_nsec - en->start.tv_nsec;
+    if (en->duration.tv_nsec < 0) {
+        --en->duration.tv_sec;
+        en->duration.tv_nsec += 1000000000L;
+    }
+}
+
+void energy_report(FILE * out, const energy_t * en) {
+    double seconds = en->duration.tv_sec + en->duration.tv_nsec / 1e9;
+
+    for (unsigned int i = 0; i < en->ndomains; ++i) {
+        double joules = en->domains[i].total / 1e6;
+
+        fprintf(out, "energy   %13.3f (joules consumed by %s, %.2f W on average)\n",
+                joules, en->domains[i].name, seconds > 0 ? joules / seconds : 0.0);
+    }
+}
+
+void energy_free(energy_t * en) {
+    if (en == NULL)
+        return ;
+    if (en->running) {
+        pthread_mutex_lock(&en->mutex);
+        en->stop = 1;
+        pthread_cond_signal(&en->cond);
+        pthread_mutex_unlock(&en->mutex);
+        pthread_join(en->thread, NULL);
+        en->running = 0;
+    }
+    for (unsigned int i = 0; i < en->ndomains; ++i) {
+        if (en->domains[i].fd >= 0)
+            close(en->domains[i].fd);
+        en->domains[i].fd = -1;
+    }
+    en->ndomains = 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Energy consumed during the run, from the RAPL domains of linux powercap
+ * (package, core, uncore, dram energy counters).
+ */
+#ifndef VRUNAS_ENERGY_H
+#define VRUNAS_ENERGY_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define ENERGY_DEFAULT_SYSFS    "/sys"
+#define ENERGY_MAX_DOMAINS      16
+#define ENERGY_INTERVAL_MS      10000   /* sampling period, far below the wraparound of counters */
+
+typedef struct {
+    char                name[64];       /* 'package-0', 'package-0/dram', ... */
+    int                 fd;             /* energy_uj */
+    uint64_t            range;          /* max_energy_range_uj: the counter wraps to 0 after it */
+    uint64_t            last;           /* last value read */
+    uint64_t            total;          /* microjoules since energy_start() */
+} energy_domain_t;
+
+typedef struct {
+    const char *        sysfs;          /* root of sysfs, ENERGY_DEFAULT_SYSFS or a fake tree */
+    energy_domain_t     domains[ENERGY_MAX_DOMAINS];
+    unsigned int        ndomains;
+    struct timespec     start;
+    struct timespec     duration;
+    pthread_mutex_t     mutex;          /* domain counters, sampled by the thread and the caller */
+    pthread_cond_t      cond;           /* signaled by energy_stop() */
+    int                 running;
+    int                 stop;
+    pthread_t           thread;
+} energy_t;
+
+#define ENERGY_INITIALIZER { ENERGY_DEFAULT_SYSFS, { { { 0 }, -1, 0, 0, 0 }, }, 0, { 0, 0 }, { 0, 0 }, \
+                             PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, }
+
+/** energy_init() : find the RAPL domains in <sysfs>/class/powercap, and check their
+ * counters are readable (root on recent kernels).
+ * @return 0 on success, -1 on error (errno set, ENOENT if no RAPL domain) */
+int energy_init(energy_t * en);
+
+/** energy_start() : take the counters at the start of the run, before fork() */
+void energy_start(energy_t * en);
+
+/** energy_watch() : start a thread which samples the counters until energy_stop(),
+ * so that several wraparounds are not missed on long runs. To be called by the father.
+ * @return 0 on success, -1 on error (errno set) */
+int energy_watch(energy_t * en);
+
+/** energy_stop() : take the counters for the last time */
+void energy_stop(energy_t * en);
+
+/** energy_report() : print the joules and average watts of each domain
+ * (extended timings format) */
+void energy_report(FILE * out, const energy_t * en);
+
+/** energy_free() : release resources of en (not en itself) */
+void energy_free(energy_t * en);
+
+#endif /* ! ifndef VRUNAS_ENERGY_H */
@@ -0,0 +1,428 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Lifecycle events of the program as newline-delimited JSON, for orchestrators:
+ * spawn, exec, periodic samples, signals, exit and final metrics, and snapshots
+ * on demand through a control FIFO.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "livestat.h"
+#include "events.h"
+
+#define EVENTS_STOP         0       /* byte of wakepipe requesting the stop of the thread */
+#define EVENTS_LINE_MAX     8192
+
+/* str as a JSON string */
+static size_t events_json_string(char * buf, size_t size, const char * str) {
+    size_t len = 0;
+
+    if (size < 3)
+        return 0;
+    buf[len++] = '"';
+    for (; str != NULL && *str && len + 8 < size; ++str) {
+        unsigned char c = (unsigned char) *str;
+
+        if (c == '"' || c == '\\') {
+            buf[len++] = '\\';
+            buf[len++] = c;
+        } else if (c < 0x20) {
+            len += snprintf(buf + len, size - len, "\\u%04x", c);
+        } else {
+            buf[len++] = c;
+        }
+    }
+    buf[len++] = '"';
+    buf[len] = 0;
+    return len;
+}
+
+/* the reader may be gone: events are then lost, but the program is not disturbed.
+ * SIGPIPE, forwarded to the program by vrunas, is blocked and consumed */
+static void events_write(events_t * ev, const char * line, size_t len) {
+    sigset_t        pipeset, oldset, pending;
+    struct timespec zero = { 0, 0 };
+    int             was_pending;
+    ssize_t         n;
+
+    sigemptyset(&pipeset);
+    sigaddset(&pipeset, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeset, &oldset);
+    was_pending = sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE);
+    while ((n = write(ev->fd, line, len)) < 0 && errno == EINTR)
+        ; /* nothing */
+    if (n < 0 && errno == EPIPE) {
+        ev->broken = 1;
+        if (!was_pending)
+            while (sigtimedwait(&pipeset, NULL, &zero) < 0 && errno == EINTR)
+                ; /* nothing */
+    }
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+}
+
+/* write {"event":"<name>","time":<epoch>,"elapsed":<s>,<fields>} in one write() */
+static void events_emit(events_t * ev, const char * name, const char * fmt, ...) {
+    char            line[EVENTS_LINE_MAX];
+    struct timespec now, mono;
+    va_list         valist;
+    int             len, head;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    len = snprintf(line, sizeof(line), "{\"event\":\"%s\",\"time\":%ld.%06ld,\"elapsed\":%.6f",
+                   name, (long) now.tv_sec, now.tv_nsec / 1000L,
+                   (mono.tv_sec - ev->start.tv_sec) + (mono.tv_nsec - ev->start.tv_nsec) / 1e9);
+    if (fmt != NULL && (head = len) < (int) sizeof(line) - 3) {
+        line[len++] = ',';
+        va_start(valist, fmt);
+        len += vsnprintf(line + len, sizeof(line) - len, fmt, valist);
+        va_end(valist);
+        /* a line cut in the middle of a field would not be JSON: the fields are dropped */
+        if (len > (int) sizeof(line) - 3)
+            len = head + snprintf(line + head, sizeof(line) - head, ",\"truncated\":true");
+    }
+    line[len++] = '}';
+    line[len++] = '\n';
+    pthread_mutex_lock(&ev->mutex);
+    if (!ev->broken)
+        events_write(ev, line, len);
+    pthread_mutex_unlock(&ev->mutex);
+}
+
+static void events_sample(events_t * ev, const char * name) {
+    livestat_sample_t sample;
+    long              hz = sysconf(_SC_CLK_TCK);
+
+    livestat_sample(ev->pid, &sample, NULL, 0);
+    events_emit(ev, name, "\"pid\":%d,\"procs\":%u,\"threads\":%u,\"cpu\":%.2f,\"rss\":%llu,"
+                "\"read_bytes\":%llu,\"write_bytes\":%llu,\"wchar\":%llu",
+                (int) ev->pid, sample.nprocs, sample.nthreads,
+                hz > 0 ? (double) sample.cpu_ticks / hz : 0.0,
+                (unsigned long long) sample.rss_pages * sysconf(_SC_PAGESIZE),
+                (unsigned long long) sample.read_bytes, (unsigned long long) sample.write_bytes,
+                (unsigned long long) sample.wchar);
+}
+
+/* result of execve() in the child: EOF if it succeeded (close-on-exec) */
+static void events_read_exec(events_t * ev) {
+    int     failure[2];
+    char    error[256];
+    ssize_t n;
+
+    while ((n = read(ev->execpipe[0], failure, sizeof(failure))) < 0 && errno == EINTR)
+        ; /* nothing */
+    if (n == sizeof(failure)) {
+        events_json_string(error, sizeof(error), strerror(failure[1]));
+        events_emit(ev, "exec_failed", "\"pid\":%d,\"code\":%d,\"errno\":%d,\"error\":%s",
+                    (int) ev->pid, failure[0], failure[1], error);
+    } else {
+        events_emit(ev, "exec_ok", "\"pid\":%d", (int) ev->pid);
+    }
+    close(ev->execpipe[0]);
+    ev->execpipe[0] = -1;
+}
+
+static void events_control_command(events_t * ev, char * line) {
+    char cmd[EVENTS_CONTROL_MAX + 16];
+
+    line[strcspn(line, "\r")] = 0;
+    if (*line == 0)
+        return ;
+    if (strcmp(line, "snapshot") == 0) {
+        events_sample(ev, "snapshot");
+    } else {
+        events_json_string(cmd, sizeof(cmd), line);
+        events_emit(ev, "control_error", "\"command\":%s,\"error\":\"unknown command\"", cmd);
+    }
+}
+
+/* commands of the control FIFO, one per line. A line can come in several reads:
+ * its beginning is kept until its end is read */
+static void events_read_control(events_t * ev) {
+    char *  line, * eol;
+    ssize_t n;
+
+    while ((n = read(ev->controlfd, ev->controlline + ev->controllen,
+                     sizeof(ev->controlline) - 1 - ev->controllen)) > 0) {
+        ev->controllen += n;
+        ev->controlline[ev->controllen] = 0;
+        for (line = ev->controlline; (eol = strchr(line, '\n')) != NULL; line = eol + 1) {
+            *eol = 0;
+            events_control_command(ev, line);
+        }
+        ev->controllen -= line - ev->controlline;
+        memmove(ev->controlline, line, ev->controllen + 1);
+        /* a line longer than the buffer is an unknown command */
+        if (ev->controllen == sizeof(ev->controlline) - 1) {
+            events_control_command(ev, ev->controlline);
+            ev->controllen = 0;
+        }
+    }
+}
+
+static void * events_thread(void * data) {
+    events_t *      ev = data;
+    struct pollfd   fds[3];
+    struct timespec next, now;
+
+    next = ev->start;
+    next.tv_sec += EVENTS_INTERVAL_MS / 1000;
+    next.tv_nsec += (EVENTS_INTERVAL_MS % 1000) * 1000000L;
+    while (!ev->stop) {
+        nfds_t  nfds = 0;
+        long    timeout;
+        int     execidx = -1, controlidx = -1;
+
+        fds[nfds].fd = ev->wakepipe[0];
+        fds[nfds++].events = POLLIN;
+        if (ev->execpipe[0] >= 0) {
+            execidx = nfds;
+            fds[nfds].fd = ev->execpipe[0];
+            fds[nfds++].events = POLLIN;
+        }
+        if (ev->controlfd >= 0) {
+            controlidx = nfds;
+            fds[nfds].fd = ev->controlfd;
+            fds[nfds++].events = POLLIN;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        timeout = (next.tv_sec - now.tv_sec) * 1000L + (next.tv_nsec - now.tv_nsec) / 1000000L;
+        if (timeout <= 0) {
+            events_sample(ev, "sample");
+            next.tv_sec += EVENTS_INTERVAL_MS / 1000;
+            next.tv_nsec += (EVENTS_INTERVAL_MS % 1000) * 1000000L;
+            if (next.tv_nsec >= 1000000000L) {
+                ++next.tv_sec;
+                next.tv_nsec -= 1000000000L;
+            }
+            continue ;
+        }
+        if (poll(fds, nfds, (int) timeout) <= 0)
+            continue ;
+        if ((fds[0].revents & POLLIN) != 0) {
+            unsigned char   sigs[64];
+            ssize_t         n = read(ev->wakepipe[0], sigs, sizeof(sigs));
+
+            for (ssize_t i = 0; i < n; ++i) {
+                if (sigs[i] == EVENTS_STOP)
+                    ev->stop = 1;
+                else if (sigs[i] == SIGUSR1)
+                    events_sample(ev, "snapshot");
+                else
+                    events_emit(ev, "signal", "\"pid\":%d,\"signal\":%d,\"name\":\"%s\",\"forwarded\":true",
+                                (int) ev->pid, sigs[i], strsignal(sigs[i]));
+            }
+        }
+        if (execidx >= 0 && (fds[execidx].revents & (POLLIN | POLLHUP)) != 0)
+            events_read_exec(ev);
+        if (controlidx >= 0 && (fds[controlidx].revents & POLLIN) != 0)
+            events_read_control(ev);
+    }
+    return NULL;
+}
+
+int events_init(events_t * ev, const char * output, const char * control) {
+    char *  end;
+    long    fd;
+
+    if (ev == NULL || output == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    fd = strtol(output, &end, 10);
+    if (*output != 0 && *end == 0) {
+        if (fd < 0 || fcntl((int) fd, F_GETFD) < 0) {
+            errno = EBADF;
+            return -1;
+        }
+        ev->fd = (int) fd;
+    } else if ((ev->fd = open(output, O_WRONLY | O_CREAT | O_APPEND | O_NOFOLLOW | O_CLOEXEC, 0644)) >= 0) {
+        struct stat st;
+
+        ev->owned = 1;
+        /* not a symlink: a FIFO read by a collector, or a file of ours not linked elsewhere */
+        if (fstat(ev->fd, &st) != 0)
+            return -1;
+        if (!S_ISFIFO(st.st_mode)
+        &&  (!S_ISREG(st.st_mode) || st.st_uid != geteuid() || st.st_nlink > 1)) {
+            errno = EPERM;
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    /* the program does not inherit it */
+    fcntl(ev->fd, F_SETFD, FD_CLOEXEC);
+    if (pipe(ev->execpipe) != 0 || pipe(ev->wakepipe) != 0)
+        return -1;
+    for (int i = 0; i < 2; ++i) {
+        fcntl(ev->execpipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(ev->wakepipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    /* a signal handler must never block on a full pipe */
+    fcntl(ev->wakepipe[1], F_SETFL, O_NONBLOCK);
+    if (control != NULL) {
+        struct stat st, stfd;
+
+        if (mkfifo(control, 0600) == 0)
+            ev->created = 1;
+        else if (errno != EEXIST)
+            return -1;
+        ev->control = control;
+        /* an existing one must be a FIFO of ours, that others cannot write to */
+        if (lstat(control, &st) != 0)
+            return -1;
+        if (!S_ISFIFO(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+            errno = EPERM;
+            return -1;
+        }
+        /* opened for writing too, so that there is no EOF when a writer closes it */
+        if ((ev->controlfd = open(control, O_RDWR | O_NONBLOCK | O_CLOEXEC | O_NOFOLLOW)) < 0)
+            return -1;
+        if (fstat(ev->controlfd, &stfd) != 0 || stfd.st_dev != st.st_dev || stfd.st_ino != st.st_ino) {
+            errno = EPERM;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void events_child(events_t * ev) {
+    ev->ischild = 1;
+    if (ev->execpipe[0] >= 0)
+        close(ev->execpipe[0]);
+    ev->execpipe[0] = -1;
+}
+
+void events_child_failed(events_t * ev, int code, int errnum) {
+    int failure[2] = { code, errnum };
+
+    if (!ev->ischild || ev->execpipe[1] < 0)
+        return ;
+    if (write(ev->execpipe[1], failure, sizeof(failure)) != sizeof(failure))
+        return ;
+    /* only the first failure is reported */
+    close(ev->execpipe[1]);
+    ev->execpipe[1] = -1;
+}
+
+int events_start(events_t * ev, pid_t pid, char * const * argv, uid_t uid, gid_t gid) {
+    char    args[EVENTS_LINE_MAX - 256];
+    size_t  len = 0;
+
+    ev->pid = pid;
+    ev->stop = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ev->start);
+    /* only the child keeps it, to be closed by execve() */
+    close(ev->execpipe[1]);
+    ev->execpipe[1] = -1;
+
+    args[len++] = '[';
+    for (int i = 0; argv != NULL && argv[i] != NULL && len + 16 < sizeof(args); ++i) {
+        if (i > 0)
+            args[len++] = ',';
+        len += events_json_string(args + len, sizeof(args) - len - 2, argv[i]);
+    }
+    args[len++] = ']';
+    args[len] = 0;
+    events_emit(ev, "spawned", "\"pid\":%d,\"ppid\":%d,\"uid\":%lu,\"gid\":%lu,\"argv\":%s",
+                (int) pid, (int) getpid(), (unsigned long) uid, (unsigned long) gid, args);
+
+    if ((errno = pthread_create(&ev->thread, NULL, events_thread, ev)) != 0)
+        return -1;
+    ev->running = 1;
+    return 0;
+}
+
+void events_signal(events_t * ev, int sig) {
+    unsigned char c = (unsigned char) sig;
+
+    if (ev->wakepipe[1] >= 0 && write(ev->wakepipe[1], &c, 1) < 0)
+        return ;
+}
+
+void events_stop(events_t * ev) {
+    unsigned char c = EVENTS_STOP;
+
+    if (!ev->running)
+        return ;
+    while (write(ev->wakepipe[1], &c, 1) < 0 && errno == EINTR)
+        ; /* nothing */
+    pthread_join(ev->thread, NULL);
+    ev->running = 0;
+    /* the program terminated before the thread saw the result of execve() */
+    if (ev->execpipe[0] >= 0)
+        events_read_exec(ev);
+    if (ev->controlfd >= 0)
+        events_read_control(ev);
+}
+
+void events_exited(events_t * ev, int status, const struct timespec * real, const struct rusage * ru) {
+    if (WIFEXITED(status))
+        events_emit(ev, "exited", "\"pid\":%d,\"code\":%d", (int) ev->pid, WEXITSTATUS(status));
+    else if (WIFSIGNALED(status))
+        events_emit(ev, "exited", "\"pid\":%d,\"signal\":%d,\"name\":\"%s\",\"core\":%s", (int) ev->pid,
+                    WTERMSIG(status), strsignal(WTERMSIG(status)), WCOREDUMP(status) ? "true" : "false");
+    else
+        events_emit(ev, "exited", "\"pid\":%d", (int) ev->pid);
+    events_emit(ev, "metrics", "\"pid\":%d,\"real\":%ld.%09ld,\"user\":%ld.%06ld,\"sys\":%ld.%06ld,"
+                "\"maxrss_kb\":%ld,\"minflt\":%ld,\"majflt\":%ld,\"inblock\":%ld,\"oublock\":%ld,"
+                "\"nvcsw\":%ld,\"nivcsw\":%ld", (int) ev->pid,
+                (long) real->tv_sec, (long) real->tv_nsec,
+                (long) ru->ru_utime.tv_sec, (long) ru->ru_utime.tv_usec,
+                (long) ru->ru_stime.tv_sec, (long) ru->ru_stime.tv_usec,
+                ru->ru_maxrss, ru->ru_minflt, ru->ru_majflt, ru->ru_inblock, ru->ru_oublock,
+                ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+void events_free(events_t * ev) {
+    if (ev == NULL)
+        return ;
+    if (!ev->ischild)
+        events_stop(ev);
+    for (int i = 0; i < 2; ++i) {
+        if (ev->execpipe[i] >= 0)
+            close(ev->execpipe[i]);
+        if (ev->wakepipe[i] >= 0)
+            close(ev->wakepipe[i]);
+        ev->execpipe[i] = ev->wakepipe[i] = -1;
+    }
+    if (ev->controlfd >= 0)
+        close(ev->controlfd);
+    ev->controlfd = -1;
+    if (ev->created && !ev->ischild)
+        unlink(ev->control);
+    ev->created = 0;
+    if (ev->owned && ev->fd >= 0)
+        close(ev->fd);
+    ev->fd = -1;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Lifecycle events of the program as newline-delimited JSON, for orchestrators:
+ * spawn, exec, periodic samples, signals, exit and final metrics, and snapshots
+ * on demand through a control FIFO.
+ */
+#ifndef VRUNAS_EVENTS_H
+#define VRUNAS_EVENTS_H
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <pthread.h>
+
+#define EVENTS_INTERVAL_MS      1000    /* period of 'sample' events */
+#define EVENTS_CONTROL_MAX      256     /* longest command of the control FIFO */
+
+typedef struct {
+    int                 fd;             /* NDJSON output */
+    int                 owned;          /* fd opened by events_init() */
+    volatile int        broken;         /* the reader is gone (EPIPE): no more events */
+    const char *        control;        /* path of the control FIFO, or NULL */
+    int                 controlfd;
+    char                controlline[EVENTS_CONTROL_MAX]; /* command not yet terminated */
+    size_t              controllen;
+    int                 created;        /* control FIFO created by vrunas, removed by events_free() */
+    int                 execpipe[2];    /* closed by execve(), or receives the failure of the child */
+    int                 wakepipe[2];    /* signals received and stop request, for the thread */
+    int                 ischild;
+    pid_t               pid;
+    struct timespec     start;
+    pthread_mutex_t     mutex;          /* one event written at a time */
+    int                 running;
+    volatile int        stop;
+    pthread_t           thread;
+} events_t;
+
+#define EVENTS_INITIALIZER { -1, 0, 0, NULL, -1, { 0, }, 0, 0, { -1, -1 }, { -1, -1 }, 0, 0, { 0, 0 }, \
+                             PTHREAD_MUTEX_INITIALIZER, 0, 0, }
+
+/** events_init() : open the events output (a file descriptor number, or a path
+ * appended to, not a symlink: a FIFO, or a regular file of the effective user with no
+ * other link, else EPERM), and create the control FIFO if control is not NULL. An existing
+ * control must be a FIFO of the effective user, not writable by others. To be called
+ * before fork(). An event too long for a line is written without its fields, with
+ * '"truncated":true'.
+ * @return 0 on success, -1 on error (errno set) */
+int events_init(events_t * ev, const char * output, const char * control);
+
+/** events_child() : to be called by the child after fork() */
+void events_child(events_t * ev);
+
+/** events_child_failed() : to be called by the child if the program could not be
+ * executed: the father emits 'exec_failed' with the exit code and errno */
+void events_child_failed(events_t * ev, int code, int errnum);
+
+/** events_start() : emit 'spawned' with the identity of the program, and start the
+ * thread which emits 'exec_ok'/'exec_failed', periodic 'sample', 'signal' and the
+ * 'snapshot' requested with SIGUSR1 or the control FIFO.
+ * @return 0 on success, -1 on error (errno set) */
+int events_start(events_t * ev, pid_t pid, char * const * argv, uid_t uid, gid_t gid);
+
+/** events_signal() : async-signal-safe notification of a signal received by vrunas,
+ * SIGUSR1 being a snapshot request, the other ones being forwarded to the program */
+void events_signal(events_t * ev, int sig);
+
+/** events_stop() : stop the thread, once the program is terminated */
+void events_stop(events_t * ev);
+
+/** events_exited() : emit 'exited' with the wait status of the program, and 'metrics'
+ * with its real time and resource usage */
+void events_exited(events_t * ev, int status, const struct timespec * real, const struct rusage * ru);
+
+/** events_free() : release resources of ev (not ev itself) */
+void events_free(events_t * ev);
+
+#endif /* ! ifndef VRUNAS_EVENTS_H */
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Host-wide accounting of the programs run by vrunas: a file mapped by all the
+ * instances, aggregating per identity and program the launches, failures, cpu
+ * time and peak rss, updated with atomic operations (no lock, no daemon).
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pwd.h>
+
+#include "fleetstat.h"
+
+static const char * const s_rss_buckets[FLEETSTAT_RSS_BUCKETS] = {
+    "<16M", "<64M", "<256M", "<1G", "<4G", "<16G", "<64G", ">=64G"
+};
+
+/* FNV-1a of uid and program, never 0 */
+static uint64_t fleetstat_hash(uid_t uid, const char * program) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (unsigned int i = 0; i < sizeof(uid); ++i)
+        hash = (hash ^ ((uid >> (i * 8)) & 0xff)) * 0x100000001b3ULL;
+    for (; *program; ++program)
+        hash = (hash ^ (unsigned char) *program) * 0x100000001b3ULL;
+    return hash != 0 ? hash : 1;
+}
+
+int fleetstat_default_path(const char * name, char * path, size_t size) {
+    struct stat st;
+    char        dir[32];
+    int         n;
+
+    if (geteuid() == 0) {
+        snprintf(dir, sizeof(dir), "%s", VRUNAS_RUNDIR);
+        n = snprintf(path, size, "%s/%s", dir, name);
+    } else {
+        snprintf(dir, sizeof(dir), "%s/%lu", VRUNAS_USER_RUNDIR, (unsigned long) geteuid());
+        n = snprintf(path, size, "%s/vrunas.%s", dir, name);
+    }
+    if (n < 0 || (size_t) n >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (geteuid() == 0 && mkdir(dir, 0755) != 0 && errno != EEXIST)
+        return -1;
+    /* its parent is not writable by others: the directory cannot be replaced */
+    if (lstat(dir, &st) != 0)
+        return -1;
+    if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        errno = EPERM;
+        return -1;
+    }
+    return 0;
+}
+
+int fleetstat_open(fleetstat_t * fs, const char * path, int writable) {
+    struct stat st;
+    void *      p;
+    uint64_t    magic = 0;
+    int         fd, errno_bak;
+
+    fs->path = path != NULL ? path : fs->defpath;
+    if (path == NULL && fleetstat_default_path("stats", fs->defpath, sizeof(fs->defpath)) != 0)
+        return -1;
+    if ((fd = open(fs->path, (writable ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC | O_NOFOLLOW, 0644)) < 0)
+        return -1;
+    if (fstat(fd, &st) != 0)
+        goto error;
+    /* a file of root or of ours, that nobody else can write to */
+    if (!S_ISREG(st.st_mode) || (st.st_uid != 0 && st.st_uid != geteuid())
+    ||  (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        errno = EPERM;
+        goto error;
+    }
+    /* a smaller file is extended with zeros, the data of another instance is kept */
+    if ((size_t) st.st_size < sizeof(*fs->file)) {
+        if (!writable && (errno = EINVAL))
+            goto error;
+        if (ftruncate(fd, sizeof(*fs->file)) != 0)
+            goto error;
+    }
+    if ((p = mmap(NULL, sizeof(*fs->file), PROT_READ | (writable ? PROT_WRITE : 0),
+                  MAP_SHARED, fd, 0)) == MAP_FAILED)
+        goto error;
+    close(fd);
+    fs->file = p;
+    if (writable && __atomic_compare_exchange_n(&fs->file->magic, &magic, FLEETSTAT_MAGIC, 0,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        fs->file->size = sizeof(*fs->file);
+        fs->file->nslots = FLEETSTAT_SLOTS;
+    } else if (__atomic_load_n(&fs->file->magic, __ATOMIC_ACQUIRE) != FLEETSTAT_MAGIC) {
+        fleetstat_close(fs);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+error:
+    errno_bak = errno;
+    close(fd);
+    errno = errno_bak;
+    return -1;
+}
+
+static void fleetstat_max(uint64_t * max, uint64_t value) {
+    uint64_t old = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+    while (old < value && !__atomic_compare_exchange_n(max, &old, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ; /* nothing */
+}
+
+/* slot of uid and program, claimed if needed */
+static fleetstat_slot_data_t * fleetstat_slot(fleetstat_t * fs, uid_t uid, const char * program) {
+    uint64_t key = fleetstat_hash(uid, program);
+
+    for (unsigned int n = 0, i = key % FLEETSTAT_SLOTS; n < FLEETSTAT_SLOTS; ++n, i = (i + 1) % FLEETSTAT_SLOTS) {
+        fleetstat_slot_data_t * slot = &fs->file->slots[i].d;
+        uint64_t                owner = 0;
+
+        if (__atomic_compare_exchange_n(&slot->key, &owner, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            slot->uid = uid;
+            snprintf(slot->program, sizeof(slot->program), "%s", program);
+            __atomic_store_n(&slot->state, FLEETSTAT_READY, __ATOMIC_RELEASE);
+            return slot;
+        }
+        if (owner != key)
+            continue ;
+        /* being named by another instance */
+        for (unsigned int spin = 0; __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != FLEETSTAT_READY; ++spin) {
+            if (spin >= 1000)
+                return NULL;
+            sched_yield();
+        }
+        if (slot->uid == uid && strncmp(slot->program, program, FLEETSTAT_NAMELEN) == 0)
+            return slot;
+    }
+    return NULL;
+}
+
+int fleetstat_account(fleetstat_t * fs, uid_t uid, const char * program, int failed,
+                      uint64_t cpu_us, uint64_t real_us, uint64_t rss) {
+    fleetstat_slot_data_t * slot;
+    const char *            name = strrchr(program, '/');
+    unsigned int            bucket = 0;
+
+    if (name != NULL && name[1])
+        program = name + 1;
+    if (fs->file == NULL || (slot = fleetstat_slot(fs, uid, program)) == NULL) {
+        if (fs->file != NULL)
+            __atomic_add_fetch(&fs->file->overflow, 1, __ATOMIC_RELAXED);
+        errno = ENOSPC;
+        return -1;
+    }
+    for (uint64_t limit = 16ULL << 20; bucket + 1 < FLEETSTAT_RSS_BUCKETS && rss >= limit; limit <<= 2)
+        ++bucket;
+    __atomic_add_fetch(&slot->launches, 1, __ATOMIC_RELAXED);
+    if (failed)
+        __atomic_add_fetch(&slot->failures, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&slot->cpu_us, cpu_us, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&slot->real_us, real_us, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&slot->rss_hist[bucket], 1, __ATOMIC_RELAXED);
+    fleetstat_max(&slot->rss_max, rss);
+    return 0;
+}
+
+static int fleetstat_cmp(const void * a, const void * b) {
+    const fleetstat_slot_data_t * sa = *(fleetstat_slot_data_t * const *) a;
+    const fleetstat_slot_data_t * sb = *(fleetstat_slot_data_t * const *) b;
+
+    if (sa->uid != sb->uid)
+        return sa->uid < sb->uid ? -1 : 1;
+    if (sa->launches != sb->launches)
+        return sa->launches > sb->launches ? -1 : 1;
+    return strcmp(sa->program, sb->program);
+}
+
+static void fleetstat_line(FILE * out, const char * user, const char * program, const fleetstat_slot_data_t * s) {
+    fprintf(out, "%-12.12s %-24.24s %9llu %9llu %12.3f %12.3f %8.1f ", user, program,
+            (unsigned long long) s->launches, (unsigned long long) s->failures,
+            s->cpu_us / 1e6, s->real_us / 1e6, s->rss_max / 1048576.0);
+    for (unsigned int b = 0; b < FLEETSTAT_RSS_BUCKETS; ++b)
+        fprintf(out, "%s%llu", b > 0 ? "/" : "", (unsigned long long) s->rss_hist[b]);
+    fputc('\n', out);
+}
+
+void fleetstat_report(FILE * out, const fleetstat_t * fs) {
+    fleetstat_slot_data_t * slots[FLEETSTAT_SLOTS];
+    fleetstat_slot_data_t   total;
+    unsigned int            n = 0;
+
+    if (fs->file == NULL)
+        return ;
+    for (unsigned int i = 0; i < FLEETSTAT_SLOTS; ++i) {
+        if (__atomic_load_n(&fs->file->slots[i].d.state, __ATOMIC_ACQUIRE) == FLEETSTAT_READY)
+            slots[n++] = &fs->file->slots[i].d;
+    }
+    qsort(slots, n, sizeof(*slots), fleetstat_cmp);
+    fprintf(out, "%-12s %-24s %9s %9s %12s %12s %8s rss peaks (", "user", "program", "launches",
+            "failures", "cpu(s)", "real(s)", "rss(MB)");
+    for (unsigned int b = 0; b < FLEETSTAT_RSS_BUCKETS; ++b)
+        fprintf(out, "%s%s", b > 0 ? "/" : "", s_rss_buckets[b]);
+    fputs(")\n", out);
+    for (unsigned int i = 0; i < n; ) {
+        struct passwd * pw = getpwuid(slots[i]->uid);
+        char            user[32];
+        unsigned int    first = i;
+
+        if (pw != NULL)
+            snprintf(user, sizeof(user), "%s", pw->pw_name);
+        else
+            snprintf(user, sizeof(user), "%lu", (unsigned long) slots[i]->uid);
+        memset(&total, 0, sizeof(total));
+        for (; i < n && slots[i]->uid == slots[first]->uid; ++i) {
+            fleetstat_line(out, user, slots[i]->program, slots[i]);
+            total.launches += slots[i]->launches;
+            total.failures += slots[i]->failures;
+            total.cpu_us += slots[i]->cpu_us;
+            total.real_us += slots[i]->real_us;
+            if (slots[i]->rss_max > total.rss_max)
+                total.rss_max = slots[i]->rss_max;
+            for (unsigned int b = 0; b < FLEETSTAT_RSS_BUCKETS; ++b)
+                total.rss_hist[b] += slots[i]->rss_hist[b];
+        }
+        if (i - first > 1)
+            fleetstat_line(out, user, "(total)", &total);
+    }
+    if (fs->file->overflow > 0)
+        fprintf(out, "(%llu runs not accounted, table full)\n", (unsigned long long) fs->file->overflow);
+}
+
+void fleetstat_close(fleetstat_t * fs) {
+    if (fs->file != NULL)
+        munmap(fs->file, sizeof(*fs->file));
+    fs->file = NULL;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Host-wide accounting of the programs run by vrunas: a file mapped by all the
+ * instances, aggregating per identity and program the launches, failures, cpu
+ * time and peak rss, updated with atomic operations (no lock, no daemon).
+ */
+#ifndef VRUNAS_FLEETSTAT_H
+#define VRUNAS_FLEETSTAT_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/* The default files are shared by the instances of one effective user: those of root
+ * in VRUNAS_RUNDIR, created 0755 by root so that nobody else can create them, those of
+ * other users in their runtime directory. Only the owner of a file may update it. */
+#define VRUNAS_RUNDIR           "/run/vrunas"
+#define VRUNAS_USER_RUNDIR      "/run/user"     /* <uid>/vrunas.<name> for non-root users */
+#define FLEETSTAT_DEFAULT_PATH  VRUNAS_RUNDIR "/stats"
+#define FLEETSTAT_MAGIC         0x7672756e61736631ULL   /* "vrunasf1" */
+#define FLEETSTAT_SLOTS         1024    /* identity and program pairs */
+#define FLEETSTAT_NAMELEN       47
+#define FLEETSTAT_RSS_BUCKETS   8       /* peak rss < 16MB, < 64MB, ... < 64GB, >= 64GB */
+
+enum { FLEETSTAT_FREE = 0, FLEETSTAT_BUSY, FLEETSTAT_READY };
+
+typedef struct {
+    volatile uint64_t   key;            /* hash of uid and program, 0 if free */
+    volatile uint32_t   state;          /* FLEETSTAT_FREE, _BUSY while named, _READY */
+    uint32_t            uid;
+    char                program[FLEETSTAT_NAMELEN + 1];
+    uint64_t            launches;
+    uint64_t            failures;       /* exit code not 0, or signal */
+    uint64_t            cpu_us;         /* user + sys */
+    uint64_t            real_us;
+    uint64_t            rss_max;        /* bytes */
+    uint64_t            rss_hist[FLEETSTAT_RSS_BUCKETS];
+} fleetstat_slot_data_t;
+
+/* one slot per cache line(s), so that instances updating different slots do not share lines */
+typedef union {
+    fleetstat_slot_data_t   d;
+    char                    pad[(sizeof(fleetstat_slot_data_t) + 63) & ~(size_t) 63];
+} fleetstat_slot_t;
+
+typedef struct {
+    volatile uint64_t   magic;          /* set by the first instance */
+    uint32_t            size;           /* of the file */
+    uint32_t            nslots;
+    volatile uint64_t   overflow;       /* runs not accounted, table full */
+    char                reserved[40];
+    fleetstat_slot_t    slots[FLEETSTAT_SLOTS];
+} fleetstat_file_t;
+
+typedef struct {
+    const char *        path;           /* NULL for the default one */
+    fleetstat_file_t *  file;
+    char                defpath[64];
+} fleetstat_t;
+
+#define FLEETSTAT_INITIALIZER { NULL, NULL, { 0, } }
+
+/** fleetstat_default_path() : build the default path of file 'name' for the effective
+ * user: VRUNAS_RUNDIR/name for root, creating the directory if needed, else
+ * VRUNAS_USER_RUNDIR/<euid>/vrunas.name. The path is always built.
+ * @return 0 on success, -1 on error (errno set, ENAMETOOLONG, EPERM if the directory is
+ *         not owned by the effective user or writable by group and others) */
+int fleetstat_default_path(const char * name, char * path, size_t size);
+
+/** fleetstat_open() : map the statistics file (default one if path is NULL), created if
+ * needed (writable). Concurrent instances may create it at the same time. It must be a regular file
+ * (not a symlink) of root or of the effective user, not writable by group and others.
+ * @return 0 on success, -1 on error (errno set, EINVAL if not a statistics file,
+ *         EPERM if not trusted) */
+int fleetstat_open(fleetstat_t * fs, const char * path, int writable);
+
+/** fleetstat_account() : add a run of program (path or name) by uid.
+ * @return 0 on success, -1 if the table is full (ENOSPC) */
+int fleetstat_account(fleetstat_t * fs, uid_t uid, const char * program, int failed,
+                      uint64_t cpu_us, uint64_t real_us, uint64_t rss);
+
+/** fleetstat_report() : print the programs run by each identity, and totals per identity */
+void fleetstat_report(FILE * out, const fleetstat_t * fs);
+
+/** fleetstat_close() : unmap the file */
+void fleetstat_close(fleetstat_t * fs);
+
+#endif /* ! ifndef VRUNAS_FLEETSTAT_H */
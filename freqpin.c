@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Frequency pinning of the cpus of a run with linux cpufreq: fixed frequency and
+ * turbo disabled, the previous values being restored at exit, or by a later run
+ * from a recovery record if vrunas could not restore them.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "freqpin.h"
+
+#define FREQPIN_RECORD_HEADER   "vrunas-cpufreq"
+
+static int freqpin_read(const char * path, char * buf, size_t size) {
+    ssize_t n;
+    int     fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+        return -1;
+    buf[n] = 0;
+    buf[strcspn(buf, "\n")] = 0;
+    return 0;
+}
+
+static int freqpin_write(const char * path, const char * value) {
+    ssize_t n;
+    int     fd, errno_bak;
+
+    if ((fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC)) < 0)
+        return -1;
+    n = write(fd, value, strlen(value));
+    errno_bak = errno;
+    close(fd);
+    errno = errno_bak;
+    return n == (ssize_t) strlen(value) ? 0 : -1;
+}
+
+int freqpin_parse(const char * str, unsigned long * khz) {
+    char *  end;
+    double  v;
+
+    errno = 0;
+    v = strtod(str, &end);
+    if (errno != 0 || end == str || v <= 0)
+        return -1;
+    if (strcasecmp(end, "GHz") == 0)
+        v *= 1e6;
+    else if (strcasecmp(end, "MHz") == 0)
+        v *= 1e3;
+    else if (*end != 0 && strcasecmp(end, "kHz") != 0)
+        return -1;
+    if (v < 1 || v > 1e9)
+        return -1;
+    *khz = (unsigned long) (v + 0.5);
+    return 0;
+}
+
+/* start time of pid since boot, in clock ticks (/proc/<pid>/stat field 22), 0 if unknown */
+static unsigned long long freqpin_starttime(pid_t pid) {
+    char                path[64], buf[1024];
+    char *              s;
+    unsigned long long  start = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    if (freqpin_read(path, buf, sizeof(buf)) != 0 || (s = strrchr(buf, ')')) == NULL
+    ||  sscanf(s + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+               &start) != 1)
+        return 0;
+    return start;
+}
+
+/* only the knobs written by freqpin_apply(), under <sysfs>/devices/system/cpu/ */
+static int freqpin_knob_valid(const char * sysfs, const char * path, const char * value) {
+    char            prefix[FREQPIN_PATH_MAX];
+    const char *    s;
+
+    if ((size_t) snprintf(prefix, sizeof(prefix), "%s/devices/system/cpu/", sysfs) >= sizeof(prefix)
+    ||  strncmp(path, prefix, strlen(prefix)) != 0 || *value == 0 || value[strspn(value, "0123456789")] != 0)
+        return 0;
+    s = path + strlen(prefix);
+    if (strcmp(s, "intel_pstate/no_turbo") == 0 || strcmp(s, "cpufreq/boost") == 0)
+        return 1;
+    if (strncmp(s, "cpu", 3) != 0 || s[3] < '0' || s[3] > '9')
+        return 0;
+    for (s += 3; *s >= '0' && *s <= '9'; ++s)
+        ; /* nothing */
+    return strcmp(s, "/cpufreq/scaling_min_freq") == 0 || strcmp(s, "/cpufreq/scaling_max_freq") == 0;
+}
+
+int freqpin_recover(const char * sysfs, const char * record) {
+    char                path[FREQPIN_PATH_MAX], value[32];
+    freqpin_knob_t *    knobs = NULL;
+    unsigned int        nknobs = 0;
+    unsigned long long  start = 0;
+    struct stat         st;
+    long                pid;
+    FILE *              file;
+    int                 fd, n, errno_bak;
+
+    if ((fd = open(record, O_RDONLY | O_CLOEXEC | O_NOFOLLOW)) < 0)
+        return errno == ENOENT ? 0 : -1;
+    /* written by us, and that nobody else can modify */
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+    ||  (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        close(fd);
+        errno = EPERM;
+        return -1;
+    }
+    if ((file = fdopen(fd, "r")) == NULL) {
+        errno_bak = errno;
+        close(fd);
+        errno = errno_bak;
+        return -1;
+    }
+    /* the run of the record is alive: its values are not to be touched. The start
+     * time tells a recycled pid */
+    if ((n = fscanf(file, FREQPIN_RECORD_HEADER " %ld %llu", &pid, &start)) >= 1 && pid > 0 && pid != getpid()
+    && (kill(pid, 0) == 0 || errno == EPERM) && (n < 2 || freqpin_starttime(pid) == start)) {
+        fclose(file);
+        errno = EBUSY;
+        return -1;
+    }
+    /* all or nothing: a record with other files is not restored */
+    while (fscanf(file, " %255s %31s", path, value) == 2) {
+        void * p;
+
+        if (!freqpin_knob_valid(sysfs, path, value)
+        ||  (p = realloc(knobs, (nknobs + 1) * sizeof(*knobs))) == NULL) {
+            free(knobs);
+            fclose(file);
+            errno = EINVAL;
+            return -1;
+        }
+        knobs = p;
+        snprintf(knobs[nknobs].path, sizeof(knobs[nknobs].path), "%s", path);
+        snprintf(knobs[nknobs].value, sizeof(knobs[nknobs].value), "%s", value);
+        ++nknobs;
+    }
+    fclose(file);
+    /* in the order of freqpin_apply(): the first max can fail until min is restored */
+    for (unsigned int i = 0; i < nknobs; ++i)
+        freqpin_write(knobs[i].path, knobs[i].value);
+    free(knobs);
+    return unlink(record) == 0 || errno == ENOENT ? 1 : -1;
+}
+
+static int freqpin_save(freqpin_t * fp, const char * file) {
+    freqpin_knob_t * knob = &fp->knobs[fp->nknobs];
+
+    snprintf(knob->path, sizeof(knob->path), "%s/%s", fp->sysfs, file);
+    if (freqpin_read(knob->path, knob->value, sizeof(knob->value)) != 0 || *knob->value == 0)
+        return -1;
+    ++fp->nknobs;
+    return 0;
+}
+
+/* the values before the run, written to the record before being changed */
+static int freqpin_prepare(freqpin_t * fp) {
+    char    file[128];
+    char    buf[32];
+
+    if ((fp->knobs = calloc(fp->ncpus * 3 + 1, sizeof(*fp->knobs))) == NULL)
+        return -1;
+    for (unsigned int i = 0; fp->khz > 0 && i < fp->ncpus; ++i) {
+        unsigned long min, max;
+
+        snprintf(file, sizeof(file), "%s/devices/system/cpu/cpu%d/cpufreq/cpuinfo_min_freq", fp->sysfs, fp->cpus[i]);
+        if (freqpin_read(file, buf, sizeof(buf)) != 0)
+            return -1;
+        min = strtoul(buf, NULL, 10);
+        snprintf(file, sizeof(file), "%s/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", fp->sysfs, fp->cpus[i]);
+        if (freqpin_read(file, buf, sizeof(buf)) != 0)
+            return -1;
+        max = strtoul(buf, NULL, 10);
+        if (fp->khz < min || fp->khz > max) {
+            errno = ERANGE;
+            return -1;
+        }
+        /* max, min, max: the first max cannot be below the current min */
+        snprintf(file, sizeof(file), "devices/system/cpu/cpu%d/cpufreq/scaling_max_freq", fp->cpus[i]);
+        if (freqpin_save(fp, file) != 0)
+            return -1;
+        snprintf(file, sizeof(file), "devices/system/cpu/cpu%d/cpufreq/scaling_min_freq", fp->cpus[i]);
+        if (freqpin_save(fp, file) != 0)
+            return -1;
+        fp->knobs[fp->nknobs] = fp->knobs[fp->nknobs - 2];
+        ++fp->nknobs;
+    }
+    if (fp->noturbo) {
+        /* global knob of intel_pstate, or of the other drivers */
+        if (freqpin_save(fp, "devices/system/cpu/intel_pstate/no_turbo") == 0)
+            fp->turbo = "intel_pstate/no_turbo";
+        else if (freqpin_save(fp, "devices/system/cpu/cpufreq/boost") == 0)
+            fp->turbo = "cpufreq/boost";
+        else
+            return -1;
+    }
+    return 0;
+}
+
+static int freqpin_write_record(freqpin_t * fp) {
+    FILE *  file;
+    int     fd, ret, errno_bak;
+
+    /* exclusive: another run may have created it since the recovery */
+    if ((fd = open(fp->record, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC | O_NOFOLLOW, 0644)) < 0) {
+        if (errno == EEXIST)
+            errno = EBUSY;
+        return -1;
+    }
+    if ((file = fdopen(fd, "w")) == NULL) {
+        errno_bak = errno;
+        close(fd);
+        unlink(fp->record);
+        errno = errno_bak;
+        return -1;
+    }
+    fprintf(file, FREQPIN_RECORD_HEADER " %ld %llu\n", (long) getpid(), freqpin_starttime(getpid()));
+    for (unsigned int i = 0; i < fp->nknobs; ++i)
+        fprintf(file, "%s %s\n", fp->knobs[i].path, fp->knobs[i].value);
+    ret = fflush(file) != 0 || ferror(file) || fsync(fd) != 0 ? -1 : 0;
+    errno_bak = errno;
+    if (fclose(file) != 0 && ret == 0 && (ret = -1))
+        errno_bak = errno;
+    if (ret != 0)
+        unlink(fp->record);
+    errno = errno_bak;
+    return ret;
+}
+
+int freqpin_apply(freqpin_t * fp, int cpu) {
+    cpu_set_t   set;
+    char        value[32];
+    int         errno_bak;
+
+    if (freqpin_recover(fp->sysfs, fp->record) < 0)
+        return -1;
+    if (cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+    } else if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return -1;
+    }
+    if ((fp->cpus = calloc(CPU_COUNT(&set), sizeof(*fp->cpus))) == NULL)
+        return -1;
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &set))
+            fp->cpus[fp->ncpus++] = i;
+    }
+    if (freqpin_prepare(fp) != 0 || freqpin_write_record(fp) != 0)
+        return -1;
+
+    fp->owner = getpid();
+    snprintf(value, sizeof(value), "%lu", fp->khz);
+    for (unsigned int i = 0; i < fp->nknobs; ++i) {
+        const char * target = value;
+
+        if (fp->turbo != NULL && i == fp->nknobs - 1)
+            target = strcmp(fp->turbo, "cpufreq/boost") == 0 ? "0" : "1";
+        /* the first max fails if the frequency is below the current min */
+        if (freqpin_write(fp->knobs[i].path, target) != 0 && (fp->khz == 0 || i % 3 != 0)) {
+            errno_bak = errno;
+            freqpin_restore(fp);
+            errno = errno_bak;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void freqpin_restore(freqpin_t * fp) {
+    if (fp->owner == 0 || fp->owner != getpid())
+        return ;
+    for (unsigned int i = 0; i < fp->nknobs; ++i)
+        freqpin_write(fp->knobs[i].path, fp->knobs[i].value);
+    unlink(fp->record);
+    fp->owner = 0;
+}
+
+/* cpus as a list of ranges '0-3,6' */
+static const char * freqpin_cpulist(const freqpin_t * fp, char * buf, size_t size) {
+    size_t len = 0;
+
+    *buf = 0;
+    for (unsigned int i = 0; i < fp->ncpus && len < size; ) {
+        unsigned int j = i;
+
+        while (j + 1 < fp->ncpus && fp->cpus[j + 1] == fp->cpus[j] + 1)
+            ++j;
+        if (j > i)
+            len += snprintf(buf + len, size - len, "%s%d-%d", len > 0 ? "," : "", fp->cpus[i], fp->cpus[j]);
+        else
+            len += snprintf(buf + len, size - len, "%s%d", len > 0 ? "," : "", fp->cpus[i]);
+        i = j + 1;
+    }
+    return buf;
+}
+
+void freqpin_report(FILE * out, const freqpin_t * fp) {
+    char cpus[128];
+
+    if (fp->khz > 0) {
+        fprintf(out, "cpufreq  %13lu (kHz of the cpus %s of the program, fixed during the run)\n",
+                fp->khz, freqpin_cpulist(fp, cpus, sizeof(cpus)));
+    }
+    if (fp->noturbo && fp->turbo != NULL) {
+        fprintf(out, "turbo    %13s (turbo of the host during the run, disabled with %s)\n", "off", fp->turbo);
+    }
+}
+
+void freqpin_free(freqpin_t * fp) {
+    freqpin_restore(fp);
+    free(fp->cpus);
+    fp->cpus = NULL;
+    fp->ncpus = 0;
+    free(fp->knobs);
+    fp->knobs = NULL;
+    fp->nknobs = 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Frequency pinning of the cpus of a run with linux cpufreq: fixed frequency and
+ * turbo disabled, the previous values being restored at exit, or by a later run
+ * from a recovery record if vrunas could not restore them.
+ */
+#ifndef VRUNAS_FREQPIN_H
+#define VRUNAS_FREQPIN_H
+
+#include <sys/types.h>
+#include <stdio.h>
+
+#define FREQPIN_DEFAULT_RECORD  "/run/vrunas.cpufreq"
+#define FREQPIN_PATH_MAX        256
+
+typedef struct {
+    char                path[FREQPIN_PATH_MAX];
+    char                value[32];      /* before the run */
+} freqpin_knob_t;
+
+typedef struct {
+    const char *        sysfs;          /* root of sysfs */
+    const char *        record;         /* recovery record */
+    unsigned long       khz;            /* fixed frequency, 0 if not fixed */
+    int                 noturbo;
+    int *               cpus;
+    unsigned int        ncpus;
+    freqpin_knob_t *    knobs;          /* values to restore, in the order to write them */
+    unsigned int        nknobs;
+    const char *        turbo;          /* knob of the turbo, NULL if unknown */
+    pid_t               owner;          /* process which applied the values, 0 if none */
+    int                 recover;        /* freqpin_recover() requested */
+} freqpin_t;
+
+#define FREQPIN_INITIALIZER { "/sys", FREQPIN_DEFAULT_RECORD, 0, 0, NULL, 0, NULL, 0, NULL, 0, 0 }
+
+/** freqpin_parse() : parse a frequency 'F[GHz|MHz|kHz]' (kHz without unit).
+ * @return 0 or -1 on error */
+int freqpin_parse(const char * str, unsigned long * khz);
+
+/** freqpin_recover() : restore the values of a record left by a run which did not
+ * restore them, and remove it. The record must be a regular file of the effective
+ * user, not writable by group and others, with only cpufreq and turbo knobs of sysfs.
+ * @return 1 if restored, 0 if there is no record, -1 on error (errno set, EBUSY if
+ *         the run of the record is still alive, EPERM if the record is not trusted,
+ *         EINVAL if it has other files) */
+int freqpin_recover(const char * sysfs, const char * record);
+
+/** freqpin_apply() : after the recovery of a previous record, save the values to the
+ * record, then fix the frequency and disable the turbo of the cpus of the run.
+ * @param cpu the cpu of the run, -1 for the ones allowed to vrunas
+ * @return 0 on success, -1 on error (errno set, ERANGE if the frequency is not
+ *         supported, nothing being changed) */
+int freqpin_apply(freqpin_t * fp, int cpu);
+
+/** freqpin_restore() : restore the values saved by this process and remove the record */
+void freqpin_restore(freqpin_t * fp);
+
+/** freqpin_report() : print the frequency and turbo of the run (extended timings format) */
+void freqpin_report(FILE * out, const freqpin_t * fp);
+
+/** freqpin_free() : restore the values and release resources of fp (not fp itself) */
+void freqpin_free(freqpin_t * fp);
+
+#endif /* ! ifndef VRUNAS_FREQPIN_H */
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Heap allocations of a process tree, counted by the preload library HEAPPROF_PRELOAD_LIB
+ * (malloc/calloc/realloc/free/mmap) and written at exit of each process.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <grp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "elfutil.h"
+#include "ldstat.h"
+#include "heapprof.h"
+
+#ifndef PATH_MAX
+# define PATH_MAX 4096
+#endif
+
+#define HEAPPROF_ENV    "VRUNAS_HEAP"   /* "<fd>:<dev>:<ino>", see preload/vrunas_heap.c */
+
+int heapprof_init(heapprof_t * hp, uid_t uid, gid_t gid) {
+    char path[PATH_MAX];
+
+    if (hp == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    hp->uid = uid;
+    hp->gid = gid;
+#   if !defined(__linux__) || !defined(__GLIBC__)
+    errno = ENOSYS;
+    return -1;
+#   endif
+    if (ldstat_find_preload(HEAPPROF_PRELOAD_LIB, path) != 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    if ((hp->preload = strdup(path)) == NULL)
+        return -1;
+    /* inherited by the program, as the preload library writes in it */
+    if ((hp->records = tmpfile()) == NULL)
+        return -1;
+    return 0;
+}
+
+int heapprof_child(heapprof_t * hp) {
+    struct stat st;
+    char        buf[128];
+
+    if (hp == NULL || hp->records == NULL || hp->preload == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* the library checks the file is still this one before writing in it */
+    if (fstat(fileno(hp->records), &st) != 0)
+        return -1;
+    snprintf(buf, sizeof(buf), "%d:%llu:%llu", fileno(hp->records),
+             (unsigned long long) st.st_dev, (unsigned long long) st.st_ino);
+    if (ldstat_setenv_append("LD_PRELOAD", hp->preload, ':') != 0
+    ||  setenv(HEAPPROF_ENV, buf, 1) != 0)
+        return -1;
+    return 0;
+}
+
+static int heapprof_add_site(heapprof_t * hp, const char * path, uint64_t offset, uint64_t samples) {
+    heapprof_site_t * sites;
+
+    for (unsigned int i = 0; i < hp->nsites; ++i) {
+        if (hp->sites[i].offset == offset && strcmp(hp->sites[i].path, path) == 0) {
+            hp->sites[i].samples += samples;
+            return 0;
+        }
+    }
+    if (hp->nsites >= hp->capacity) {
+        unsigned int capacity = hp->capacity ? hp->capacity * 2 : 64;
+        if ((sites = realloc(hp->sites, capacity * sizeof(*sites))) == NULL)
+            return -1;
+        hp->sites = sites;
+        hp->capacity = capacity;
+    }
+    if ((hp->sites[hp->nsites].path = strdup(path)) == NULL)
+        return -1;
+    hp->sites[hp->nsites].offset = offset;
+    hp->sites[hp->nsites].samples = samples;
+    hp->sites[hp->nsites].name = NULL;
+    ++hp->nsites;
+    return 0;
+}
+
+static int heapprof_cmp_site(const void * a, const void * b) {
+    const heapprof_site_t * sa = a, * sb = b;
+    return sa->samples > sb->samples ? -1 : (sa->samples < sb->samples ? 1 : 0);
+}
+
+/* 'function [object]', or '[object]+offset' if the object has no symbols */
+static void heapprof_site_name(const heapprof_site_t * site, int load, char * buf, size_t size) {
+    elf_symtab_t *  symtab = load ? elf_symtab_load(site->path) : NULL;
+    const char *    name = symtab != NULL ? elf_symtab_lookup(symtab, site->offset) : NULL;
+    const char *    base = strrchr(site->path, '/');
+
+    base = base != NULL ? base + 1 : site->path;
+    if (name != NULL)
+        snprintf(buf, size, "%s [%s]", name, base);
+    else
+        snprintf(buf, size, "[%s]+0x%llx", base, (unsigned long long) site->offset);
+    elf_symtab_free(symtab);
+}
+
+/* The site paths come from the records written by the program: the objects are
+ * opened with its identity, in a child, so that a privileged father never reads
+ * a file the program could not read itself. The child writes '<index>\t<name>\n'. */
+static void heapprof_symbolize(heapprof_t * hp, unsigned int count) {
+    char    buf[PATH_MAX + 256];
+    char *  s;
+    FILE *  in;
+    pid_t   pid;
+    int     fds[2], status;
+    unsigned int i;
+
+    if (geteuid() == hp->uid && getegid() == hp->gid) {
+        for (i = 0; i < count; ++i) {
+            heapprof_site_name(&hp->sites[i], 1, buf, sizeof(buf));
+            hp->sites[i].name = strdup(buf);
+        }
+        return ;
+    }
+    if (pipe(fds) != 0 || (pid = fork()) < 0) {
+        pid = -1;
+    } else if (pid == 0) {
+        FILE * out;
+
+        close(fds[0]);
+        if ((geteuid() == 0 && setgroups(0, NULL) != 0)
+        ||  setgid(hp->gid) != 0 || setuid(hp->uid) != 0
+        ||  (out = fdopen(fds[1], "w")) == NULL)
+            _exit(1);
+        for (i = 0; i < count; ++i) {
+            heapprof_site_name(&hp->sites[i], 1, buf, sizeof(buf));
+            fprintf(out, "%u\t%s\n", i, buf);
+        }
+        _exit(fclose(out) == 0 ? 0 : 1);
+    }
+    if (pid > 0) {
+        close(fds[1]);
+        if ((in = fdopen(fds[0], "r")) == NULL)
+            close(fds[0]);
+        while (in != NULL && fgets(buf, sizeof(buf), in) != NULL) {
+            if ((s = strchr(buf, '\n')) != NULL)
+                *s = 0;
+            if ((i = strtoul(buf, &s, 10)) < count && *s == '\t' && hp->sites[i].name == NULL)
+                hp->sites[i].name = strdup(s + 1);
+        }
+        if (in != NULL)
+            fclose(in);
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ; /* nothing */
+    }
+    /* sites the child could not name keep their offset */
+    for (i = 0; i < count; ++i) {
+        if (hp->sites[i].name == NULL) {
+            heapprof_site_name(&hp->sites[i], 0, buf, sizeof(buf));
+            hp->sites[i].name = strdup(buf);
+        }
+    }
+}
+
+int heapprof_read(heapprof_t * hp) {
+    char    line[PATH_MAX + 128];
+
+    if (hp == NULL || hp->records == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    rewind(hp->records);
+    while (fgets(line, sizeof(line), hp->records) != NULL) {
+        unsigned long long  v[HEAPPROF_NCALLS];
+        long long           peak, live;
+        int                 pid, pos = 0;
+        char *              s;
+
+        if ((s = strchr(line, '\n')) != NULL)
+            *s = 0;
+        if (sscanf(line, "calls %d %llu %llu %llu %llu %llu %llu", &pid,
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) == 1 + HEAPPROF_NCALLS) {
+            ++hp->nprocs;
+            for (unsigned int i = 0; i < HEAPPROF_NCALLS; ++i)
+                hp->calls[i] += v[i];
+        } else if (sscanf(line, "bytes %d %llu %llu %lld %lld", &pid, &v[0], &v[1], &peak, &live) == 5) {
+            hp->bytes += v[0];
+            hp->mmap_bytes += v[1];
+            if (peak > hp->peak) {
+                hp->peak = peak;
+                hp->peak_pid = pid;
+            }
+        } else if (sscanf(line, "classes %d %n", &pid, &pos) == 1 && pos > 0) {
+            s = line + pos;
+            for (unsigned int i = 0; i < HEAPPROF_CLASSES && *s; ++i)
+                hp->classes[i] += strtoull(s, &s, 10);
+        } else if (sscanf(line, "site %d %llu %llx %n", &pid, &v[0], &v[1], &pos) == 3 && pos > 0) {
+            if (heapprof_add_site(hp, line + pos, v[1], v[0]) != 0)
+                return -1;
+        } else if (sscanf(line, "samples %d %llu %llu", &pid, &v[0], &v[1]) == 3) {
+            hp->samples += v[0];
+            hp->sample_bytes = v[1];
+        }
+    }
+    qsort(hp->sites, hp->nsites, sizeof(*hp->sites), heapprof_cmp_site);
+    heapprof_symbolize(hp, hp->nsites < HEAPPROF_SITES ? hp->nsites : HEAPPROF_SITES);
+    return 0;
+}
+
+void heapprof_report(FILE * out, const heapprof_t * hp) {
+    fprintf(out, "heap     %13llu (bytes requested by %llu malloc, %llu calloc, %llu realloc, "
+                 "%llu free in %u processes)\n",
+            (unsigned long long) hp->bytes, (unsigned long long) hp->calls[HEAPPROF_MALLOC],
+            (unsigned long long) hp->calls[HEAPPROF_CALLOC], (unsigned long long) hp->calls[HEAPPROF_REALLOC],
+            (unsigned long long) hp->calls[HEAPPROF_FREE], hp->nprocs);
+    fprintf(out, "heappeak %13lld (peak live heap in bytes, process %d)\n", (long long) hp->peak, (int) hp->peak_pid);
+    fprintf(out, "mmap     %13llu (bytes mapped by %llu mmap, %llu munmap of the program)\n",
+            (unsigned long long) hp->mmap_bytes, (unsigned long long) hp->calls[HEAPPROF_MMAP],
+            (unsigned long long) hp->calls[HEAPPROF_MUNMAP]);
+    for (unsigned int i = 0; i < HEAPPROF_CLASSES; ++i) {
+        if (hp->classes[i] == 0)
+            continue ;
+        fprintf(out, "heapsize %13llu (allocations of %llu to %llu bytes)\n", (unsigned long long) hp->classes[i],
+                i == 0 ? 0ULL : 1ULL << i, (2ULL << i) - 1);
+    }
+    for (unsigned int i = 0; i < hp->nsites && i < HEAPPROF_SITES; ++i) {
+        fprintf(out, "heapsite %12.1f%% (%s, ~%llu bytes)\n",
+                hp->samples ? 100.0 * hp->sites[i].samples / hp->samples : 0.0,
+                hp->sites[i].name ? hp->sites[i].name : hp->sites[i].path,
+                (unsigned long long) (hp->sites[i].samples * hp->sample_bytes));
+    }
+}
+
+void heapprof_free(heapprof_t * hp) {
+    if (hp == NULL)
+        return ;
+    for (unsigned int i = 0; i < hp->nsites; ++i) {
+        free(hp->sites[i].path);
+        free(hp->sites[i].name);
+    }
+    free(hp->sites);
+    free(hp->preload);
+    if (hp->records != NULL)
+        fclose(hp->records);
+    hp->sites = NULL;
+    hp->preload = NULL;
+    hp->records = NULL;
+    hp->nsites = hp->capacity = 0;
+}
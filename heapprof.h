@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Heap allocations of a process tree, counted by the preload library
+ * (malloc/calloc/realloc/free/mmap) and written at exit of each process.
+ */
+#ifndef VRUNAS_HEAPPROF_H
+#define VRUNAS_HEAPPROF_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#define HEAPPROF_PRELOAD_LIB "libvrunas_heap.so" /* found as LDSTAT_PRELOAD_LIB */
+#define HEAPPROF_CLASSES    32      /* log2 of requested sizes, see preload/ */
+#define HEAPPROF_SITES      10      /* call sites listed by heapprof_report() */
+
+typedef enum {
+    HEAPPROF_MALLOC = 0,        /* malloc() and aligned allocations */
+    HEAPPROF_CALLOC,
+    HEAPPROF_REALLOC,
+    HEAPPROF_FREE,
+    HEAPPROF_MMAP,
+    HEAPPROF_MUNMAP,
+    HEAPPROF_NCALLS
+} heapprof_call_t;
+
+typedef struct {
+    char *              path;           /* object containing the call site */
+    uint64_t            offset;         /* file offset of the call */
+    uint64_t            samples;
+    char *              name;           /* symbol, set for the reported sites */
+} heapprof_site_t;
+
+typedef struct {
+    char *              preload;        /* path of the preload library */
+    FILE *              records;        /* written by each process of the tree at exit */
+    unsigned int        nprocs;
+    uint64_t            calls[HEAPPROF_NCALLS];
+    uint64_t            bytes;          /* requested */
+    uint64_t            mmap_bytes;
+    int64_t             peak;           /* peak live heap of the largest process */
+    pid_t               peak_pid;
+    uint64_t            classes[HEAPPROF_CLASSES];
+    uint64_t            samples;        /* all samples, including sites not reported */
+    uint64_t            sample_bytes;   /* sampling period */
+    heapprof_site_t *   sites;
+    unsigned int        nsites;
+    unsigned int        capacity;
+    uid_t               uid;            /* identity of the program, to symbolize sites */
+    gid_t               gid;
+} heapprof_t;
+
+#define HEAPPROF_INITIALIZER { NULL, NULL, 0, { 0, }, 0, 0, 0, 0, { 0, }, 0, 0, NULL, 0, 0, 0, 0 }
+
+/** heapprof_init() : find the preload library and create the records file inherited
+ * by the program. To be called before fork(), with the identity the program will run
+ * with: call sites are symbolized with it.
+ * @return 0 on success, -1 on error (errno set, ENOENT if preload library not found) */
+int heapprof_init(heapprof_t * hp, uid_t uid, gid_t gid);
+
+/** heapprof_child() : to be called by the child before execve(), after the identity
+ * switch: inject the preload library with LD_PRELOAD.
+ * @return 0 on success, -1 on error (errno set) */
+int heapprof_child(heapprof_t * hp);
+
+/** heapprof_read() : read the records of the processes once the program is terminated,
+ * written at exit() or _exit() (processes killed by a signal are missing),
+ * and symbolize the main call sites, in a child switched to the program identity
+ * if it is not the current one.
+ * @return 0 on success, -1 on error (errno set) */
+int heapprof_read(heapprof_t * hp);
+
+/** heapprof_report() : print allocation counts, bytes, peak live heap, size classes and
+ * call sites allocating most (extended timings format) */
+void heapprof_report(FILE * out, const heapprof_t * hp);
+
+/** heapprof_free() : release resources of hp (not hp itself) */
+void heapprof_free(heapprof_t * hp);
+
+#endif /* ! ifndef VRUNAS_HEAPPROF_H */
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Fingerprint of the host environment of a run: kernel, cpu model, microcode and
+ * topology, frequency scaling, transparent huge pages, clocksource, memory,
+ * NUMA nodes and versions, from linux /proc and sysfs.
+ */
+#include <sys/types.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "hostinfo.h"
+
+#define HOSTINFO_FNV_OFFSET 0xcbf29ce484222325ULL
+#define HOSTINFO_FNV_PRIME  0x100000001b3ULL
+#define HOSTINFO_MAX_NODES  64
+
+/* first line of path, without its newline. @return length or -1 */
+static ssize_t hostinfo_read(const char * path, char * buf, size_t size) {
+    ssize_t n;
+    int     fd;
+
+    buf[0] = 0;
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    buf[n > 0 ? n : 0] = 0;
+    buf[strcspn(buf, "\n")] = 0;
+    return n < 0 ? -1 : (ssize_t) strlen(buf);
+}
+
+static ssize_t hostinfo_sysfs(const char * sysfs, const char * file, char * buf, size_t size) {
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", sysfs, file);
+    return hostinfo_read(path, buf, size);
+}
+
+static long hostinfo_sysfs_long(const char * sysfs, const char * file, long def) {
+    char buf[64];
+    char * end;
+    long v;
+
+    if (hostinfo_sysfs(sysfs, file, buf, sizeof(buf)) <= 0)
+        return def;
+    v = strtol(buf, &end, 10);
+    return end != buf ? v : def;
+}
+
+/* value of a field 'name : value' of /proc/cpuinfo or /proc/meminfo */
+static void hostinfo_field(const char * buf, const char * name, char * value, size_t size) {
+    const char * s = buf;
+    size_t       len = strlen(name);
+
+    while ((s = strstr(s, name)) != NULL) {
+        if ((s == buf || s[-1] == '\n') && (s[len] == ' ' || s[len] == '\t' || s[len] == ':')) {
+            s += len + strspn(s + len, " \t:");
+            snprintf(value, size, "%.*s", (int) strcspn(s, "\n"), s);
+            return ;
+        }
+        s += len;
+    }
+}
+
+static void hostinfo_cpuinfo(hostinfo_t * hi) {
+    char    buf[16384];
+    char    mem[64] = "";
+    int     fd;
+    ssize_t n;
+
+    /* first cpu only */
+    if ((fd = open("/proc/cpuinfo", O_RDONLY | O_CLOEXEC)) >= 0) {
+        n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        buf[n > 0 ? n : 0] = 0;
+        hostinfo_field(buf, "model name", hi->cpumodel, sizeof(hi->cpumodel));
+        if (*hi->cpumodel == 0)
+            hostinfo_field(buf, "Hardware", hi->cpumodel, sizeof(hi->cpumodel));
+        hostinfo_field(buf, "microcode", hi->microcode, sizeof(hi->microcode));
+    }
+    /* MemTotal is the first line */
+    if (hostinfo_read("/proc/meminfo", buf, sizeof(buf)) > 0) {
+        hostinfo_field(buf, "MemTotal", mem, sizeof(mem));
+        hi->memory = strtoull(mem, NULL, 10) * 1024;
+    }
+}
+
+/* sockets, physical cores and threads per core from the topology of each cpu */
+static void hostinfo_topology(hostinfo_t * hi, const char * sysfs) {
+    long *  packages, * cores;
+    char    file[128];
+
+    hi->ncores = hi->nsockets = 0;
+    if ((packages = calloc(hi->ncpus, sizeof(*packages))) == NULL)
+        return ;
+    if ((cores = calloc(hi->ncpus, sizeof(*cores))) == NULL) {
+        free(packages);
+        return ;
+    }
+    for (int cpu = 0; cpu < hi->ncpus; ++cpu) {
+        long package, core;
+        int  known = 0, sameps = 0;
+
+        snprintf(file, sizeof(file), "devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        if ((package = hostinfo_sysfs_long(sysfs, file, -1)) < 0)
+            continue ;
+        snprintf(file, sizeof(file), "devices/system/cpu/cpu%d/topology/core_id", cpu);
+        core = hostinfo_sysfs_long(sysfs, file, cpu);
+        for (int i = 0; i < hi->ncores && !known; ++i)
+            known = packages[i] == package && cores[i] == core;
+        for (int i = 0; i < hi->ncores && !sameps; ++i)
+            sameps = packages[i] == package;
+        if (!sameps)
+            ++hi->nsockets;
+        if (!known) {
+            packages[hi->ncores] = package;
+            cores[hi->ncores++] = core;
+        }
+    }
+    free(packages);
+    free(cores);
+    hi->smt = hi->ncores > 0 ? (hi->ncpus + hi->ncores - 1) / hi->ncores : 0;
+}
+
+static void hostinfo_hash(uint64_t * h, const void * data, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        *h = (*h ^ ((const unsigned char *) data)[i]) * HOSTINFO_FNV_PRIME;
+}
+
+void hostinfo_collect(hostinfo_t * hi, const char * sysfs, const char * version) {
+    struct utsname  uts;
+    struct timespec res;
+    char            file[128], buf[256], * s, * e;
+    long            v;
+
+    memset(hi, 0, sizeof(*hi));
+    if (uname(&uts) == 0)
+        snprintf(hi->kernel, sizeof(hi->kernel), "%s %s %s", uts.sysname, uts.release, uts.machine);
+    snprintf(hi->version, sizeof(hi->version), "%.*s", (int) strcspn(version, "\n"), version);
+    hostinfo_cpuinfo(hi);
+    if ((hi->ncpus = sysconf(_SC_NPROCESSORS_CONF)) <= 0)
+        hi->ncpus = 1;
+    hostinfo_topology(hi, sysfs);
+    hi->nnodes = 1;
+    for (int node = 0; node < HOSTINFO_MAX_NODES; ++node) {
+        snprintf(file, sizeof(file), "devices/system/node/node%d/cpulist", node);
+        if (hostinfo_sysfs(sysfs, file, buf, sizeof(buf)) >= 0)
+            hi->nnodes = node + 1;
+    }
+
+    /* frequency scaling of cpu0 */
+    hostinfo_sysfs(sysfs, "devices/system/cpu/cpu0/cpufreq/scaling_driver", hi->driver, sizeof(hi->driver));
+    hostinfo_sysfs(sysfs, "devices/system/cpu/cpu0/cpufreq/scaling_governor", hi->governor, sizeof(hi->governor));
+    hi->freq[0] = hostinfo_sysfs_long(sysfs, "devices/system/cpu/cpu0/cpufreq/scaling_cur_freq", 0);
+    hi->freq[1] = hostinfo_sysfs_long(sysfs, "devices/system/cpu/cpu0/cpufreq/scaling_min_freq", 0);
+    hi->freq[2] = hostinfo_sysfs_long(sysfs, "devices/system/cpu/cpu0/cpufreq/scaling_max_freq", 0);
+    if ((v = hostinfo_sysfs_long(sysfs, "devices/system/cpu/intel_pstate/no_turbo", -1)) >= 0)
+        hi->turbo = !v;
+    else if ((v = hostinfo_sysfs_long(sysfs, "devices/system/cpu/cpufreq/boost", -1)) >= 0)
+        hi->turbo = v > 0;
+    else
+        hi->turbo = -1;
+
+    /* selected mode between brackets: 'always [madvise] never' */
+    if (hostinfo_sysfs(sysfs, "kernel/mm/transparent_hugepage/enabled", buf, sizeof(buf)) > 0
+    &&  (s = strchr(buf, '[')) != NULL && (e = strchr(s, ']')) != NULL)
+        snprintf(hi->thp, sizeof(hi->thp), "%.*s", (int) (e - s - 1), s + 1);
+    hostinfo_sysfs(sysfs, "devices/system/clocksource/clocksource0/current_clocksource",
+                   hi->clocksource, sizeof(hi->clocksource));
+    if (clock_getres(CLOCK_MONOTONIC, &res) == 0)
+        hi->resolution = res.tv_sec * 1000000000L + res.tv_nsec;
+
+    /* environments are comparable whatever the current frequency */
+    hi->id = HOSTINFO_FNV_OFFSET;
+    hostinfo_hash(&hi->id, hi->kernel, strlen(hi->kernel));
+    hostinfo_hash(&hi->id, hi->cpumodel, strlen(hi->cpumodel));
+    hostinfo_hash(&hi->id, hi->microcode, strlen(hi->microcode));
+    hostinfo_hash(&hi->id, &hi->ncpus, offsetof(hostinfo_t, driver) - offsetof(hostinfo_t, ncpus));
+    hostinfo_hash(&hi->id, hi->driver, strlen(hi->driver));
+    hostinfo_hash(&hi->id, hi->governor, strlen(hi->governor));
+    hostinfo_hash(&hi->id, &hi->freq[1], sizeof(hi->freq) - sizeof(*hi->freq));
+    hostinfo_hash(&hi->id, &hi->turbo, sizeof(hi->turbo));
+    hostinfo_hash(&hi->id, hi->thp, strlen(hi->thp));
+    hostinfo_hash(&hi->id, hi->clocksource, strlen(hi->clocksource));
+    hostinfo_hash(&hi->id, &hi->resolution, sizeof(hi->resolution));
+    hostinfo_hash(&hi->id, hi->version, strlen(hi->version));
+}
+
+static const char * hostinfo_str(const char * s) {
+    return *s != 0 ? s : "unknown";
+}
+
+void hostinfo_report(FILE * out, const hostinfo_t * hi) {
+    fprintf(out, "host     %016llx (fingerprint of the environment of the run: %s, %s)\n"
+                 "hostcpu  %13d (cpus of %s, microcode %s, %d socket%s, %d core%s, %d threads per core, "
+                                  "%d numa node%s, %llu bytes of memory)\n",
+            (unsigned long long) hi->id, hostinfo_str(hi->kernel), hostinfo_str(hi->version),
+            hi->ncpus, hostinfo_str(hi->cpumodel), hostinfo_str(hi->microcode),
+            hi->nsockets, hi->nsockets > 1 ? "s" : "", hi->ncores, hi->ncores > 1 ? "s" : "", hi->smt,
+            hi->nnodes, hi->nnodes > 1 ? "s" : "", (unsigned long long) hi->memory);
+    if (*hi->driver != 0) {
+        fprintf(out, "hostfreq %13lu (kHz of cpu0 at start, min %lu, max %lu, %s governor %s, turbo %s)\n",
+                hi->freq[0], hi->freq[1], hi->freq[2], hi->driver, hostinfo_str(hi->governor),
+                hi->turbo > 0 ? "on" : hi->turbo == 0 ? "off" : "unknown");
+    } else {
+        fprintf(out, "hostfreq %13lu (kHz of cpu0 at start, no cpufreq driver, turbo %s)\n",
+                hi->freq[0], hi->turbo > 0 ? "on" : hi->turbo == 0 ? "off" : "unknown");
+    }
+    fprintf(out, "hostclk  %13ld (nanoseconds of resolution of CLOCK_MONOTONIC, clocksource %s, "
+                                  "transparent huge pages %s)\n",
+            hi->resolution, hostinfo_str(hi->clocksource), hostinfo_str(hi->thp));
+}
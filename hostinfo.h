@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Fingerprint of the host environment of a run: kernel, cpu model, microcode and
+ * topology, frequency scaling, transparent huge pages, clocksource, memory,
+ * NUMA nodes and versions, from linux /proc and sysfs.
+ */
+#ifndef VRUNAS_HOSTINFO_H
+#define VRUNAS_HOSTINFO_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define HOSTINFO_STR_MAX    128
+
+typedef struct {
+    char                kernel[2 * HOSTINFO_STR_MAX];   /* sysname release machine */
+    char                cpumodel[HOSTINFO_STR_MAX];
+    char                microcode[32];
+    int                 ncpus;
+    int                 ncores;                         /* physical cores */
+    int                 nsockets;
+    int                 smt;                            /* threads per core */
+    int                 nnodes;
+    uint64_t            memory;                         /* bytes */
+    char                driver[32];                     /* cpufreq of cpu0, empty if none */
+    char                governor[32];
+    unsigned long       freq[3];                        /* current, min, max (kHz) */
+    int                 turbo;                          /* 1 on, 0 off, -1 unknown */
+    char                thp[16];                        /* transparent huge pages mode */
+    char                clocksource[32];
+    long                resolution;                     /* of CLOCK_MONOTONIC (ns) */
+    char                version[HOSTINFO_STR_MAX];      /* of vrunas and vlib */
+    uint64_t            id;                             /* hash of the fields but the current frequency */
+} hostinfo_t;
+
+#define HOSTINFO_INITIALIZER { "", "", "", 0, 0, 0, 0, 0, 0, "", "", { 0, 0, 0 }, -1, "", "", 0, "", 0 }
+
+/** hostinfo_collect() : read the fingerprint of the host, unknown fields being
+ * empty or zero.
+ * @param sysfs root of sysfs ("/sys" or a fake tree)
+ * @param version of vrunas and vlib, first line only is kept */
+void hostinfo_collect(hostinfo_t * hi, const char * sysfs, const char * version);
+
+/** hostinfo_report() : print the fingerprint (extended timings format) */
+void hostinfo_report(FILE * out, const hostinfo_t * hi);
+
+#endif /* ! ifndef VRUNAS_HOSTINFO_H */
@@ -0,0 +1,724 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * File access profiling of a process tree, prefetch list generation and replay.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <errno.h>
+
+#ifdef __linux__
+# include <sys/fanotify.h>
+#endif
+
+#include "vlib/time.h"
+
+#include "iotrace.h"
+#include "ptracer.h"
+#include "pagecache.h"
+#include "proctree.h"
+
+#ifndef PATH_MAX
+# define PATH_MAX 4096
+#endif
+
+#define IOT_PAGESZ          4096    /* ranges are aligned on this size */
+#define IOT_MAX_THREADS     16      /* maximum prefetch threads */
+#define IOT_POLL_MS         10      /* child exit polling when pidfd is not available */
+#define IOT_LIST_HEADER     "# vrunas prefetch list: <offset>+<length>[,...] <path>\n"
+
+/* ************************************************************************ */
+/* files and ranges                                                          */
+/* ************************************************************************ */
+
+static int iotrace_get_file(iotrace_t * iot, const char * path) {
+    iotrace_file_t * files;
+
+    /* search from the end, most recent files are the most used */
+    for (unsigned int i = iot->count; i > 0; --i) {
+        if (strcmp(iot->files[i - 1].path, path) == 0)
+            return i - 1;
+    }
+    if (iot->count >= iot->capacity) {
+        unsigned int capacity = iot->capacity ? iot->capacity * 2 : 64;
+        if ((files = realloc(iot->files, capacity * sizeof(*files))) == NULL)
+            return -1;
+        iot->files = files;
+        iot->capacity = capacity;
+    }
+    memset(&iot->files[iot->count], 0, sizeof(*iot->files));
+    if ((iot->files[iot->count].path = strdup(path)) == NULL)
+        return -1;
+    return iot->count++;
+}
+
+static int iotrace_add_range(iotrace_file_t * file, uint64_t offset, uint64_t length) {
+    uint64_t        end = offset + length;
+    unsigned int    i, j;
+
+    if (length == 0)
+        return 0;
+    offset -= offset % IOT_PAGESZ;
+    end += (IOT_PAGESZ - end % IOT_PAGESZ) % IOT_PAGESZ;
+
+    /* first range ending at or after offset, then the ones overlapping or adjacent are merged */
+    for (i = 0; i < file->nranges && file->ranges[i].offset + file->ranges[i].length < offset; ++i)
+        ; /* nothing */
+    for (j = i; j < file->nranges && file->ranges[j].offset <= end; ++j) {
+        if (file->ranges[j].offset < offset)
+            offset = file->ranges[j].offset;
+        if (file->ranges[j].offset + file->ranges[j].length > end)
+            end = file->ranges[j].offset + file->ranges[j].length;
+    }
+    if (j == i) {
+        /* no merge: insert a new range at i */
+        if (file->nranges >= file->capacity) {
+            unsigned int        capacity = file->capacity ? file->capacity * 2 : 8;
+            iotrace_range_t *   ranges;
+            if ((ranges = realloc(file->ranges, capacity * sizeof(*ranges))) == NULL)
+                return -1;
+            file->ranges = ranges;
+            file->capacity = capacity;
+        }
+        memmove(&file->ranges[i + 1], &file->ranges[i], (file->nranges - i) * sizeof(*file->ranges));
+        ++file->nranges;
+    } else if (j > i + 1) {
+        /* ranges i to j-1 are merged in i */
+        memmove(&file->ranges[i + 1], &file->ranges[j], (file->nranges - j) * sizeof(*file->ranges));
+        file->nranges -= j - i - 1;
+    }
+    file->ranges[i].offset = offset;
+    file->ranges[i].length = end - offset;
+    return 0;
+}
+
+static int iotrace_add_resident_range(off_t offset, off_t length, void * user_data) {
+    return iotrace_add_range((iotrace_file_t *) user_data, offset, length);
+}
+
+/* ************************************************************************ */
+/* ptrace method                                                             */
+/* ************************************************************************ */
+#ifdef __linux__
+
+static iotrace_fd_t * iotrace_get_fd(iotrace_t * iot, pid_t tid, pid_t tgid, int fd) {
+    iotrace_fd_t *  fds;
+    char            path[64];
+    char            target[PATH_MAX];
+    struct stat     st;
+    ssize_t         len;
+
+    for (unsigned int i = 0; i < iot->nfds; ++i) {
+        if (iot->fds[i].tgid == tgid && iot->fds[i].fd == fd)
+            return &iot->fds[i];
+    }
+    if (iot->nfds >= iot->fdcapacity) {
+        unsigned int capacity = iot->fdcapacity ? iot->fdcapacity * 2 : 64;
+        if ((fds = realloc(iot->fds, capacity * sizeof(*fds))) == NULL)
+            return NULL;
+        iot->fds = fds;
+        iot->fdcapacity = capacity;
+    }
+    fds = &iot->fds[iot->nfds++];
+    fds->tgid = tgid;
+    fds->fd = fd;
+    fds->file = -1;
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int) tid, fd);
+    if ((len = readlink(path, target, sizeof(target) - 1)) > 0 && *target == '/'
+    &&  stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        target[len] = 0;
+        fds->file = iotrace_get_file(iot, target);
+    }
+    return fds;
+}
+
+static void iotrace_del_fd(iotrace_t * iot, pid_t tgid, int fd) {
+    for (unsigned int i = 0; i < iot->nfds; ++i) {
+        if (iot->fds[i].tgid == tgid && (fd < 0 || iot->fds[i].fd == fd)) {
+            iot->fds[i--] = iot->fds[--iot->nfds];
+        }
+    }
+}
+
+/* file position of fd after the syscall, read in /proc/<tid>/fdinfo/<fd> */
+static int iotrace_get_pos(pid_t tid, int fd, uint64_t * pos) {
+    char    path[64];
+    char    line[128];
+    FILE *  f;
+    int     ret = -1;
+
+    snprintf(path, sizeof(path), "/proc/%d/fdinfo/%d", (int) tid, fd);
+    if ((f = fopen(path, "r")) == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "pos:", 4) == 0) {
+            *pos = strtoull(line + 4, NULL, 10);
+            ret = 0;
+            break ;
+        }
+    }
+    fclose(f);
+    return ret;
+}
+
+static void iotrace_read(iotrace_t * iot, const ptracer_syscall_t * sc, int64_t offset) {
+    iotrace_fd_t *  fd;
+    uint64_t        pos;
+
+    if ((fd = iotrace_get_fd(iot, sc->tid, sc->tgid, (int) sc->args[0])) == NULL || fd->file < 0)
+        return ;
+    if (offset < 0) {
+        /* read at current position, which is now after the bytes read */
+        if (iotrace_get_pos(sc->tid, fd->fd, &pos) != 0 || pos < (uint64_t) sc->ret)
+            return ;
+        offset = pos - sc->ret;
+    }
+    iot->bytes += sc->ret;
+    iotrace_add_range(&iot->files[fd->file], offset, sc->ret);
+}
+
+/* program and interpreter are mapped by the kernel on execve(), get them from /proc/<tid>/maps */
+static void iotrace_exec_maps(iotrace_t * iot, pid_t tid) {
+    char    path[64];
+    char    line[PATH_MAX + 128];
+    FILE *  f;
+
+    snprintf(path, sizeof(path), "/proc/%d/maps", (int) tid);
+    if ((f = fopen(path, "r")) == NULL)
+        return ;
+    /* start-end perms offset dev inode path */
+    while (fgets(line, sizeof(line), f) != NULL) {
+        unsigned long long  start, end, offset, inode;
+        int                 n = 0, i;
+        size_t              len;
+
+        if (sscanf(line, "%llx-%llx %*s %llx %*s %llu %n", &start, &end, &offset, &inode, &n) < 4
+        ||  inode == 0 || n == 0 || line[n] != '/')
+            continue ;
+        if ((len = strlen(line + n)) > 0 && line[n + len - 1] == '\n')
+            line[n + len - 1] = 0;
+        if ((i = iotrace_get_file(iot, line + n)) >= 0)
+            iotrace_add_range(&iot->files[i], offset, end - start);
+    }
+    fclose(f);
+}
+
+static void iotrace_syscall(const ptracer_syscall_t * sc, void * user_data) {
+    iotrace_t * iot = (iotrace_t *) user_data;
+    long        nr = sc->nr;
+
+    ++iot->nevents;
+    if (sc->is_error) {
+        return ;
+    }
+    if (0
+#   ifdef SYS_open
+        || nr == SYS_open
+#   endif
+#   ifdef SYS_creat
+        || nr == SYS_creat
+#   endif
+#   ifdef SYS_openat2
+        || nr == SYS_openat2
+#   endif
+        || nr == SYS_openat) {
+        iotrace_fd_t * fd;
+        iotrace_del_fd(iot, sc->tgid, (int) sc->ret);
+        /* files opened without being read are kept in list */
+        fd = iotrace_get_fd(iot, sc->tid, sc->tgid, (int) sc->ret);
+        (void) fd;
+    } else if (nr == SYS_close) {
+        iotrace_del_fd(iot, sc->tgid, (int) sc->args[0]);
+    } else if (nr == SYS_dup || nr == SYS_dup3 || nr == SYS_fcntl
+#   ifdef SYS_dup2
+               || nr == SYS_dup2
+#   endif
+               ) {
+        /* fcntl returns fd only for F_DUPFD*, otherwise ret is 0 or a value to ignore */
+        if (nr != SYS_fcntl || sc->args[1] == F_DUPFD || sc->args[1] == F_DUPFD_CLOEXEC)
+            iotrace_del_fd(iot, sc->tgid, (int) sc->ret);
+    } else if (nr == SYS_execve
+#   ifdef SYS_execveat
+               || nr == SYS_execveat
+#   endif
+               ) {
+        /* O_CLOEXEC fds are closed, forget all fds of the process */
+        iotrace_del_fd(iot, sc->tgid, -1);
+        iotrace_exec_maps(iot, sc->tid);
+    } else if (sc->ret > 0 && (nr == SYS_read || nr == SYS_readv)) {
+        iotrace_read(iot, sc, -1);
+    } else if (sc->ret > 0 && (nr == SYS_pread64 || nr == SYS_preadv)) {
+        iotrace_read(iot, sc, (int64_t) sc->args[3]);
+#   ifdef SYS_preadv2
+    } else if (sc->ret > 0 && nr == SYS_preadv2) {
+        iotrace_read(iot, sc, (int64_t) sc->args[3]);
+#   endif
+#   ifdef SYS_mmap
+    } else if (nr == SYS_mmap && (int) sc->args[4] >= 0 && (sc->args[3] & MAP_ANONYMOUS) == 0) {
+        iotrace_fd_t * fd = iotrace_get_fd(iot, sc->tid, sc->tgid, (int) sc->args[4]);
+        if (fd != NULL && fd->file >= 0)
+            iotrace_add_range(&iot->files[fd->file], sc->args[5], sc->args[1]);
+#   endif
+    }
+}
+
+/* ************************************************************************ */
+/* fanotify method                                                           */
+/* ************************************************************************ */
+
+/* filesystems without files worth to be prefetched */
+static const char * const s_iot_pseudofs[] = {
+    "proc", "sysfs", "cgroup", "cgroup2", "devpts", "devtmpfs", "debugfs", "tracefs", "securityfs",
+    "pstore", "bpf", "mqueue", "hugetlbfs", "configfs", "fusectl", "autofs", "binfmt_misc",
+    "efivarfs", "nsfs", "rpc_pipefs", NULL
+};
+
+static int iotrace_fanotify_init(iotrace_t * iot) {
+    char    line[PATH_MAX * 2];
+    FILE *  f;
+    int     nmarks = 0;
+
+    if ((iot->fanfd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK,
+                                    O_RDONLY | O_LARGEFILE | O_CLOEXEC)) < 0)
+        return -1;
+    if ((f = fopen("/proc/self/mountinfo", "r")) == NULL)
+        return -1;
+    /* mountinfo: id parent maj:min root mountpoint options [optional...] - fstype source opts */
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char    mnt[PATH_MAX];
+        char *  fstype;
+        char *  s;
+        int     i, j, pseudo = 0;
+
+        if ((fstype = strstr(line, " - ")) == NULL)
+            continue ;
+        fstype += 3;
+        for (i = 0; s_iot_pseudofs[i] != NULL; ++i) {
+            size_t len = strlen(s_iot_pseudofs[i]);
+            if (strncmp(fstype, s_iot_pseudofs[i], len) == 0 && fstype[len] == ' ')
+                pseudo = 1;
+        }
+        if (pseudo)
+            continue ;
+        for (s = line, i = 0; i < 4 && (s = strchr(s, ' ')) != NULL; ++i)
+            ++s;
+        if (s == NULL)
+            continue ;
+        /* unescape octal sequences (\040 for space, ...) */
+        for (i = j = 0; s[i] && s[i] != ' ' && j < (int) sizeof(mnt) - 1; ++j) {
+            if (s[i] == '\\' && s[i+1] >= '0' && s[i+1] <= '3') {
+                mnt[j] = (char) strtol((char[]) { s[i+1], s[i+2], s[i+3], 0 }, NULL, 8);
+                i += 4;
+            } else {
+                mnt[j] = s[i++];
+            }
+        }
+        mnt[j] = 0;
+        if (fanotify_mark(iot->fanfd, FAN_MARK_ADD | FAN_MARK_MOUNT, FAN_OPEN, AT_FDCWD, mnt) == 0)
+            ++nmarks;
+    }
+    fclose(f);
+    if (nmarks == 0) {
+        close(iot->fanfd);
+        iot->fanfd = -1;
+        errno = ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+static void iotrace_fanotify_read(iotrace_t * iot) {
+    char    buf[8192] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+    ssize_t len;
+    pid_t   self = getpid();
+
+    while ((len = read(iot->fanfd, buf, sizeof(buf))) > 0) {
+        struct fanotify_event_metadata * ev = (struct fanotify_event_metadata *) buf;
+
+        for ( ; FAN_EVENT_OK(ev, len); ev = FAN_EVENT_NEXT(ev, len)) {
+            char        path[64];
+            char        target[PATH_MAX];
+            struct stat st;
+            ssize_t     n;
+            int         in_tree;
+
+            if (ev->vers != FANOTIFY_METADATA_VERSION)
+                break ;
+            ++iot->nevents;
+            if (ev->fd < 0) {
+                ++iot->ndropped; /* queue overflow */
+                continue ;
+            }
+            if (ev->pid != self && (in_tree = proctree_contains(&iot->tree, ev->pid)) != 0) {
+                if (in_tree < 0) {
+                    ++iot->ndropped;
+                } else if (fstat(ev->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                    snprintf(path, sizeof(path), "/proc/self/fd/%d", ev->fd);
+                    if ((n = readlink(path, target, sizeof(target) - 1)) > 0) {
+                        target[n] = 0;
+                        iotrace_get_file(iot, target);
+                    }
+                }
+            }
+            close(ev->fd);
+        }
+    }
+}
+
+static int iotrace_fanotify_wait(iotrace_t * iot, pid_t pid) {
+    struct pollfd   pfd[2];
+    int             nfds = 1;
+    int             ret = 0;
+
+    pfd[0].fd = iot->fanfd;
+    pfd[0].events = POLLIN;
+#   ifdef SYS_pidfd_open
+    if ((pfd[1].fd = syscall(SYS_pidfd_open, pid, 0)) >= 0) {
+        pfd[1].events = POLLIN;
+        ++nfds;
+    }
+#   endif
+    proctree_add(&iot->tree, pid);
+    while (1) {
+        siginfo_t si;
+
+        if (poll(pfd, nfds, nfds > 1 ? -1 : IOT_POLL_MS) < 0 && errno != EINTR) {
+            ret = -1;
+            break ;
+        }
+        /* terminated, not reaped */
+        memset(&si, 0, sizeof(si));
+        if (waitid(P_PID, pid, &si, WEXITED | WNOHANG | WNOWAIT) == 0) {
+            if (si.si_pid == pid)
+                break ;
+        } else if (errno != EINTR) {
+            ret = -1;
+            break ;
+        }
+        if ((pfd[0].revents & POLLIN) != 0)
+            iotrace_fanotify_read(iot);
+    }
+    if (nfds > 1)
+        close(pfd[1].fd);
+    iotrace_fanotify_read(iot);
+    close(iot->fanfd);
+    iot->fanfd = -1;
+
+    /* ranges are the pages of opened files which are resident at the end of run */
+    for (unsigned int i = 0; i < iot->count; ++i) {
+        int fd;
+        if ((fd = open(iot->files[i].path, O_RDONLY)) >= 0) {
+            pagecache_fd_residency(fd, 0, 0, NULL, NULL, iotrace_add_resident_range, &iot->files[i]);
+            close(fd);
+        }
+    }
+    return ret;
+}
+#endif /* __linux__ */
+
+/* ************************************************************************ */
+/* profiling                                                                 */
+/* ************************************************************************ */
+
+int iotrace_init(iotrace_t * iot) {
+    if (iot == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+#   ifdef __linux__
+    if (geteuid() == 0 && iotrace_fanotify_init(iot) == 0) {
+        iot->method = IOT_FANOTIFY;
+        return 0;
+    }
+    iot->method = IOT_PTRACE;
+    return 0;
+#   else
+    errno = ENOSYS;
+    return -1;
+#   endif
+}
+
+int iotrace_child(iotrace_t * iot) {
+    if (iot == NULL)
+        return 0;
+    if (iot->fanfd >= 0) {
+        close(iot->fanfd);
+        iot->fanfd = -1;
+    }
+    if (iot->method == IOT_PTRACE)
+        return ptracer_child_init();
+    return 0;
+}
+
+int iotrace_wait(iotrace_t * iot, pid_t pid) {
+#   ifdef __linux__
+    if (iot->method == IOT_FANOTIFY)
+        return iotrace_fanotify_wait(iot, pid);
+    if (iot->method == IOT_PTRACE)
+        return ptracer_run(pid, iotrace_syscall, iot);
+#   else
+    (void) iot;
+    (void) pid;
+#   endif
+    errno = ECHILD;
+    return -1;
+}
+
+int iotrace_write(iotrace_t * iot) {
+    char *  tmp;
+    FILE *  f;
+    int     fd, ret, errno_bak;
+    size_t  size;
+
+    if (iot == NULL || iot->listfile == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* a new file (O_EXCL) renamed to listfile, as a symlink or a file there is not followed */
+    size = strlen(iot->listfile) + 32;
+    if ((tmp = malloc(size)) == NULL)
+        return -1;
+    snprintf(tmp, size, "%s.XXXXXX", iot->listfile);
+    if ((fd = mkstemp(tmp)) < 0) {
+        free(tmp);
+        return -1;
+    }
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) != 0 || fchmod(fd, S_IWUSR | S_IRUSR | S_IRGRP) != 0
+    ||  (f = fdopen(fd, "w")) == NULL) {
+        errno_bak = errno;
+        close(fd);
+        unlink(tmp);
+        free(tmp);
+        errno = errno_bak;
+        return -1;
+    }
+    fprintf(f, IOT_LIST_HEADER);
+    for (unsigned int i = 0; i < iot->count; ++i) {
+        const iotrace_file_t * file = &iot->files[i];
+
+        if (strchr(file->path, '\n') != NULL)
+            continue ;
+        if (file->nranges == 0)
+            fputc('-', f);
+        for (unsigned int r = 0; r < file->nranges; ++r) {
+            fprintf(f, "%s%llu+%llu", r ? "," : "", (unsigned long long) file->ranges[r].offset,
+                    (unsigned long long) file->ranges[r].length);
+        }
+        fprintf(f, " %s\n", file->path);
+    }
+    ret = fflush(f) != 0 || ferror(f) ? -1 : 0;
+    errno_bak = errno;
+    if (fclose(f) != 0 && ret == 0 && (ret = -1))
+        errno_bak = errno;
+    if (ret == 0 && rename(tmp, iot->listfile) != 0 && (ret = -1))
+        errno_bak = errno;
+    if (ret != 0)
+        unlink(tmp);
+    free(tmp);
+    errno = errno_bak;
+    return ret;
+}
+
+void iotrace_report(FILE * out, const iotrace_t * iot) {
+    uint64_t        bytes = 0;
+    unsigned int    nranges = 0;
+
+    if (out == NULL || iot == NULL)
+        return ;
+    for (unsigned int i = 0; i < iot->count; ++i) {
+        nranges += iot->files[i].nranges;
+        for (unsigned int r = 0; r < iot->files[i].nranges; ++r)
+            bytes += iot->files[i].ranges[r].length;
+    }
+    fprintf(out, "iofiles  %13u (files opened by the process tree, recorded with %s)\n", iot->count,
+            iot->method == IOT_FANOTIFY ? "fanotify" : "ptrace");
+    fprintf(out, "ioranges %13u (page aligned ranges %s)\n", nranges,
+            iot->method == IOT_FANOTIFY ? "of opened files resident in page cache at end of run"
+                                        : "of opened files read or mapped");
+    fprintf(out, "iobytes  %13llu (bytes in ranges, prefetch list '%s')\n", (unsigned long long) bytes,
+            iot->listfile ? iot->listfile : "");
+    if (iot->method == IOT_PTRACE)
+        fprintf(out, "ioread   %13llu (bytes read by read/pread/readv syscalls on regular files)\n",
+                (unsigned long long) iot->bytes);
+    fprintf(out, "ioevents %13lu (%s handled, %lu dropped)\n", iot->nevents,
+            iot->method == IOT_FANOTIFY ? "fanotify events" : "syscalls", iot->ndropped);
+}
+
+void iotrace_free(iotrace_t * iot) {
+    if (iot == NULL)
+        return ;
+    for (unsigned int i = 0; i < iot->count; ++i) {
+        free(iot->files[i].path);
+        free(iot->files[i].ranges);
+    }
+    free(iot->files);
+    free(iot->fds);
+    proctree_free(&iot->tree);
+    if (iot->fanfd >= 0)
+        close(iot->fanfd);
+    iot->files = NULL;
+    iot->fds = NULL;
+    iot->fanfd = -1;
+    iot->count = iot->capacity = iot->nfds = iot->fdcapacity = 0;
+}
+
+/* ************************************************************************ */
+/* prefetch                                                                  */
+/* ************************************************************************ */
+
+typedef struct {
+    iotrace_t               list;
+    unsigned int            next;
+    pthread_mutex_t         lock;
+    iotrace_prefetch_t *    stats;
+} iotrace_prefetch_ctx_t;
+
+static int iotrace_read_list(const char * listfile, iotrace_t * iot) {
+    char *  line = NULL;
+    size_t  size = 0;
+    ssize_t len;
+    FILE *  f;
+
+    if ((f = fopen(listfile, "r")) == NULL)
+        return -1;
+    while ((len = getline(&line, &size, f)) > 0) {
+        char *  path;
+        char *  s;
+        int     i;
+
+        if (line[len - 1] == '\n')
+            line[--len] = 0;
+        if (*line == '#' || *line == 0 || (path = strchr(line, ' ')) == NULL)
+            continue ;
+        *path++ = 0;
+        if ((i = iotrace_get_file(iot, path)) < 0) {
+            free(line);
+            fclose(f);
+            return -1;
+        }
+        for (s = line; *s && *s != '-'; ) {
+            uint64_t offset, length;
+            offset = strtoull(s, &s, 10);
+            if (*s++ != '+')
+                break ;
+            length = strtoull(s, &s, 10);
+            iotrace_add_range(&iot->files[i], offset, length);
+            if (*s == ',')
+                ++s;
+        }
+    }
+    free(line);
+    fclose(f);
+    return 0;
+}
+
+static void * iotrace_prefetch_thread(void * data) {
+    iotrace_prefetch_ctx_t * ctx = (iotrace_prefetch_ctx_t *) data;
+
+    while (1) {
+        iotrace_file_t *    file;
+        uint64_t            bytes = 0;
+        unsigned int        errors = 0;
+        unsigned int        i;
+        int                 fd;
+
+        pthread_mutex_lock(&ctx->lock);
+        i = ctx->next++;
+        pthread_mutex_unlock(&ctx->lock);
+        if (i >= ctx->list.count)
+            break ;
+        file = &ctx->list.files[i];
+        /* opening the file is enough to warm its inode when no range is known */
+        if ((fd = open(file->path, O_RDONLY)) < 0) {
+            ++errors;
+        } else {
+            for (unsigned int r = 0; r < file->nranges; ++r) {
+                if (pagecache_load_range(fd, file->ranges[r].offset, file->ranges[r].length) == 0)
+                    bytes += file->ranges[r].length;
+                else
+                    ++errors;
+            }
+            close(fd);
+        }
+        pthread_mutex_lock(&ctx->lock);
+        ctx->stats->bytes += bytes;
+        ctx->stats->errors += errors;
+        ctx->stats->ranges += file->nranges;
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    return NULL;
+}
+
+int iotrace_prefetch(const char * listfile, iotrace_prefetch_t * stats) {
+    iotrace_prefetch_ctx_t  ctx = { .list = IOTRACE_INITIALIZER, .next = 0, .stats = stats };
+    pthread_t               threads[IOT_MAX_THREADS];
+    struct timespec         ts0, ts1;
+    long                    ncpus;
+    unsigned int            nthreads = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    vclock_gettime(CLOCK_MONOTONIC, &ts0);
+    if (iotrace_read_list(listfile, &ctx.list) != 0) {
+        int errno_bak = errno;
+        iotrace_free(&ctx.list);
+        errno = errno_bak;
+        return -1;
+    }
+    pthread_mutex_init(&ctx.lock, NULL);
+    if ((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        ncpus = 1;
+    /* readahead() can block on I/O submission: use more threads than cpus */
+    while (nthreads < ctx.list.count && nthreads < ncpus * 2 && nthreads < IOT_MAX_THREADS
+           && pthread_create(&threads[nthreads], NULL, iotrace_prefetch_thread, &ctx) == 0) {
+        ++nthreads;
+    }
+    if (nthreads == 0)
+        iotrace_prefetch_thread(&ctx);
+    for (unsigned int i = 0; i < nthreads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&ctx.lock);
+    stats->files = ctx.list.count;
+    stats->threads = nthreads;
+    iotrace_free(&ctx.list);
+    vclock_gettime(CLOCK_MONOTONIC, &ts1);
+    vtimespecsub(&ts1, &ts0, &stats->duration);
+    return 0;
+}
+
+void iotrace_prefetch_report(FILE * out, const char * listfile, const iotrace_prefetch_t * stats) {
+    if (out == NULL || stats == NULL)
+        return ;
+    fprintf(out, "prefetch % 3ld.%09ld (time spent to prefetch list '%s' before run)\n",
+            (long) stats->duration.tv_sec, (long) stats->duration.tv_nsec, listfile ? listfile : "");
+    fprintf(out, "prefetch %13u (files prefetched by %u threads, %u ranges, %u errors)\n",
+            stats->files, stats->threads, stats->ranges, stats->errors);
+    fprintf(out, "prefetch %13llu (bytes loaded in page cache)\n", (unsigned long long) stats->bytes);
+}
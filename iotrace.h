@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * File access profiling of a process tree, prefetch list generation and replay.
+ */
+#ifndef VRUNAS_IOTRACE_H
+#define VRUNAS_IOTRACE_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "proctree.h"
+
+typedef enum {
+    IOT_NONE = 0,
+    IOT_FANOTIFY,               /* root: files opened, ranges resident at end of run */
+    IOT_PTRACE,                 /* syscall tracing: files opened, exact ranges read */
+} iotrace_method_t;
+
+typedef struct {
+    uint64_t            offset;
+    uint64_t            length;
+} iotrace_range_t;
+
+typedef struct {
+    char *              path;
+    iotrace_range_t *   ranges;     /* sorted, merged, page aligned */
+    unsigned int        nranges;
+    unsigned int        capacity;
+} iotrace_file_t;
+
+typedef struct {
+    int                 tgid;
+    int                 fd;
+    int                 file;       /* index in files, -1 if not a regular file */
+} iotrace_fd_t;
+
+typedef struct {
+    const char *        listfile;   /* prefetch list written at end of run */
+    iotrace_method_t    method;
+    iotrace_file_t *    files;
+    unsigned int        count;
+    unsigned int        capacity;
+    iotrace_fd_t *      fds;        /* ptrace: cache of fds of traced processes */
+    unsigned int        nfds;
+    unsigned int        fdcapacity;
+    proctree_t          tree;       /* fanotify: processes known to be in the tree */
+    int                 fanfd;
+    unsigned long       nevents;    /* fanotify events or syscalls handled */
+    unsigned long       ndropped;   /* events of processes which could not be identified */
+    uint64_t            bytes;      /* bytes read (ptrace) */
+} iotrace_t;
+
+typedef struct {
+    unsigned int        files;
+    unsigned int        ranges;
+    unsigned int        errors;
+    unsigned int        threads;
+    uint64_t            bytes;
+    struct timespec     duration;
+} iotrace_prefetch_t;
+
+#define IOTRACE_INITIALIZER { NULL, IOT_NONE, NULL, 0, 0, NULL, 0, 0, PROCTREE_INITIALIZER, -1, 0, 0, 0 }
+
+/** iotrace_init() : choose the method (fanotify if root, ptrace otherwise) and for
+ * fanotify, start watching all mounts. To be called before fork().
+ * @return 0 on success, -1 on error (errno set) */
+int iotrace_init(iotrace_t * iot);
+
+/** iotrace_child() : to be called by the traced child just before execve() */
+int iotrace_child(iotrace_t * iot);
+
+/** iotrace_wait() : record file accesses of pid and its children until pid terminates.
+ * pid is not reaped: waitpid() is to be called next.
+ * @return 0 on success, -1 on error (errno set) */
+int iotrace_wait(iotrace_t * iot, pid_t pid);
+
+/** iotrace_write() : write the prefetch list to iot->listfile, through a new temporary
+ * file renamed to it (with the current effective identity, a symlink is replaced).
+ * One line per file '<offset>+<length>[,...] <path>', '-' when no range is known.
+ * @return 0 on success, -1 on error (errno set) */
+int iotrace_write(iotrace_t * iot);
+
+/** iotrace_report() : print profiling summary (extended timings format) */
+void iotrace_report(FILE * out, const iotrace_t * iot);
+
+/** iotrace_free() : release resources of iot (not iot itself) */
+void iotrace_free(iotrace_t * iot);
+
+/** iotrace_prefetch() : load in page cache the ranges of the prefetch list listfile,
+ * with several threads using readahead().
+ * @return 0 on success, -1 on error (errno set) */
+int iotrace_prefetch(const char * listfile, iotrace_prefetch_t * stats);
+
+/** iotrace_prefetch_report() : print prefetch summary (extended timings format) */
+void iotrace_prefetch_report(FILE * out, const char * listfile, const iotrace_prefetch_t * stats);
+
+#endif /* ! ifndef VRUNAS_IOTRACE_H */
@@ -0,0 +1,461 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Dynamic loader cost of the program (LD_AUDIT, LD_PRELOAD, loader statistics).
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "vlib/time.h"
+
+#include "ldstat.h"
+#include "elfutil.h"
+
+#ifndef PATH_MAX
+# define PATH_MAX 4096
+#endif
+
+#define LDSTAT_ENV          "VRUNAS_LDSTAT"     /* "<fd>:<pid>", see preload/vrunas_preload.c */
+#define LDSTAT_PRELOAD_ENV  "VRUNAS_PRELOAD"
+#define LDSTAT_DEBUG_PREFIX "ld"                /* LD_DEBUG_OUTPUT file, the loader adds .<pid> */
+
+static const char * const s_ldstat_events[LDS_NSTEPS] = {
+    "exec", "audit", "consistent", "startmain", "main"
+};
+
+static uint64_t ldstat_now(void) {
+    struct timespec ts;
+
+    if (vclock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the loader statistics are in cycles of rdtsc on x86, in ns of CLOCK_MONOTONIC otherwise */
+static uint64_t ldstat_cycles(void) {
+#   if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#   else
+    return ldstat_now();
+#   endif
+}
+
+static void ldstat_record(ldstat_t * lds, const char * event, const char * arg) {
+    char    buf[PATH_MAX + 64];
+    int     n;
+
+    n = snprintf(buf, sizeof(buf), "%s %llu%s%s\n", event, (unsigned long long) ldstat_now(),
+                 arg ? " " : "", arg ? arg : "");
+    if (n > 0 && n < (int) sizeof(buf) && write(fileno(lds->records), buf, n) != n) {
+        /* nothing, the step will be reported as not available */
+    }
+}
+
+int ldstat_find_preload(const char * name, char * path) {
+    const char * const  dirs[] = { "preload", "../lib", NULL };
+    const char *        env;
+    char                exe[PATH_MAX];
+    char                try[PATH_MAX * 2];
+    char *              slash;
+    struct stat         st;
+    ssize_t             n;
+
+    if ((env = getenv(LDSTAT_PRELOAD_ENV)) != NULL && *env != 0) {
+        /* the libraries are installed together */
+        if (realpath(env, exe) == NULL || stat(exe, &st) != 0)
+            return -1;
+        if (!S_ISDIR(st.st_mode) && (slash = strrchr(exe, '/')) != NULL)
+            *slash = 0;
+        snprintf(try, sizeof(try), "%s/%s", exe, name);
+        return realpath(try, path) != NULL && access(path, R_OK) == 0 ? 0 : -1;
+    }
+    if ((n = readlink("/proc/self/exe", exe, sizeof(exe) - 1)) <= 0)
+        return -1;
+    exe[n] = 0;
+    if ((slash = strrchr(exe, '/')) != NULL)
+        *slash = 0;
+    for (unsigned int i = 0; dirs[i] != NULL; ++i) {
+        snprintf(try, sizeof(try), "%s/%s/%s", exe, dirs[i], name);
+        if (realpath(try, path) != NULL && access(path, R_OK) == 0)
+            return 0;
+    }
+    return -1;
+}
+
+static int ldstat_add_dependency(const char * path, void * user_data) {
+    return pagecache_add((pagecache_t *) user_data, path);
+}
+
+/* LD_DEBUG_OUTPUT directory, created here and not by the child: the father may be
+ * root, and only touches it through the descriptors opened now. Without it, the
+ * loader statistics are not enabled, the other phases are measured anyway */
+static void ldstat_debugdir(ldstat_t * lds) {
+    char            dir[PATH_MAX];
+    const char *    tmpdir;
+    char *          base;
+
+    if ((tmpdir = getenv("TMPDIR")) == NULL || *tmpdir == 0)
+        tmpdir = "/tmp";
+    if ((size_t) snprintf(dir, sizeof(dir), "%s/vrunas-ld.XXXXXX", tmpdir) >= sizeof(dir)
+    ||  mkdtemp(dir) == NULL)
+        return ;
+    if ((lds->debugdir = strdup(dir)) != NULL) {
+        base = strrchr(dir, '/');
+        *base++ = 0;
+        /* written by the loader of the program */
+        if ((lds->debugparent = open(*dir ? dir : "/", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0
+        &&  (lds->debugfd = openat(lds->debugparent, base, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) >= 0
+        &&  (lds->uid == geteuid() || fchown(lds->debugfd, lds->uid, (gid_t) -1) == 0))
+            return ;
+    }
+    /* still the one just created */
+    if (lds->debugfd >= 0)
+        close(lds->debugfd);
+    if (lds->debugparent >= 0)
+        close(lds->debugparent);
+    lds->debugfd = lds->debugparent = -1;
+    if (lds->debugdir != NULL)
+        rmdir(lds->debugdir);
+    free(lds->debugdir);
+    lds->debugdir = NULL;
+}
+
+int ldstat_init(ldstat_t * lds, const char * program, uid_t uid) {
+    char path[PATH_MAX];
+    char real[PATH_MAX];
+
+    if (lds == NULL || program == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+#   ifndef __linux__
+    errno = ENOSYS;
+    return -1;
+#   endif
+    if (ldstat_find_preload(LDSTAT_PRELOAD_LIB, path) != 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    if ((lds->preload = strdup(path)) == NULL)
+        return -1;
+    /* libraries loaded by the program are compared with the predicted ones to give their
+     * residency at start of run */
+    if (elf_find_program(program, path, sizeof(path)) == 0) {
+        if ((lds->program = strdup(realpath(path, real) != NULL ? real : path)) == NULL
+        ||  pagecache_add(&lds->pagecache, lds->program) != 0
+        ||  elf_foreach_dependency(lds->program, ldstat_add_dependency, &lds->pagecache) < 0)
+            return -1;
+        pagecache_residency(&lds->pagecache, PGC_START);
+    }
+    /* inherited by the program, as the preload library writes in it */
+    if ((lds->records = tmpfile()) == NULL)
+        return -1;
+    /* loader statistics give relocation time, they are not enabled over user's LD_DEBUG */
+    lds->uid = uid;
+    if (getenv("LD_DEBUG") == NULL)
+        ldstat_debugdir(lds);
+    lds->calib_cycles = ldstat_cycles();
+    lds->calib_ns = ldstat_now();
+    return 0;
+}
+
+int ldstat_setenv_append(const char * name, const char * value, char sep) {
+    const char *    old = getenv(name);
+    char *          str;
+    int             ret;
+
+    if (old == NULL || *old == 0)
+        return setenv(name, value, 1);
+    if ((str = malloc(strlen(old) + strlen(value) + 2)) == NULL)
+        return -1;
+    sprintf(str, "%s%c%s", old, sep, value);
+    ret = setenv(name, str, 1);
+    free(str);
+    return ret;
+}
+
+int ldstat_child(ldstat_t * lds) {
+    char            buf[64];
+    char            dir[PATH_MAX];
+
+    if (lds == NULL || lds->records == NULL || lds->preload == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    snprintf(buf, sizeof(buf), "%d:%d", fileno(lds->records), (int) getpid());
+    if (ldstat_setenv_append("LD_AUDIT", lds->preload, ':') != 0
+    ||  ldstat_setenv_append("LD_PRELOAD", lds->preload, ':') != 0
+    ||  setenv(LDSTAT_ENV, buf, 1) != 0)
+        return -1;
+
+    if (lds->debugdir != NULL && getenv("LD_DEBUG") == NULL
+    &&  (size_t) snprintf(dir, sizeof(dir), "%s/" LDSTAT_DEBUG_PREFIX, lds->debugdir) < sizeof(dir)) {
+        setenv("LD_DEBUG_OUTPUT", dir, 1);
+        setenv("LD_DEBUG", "statistics", 1);
+    }
+    /* the program does not get the descriptors of the father */
+    if (lds->debugfd >= 0)
+        close(lds->debugfd);
+    if (lds->debugparent >= 0)
+        close(lds->debugparent);
+    lds->debugfd = lds->debugparent = -1;
+    ldstat_record(lds, s_ldstat_events[LDS_EXEC], NULL);
+    return 0;
+}
+
+static int ldstat_add_object(ldstat_t * lds, const char * path, uint64_t load_ns) {
+    ldstat_object_t * objects;
+
+    if (lds->count >= lds->capacity) {
+        unsigned int capacity = lds->capacity ? lds->capacity * 2 : 16;
+        if ((objects = realloc(lds->objects, capacity * sizeof(*objects))) == NULL)
+            return -1;
+        lds->objects = objects;
+        lds->capacity = capacity;
+    }
+    if ((lds->objects[lds->count].path = strdup(path)) == NULL)
+        return -1;
+    lds->objects[lds->count].load_ns = load_ns;
+    lds->objects[lds->count].dlopened = lds->ts[LDS_MAIN] != 0;
+    ++lds->count;
+    return 0;
+}
+
+/* statistics are printed after relocation and at exit: only the first ones are used.
+ * Regular files of the program only, written in the directory of ldstat_init() */
+static void ldstat_read_statistics(ldstat_t * lds, const char * file) {
+    const struct { const char * key; uint64_t * value; } keys[] = {
+        { "time needed for relocation:",    &lds->reloc_cycles },
+    };
+    char        line[256];
+    struct stat st;
+    FILE *      f;
+    int         fd;
+
+    if ((fd = openat(lds->debugfd, file, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC)) < 0)
+        return ;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != lds->uid || (f = fdopen(fd, "r")) == NULL) {
+        close(fd);
+        return ;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char * s;
+        for (unsigned int i = 0; i < sizeof(keys) / sizeof(*keys); ++i) {
+            if (*keys[i].value == 0 && (s = strstr(line, keys[i].key)) != NULL)
+                *keys[i].value = strtoull(s + strlen(keys[i].key), NULL, 10);
+        }
+        if (lds->nrelocs == 0 && (s = strstr(line, "number of relocations:")) != NULL)
+            lds->nrelocs = strtoul(s + sizeof("number of relocations:") - 1, NULL, 10);
+        if (lds->nrelative == 0 && (s = strstr(line, "number of relative relocations:")) != NULL)
+            lds->nrelative = strtoul(s + sizeof("number of relative relocations:") - 1, NULL, 10);
+    }
+    fclose(f);
+}
+
+/* read and remove LD_DEBUG_OUTPUT files, relative to the directory opened by
+ * ldstat_init(), whatever the program did with its path */
+static void ldstat_clean_debugdir(ldstat_t * lds, int read) {
+    struct stat     st, stdir;
+    const char *    base;
+    DIR *           dir;
+    struct dirent * ent;
+    int             fd;
+
+    if (lds->debugdir == NULL)
+        return ;
+    if (lds->debugfd >= 0 && (fd = dup(lds->debugfd)) >= 0) {
+        if ((dir = fdopendir(fd)) == NULL) {
+            close(fd);
+        } else {
+            while ((ent = readdir(dir)) != NULL) {
+                if (strncmp(ent->d_name, LDSTAT_DEBUG_PREFIX ".", sizeof(LDSTAT_DEBUG_PREFIX)) != 0)
+                    continue ;
+                if (read)
+                    ldstat_read_statistics(lds, ent->d_name);
+                unlinkat(lds->debugfd, ent->d_name, 0);
+            }
+            closedir(dir);
+        }
+    }
+    /* the directory, if still the one created */
+    base = strrchr(lds->debugdir, '/') + 1;
+    if (lds->debugfd >= 0 && lds->debugparent >= 0 && fstat(lds->debugfd, &stdir) == 0
+    &&  fstatat(lds->debugparent, base, &st, AT_SYMLINK_NOFOLLOW) == 0
+    &&  st.st_dev == stdir.st_dev && st.st_ino == stdir.st_ino)
+        unlinkat(lds->debugparent, base, AT_REMOVEDIR);
+    if (lds->debugfd >= 0)
+        close(lds->debugfd);
+    if (lds->debugparent >= 0)
+        close(lds->debugparent);
+    lds->debugfd = lds->debugparent = -1;
+    free(lds->debugdir);
+    lds->debugdir = NULL;
+}
+
+int ldstat_read(ldstat_t * lds) {
+    char        line[PATH_MAX + 64];
+    uint64_t    ts_search = 0;
+    uint64_t    cycles = ldstat_cycles(), ns = ldstat_now();
+
+    if (lds == NULL || lds->records == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ns > lds->calib_ns && cycles > lds->calib_cycles)
+        lds->cycle_ns = (double) (ns - lds->calib_ns) / (cycles - lds->calib_cycles);
+    rewind(lds->records);
+    while (fgets(line, sizeof(line), lds->records) != NULL) {
+        char *      arg;
+        uint64_t    ts;
+        size_t      len = strlen(line);
+        int         step;
+
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = 0;
+        if ((arg = strchr(line, ' ')) == NULL)
+            continue ;
+        *arg++ = 0;
+        ts = strtoull(arg, &arg, 10);
+        if (*arg == ' ')
+            ++arg;
+
+        for (step = 0; step < LDS_NSTEPS && strcmp(line, s_ldstat_events[step]) != 0; ++step)
+            ; /* nothing */
+        if (step == LDS_AUDIT && lds->ts[step] != 0) {
+            break ; /* the program has executed another one */
+        } else if (step < LDS_NSTEPS) {
+            if (lds->ts[step] == 0)
+                lds->ts[step] = ts;
+        } else if (strcmp(line, "search") == 0) {
+            ts_search = ts;
+        } else if (strcmp(line, "open") == 0) {
+            /* objects are mapped just after they are found */
+            if (strcmp(arg, lds->preload) == 0 || (*arg != '-' && *arg != '/')) {
+                ts_search = 0;
+                continue ;
+            }
+            if (ldstat_add_object(lds, strcmp(arg, "-") == 0 && lds->program ? lds->program : arg,
+                                  ts_search != 0 && ts >= ts_search ? ts - ts_search : 0) != 0)
+                return -1;
+            ts_search = 0;
+        }
+    }
+    ldstat_clean_debugdir(lds, 1);
+    return 0;
+}
+
+static int64_t ldstat_delta(const ldstat_t * lds, ldstat_step_t from, ldstat_step_t to) {
+    if (lds->ts[from] == 0 || lds->ts[to] == 0 || lds->ts[to] < lds->ts[from])
+        return -1;
+    return lds->ts[to] - lds->ts[from];
+}
+
+static void ldstat_print_time(FILE * out, const char * name, int64_t ns, const char * desc) {
+    if (ns < 0)
+        fprintf(out, "%-8s %13s (%s)\n", name, "n/a", desc);
+    else
+        fprintf(out, "%-8s % 3ld.%09ld (%s)\n", name, (long) (ns / 1000000000), (long) (ns % 1000000000), desc);
+}
+
+void ldstat_report(FILE * out, const ldstat_t * lds) {
+    int64_t relocinit, reloc = -1;
+    char    desc[128];
+
+    if (out == NULL || lds == NULL)
+        return ;
+    if (lds->ts[LDS_AUDIT] == 0) {
+        fprintf(out, "ldexec   %13s (no loader activity: static program, secure execution "
+                     "or LD_AUDIT not supported)\n", "n/a");
+        return ;
+    }
+    relocinit = ldstat_delta(lds, LDS_CONSISTENT, LDS_STARTMAIN);
+    if (relocinit >= 0 && lds->reloc_cycles != 0 && lds->cycle_ns > 0.0) {
+        reloc = (int64_t) (lds->reloc_cycles * lds->cycle_ns);
+        if (reloc > relocinit)
+            reloc = relocinit;
+    }
+    ldstat_print_time(out, "ldexec", ldstat_delta(lds, LDS_EXEC, LDS_AUDIT),
+                      "execve(): mapping of program and loader, loader startup");
+    snprintf(desc, sizeof(desc), "search and mapping of %u objects", lds->count);
+    ldstat_print_time(out, "ldload", ldstat_delta(lds, LDS_AUDIT, LDS_CONSISTENT), desc);
+    snprintf(desc, sizeof(desc), "%lu symbol and %lu relative relocations",
+             lds->nrelocs, lds->nrelative);
+    ldstat_print_time(out, "ldreloc", reloc, desc);
+    ldstat_print_time(out, "ldinit", reloc >= 0 ? relocinit - reloc : relocinit,
+                      reloc >= 0 ? "constructors of shared objects" : "relocations and constructors of shared objects");
+    ldstat_print_time(out, "ldctors", ldstat_delta(lds, LDS_STARTMAIN, LDS_MAIN), "constructors of program");
+    /* the statistics are computed and written to a file by the loader of the measured run */
+    ldstat_print_time(out, "ldtotal", ldstat_delta(lds, LDS_EXEC, LDS_MAIN),
+                      lds->reloc_cycles != 0 ? "time from execve() to main(), including auditing overhead "
+                                               "and the output of LD_DEBUG=statistics"
+                                             : "time from execve() to main(), including auditing overhead");
+
+    fprintf(out, "ldobject %9s %12s %8s (shared objects loaded, '+' if loaded after main())\n",
+            "load(ms)", "size", "resident");
+    for (unsigned int i = 0; i < lds->count; ++i) {
+        const ldstat_object_t *     obj = &lds->objects[i];
+        const pagecache_file_t *    file = NULL;
+        char                        real[PATH_MAX];
+        struct stat                 st;
+
+        if (realpath(obj->path, real) != NULL) {
+            for (unsigned int j = 0; j < lds->pagecache.count && file == NULL; ++j) {
+                if (strcmp(lds->pagecache.files[j].path, real) == 0 && lds->pagecache.files[j].error[PGC_START] == 0)
+                    file = &lds->pagecache.files[j];
+            }
+        }
+        fprintf(out, "ldobject %9.3f", obj->load_ns / 1000000.0);
+        if (stat(obj->path, &st) == 0)
+            fprintf(out, " %12lld", (long long) st.st_size);
+        else
+            fprintf(out, " %12s", "n/a");
+        if (file != NULL)
+            fprintf(out, " %7.1f%%", file->pages == 0 ? 100.0 : 100.0 * file->resident[PGC_START] / file->pages);
+        else
+            fprintf(out, " %8s", "n/a");
+        fprintf(out, " %s%s\n", obj->dlopened ? "+" : "", obj->path);
+    }
+}
+
+void ldstat_free(ldstat_t * lds) {
+    if (lds == NULL)
+        return ;
+    ldstat_clean_debugdir(lds, 0);
+    for (unsigned int i = 0; i < lds->count; ++i) {
+        free(lds->objects[i].path);
+    }
+    free(lds->objects);
+    free(lds->preload);
+    free(lds->program);
+    if (lds->records != NULL)
+        fclose(lds->records);
+    pagecache_free(&lds->pagecache);
+    lds->objects = NULL;
+    lds->preload = lds->program = NULL;
+    lds->records = NULL;
+    lds->count = lds->capacity = 0;
+}
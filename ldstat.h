@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Dynamic loader cost of the program (LD_AUDIT, LD_PRELOAD, loader statistics).
+ */
+#ifndef VRUNAS_LDSTAT_H
+#define VRUNAS_LDSTAT_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "pagecache.h"
+
+/** name of the library injected in the program, see preload/ */
+#define LDSTAT_PRELOAD_LIB  "libvrunas_preload.so"
+
+typedef enum {
+    LDS_EXEC = 0,               /* just before execve() */
+    LDS_AUDIT,                  /* loader started, audit library loaded */
+    LDS_CONSISTENT,             /* all shared objects loaded */
+    LDS_STARTMAIN,              /* __libc_start_main(): constructors of shared objects done */
+    LDS_MAIN,                   /* main(): constructors of program done */
+    LDS_NSTEPS
+} ldstat_step_t;
+
+typedef struct {
+    char *              path;
+    uint64_t            load_ns;        /* search and mapping time, 0 if unknown */
+    int                 dlopened;       /* loaded after main() */
+} ldstat_object_t;
+
+typedef struct {
+    char *              preload;        /* path of LDSTAT_PRELOAD_LIB */
+    char *              program;        /* resolved path of program */
+    FILE *              records;        /* written by child and preload library */
+    char *              debugdir;       /* LD_DEBUG_OUTPUT directory created by ldstat_init() */
+    int                 debugfd;        /* the directory, opened */
+    int                 debugparent;    /* its parent, opened */
+    uid_t               uid;            /* identity of the program, owning the LD_DEBUG_OUTPUT files */
+    pagecache_t         pagecache;      /* program and its libraries, residency at start of run */
+    uint64_t            ts[LDS_NSTEPS]; /* CLOCK_MONOTONIC ns, 0 if unknown */
+    uint64_t            reloc_cycles;   /* loader statistics */
+    uint64_t            calib_cycles;   /* cycles and ns at init, to convert cycles after run */
+    uint64_t            calib_ns;
+    double              cycle_ns;
+    unsigned long       nrelocs;
+    unsigned long       nrelative;
+    ldstat_object_t *   objects;
+    unsigned int        count;
+    unsigned int        capacity;
+} ldstat_t;
+
+#define LDSTAT_INITIALIZER { NULL, NULL, NULL, NULL, -1, -1, 0, PAGECACHE_INITIALIZER, { 0, }, 0, 0, 0, 0.0, 0, 0, \
+                            NULL, 0, 0 }
+
+/** ldstat_find_preload() : find the preload library name (LDSTAT_PRELOAD_LIB...) in the
+ * directory of VRUNAS_PRELOAD (environment variable naming a library or its directory),
+ * or in preload/ or ../lib/ near vrunas executable.
+ * @param path buffer of PATH_MAX bytes receiving the real path of the library
+ * @return 0 on success, -1 if not found */
+int ldstat_find_preload(const char * name, char * path);
+
+/** ldstat_setenv_append() : append value to the environment variable name, with the
+ * separator sep if it is already set.
+ * @return 0 on success, -1 on error (errno set) */
+int ldstat_setenv_append(const char * name, const char * value, char sep);
+
+/** ldstat_init() : find LDSTAT_PRELOAD_LIB (see ldstat_find_preload()), resolve program and its libraries,
+ * and get their page cache residency. Unless LD_DEBUG is set, create the LD_DEBUG_OUTPUT
+ * directory of the loader statistics, given to uid, the identity of the program.
+ * To be called before fork().
+ * @return 0 on success, -1 on error (errno set) */
+int ldstat_init(ldstat_t * lds, const char * program, uid_t uid);
+
+/** ldstat_child() : to be called by the child just before execve(): inject the preload
+ * library with LD_AUDIT and LD_PRELOAD, enable loader statistics if LD_DEBUG is not set.
+ * @return 0 on success, -1 on error (errno set) */
+int ldstat_child(ldstat_t * lds);
+
+/** ldstat_read() : read records of the child once it has terminated.
+ * @return 0 on success, -1 on error (errno set) */
+int ldstat_read(ldstat_t * lds);
+
+/** ldstat_report() : print loader phases and shared objects (extended timings format) */
+void ldstat_report(FILE * out, const ldstat_t * lds);
+
+/** ldstat_free() : release resources of lds (not lds itself) */
+void ldstat_free(ldstat_t * lds);
+
+#endif /* ! ifndef VRUNAS_LDSTAT_H */
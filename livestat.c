@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Live status panel of a running process tree, refreshed at the bottom of the
+ * terminal with cursor addressing (linux /proc).
+ */
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "vlib/term.h"
+
+#include "livestat.h"
+
+#define LIVESTAT_MAX_DEPTH  64
+
+static ssize_t livestat_read(const char * path, char * buf, size_t size) {
+    ssize_t n;
+    int     fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n >= 0)
+        buf[n] = 0;
+    return n;
+}
+
+static void livestat_sample_proc(livestat_sample_t * sample, pid_t pid, char * comm, size_t commsize,
+                                 livestat_task_fun_t fun, void * data, int depth) {
+    char            path[128];
+    char            buf[4096];
+    char *          s;
+    DIR *           dir;
+    struct dirent * ent;
+
+    /* /proc/<pid>/stat: fields after the command name, from 3 (state) */
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    if (livestat_read(path, buf, sizeof(buf)) > 0 && (s = strrchr(buf, ')')) != NULL) {
+        unsigned long long  utime = 0, stime = 0, rss = 0;
+        long long           cutime = 0, cstime = 0;
+        long                nthreads = 0;
+        char *              name = strchr(buf, '(');
+
+        if (sscanf(s + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %lld %lld %*d %*d %ld "
+                          "%*d %*u %*u %llu", &utime, &stime, &cutime, &cstime, &nthreads, &rss) == 6) {
+            /* children already reaped are in cutime/cstime, the others are sampled */
+            sample->cpu_ticks += utime + stime + cutime + cstime;
+            sample->rss_pages += rss;
+            sample->nthreads += nthreads;
+            ++sample->nprocs;
+        }
+        if (depth == 0 && comm != NULL && name != NULL)
+            snprintf(comm, commsize, "%.*s", (int) (s - name - 1), name + 1);
+    }
+    /* /proc/<pid>/io, readable by the owner or root */
+    snprintf(path, sizeof(path), "/proc/%d/io", (int) pid);
+    if (livestat_read(path, buf, sizeof(buf)) > 0) {
+        if ((s = strstr(buf, "wchar:")) != NULL)
+            sample->wchar += strtoull(s + 6, NULL, 10);
+        if ((s = strstr(buf, "\nread_bytes:")) != NULL)
+            sample->read_bytes += strtoull(s + 12, NULL, 10);
+        if ((s = strstr(buf, "\nwrite_bytes:")) != NULL)
+            sample->write_bytes += strtoull(s + 13, NULL, 10);
+    }
+    /* children of each thread (linux 3.5, CONFIG_PROC_CHILDREN) */
+    snprintf(path, sizeof(path), "/proc/%d/task", (int) pid);
+    if ((fun == NULL && depth >= LIVESTAT_MAX_DEPTH) || (dir = opendir(path)) == NULL)
+        return ;
+    while ((ent = readdir(dir)) != NULL) {
+        char * end;
+        long   child;
+        pid_t  tid;
+
+        if (*ent->d_name < '0' || *ent->d_name > '9')
+            continue ;
+        tid = strtol(ent->d_name, NULL, 10);
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", (int) pid, (int) tid);
+        if (fun != NULL && livestat_read(path, buf, sizeof(buf)) > 0)
+            fun(pid, tid, buf, data);
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/children", (int) pid, (int) tid);
+        if (depth >= LIVESTAT_MAX_DEPTH || livestat_read(path, buf, sizeof(buf)) <= 0)
+            continue ;
+        for (s = buf; (child = strtol(s, &end, 10)) > 0 && end != s; s = end)
+            livestat_sample_proc(sample, child, NULL, 0, fun, data, depth + 1);
+    }
+    closedir(dir);
+}
+
+void livestat_sample(pid_t pid, livestat_sample_t * sample, char * comm, size_t commsize) {
+    memset(sample, 0, sizeof(*sample));
+    livestat_sample_proc(sample, pid, comm, commsize, NULL, NULL, 0);
+}
+
+void livestat_sample_tasks(pid_t pid, livestat_sample_t * sample, livestat_task_fun_t fun, void * data) {
+    memset(sample, 0, sizeof(*sample));
+    livestat_sample_proc(sample, pid, NULL, 0, fun, data, 0);
+}
+
+/* the panel is only informative: errors are ignored */
+static void livestat_write(int fd, const char * buf, size_t len) {
+    while (len > 0 && write(fd, buf, len) < 0 && errno == EINTR)
+        ; /* nothing */
+}
+
+/* human readable size */
+static const char * livestat_size(char * buf, size_t size, double value) {
+    static const char * const units[] = { "B", "KB", "MB", "GB", "TB" };
+    unsigned int unit = 0;
+
+    while (value >= 1024.0 && unit + 1 < sizeof(units) / sizeof(*units)) {
+        value /= 1024.0;
+        ++unit;
+    }
+    snprintf(buf, size, unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+    return buf;
+}
+
+/* rate of a counter which decreases when processes terminate */
+static double livestat_rate(uint64_t value, uint64_t last, double seconds) {
+    return value > last && seconds > 0 ? (value - last) / seconds : 0.0;
+}
+
+/* lines of the panel. Cursor addressing: ESC 7/ESC 8 save/restore the cursor of the
+ * program output, ESC [<row>;1H moves to the line, ESC [K clears it. */
+static void livestat_draw(livestat_t * ls, int final) {
+    char                lines[LIVESTAT_LINES][LIVESTAT_LINE_MAX];
+    char                out[LIVESTAT_LINES * (LIVESTAT_LINE_MAX + 64) + 64];
+    char                s1[32], s2[32], s3[32], s4[32], s5[32];
+    livestat_sample_t   sample;
+    struct timespec     now;
+    struct winsize      ws;
+    double              seconds, elapsed;
+    long                hz = sysconf(_SC_CLK_TCK);
+    size_t              len = 0;
+    int                 rows = ls->rows, cols = ls->cols;
+
+    livestat_sample(ls->root, &sample, ls->comm, sizeof(ls->comm));
+    /* the tree has terminated: totals of the last refresh */
+    if (sample.nprocs == 0)
+        sample = ls->sample;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    seconds = (now.tv_sec - ls->last.tv_sec) + (now.tv_nsec - ls->last.tv_nsec) / 1e9;
+    elapsed = (now.tv_sec - ls->start.tv_sec) + (now.tv_nsec - ls->start.tv_nsec) / 1e9;
+    if (hz <= 0)
+        hz = 100;
+
+    snprintf(lines[0], sizeof(lines[0]), "%svrunas%s %.15s pid %d  elapsed %02ld:%02ld:%02ld  cpu %5.1f%%  "
+             "rss %s  threads %u  procs %u%s",
+             vterm_color(ls->fd, VCOLOR_BUILD(VCOLOR_EMPTY, VCOLOR_EMPTY, VCOLOR_BOLD)),
+             vterm_color(ls->fd, VCOLOR_RESET), ls->comm, (int) ls->root,
+             (long) elapsed / 3600, ((long) elapsed / 60) % 60, (long) elapsed % 60,
+             100.0 * livestat_rate(sample.cpu_ticks, ls->sample.cpu_ticks, seconds) / hz,
+             livestat_size(s1, sizeof(s1), (double) sample.rss_pages * sysconf(_SC_PAGESIZE)),
+             sample.nthreads, sample.nprocs, final ? "  (terminated)" : "");
+    snprintf(lines[1], sizeof(lines[1]), "       read %s/s  write %s/s  output %s/s  (read %s, output %s)",
+             livestat_size(s2, sizeof(s2), livestat_rate(sample.read_bytes, ls->sample.read_bytes, seconds)),
+             livestat_size(s3, sizeof(s3), livestat_rate(sample.write_bytes, ls->sample.write_bytes, seconds)),
+             livestat_size(s4, sizeof(s4), livestat_rate(sample.wchar, ls->sample.wchar, seconds)),
+             livestat_size(s5, sizeof(s5), (double) sample.read_bytes),
+             livestat_size(s1, sizeof(s1), (double) sample.wchar));
+    ls->sample = sample;
+    ls->last = now;
+
+    /* the terminal was resized: set up the scrolling region again and redraw everything */
+    if (ioctl(ls->fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row > LIVESTAT_LINES && ws.ws_col > 0
+    &&  (ws.ws_row != rows || ws.ws_col != cols)) {
+        ls->rows = rows = ws.ws_row;
+        ls->cols = cols = ws.ws_col;
+        len += snprintf(out + len, sizeof(out) - len, "\0337\033[1;%dr\0338", rows - LIVESTAT_LINES);
+        memset(ls->lines, 0, sizeof(ls->lines));
+    }
+    for (int i = 0; i < LIVESTAT_LINES; ++i) {
+        if (strcmp(lines[i], ls->lines[i]) == 0)
+            continue ;
+        memcpy(ls->lines[i], lines[i], sizeof(lines[i]));
+        /* the width of color sequences is not counted: a line may be cut a bit early */
+        len += snprintf(out + len, sizeof(out) - len, "\0337\033[%d;1H\033[K%.*s\0338",
+                        rows - LIVESTAT_LINES + 1 + i, cols - 1, lines[i]);
+    }
+    livestat_write(ls->fd, out, len);
+}
+
+static void * livestat_thread(void * data) {
+    livestat_t *    ls = data;
+    struct timespec ts;
+
+    pthread_mutex_lock(&ls->mutex);
+    while (!ls->stop) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += LIVESTAT_INTERVAL_MS / 1000;
+        ts.tv_nsec += (LIVESTAT_INTERVAL_MS % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ++ts.tv_sec;
+            ts.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&ls->cond, &ls->mutex, &ts) == ETIMEDOUT && !ls->stop)
+            livestat_draw(ls, 0);
+    }
+    pthread_mutex_unlock(&ls->mutex);
+    return NULL;
+}
+
+int livestat_init(livestat_t * ls, int fd) {
+    if (ls == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!isatty(fd)) {
+        errno = ENOTTY;
+        return -1;
+    }
+    ls->fd = fd;
+    return 0;
+}
+
+int livestat_start(livestat_t * ls, pid_t pid) {
+    char    out[128];
+    int     len;
+
+    ls->root = pid;
+    ls->stop = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ls->start);
+    ls->last = ls->start;
+    /* room for the panel at the bottom, scrolling the current content if needed.
+     * The scrolling region is set up by the first livestat_draw(), which sees the size */
+    len = snprintf(out, sizeof(out), "%.*s\033[%dA", LIVESTAT_LINES, "\n\n\n\n\n\n\n\n", LIVESTAT_LINES);
+    livestat_write(ls->fd, out, len);
+    ls->rows = ls->cols = 0;
+    pthread_mutex_lock(&ls->mutex);
+    livestat_draw(ls, 0);
+    pthread_mutex_unlock(&ls->mutex);
+    if ((errno = pthread_create(&ls->thread, NULL, livestat_thread, ls)) != 0)
+        return -1;
+    ls->running = 1;
+    return 0;
+}
+
+void livestat_stop(livestat_t * ls) {
+    char    out[64];
+    int     len;
+
+    if (!ls->running)
+        return ;
+    pthread_mutex_lock(&ls->mutex);
+    ls->stop = 1;
+    pthread_cond_signal(&ls->cond);
+    pthread_mutex_unlock(&ls->mutex);
+    pthread_join(ls->thread, NULL);
+    ls->running = 0;
+    /* last state, then whole terminal scrolling again, cursor below the panel */
+    livestat_draw(ls, 1);
+    len = snprintf(out, sizeof(out), "\033[r\033[%d;1H\n", ls->rows);
+    livestat_write(ls->fd, out, len);
+}
+
+void livestat_free(livestat_t * ls) {
+    if (ls == NULL)
+        return ;
+    livestat_stop(ls);
+}
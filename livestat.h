@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Live status panel of a running process tree, refreshed at the bottom of the
+ * terminal with cursor addressing (linux /proc).
+ */
+#ifndef VRUNAS_LIVESTAT_H
+#define VRUNAS_LIVESTAT_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define LIVESTAT_INTERVAL_MS    1000
+#define LIVESTAT_LINES          2       /* lines of the panel */
+#define LIVESTAT_LINE_MAX       256
+
+typedef struct {
+    uint64_t            cpu_ticks;      /* user + sys time of the tree, reaped children included */
+    uint64_t            rss_pages;
+    uint64_t            read_bytes;     /* storage I/O */
+    uint64_t            write_bytes;
+    uint64_t            wchar;          /* bytes written by the program (output, pipes, files) */
+    unsigned int        nthreads;
+    unsigned int        nprocs;
+} livestat_sample_t;
+
+typedef struct {
+    int                 fd;             /* terminal of the panel */
+    int                 rows;           /* size of the terminal when the panel was set up */
+    int                 cols;
+    pid_t               root;
+    char                comm[16];
+    struct timespec     start;
+    struct timespec     last;
+    livestat_sample_t   sample;         /* at last refresh */
+    char                lines[LIVESTAT_LINES][LIVESTAT_LINE_MAX];   /* as displayed */
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;           /* signaled by livestat_stop() */
+    int                 running;
+    int                 stop;
+    pthread_t           thread;
+} livestat_t;
+
+#define LIVESTAT_INITIALIZER { -1, 0, 0, 0, { 0 }, { 0, 0 }, { 0, 0 }, { 0, 0, 0, 0, 0, 0, 0 }, \
+                               { { 0 }, }, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, }
+
+/** livestat_sample() : sum the counters of pid and of its descendants.
+ * @param comm if not NULL, receives the command name of pid */
+void livestat_sample(pid_t pid, livestat_sample_t * sample, char * comm, size_t commsize);
+
+/** livestat_task_fun_t : called for each thread by livestat_sample_tasks(), with the
+ * content of /proc/<pid>/task/<tid>/stat */
+typedef void (*livestat_task_fun_t)(pid_t pid, pid_t tid, const char * stat, void * data);
+
+/** livestat_sample_tasks() : livestat_sample(), calling fun for each thread of the tree */
+void livestat_sample_tasks(pid_t pid, livestat_sample_t * sample, livestat_task_fun_t fun, void * data);
+
+/** livestat_init() : check that fd is a terminal, on which the panel is displayed.
+ * @return 0 on success, -1 on error (errno set, ENOTTY if not a terminal) */
+int livestat_init(livestat_t * ls, int fd);
+
+/** livestat_start() : reserve the last lines of the terminal (scrolling region) and
+ * start refreshing there the status of pid and of its children every second:
+ * elapsed time, cpu usage, rss, storage I/O and output rates, threads.
+ * Only the lines which changed are redrawn.
+ * @return 0 on success, -1 on error (errno set) */
+int livestat_start(livestat_t * ls, pid_t pid);
+
+/** livestat_stop() : stop refreshing, and give back the whole terminal, the cursor
+ * being below the last state of the panel */
+void livestat_stop(livestat_t * ls);
+
+/** livestat_free() : release resources of ls (not ls itself), stopping it if needed */
+void livestat_free(livestat_t * ls);
+
+#endif /* ! ifndef VRUNAS_LIVESTAT_H */
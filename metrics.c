@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Final metrics of a run in the OpenMetrics text format, for the textfile
+ * collector of node_exporter.
+ */
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
+#include <signal.h>
+
+#include "metrics.h"
+
+#define METRICS_LABELS_MAX  1024
+
+static const char * const s_heap_calls[HEAPPROF_NCALLS] = {
+    "malloc", "calloc", "realloc", "free", "mmap", "munmap"
+};
+
+/* append name="value" to labels, value escaped */
+static void metrics_label(char * labels, size_t size, const char * name, const char * value) {
+    size_t len = strlen(labels);
+
+    len += snprintf(labels + len, len < size ? size - len : 0, "%s%s=\"", len > 0 ? "," : "", name);
+    for (; *value && len + 3 < size; ++value) {
+        if (*value == '\\' || *value == '"')
+            labels[len++] = '\\';
+        else if (*value == '\n') {
+            labels[len++] = '\\';
+            labels[len++] = 'n';
+            continue ;
+        }
+        labels[len++] = *value;
+    }
+    if (len + 1 < size)
+        labels[len++] = '"';
+    labels[len < size ? len : size - 1] = 0;
+}
+
+static void metrics_family(FILE * out, const char * name, const char * help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s gauge\n", name, help, name);
+}
+
+/* sample of name with the labels of the run and an optional label */
+static void metrics_sample(FILE * out, const char * name, const char * labels,
+                           const char * label, const char * value, double v) {
+    char all[METRICS_LABELS_MAX + 128];
+
+    snprintf(all, sizeof(all), "%s", labels);
+    if (label != NULL)
+        metrics_label(all, sizeof(all), label, value);
+    fprintf(out, "%s{%s} %.15g\n", name, all, v);
+}
+
+static void metrics_gauge(FILE * out, const char * name, const char * help, const char * labels, double v) {
+    metrics_family(out, name, help);
+    metrics_sample(out, name, labels, NULL, NULL, v);
+}
+
+static void metrics_print(FILE * out, const metrics_run_t * run) {
+    const struct rusage *   ru = run->rusage;
+    char                    labels[METRICS_LABELS_MAX] = "";
+    char                    buf[64];
+    const char *            job = strrchr(run->program, '/');
+    struct passwd *         pw = getpwuid(run->uid);
+    struct group *          gr = getgrgid(run->gid);
+
+    metrics_label(labels, sizeof(labels), "job", job != NULL && job[1] ? job + 1 : run->program);
+    metrics_label(labels, sizeof(labels), "user", pw != NULL ? pw->pw_name : "");
+    snprintf(buf, sizeof(buf), "%lu", (unsigned long) run->uid);
+    metrics_label(labels, sizeof(labels), "uid", buf);
+    metrics_label(labels, sizeof(labels), "group", gr != NULL ? gr->gr_name : "");
+    snprintf(buf, sizeof(buf), "%lu", (unsigned long) run->gid);
+    metrics_label(labels, sizeof(labels), "gid", buf);
+    snprintf(buf, sizeof(buf), "%d", WIFEXITED(run->status) ? WEXITSTATUS(run->status) : -1);
+    metrics_label(labels, sizeof(labels), "exit_code", buf);
+    snprintf(buf, sizeof(buf), "%d", WIFSIGNALED(run->status) ? WTERMSIG(run->status) : 0);
+    metrics_label(labels, sizeof(labels), "exit_signal", WIFSIGNALED(run->status) ? buf : "");
+
+    metrics_gauge(out, "vrunas_last_run_timestamp_seconds", "End of the run (unix time).", labels, (double) time(NULL));
+    metrics_gauge(out, "vrunas_real_seconds", "Elapsed real time of the run.", labels,
+                  run->real.tv_sec + run->real.tv_nsec / 1e9);
+    metrics_gauge(out, "vrunas_user_seconds", "User cpu time of the processes of the run.", labels,
+                  ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6);
+    metrics_gauge(out, "vrunas_sys_seconds", "System cpu time of the processes of the run.", labels,
+                  ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6);
+    metrics_gauge(out, "vrunas_maxrss_bytes", "Maximum resident set size of the largest process.", labels,
+                  ru->ru_maxrss * 1024.0);
+    metrics_gauge(out, "vrunas_minor_faults", "Page faults serviced without I/O.", labels, ru->ru_minflt);
+    metrics_gauge(out, "vrunas_major_faults", "Page faults serviced with I/O.", labels, ru->ru_majflt);
+    metrics_gauge(out, "vrunas_block_inputs", "Block input operations of the filesystem.", labels, ru->ru_inblock);
+    metrics_gauge(out, "vrunas_block_outputs", "Block output operations of the filesystem.", labels, ru->ru_oublock);
+    metrics_gauge(out, "vrunas_voluntary_context_switches", "Context switches to wait for a resource.",
+                  labels, ru->ru_nvcsw);
+    metrics_gauge(out, "vrunas_involuntary_context_switches", "Context switches by preemption.",
+                  labels, ru->ru_nivcsw);
+
+    if (run->delayacct != NULL) {
+        const delayacct_stats_t * st = &run->delayacct->stats;
+
+        metrics_gauge(out, "vrunas_cpu_delay_seconds", "Time waiting for a cpu (runqueue).", labels, st->cpu_delay / 1e9);
+        metrics_gauge(out, "vrunas_blkio_delay_seconds", "Time waiting for block I/O.", labels, st->blkio_delay / 1e9);
+        metrics_gauge(out, "vrunas_swapin_delay_seconds", "Time waiting for swapin.", labels, st->swapin_delay / 1e9);
+        metrics_gauge(out, "vrunas_reclaim_delay_seconds", "Time in memory reclaim.", labels, st->reclaim_delay / 1e9);
+    }
+    if (run->syscount != NULL && run->syscount->stats != NULL) {
+        uint64_t calls = 0, errors = 0;
+
+        for (unsigned int nr = 0; nr <= SYSCOUNT_MAX_NR; ++nr) {
+            calls += run->syscount->stats[nr].calls;
+            errors += run->syscount->stats[nr].errors;
+        }
+        metrics_gauge(out, "vrunas_syscalls", "System calls of the processes of the run.", labels, calls);
+        metrics_gauge(out, "vrunas_syscall_errors", "System calls which failed.", labels, errors);
+    }
+    if (run->heapprof != NULL) {
+        metrics_gauge(out, "vrunas_heap_requested_bytes", "Bytes requested to the allocator.", labels,
+                      run->heapprof->bytes);
+        metrics_gauge(out, "vrunas_heap_peak_bytes", "Peak live heap of the largest process.", labels,
+                      run->heapprof->peak);
+        metrics_family(out, "vrunas_heap_calls", "Calls to the allocator.");
+        for (unsigned int i = 0; i < HEAPPROF_NCALLS; ++i)
+            metrics_sample(out, "vrunas_heap_calls", labels, "call", s_heap_calls[i], run->heapprof->calls[i]);
+    }
+    if (run->phasestat != NULL && run->phasestat->nphases > 0) {
+        const phasestat_t * ps = run->phasestat;
+
+        metrics_family(out, "vrunas_phase_seconds", "Wall time of the phases of the SDK, summed over threads.");
+        for (unsigned int p = 0; p < ps->nphases; ++p) {
+            metrics_sample(out, "vrunas_phase_seconds", labels, "phase", ps->phases[p].name,
+                           ps->phases[p].values[VRUNAS_SDK_WALL] / 1e9);
+        }
+        metrics_family(out, "vrunas_phase_count", "Occurrences of the phases of the SDK.");
+        for (unsigned int p = 0; p < ps->nphases; ++p)
+            metrics_sample(out, "vrunas_phase_count", labels, "phase", ps->phases[p].name, ps->phases[p].count);
+    }
+    if (run->phasestat != NULL && run->phasestat->ncounters > 0) {
+        const phasestat_t * ps = run->phasestat;
+
+        metrics_family(out, "vrunas_counter", "Counters of the SDK.");
+        for (unsigned int c = 0; c < ps->ncounters; ++c)
+            metrics_sample(out, "vrunas_counter", labels, "counter", ps->counters[c], ps->values[c]);
+    }
+    if (run->energy != NULL && run->energy->ndomains > 0) {
+        metrics_family(out, "vrunas_energy_joules", "Energy of the RAPL domains during the run.");
+        for (unsigned int d = 0; d < run->energy->ndomains; ++d) {
+            metrics_sample(out, "vrunas_energy_joules", labels, "domain", run->energy->domains[d].name,
+                           run->energy->domains[d].total / 1e6);
+        }
+    }
+    if (run->host != NULL) {
+        const hostinfo_t *  hi = run->host;
+        char                info[METRICS_LABELS_MAX];
+
+        snprintf(info, sizeof(info), "%s", labels);
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) hi->id);
+        metrics_label(info, sizeof(info), "fingerprint", buf);
+        metrics_label(info, sizeof(info), "kernel", hi->kernel);
+        metrics_label(info, sizeof(info), "cpu_model", hi->cpumodel);
+        metrics_label(info, sizeof(info), "microcode", hi->microcode);
+        metrics_label(info, sizeof(info), "governor", hi->governor);
+        metrics_label(info, sizeof(info), "turbo", hi->turbo > 0 ? "on" : hi->turbo == 0 ? "off" : "");
+        metrics_label(info, sizeof(info), "thp", hi->thp);
+        metrics_label(info, sizeof(info), "clocksource", hi->clocksource);
+        metrics_gauge(out, "vrunas_host_info", "Fingerprint of the environment of the run.", info, 1);
+    }
+    fputs("# EOF\n", out);
+}
+
+int metrics_write(const char * path, const metrics_run_t * run) {
+    char *  tmp;
+    FILE *  out;
+    int     fd, ret, errno_bak;
+    size_t  size = strlen(path) + 32;
+
+    /* same directory, not matching *.prom: ignored by the collector until renamed.
+     * A new file (O_EXCL), not one which would be there already or a symlink */
+    if ((tmp = malloc(size)) == NULL)
+        return -1;
+    snprintf(tmp, size, "%s.XXXXXX", path);
+    if ((fd = mkstemp(tmp)) < 0) {
+        free(tmp);
+        return -1;
+    }
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) != 0 || fchmod(fd, 0644) != 0
+    ||  (out = fdopen(fd, "w")) == NULL) {
+        errno_bak = errno;
+        close(fd);
+        unlink(tmp);
+        free(tmp);
+        errno = errno_bak;
+        return -1;
+    }
+    metrics_print(out, run);
+    ret = fflush(out) != 0 || ferror(out) || fsync(fd) != 0 ? -1 : 0;
+    errno_bak = errno;
+    if (fclose(out) != 0 && ret == 0 && (ret = -1))
+        errno_bak = errno;
+    if (ret == 0 && rename(tmp, path) != 0 && (ret = -1))
+        errno_bak = errno;
+    if (ret != 0)
+        unlink(tmp);
+    free(tmp);
+    errno = errno_bak;
+    return ret;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Final metrics of a run in the OpenMetrics text format, for the textfile
+ * collector of node_exporter.
+ */
+#ifndef VRUNAS_METRICS_H
+#define VRUNAS_METRICS_H
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "delayacct.h"
+#include "syscount.h"
+#include "heapprof.h"
+#include "phasestat.h"
+#include "energy.h"
+#include "hostinfo.h"
+
+typedef struct {
+    const char *            program;        /* argv[0] of the program, job label */
+    uid_t                   uid;            /* identity of the program */
+    gid_t                   gid;
+    int                     status;         /* of waitpid() */
+    struct timespec         real;
+    const struct rusage *   rusage;         /* of the terminated children */
+    /* counters of the enabled options, or NULL */
+    const delayacct_t *     delayacct;
+    const syscount_t *      syscount;
+    const heapprof_t *      heapprof;
+    const phasestat_t *     phasestat;
+    const energy_t *        energy;
+    const hostinfo_t *      host;           /* fingerprint of the host, or NULL */
+} metrics_run_t;
+
+/** metrics_write() : write the metrics of run to path, as gauges labeled with job,
+ * user, uid, group, gid, exit_code and exit_signal. The file is written to a
+ * temporary one in the same directory, then renamed, so that the collector never
+ * reads a partial file.
+ * @return 0 on success, -1 on error (errno set) */
+int metrics_write(const char * path, const metrics_run_t * run);
+
+#endif /* ! ifndef VRUNAS_METRICS_H */
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Measurement noise of a run: cpu used by the other tasks of the host on the
+ * cpus of a process tree, load, pressure stalls and interrupts, from linux /proc.
+ */
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "livestat.h"
+#include "noisestat.h"
+
+
+static const char * const s_psi_files[NOISESTAT_NPSI] = {
+    "/proc/pressure/cpu", "/proc/pressure/io", "/proc/pressure/memory"
+};
+
+static ssize_t noisestat_read(const char * path, char * buf, size_t size) {
+    ssize_t n;
+    int     fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    buf[n > 0 ? n : 0] = 0;
+    return n;
+}
+
+/* field of /proc/<pid>/stat, from 3 (state), s being after the command name */
+static const char * noisestat_field(const char * s, int field) {
+    for (s += 2; field > 3 && *s != 0; ++s) {
+        if (*s == ' ')
+            --field;
+    }
+    return s;
+}
+
+/* busy and total ticks of each cpu (/proc/stat) */
+static int noisestat_cpus(noisestat_t * ns, noisestat_cpu_t * cpus) {
+    char    line[512];
+    FILE *  file;
+
+    if ((file = fopen("/proc/stat", "re")) == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        unsigned long long  v[8] = { 0, };
+        int                 cpu;
+
+        if (strncmp(line, "cpu", 3) != 0)
+            break ;
+        if (sscanf(line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", &cpu,
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 5
+        ||  cpu < 0 || cpu >= ns->ncpus)
+            continue ;
+        /* user nice system idle iowait irq softirq steal, guest being in user */
+        cpus[cpu].busy = v[0] + v[1] + v[2] + v[5] + v[6] + v[7];
+        cpus[cpu].total = cpus[cpu].busy + v[3] + v[4];
+    }
+    fclose(file);
+    return 0;
+}
+
+/* interrupts of each cpu (/proc/interrupts, one column per online cpu), added to cpus */
+static void noisestat_irqs(noisestat_t * ns, noisestat_cpu_t * cpus) {
+    char *  line = NULL;
+    size_t  size = 0;
+    int *   columns = NULL;
+    int     ncolumns = 0;
+    FILE *  file;
+
+    if ((file = fopen("/proc/interrupts", "re")) == NULL)
+        return ;
+    if (getline(&line, &size, file) > 0 && (columns = calloc(ns->ncpus, sizeof(*columns))) != NULL) {
+        for (char * s = line; (s = strstr(s, "CPU")) != NULL && ncolumns < ns->ncpus; )
+            columns[ncolumns++] = strtol(s + 3, &s, 10);
+        while (getline(&line, &size, file) > 0) {
+            char * s = strchr(line, ':'), * end;
+
+            for (int col = 0; s != NULL && col < ncolumns; ++col, s = end) {
+                unsigned long long n = strtoull(s + 1, &end, 10);
+
+                if (end == s + 1)
+                    break ;
+                if (columns[col] >= 0 && columns[col] < ns->ncpus)
+                    cpus[columns[col]].irqs += n;
+            }
+        }
+    }
+    free(columns);
+    free(line);
+    fclose(file);
+}
+
+static void noisestat_psi(uint64_t * stall) {
+    char buf[512];
+    char * s;
+
+    for (int i = 0; i < NOISESTAT_NPSI; ++i) {
+        stall[i] = 0;
+        if (noisestat_read(s_psi_files[i], buf, sizeof(buf)) > 0
+        &&  strncmp(buf, "some ", 5) == 0 && (s = strstr(buf, "total=")) != NULL)
+            stall[i] = strtoull(s + 6, NULL, 10);
+    }
+}
+
+/* mark in ns->seen the cpu the thread last ran on */
+static void noisestat_sample_task(pid_t pid, pid_t tid, const char * stat, void * data) {
+    noisestat_t *   ns = data;
+    const char *    s;
+    int             cpu;
+
+    (void) pid;
+    (void) tid;
+    if ((s = strrchr(stat, ')')) != NULL && sscanf(noisestat_field(s, 39), "%d", &cpu) == 1
+    &&  cpu >= 0 && cpu < ns->ncpus)
+        ns->seen[cpu] = 1;
+}
+
+/* the other tasks used the cpus of the program for their busy ticks minus the ticks
+ * of the program: the program may have run elsewhere meanwhile, so it is an estimate */
+static void noisestat_sample(noisestat_t * ns) {
+    livestat_sample_t   sample;
+    uint64_t            program, obusy = 0, ototal = 0;
+    double              load;
+    char                buf[128];
+
+    for (int cpu = 0; cpu < ns->ncpus; ++cpu) {
+        ns->now[cpu] = ns->cpus[cpu];
+        ns->seen[cpu] = 0;
+    }
+    if (noisestat_cpus(ns, ns->now) != 0)
+        return ;
+    livestat_sample_tasks(ns->root, &sample, noisestat_sample_task, ns);
+    program = sample.cpu_ticks;
+    for (int cpu = 0; cpu < ns->ncpus; ++cpu) {
+        if (ns->seen[cpu]) {
+            obusy += ns->now[cpu].busy - ns->cpus[cpu].busy;
+            ototal += ns->now[cpu].total - ns->cpus[cpu].total;
+            ns->cpus[cpu].used = 1;
+        }
+        ns->cpus[cpu].busy = ns->now[cpu].busy;
+        ns->cpus[cpu].total = ns->now[cpu].total;
+    }
+    /* the tree is not readable anymore once reaped */
+    if (program >= ns->program) {
+        obusy = obusy > program - ns->program ? obusy - (program - ns->program) : 0;
+        ns->program = program;
+        ns->other += obusy;
+        ns->capacity += ototal;
+    }
+    if (noisestat_read("/proc/loadavg", buf, sizeof(buf)) > 0 && sscanf(buf, "%lf", &load) == 1
+    &&  load > ns->load[1])
+        ns->load[1] = load;
+    ++ns->nsamples;
+}
+
+static void * noisestat_thread(void * data) {
+    noisestat_t *   ns = data;
+    struct timespec ts = { 0, NOISESTAT_INTERVAL_MS * 1000000L };
+
+    while (!ns->stop) {
+        nanosleep(&ts, NULL);
+        if (ns->stop)
+            break ;
+        noisestat_sample(ns);
+    }
+    return NULL;
+}
+
+int noisestat_init(noisestat_t * ns) {
+    const char * run;
+
+    if ((ns->ncpus = sysconf(_SC_NPROCESSORS_CONF)) <= 0)
+        ns->ncpus = 1;
+    if ((ns->cpus = calloc(ns->ncpus, sizeof(*ns->cpus))) == NULL
+    ||  (ns->now = calloc(ns->ncpus, sizeof(*ns->now))) == NULL
+    ||  (ns->seen = calloc(ns->ncpus, sizeof(*ns->seen))) == NULL)
+        return -1;
+    if ((run = getenv(NOISESTAT_RUN_ENV)) != NULL) {
+        ns->run = strtoul(run, NULL, 10);
+        if (ns->run == 0)
+            ns->run = 1;
+        unsetenv(NOISESTAT_RUN_ENV);
+    }
+    return 0;
+}
+
+int noisestat_start(noisestat_t * ns, pid_t pid) {
+    char buf[128];
+
+    ns->root = pid;
+    ns->stop = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ns->start);
+    memset(ns->cpus, 0, ns->ncpus * sizeof(*ns->cpus));
+    if (noisestat_cpus(ns, ns->cpus) != 0)
+        return -1;
+    noisestat_irqs(ns, ns->cpus);
+    noisestat_psi(ns->stall);
+    ns->psi = access(s_psi_files[NOISESTAT_PSI_CPU], R_OK) == 0;
+    if (noisestat_read("/proc/loadavg", buf, sizeof(buf)) > 0)
+        sscanf(buf, "%lf", &ns->load[0]);
+    ns->load[1] = ns->load[0];
+    if ((errno = pthread_create(&ns->thread, NULL, noisestat_thread, ns)) != 0)
+        return -1;
+    ns->running = 1;
+    return 0;
+}
+
+void noisestat_stop(noisestat_t * ns) {
+    uint64_t        stall[NOISESTAT_NPSI];
+    struct timespec now;
+
+    if (!ns->running)
+        return ;
+    ns->stop = 1;
+    pthread_join(ns->thread, NULL);
+    ns->running = 0;
+    noisestat_sample(ns);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns->duration.tv_sec = now.tv_sec - ns->start.tv_sec;
+    if ((ns->duration.tv_nsec = now.tv_nsec - ns->start.tv_nsec) < 0) {
+        --ns->duration.tv_sec;
+        ns->duration.tv_nsec += 1000000000L;
+    }
+    for (int cpu = 0; cpu < ns->ncpus; ++cpu)
+        ns->now[cpu].irqs = 0;
+    noisestat_irqs(ns, ns->now);
+    for (int cpu = 0; cpu < ns->ncpus; ++cpu) {
+        if (ns->cpus[cpu].used && ns->now[cpu].irqs >= ns->cpus[cpu].irqs)
+            ns->irqs += ns->now[cpu].irqs - ns->cpus[cpu].irqs;
+    }
+    noisestat_psi(stall);
+    for (int i = 0; i < NOISESTAT_NPSI; ++i)
+        ns->stall[i] = stall[i] >= ns->stall[i] ? stall[i] - ns->stall[i] : 0;
+}
+
+double noisestat_noise(const noisestat_t * ns) {
+    return ns->capacity > 0 ? 100.0 * ns->other / ns->capacity : 0.0;
+}
+
+int noisestat_contaminated(const noisestat_t * ns) {
+    return noisestat_noise(ns) > ns->max;
+}
+
+void noisestat_report(FILE * out, const noisestat_t * ns) {
+    double  seconds = ns->duration.tv_sec + ns->duration.tv_nsec / 1e9;
+    long    hz = sysconf(_SC_CLK_TCK);
+    int     ncpus = 0;
+
+    for (int cpu = 0; cpu < ns->ncpus; ++cpu)
+        ncpus += ns->cpus[cpu].used;
+    fprintf(out, "noise    %13.2f (percent of the cpus of the program used by other tasks: %.2f seconds "
+                 "on %d cpu%s, max %g: %s",
+            noisestat_noise(ns), hz > 0 ? (double) ns->other / hz : 0.0, ncpus, ncpus > 1 ? "s" : "",
+            ns->max, noisestat_contaminated(ns) ? "contaminated" : "clean");
+    if (ns->reruns > 0 || ns->run > 1)
+        fprintf(out, ", run %u of at most %u", ns->run, ns->reruns + 1);
+    fprintf(out, ")\n"
+                 "loadavg  %13.2f (maximum load average of 1 minute during the run, %.2f at start)\n",
+            ns->load[1], ns->load[0]);
+    if (ns->psi) {
+        fprintf(out, "pressure %13llu (microseconds some tasks of the host were stalled on cpu "
+                                         "during the run, on io %llu, on memory %llu)\n",
+                (unsigned long long) ns->stall[NOISESTAT_PSI_CPU],
+                (unsigned long long) ns->stall[NOISESTAT_PSI_IO],
+                (unsigned long long) ns->stall[NOISESTAT_PSI_MEMORY]);
+    }
+    fprintf(out, "irqs     %13llu (interrupts on the cpus of the program during the run, %.0f per second)\n",
+            (unsigned long long) ns->irqs, seconds > 0 ? ns->irqs / seconds : 0.0);
+}
+
+void noisestat_free(noisestat_t * ns) {
+    if (ns->running) {
+        ns->stop = 1;
+        pthread_join(ns->thread, NULL);
+        ns->running = 0;
+    }
+    free(ns->cpus);
+    ns->cpus = NULL;
+    free(ns->now);
+    ns->now = NULL;
+    free(ns->seen);
+    ns->seen = NULL;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Measurement noise of a run: cpu used by the other tasks of the host on the
+ * cpus of a process tree, load, pressure stalls and interrupts, from linux /proc.
+ */
+#ifndef VRUNAS_NOISESTAT_H
+#define VRUNAS_NOISESTAT_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define NOISESTAT_INTERVAL_MS   100
+#define NOISESTAT_DEFAULT_MAX   5.0     /* percent of the cpus of the program used by other tasks */
+#define NOISESTAT_RUN_ENV       "VRUNAS_NOISE_RUN"  /* number of the run, given to the runs again */
+
+enum {
+    NOISESTAT_PSI_CPU = 0,
+    NOISESTAT_PSI_IO,
+    NOISESTAT_PSI_MEMORY,
+    NOISESTAT_NPSI
+};
+
+typedef struct {
+    uint64_t            busy;           /* ticks not idle nor iowait (/proc/stat) */
+    uint64_t            total;
+    uint64_t            irqs;           /* interrupts (/proc/interrupts) */
+    unsigned char       used;           /* the program ran on the cpu during the run */
+} noisestat_cpu_t;
+
+typedef struct {
+    double              max;            /* contaminated over max percent */
+    unsigned int        reruns;         /* runs again while contaminated */
+    unsigned int        run;            /* number of this run, from 1 */
+    int                 ncpus;
+    noisestat_cpu_t *   cpus;
+    noisestat_cpu_t *   now;            /* counters read by the current sample */
+    unsigned char *     seen;           /* cpus of the program at the current sample */
+    pid_t               root;
+    uint64_t            program;        /* ticks of the tree at the last sample */
+    uint64_t            other;          /* ticks of other tasks on the cpus of the program */
+    uint64_t            capacity;       /* ticks of the cpus of the program */
+    uint64_t            irqs;           /* interrupts on the cpus of the program */
+    double              load[2];        /* load average at start, maximum during the run */
+    int                 psi;            /* pressure stall information available */
+    uint64_t            stall[NOISESTAT_NPSI];  /* 'some' stalled microseconds */
+    struct timespec     start;
+    struct timespec     duration;
+    unsigned long       nsamples;
+    int                 running;
+    volatile int        stop;
+    pthread_t           thread;
+} noisestat_t;
+
+#define NOISESTAT_INITIALIZER { NOISESTAT_DEFAULT_MAX, 0, 1, 0, NULL, NULL, NULL, -1, 0, 0, 0, 0, \
+                                { 0.0, 0.0 }, 0, { 0, }, { 0, 0 }, { 0, 0 }, 0, 0, 0, }
+
+/** noisestat_init() : get the number of cpus and the number of this run from the
+ * environment (removed so that the program does not see it).
+ * @return 0 on success, -1 on error (errno set) */
+int noisestat_init(noisestat_t * ns);
+
+/** noisestat_start() : take the counters of the host and start sampling the cpus
+ * used by pid and by its children */
+int noisestat_start(noisestat_t * ns, pid_t pid);
+
+/** noisestat_stop() : stop sampling after a last sample. To be called once pid is
+ * terminated but not reaped yet (waitid(WNOWAIT)), so that its ticks are readable */
+void noisestat_stop(noisestat_t * ns);
+
+/** noisestat_noise() : percent of the capacity of the cpus of the program used by
+ * other tasks during the run */
+double noisestat_noise(const noisestat_t * ns);
+
+/** noisestat_contaminated() : @return 1 if the noise of the run is over ns->max, or 0 */
+int noisestat_contaminated(const noisestat_t * ns);
+
+/** noisestat_report() : print the noise, load, pressure stalls and interrupts
+ * of the run (extended timings format) */
+void noisestat_report(FILE * out, const noisestat_t * ns);
+
+/** noisestat_free() : release resources of ns (not ns itself), stopping it if needed */
+void noisestat_free(noisestat_t * ns);
+
+#endif /* ! ifndef VRUNAS_NOISESTAT_H */
@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Page cache control (cold/warm runs) and residency of files.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pagecache.h"
+
+#define PGC_DROP_CACHES     "/proc/sys/vm/drop_caches"
+#define PGC_MINCORE_CHUNK   4096    /* pages per mincore() call */
+#define PGC_READ_BUFSZ      65536
+
+#ifdef __linux__
+typedef unsigned char mincore_vec_t;
+#else
+typedef char mincore_vec_t;
+#endif
+
+int pagecache_parse_mode(const char * str, pagecache_mode_t * mode) {
+    if (str == NULL || mode == NULL)
+        return -1;
+    if (strcmp(str, "cold") == 0)
+        *mode = PGC_COLD;
+    else if (strcmp(str, "warm") == 0)
+        *mode = PGC_WARM;
+    else if (strcmp(str, "asis") == 0)
+        *mode = PGC_ASIS;
+    else
+        return -1;
+    return 0;
+}
+
+int pagecache_add(pagecache_t * pgc, const char * path) {
+    pagecache_file_t * files;
+
+    if (pgc == NULL || path == NULL)
+        return -1;
+    for (unsigned int i = 0; i < pgc->count; ++i) {
+        if (strcmp(pgc->files[i].path, path) == 0)
+            return 0;
+    }
+    if (pgc->count >= pgc->capacity) {
+        unsigned int capacity = pgc->capacity ? pgc->capacity * 2 : 16;
+        if ((files = realloc(pgc->files, capacity * sizeof(*files))) == NULL)
+            return -1;
+        pgc->files = files;
+        pgc->capacity = capacity;
+    }
+    memset(&pgc->files[pgc->count], 0, sizeof(*pgc->files));
+    if ((pgc->files[pgc->count].path = strdup(path)) == NULL)
+        return -1;
+    ++pgc->count;
+    return 0;
+}
+
+int pagecache_fd_residency(int fd, off_t offset, off_t length, size_t * pages, size_t * resident,
+                           pagecache_range_callback_t callback, void * user_data) {
+    long            pagesz = sysconf(_SC_PAGESIZE);
+    mincore_vec_t   vec[PGC_MINCORE_CHUNK];
+    struct stat     st;
+    void *          map;
+    off_t           end;
+    size_t          npages, nresident = 0, run = 0;
+    int             ret = 0;
+
+    if (pages != NULL)
+        *pages = 0;
+    if (resident != NULL)
+        *resident = 0;
+    if (fstat(fd, &st) < 0)
+        return errno;
+    end = (length == 0 || offset + length > st.st_size) ? st.st_size : offset + length;
+    offset -= offset % pagesz;
+    if (offset >= end)
+        return 0;
+#   ifdef __linux__
+    /* since linux 5.2, mincore() reports every page as resident unless the caller owns
+     * the file or can write it (side channel on the page cache of other users) */
+    if (geteuid() != 0 && st.st_uid != geteuid()) {
+        char procfd[32];
+
+        snprintf(procfd, sizeof(procfd), "/proc/self/fd/%d", fd);
+        if (faccessat(AT_FDCWD, procfd, W_OK, AT_EACCESS) != 0) {
+            if (pages != NULL)
+                *pages = (end - offset + pagesz - 1) / pagesz;
+            return EPERM;
+        }
+    }
+#   endif
+    if ((map = mmap(NULL, end - offset, PROT_READ, MAP_SHARED, fd, offset)) == MAP_FAILED)
+        return errno;
+    npages = (end - offset + pagesz - 1) / pagesz;
+    for (size_t page = 0; page < npages && ret == 0; page += PGC_MINCORE_CHUNK) {
+        size_t n = npages - page > PGC_MINCORE_CHUNK ? PGC_MINCORE_CHUNK : npages - page;
+        if (mincore((char *) map + page * pagesz, n * pagesz, vec) < 0) {
+            ret = errno;
+            break ;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if ((vec[i] & 1) != 0) {
+                ++nresident;
+                ++run;
+            } else if (run > 0) {
+                if (callback != NULL && callback(offset + (off_t) (page + i - run) * pagesz,
+                                                 (off_t) run * pagesz, user_data) != 0)
+                    callback = NULL;
+                run = 0;
+            }
+        }
+    }
+    if (ret == 0 && run > 0 && callback != NULL)
+        callback(offset + (off_t) (npages - run) * pagesz, (off_t) run * pagesz, user_data);
+    munmap(map, end - offset);
+    if (pages != NULL)
+        *pages = npages;
+    if (resident != NULL)
+        *resident = nresident;
+    return ret;
+}
+
+/* count pages of file which are in page cache, without loading them */
+static int pagecache_file_residency(const char * path, size_t * pages, size_t * resident) {
+    int fd, ret;
+
+    *pages = *resident = 0;
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return errno;
+    ret = pagecache_fd_residency(fd, 0, 0, pages, resident, NULL, NULL);
+    close(fd);
+    return ret;
+}
+
+void pagecache_residency(pagecache_t * pgc, pagecache_step_t step) {
+    if (pgc == NULL || step >= PGC_NSTEPS)
+        return ;
+    for (unsigned int i = 0; i < pgc->count; ++i) {
+        pagecache_file_t * file = &pgc->files[i];
+        file->error[step] = pagecache_file_residency(file->path, &file->pages, &file->resident[step]);
+    }
+}
+
+static int pagecache_evict(int fd) {
+#   ifdef POSIX_FADV_DONTNEED
+    /* dirty pages cannot be dropped, write them first */
+    fdatasync(fd);
+    return posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0 ? 0 : -1;
+#   else
+    struct stat st;
+    void *      map;
+    int         ret;
+
+    if (fstat(fd, &st) < 0)
+        return -1;
+    if (st.st_size == 0)
+        return 0;
+    if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        return -1;
+    ret = msync(map, st.st_size, MS_INVALIDATE);
+    munmap(map, st.st_size);
+    return ret;
+#   endif
+}
+
+int pagecache_load_range(int fd, off_t offset, off_t length) {
+    struct stat st;
+    size_t      pages, resident;
+    char *      buf;
+    ssize_t     n = 0;
+
+    if (fstat(fd, &st) < 0)
+        return -1;
+    if (length == 0 || offset + length > st.st_size)
+        length = st.st_size > offset ? st.st_size - offset : 0;
+    if (length == 0)
+        return 0;
+#   ifdef __linux__
+    /* readahead() does nothing if the device has its read_ahead_kb at 0: check it */
+    if (readahead(fd, offset, length) == 0
+    &&  pagecache_fd_residency(fd, offset, length, &pages, &resident, NULL, NULL) == 0 && resident >= pages)
+        return 0;
+#   else
+    (void) pages;
+    (void) resident;
+#   endif
+    /* read the range */
+    if ((buf = malloc(PGC_READ_BUFSZ)) == NULL)
+        return -1;
+    while (length > 0 && (n = pread(fd, buf, length > PGC_READ_BUFSZ ? PGC_READ_BUFSZ : length, offset)) > 0) {
+        offset += n;
+        length -= n;
+    }
+    free(buf);
+    return n < 0 ? -1 : 0;
+}
+
+int pagecache_prepare(pagecache_t * pgc) {
+    int nerrors = 0;
+
+    if (pgc == NULL || pgc->mode == PGC_ASIS)
+        return 0;
+    pgc->dropped = 0;
+    if (pgc->mode == PGC_COLD && geteuid() == 0) {
+        int fd;
+        sync();
+        if ((fd = open(PGC_DROP_CACHES, O_WRONLY)) >= 0) {
+            pgc->dropped = (write(fd, "1\n", 2) == 2);
+            close(fd);
+        }
+    }
+    for (unsigned int i = 0; i < pgc->count; ++i) {
+        int fd, ret;
+
+        if ((fd = open(pgc->files[i].path, O_RDONLY)) < 0) {
+            ++nerrors;
+            continue ;
+        }
+        ret = pgc->mode == PGC_COLD ? pagecache_evict(fd) : pagecache_load_range(fd, 0, 0);
+        close(fd);
+        if (ret != 0)
+            ++nerrors;
+    }
+    return nerrors;
+}
+
+void pagecache_report(FILE * out, const pagecache_t * pgc) {
+    static const char * const modes[] = { "asis", "cold", "warm" };
+    static const char * const steps[] = { "initial", "start", "end" };
+
+    if (out == NULL || pgc == NULL)
+        return ;
+    fprintf(out, "pgcache  %13s (page cache mode: %s)\n", modes[pgc->mode],
+            pgc->mode == PGC_COLD
+            ? (pgc->dropped ? "files evicted with posix_fadvise(DONTNEED) and drop_caches"
+                            : "files evicted with posix_fadvise(DONTNEED)")
+            : pgc->mode == PGC_WARM ? "files loaded with readahead()" : "page cache untouched");
+    fprintf(out, "pgcache  %8s %8s %8s %9s (resident pages in %% at initial, start and end of run)\n",
+            steps[PGC_INITIAL], steps[PGC_START], steps[PGC_END], "pages");
+    for (unsigned int i = 0; i < pgc->count; ++i) {
+        const pagecache_file_t * file = &pgc->files[i];
+
+        fprintf(out, "pgcache ");
+        for (unsigned int step = 0; step < PGC_NSTEPS; ++step) {
+            if (file->error[step] != 0)
+                fprintf(out, " %8s", "n/a");
+            else
+                fprintf(out, " %7.1f%%", file->pages == 0 ? 100.0
+                                         : 100.0 * file->resident[step] / file->pages);
+        }
+        fprintf(out, " %9lu %s\n", (unsigned long) file->pages, file->path);
+    }
+}
+
+void pagecache_free(pagecache_t * pgc) {
+    if (pgc == NULL)
+        return ;
+    for (unsigned int i = 0; i < pgc->count; ++i) {
+        free(pgc->files[i].path);
+    }
+    free(pgc->files);
+    pgc->files = NULL;
+    pgc->count = pgc->capacity = 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Page cache control (cold/warm runs) and residency of files.
+ */
+#ifndef VRUNAS_PAGECACHE_H
+#define VRUNAS_PAGECACHE_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stddef.h>
+
+typedef enum {
+    PGC_ASIS = 0,               /* page cache untouched */
+    PGC_COLD,                   /* files evicted from page cache before run */
+    PGC_WARM,                   /* files read in page cache before run */
+} pagecache_mode_t;
+
+typedef enum {
+    PGC_INITIAL = 0,            /* residency before cold/warm preparation */
+    PGC_START,                  /* residency at start of run */
+    PGC_END,                    /* residency at end of run */
+    PGC_NSTEPS
+} pagecache_step_t;
+
+typedef struct {
+    char *              path;
+    size_t              pages;
+    size_t              resident[PGC_NSTEPS];
+    int                 error[PGC_NSTEPS];  /* errno of residency query, 0 if ok */
+} pagecache_file_t;
+
+typedef struct {
+    pagecache_file_t *  files;
+    unsigned int        count;
+    unsigned int        capacity;
+    pagecache_mode_t    mode;
+    int                 dropped;            /* 1 if /proc/sys/vm/drop_caches was used */
+} pagecache_t;
+
+#define PAGECACHE_INITIALIZER { NULL, 0, 0, PGC_ASIS, 0 }
+
+/** pagecache_parse_mode() : parse 'cold', 'warm' or 'asis'. @return 0 or -1 on error */
+int pagecache_parse_mode(const char * str, pagecache_mode_t * mode);
+
+/** pagecache_add() : add a file (once) to the list of files managed. @return 0 or -1 on error */
+int pagecache_add(pagecache_t * pgc, const char * path);
+
+/** pagecache_residency() : update residency of all files for the given step */
+void pagecache_residency(pagecache_t * pgc, pagecache_step_t step);
+
+/** pagecache_prepare() : evict (cold) or load (warm) files according to pgc->mode.
+ * Cold mode uses posix_fadvise(DONTNEED) on each file, plus drop_caches when root.
+ * @return 0 on success or number of files which could not be handled */
+int pagecache_prepare(pagecache_t * pgc);
+
+/** pagecache_report() : print residency of files (extended timings format) */
+void pagecache_report(FILE * out, const pagecache_t * pgc);
+
+/** callback of pagecache_fd_residency(), return non-zero to stop calling it */
+typedef int (*pagecache_range_callback_t)(off_t offset, off_t length, void * user_data);
+
+/** pagecache_fd_residency() : count pages of [offset, offset+length) of fd (length 0:
+ * up to end of file) which are in page cache, without loading them, and give each run of
+ * resident pages to callback if not NULL.
+ * @return 0 on success or errno (EPERM on linux if the file is neither owned nor
+ *         writable by the caller, mincore() not telling its residency) */
+int pagecache_fd_residency(int fd, off_t offset, off_t length, size_t * pages, size_t * resident,
+                           pagecache_range_callback_t callback, void * user_data);
+
+/** pagecache_load_range() : load [offset, offset+length) of fd (length 0: up to end of file)
+ * in page cache with readahead(), reading it when readahead() is not effective.
+ * @return 0 on success, -1 on error (errno set) */
+int pagecache_load_range(int fd, off_t offset, off_t length);
+
+/** pagecache_free() : release resources of pgc (not pgc itself) */
+void pagecache_free(pagecache_t * pgc);
+
+#endif /* ! ifndef VRUNAS_PAGECACHE_H */
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Helpers of linux perf_event_open() shared by the profilers: synchronization of
+ * the child with its events, tracepoints of tracefs, per-cpu events and their rings.
+ */
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#ifdef __linux__
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+#endif
+
+#include "perfevent.h"
+
+int perfevent_sync_init(int syncfd[2]) {
+    if (pipe(syncfd) != 0)
+        return -1;
+    /* the program must not inherit them */
+    fcntl(syncfd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(syncfd[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+int perfevent_sync_wait(int syncfd[2]) {
+    char    c;
+    ssize_t n;
+
+    if (syncfd[0] < 0)
+        return 0;
+    close(syncfd[1]);
+    syncfd[1] = -1;
+    /* one byte once the events are ready, or EOF if the father is gone */
+    while ((n = read(syncfd[0], &c, 1)) < 0 && errno == EINTR)
+        ; /* nothing */
+    close(syncfd[0]);
+    syncfd[0] = -1;
+    return n < 0 ? -1 : 0;
+}
+
+void perfevent_sync_release(int syncfd[2]) {
+    if (syncfd[1] >= 0) {
+        while (write(syncfd[1], "", 1) < 0 && errno == EINTR)
+            ; /* nothing */
+        close(syncfd[1]);
+        syncfd[1] = -1;
+    }
+    if (syncfd[0] >= 0) {
+        close(syncfd[0]);
+        syncfd[0] = -1;
+    }
+}
+
+void perfevent_record_copy(const perfevent_record_t * rec, size_t offset, void * dst, size_t len) {
+    size_t pos = (rec->offset + offset) & (rec->size - 1);
+    size_t first = len < rec->size - pos ? len : rec->size - pos;
+
+    memcpy(dst, rec->data + pos, first);
+    if (first < len)
+        memcpy((char *) dst + first, rec->data, len - first);
+}
+
+#ifndef __linux__
+
+int perfevent_tracepoint(const char * event, uint64_t * id, const char * field,
+                         unsigned int * offset, unsigned int * size) {
+    (void) event;
+    (void) id;
+    (void) field;
+    (void) offset;
+    (void) size;
+    errno = ENOSYS;
+    return -1;
+}
+
+int perfevent_open(struct perf_event_attr * attr, pid_t pid, int cpu) {
+    (void) attr;
+    (void) pid;
+    (void) cpu;
+    errno = ENOSYS;
+    return -1;
+}
+
+void * perfevent_mmap(int fd, size_t * npages, int first) {
+    (void) fd;
+    (void) npages;
+    (void) first;
+    errno = ENOSYS;
+    return NULL;
+}
+
+void perfevent_munmap(void * ring, size_t size) {
+    (void) ring;
+    (void) size;
+}
+
+void perfevent_read_ring(void * ring, size_t size, perfevent_callback_t callback, void * user_data) {
+    (void) ring;
+    (void) size;
+    (void) callback;
+    (void) user_data;
+}
+
+#else /* __linux__ */
+
+int perfevent_tracepoint(const char * event, uint64_t * id, const char * field,
+                         unsigned int * offset, unsigned int * size) {
+    static const char * const   tracefs[] = { "/sys/kernel/tracing", "/sys/kernel/debug/tracing" };
+    char                        path[PATH_MAX], line[256];
+    FILE *                      f = NULL;
+    unsigned long long          value;
+    unsigned int                i;
+    int                         errno_first = 0;
+
+    for (i = 0; i < sizeof(tracefs) / sizeof(*tracefs); ++i) {
+        snprintf(path, sizeof(path), "%s/events/%s/id", tracefs[i], event);
+        if ((f = fopen(path, "r")) != NULL)
+            break ;
+        if (errno_first == 0)
+            errno_first = errno;
+    }
+    if (f == NULL) {
+        errno = errno_first; /* tracefs not mounted, or not root */
+        return -1;
+    }
+    if (fscanf(f, "%llu", &value) != 1) {
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+    fclose(f);
+    *id = value;
+    if (field == NULL)
+        return 0;
+
+    /* field:long prev_state;	offset:32;	size:8;	signed:1; */
+    snprintf(path, sizeof(path), "%s/events/%s/format", tracefs[i], event);
+    if ((f = fopen(path, "r")) == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        unsigned int    fieldoff, fieldsize;
+        const char *    s;
+
+        if ((s = strstr(line, field)) != NULL && s[strlen(field)] == ';'
+        &&  (s = strstr(line, "offset:")) != NULL && sscanf(s, "offset:%u; size:%u;", &fieldoff, &fieldsize) == 2) {
+            *offset = fieldoff;
+            if (size != NULL)
+                *size = fieldsize;
+            break ;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+int perfevent_open(struct perf_event_attr * attr, pid_t pid, int cpu) {
+    int fd;
+
+    while ((fd = syscall(__NR_perf_event_open, attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC)) < 0) {
+        if (attr->type == PERF_TYPE_HARDWARE && (errno == ENOENT || errno == EOPNOTSUPP)) {
+            /* no cpu cycles counter (virtual machine, ...) */
+            attr->type = PERF_TYPE_SOFTWARE;
+            attr->config = PERF_COUNT_SW_CPU_CLOCK;
+        } else if (attr->type != PERF_TYPE_TRACEPOINT && !attr->exclude_kernel
+                   && (errno == EACCES || errno == EPERM)) {
+            /* kernel.perf_event_paranoid: user space only */
+            attr->exclude_kernel = 1;
+        } else {
+            return -1;
+        }
+    }
+    return fd;
+}
+
+void * perfevent_mmap(int fd, size_t * npages, int first) {
+    long    pagesize = sysconf(_SC_PAGESIZE);
+    void *  ring;
+
+    while ((ring = mmap(NULL, (*npages + 1) * pagesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))
+                == MAP_FAILED && errno == EPERM && first && *npages > PERFEVENT_RING_MINPAGES)
+        *npages /= 2;
+    return ring == MAP_FAILED ? NULL : ring;
+}
+
+void perfevent_munmap(void * ring, size_t size) {
+    munmap(ring, size + sysconf(_SC_PAGESIZE));
+}
+
+void perfevent_read_ring(void * ring, size_t size, perfevent_callback_t callback, void * user_data) {
+    struct perf_event_mmap_page *   meta = ring;
+    perfevent_record_t              rec = { (const char *) ring + sysconf(_SC_PAGESIZE), size, meta->data_tail };
+    uint64_t                        head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+
+    while (rec.offset + sizeof(struct perf_event_header) <= head) {
+        struct perf_event_header hdr;
+
+        perfevent_record_copy(&rec, 0, &hdr, sizeof(hdr));
+        if (hdr.size < sizeof(hdr) || rec.offset + hdr.size > head)
+            break ;
+        callback(&hdr, &rec, user_data);
+        rec.offset += hdr.size;
+    }
+    __atomic_store_n(&meta->data_tail, rec.offset, __ATOMIC_RELEASE);
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Helpers of linux perf_event_open() shared by the profilers: synchronization of
+ * the child with its events, tracepoints of tracefs, per-cpu events and their rings.
+ */
+#ifndef VRUNAS_PERFEVENT_H
+#define VRUNAS_PERFEVENT_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#define PERFEVENT_RING_MINPAGES 8       /* when locked memory is limited (perf_event_mlock_kb) */
+
+struct perf_event_attr;
+struct perf_event_header;
+
+/** a record of a ring, possibly wrapping around its end */
+typedef struct {
+    const char *        data;           /* data pages of the ring */
+    size_t              size;           /* size of the data pages, power of 2 */
+    uint64_t            offset;         /* position of the record */
+} perfevent_record_t;
+
+/** callback of perfevent_read_ring(), for each record of the ring */
+typedef void (*perfevent_callback_t)(const struct perf_event_header * hdr, const perfevent_record_t * rec,
+                                     void * user_data);
+
+/** perfevent_sync_init() : create the pipe on which the child waits for its events.
+ * To be called before fork().
+ * @return 0 on success, -1 on error (errno set) */
+int perfevent_sync_init(int syncfd[2]);
+
+/** perfevent_sync_wait() : to be called by the child before execve(): wait for
+ * the father to have set up the events, or to be gone. Nothing done if no pipe.
+ * @return 0 on success, -1 on error (errno set) */
+int perfevent_sync_wait(int syncfd[2]);
+
+/** perfevent_sync_release() : release the child waiting in perfevent_sync_wait() */
+void perfevent_sync_release(int syncfd[2]);
+
+/** perfevent_tracepoint() : get the id of the tracepoint '<system>/<name>' of tracefs,
+ * and the offset and size of a field of its raw data if field is not NULL. offset and
+ * size are left unchanged if the format cannot be read or has not the field.
+ * @param field the name of the field preceded by a space, eg " prev_state"
+ * @return 0 on success, -1 on error (errno set: tracefs not mounted, or not root) */
+int perfevent_tracepoint(const char * event, uint64_t * id, const char * field,
+                         unsigned int * offset, unsigned int * size);
+
+/** perfevent_open() : open an event of pid on cpu. Without cycle counter, cpu-clock is
+ * used, and with kernel.perf_event_paranoid, only user space is sampled (attr updated).
+ * @return the event descriptor, -1 on error (errno set) */
+int perfevent_open(struct perf_event_attr * attr, pid_t pid, int cpu);
+
+/** perfevent_mmap() : map the ring of an event, with *npages data pages (power of 2).
+ * The first ring of a set is made smaller down to PERFEVENT_RING_MINPAGES when locked
+ * memory is limited, *npages giving the size of the following ones.
+ * @return the ring, NULL on error (errno set) */
+void * perfevent_mmap(int fd, size_t * npages, int first);
+
+/** perfevent_munmap() : unmap a ring of size bytes of data pages */
+void perfevent_munmap(void * ring, size_t size);
+
+/** perfevent_read_ring() : give the records available in a ring to callback, and
+ * release their space */
+void perfevent_read_ring(void * ring, size_t size, perfevent_callback_t callback, void * user_data);
+
+/** perfevent_record_copy() : copy len bytes at offset of a record, it can wrap around
+ * the end of the ring */
+void perfevent_record_copy(const perfevent_record_t * rec, size_t offset, void * dst, size_t len);
+
+#endif /* ! ifndef VRUNAS_PERFEVENT_H */
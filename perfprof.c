@@ -0,0 +1,964 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Sampling profiler of a process tree with linux perf_event_open(), on cpu
+ * or off cpu (sched_switch), writing folded stacks for flamegraph tools.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef __linux__
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+#endif
+
+#include "elfutil.h"
+#include "perfevent.h"
+#include "perfprof.h"
+
+/* indexed by mode bit, gives the suffix of the folded file */
+static const char * const s_perfprof_modes[PERFPROF_NMODES] = { "cpu", "offcpu" };
+
+int perfprof_parse_modes(const char * str, int * modes) {
+    *modes = 0;
+    while (*str) {
+        size_t  len = strcspn(str, ",");
+        int     index;
+
+        for (index = 0; index < PERFPROF_NMODES; ++index) {
+            if (strlen(s_perfprof_modes[index]) == len && strncmp(str, s_perfprof_modes[index], len) == 0)
+                break ;
+        }
+        if (index < PERFPROF_NMODES)
+            *modes |= 1 << index;
+        else if (len == 4 && strncmp(str, "heap", len) == 0)
+            *modes |= PERFPROF_HEAP;    /* done by heapprof, with the preload library */
+        else
+            return -1;
+        str += len;
+        if (*str == ',')
+            ++str;
+    }
+    return *modes != 0 ? 0 : -1;
+}
+
+int perfprof_init(perfprof_t * pp) {
+    return perfevent_sync_init(pp->syncfd);
+}
+
+int perfprof_child(perfprof_t * pp) {
+    return perfevent_sync_wait(pp->syncfd);
+}
+
+void perfprof_report(FILE * out, const perfprof_t * pp) {
+    const perfprof_data_t * cpu = &pp->data[0], * offcpu = &pp->data[1];
+
+    if ((pp->active & PERFPROF_CPU) != 0) {
+        fprintf(out, "profile  %13lu (cpu samples at %d Hz with %s, %lu lost, %lu stacks in %s.cpu.folded)\n",
+                cpu->nsamples, pp->freq, pp->event ? pp->event : "n/a", cpu->nlost, cpu->nstacks, pp->prefix);
+        for (unsigned int i = 0; i < PERFPROF_HOTSPOTS && cpu->hotspots[i].name != NULL; ++i) {
+            fprintf(out, "hotspot  %12.1f%% (%s, self)\n",
+                    cpu->total ? 100.0 * cpu->hotspots[i].count / cpu->total : 0.0, cpu->hotspots[i].name);
+        }
+    }
+    if ((pp->active & PERFPROF_OFFCPU) != 0) {
+        fprintf(out, "offcpu   % 3ld.%09ld (blocked time in %lu context switches, %lu lost, %lu stacks in %s.offcpu.folded)\n",
+                (long) (offcpu->total / 1000000000ULL), (long) (offcpu->total % 1000000000ULL),
+                offcpu->nsamples, offcpu->nlost, offcpu->nstacks, pp->prefix);
+        for (unsigned int i = 0; i < PERFPROF_HOTSPOTS && offcpu->hotspots[i].name != NULL; ++i) {
+            fprintf(out, "blocked  %12.1f%% (%s)\n",
+                    offcpu->total ? 100.0 * offcpu->hotspots[i].count / offcpu->total : 0.0,
+                    offcpu->hotspots[i].name);
+        }
+    }
+}
+
+#ifndef __linux__
+
+int perfprof_start(perfprof_t * pp, pid_t pid) {
+    (void) pid;
+    perfevent_sync_release(pp->syncfd);
+    errno = ENOSYS;
+    return -1;
+}
+
+void perfprof_stop(perfprof_t * pp) {
+    (void) pp;
+}
+
+int perfprof_write(perfprof_t * pp) {
+    (void) pp;
+    errno = ENOSYS;
+    return -1;
+}
+
+#else /* __linux__ */
+
+#define PERFPROF_RING_PAGES     128     /* data pages of the ring of each cpu, power of 2 */
+#define PERFPROF_READ_MS        20
+#define PERFPROF_MAX_DEPTH      64
+#define PERFPROF_LINE_MAX       16384
+
+/* the first member of the following structures is the time, see perfprof_cmp_time() */
+typedef struct {
+    uint64_t            time;
+    uint32_t            pid;
+    uint64_t            start;
+    uint64_t            len;
+    uint64_t            pgoff;
+    const char *        path;
+} perfprof_map_t;
+
+typedef struct {
+    uint64_t            time;
+    uint32_t            pid;
+    uint32_t            ppid;           /* fork: parent */
+} perfprof_task_t;
+
+typedef struct {
+    uint64_t            time;
+    uint32_t            pid;
+    uint32_t            tid;
+    const char *        comm;
+} perfprof_comm_t;
+
+typedef struct {
+    uint64_t            time;
+    uint32_t            tid;
+    const struct perf_event_header * hdr;   /* sched_switch sample, or switch-in record */
+} perfprof_switch_t;
+
+typedef struct {
+    const char *        path;
+    elf_symtab_t *      symtab;
+} perfprof_object_t;
+
+typedef struct {
+    uint64_t            addr;
+    char *              name;
+} perfprof_ksym_t;
+
+typedef struct {
+    perfprof_map_t *    maps;
+    unsigned int        nmaps, mapcapacity;
+    perfprof_task_t *   forks;
+    unsigned int        nforks, forkcapacity;
+    perfprof_task_t *   execs;
+    unsigned int        nexecs, execcapacity;
+    perfprof_comm_t *   comms;
+    unsigned int        ncomms, commcapacity;
+    perfprof_object_t * objects;
+    unsigned int        nobjects, objcapacity;
+    perfprof_ksym_t *   ksyms;          /* /proc/kallsyms, loaded on first kernel frame */
+    unsigned int        nksyms, ksymcapacity;
+    int                 ksymloaded;
+} perfprof_symctx_t;
+
+typedef struct {
+    char *              str;
+    uint64_t            value;
+} perfprof_line_t;
+
+typedef struct {
+    perfprof_line_t *   lines;          /* folded stacks */
+    unsigned int        nlines, linecapacity;
+    perfprof_line_t *   leaves;         /* last frames, for hotspots */
+    unsigned int        nleaves, leafcapacity;
+} perfprof_stacks_t;
+
+static void * perfprof_push(void * parray, unsigned int * count, unsigned int * capacity, size_t elsize) {
+    void ** array = parray;
+    char *  newarray;
+
+    if (*count >= *capacity) {
+        unsigned int newcapacity = *capacity ? *capacity * 2 : 64;
+        if ((newarray = realloc(*array, newcapacity * elsize)) == NULL)
+            return NULL;
+        *array = newarray;
+        *capacity = newcapacity;
+    }
+    newarray = *array;
+    memset(newarray + (*count) * elsize, 0, elsize);
+    return newarray + (*count)++ * elsize;
+}
+
+static int perfprof_cmp_time(const void * a, const void * b) {
+    uint64_t ta = *(const uint64_t *) a, tb = *(const uint64_t *) b;
+    return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+/* id of the sched_switch tracepoint, and position of prev_state in its raw data */
+static int perfprof_sched_switch(perfprof_t * pp, uint64_t * id) {
+    pp->stateoff = pp->statesize = 0;
+    if (perfevent_tracepoint("sched/sched_switch", id, " prev_state", &pp->stateoff, &pp->statesize) != 0)
+        return -1;
+    if (pp->statesize != 4 && pp->statesize != 8)
+        pp->statesize = 0;
+    return 0;
+}
+
+static void perfprof_record(const struct perf_event_header * hdr, const perfevent_record_t * rec, void * user_data) {
+    perfprof_data_t * pd = user_data;
+
+    switch (hdr->type) {
+        case PERF_RECORD_LOST: {
+            uint64_t lost[2]; /* id, lost */
+            perfevent_record_copy(rec, sizeof(*hdr), lost, sizeof(lost));
+            pd->nlost += lost[1];
+            break ;
+        }
+        case PERF_RECORD_SAMPLE:
+        case PERF_RECORD_MMAP2:
+        case PERF_RECORD_COMM:
+        case PERF_RECORD_FORK:
+        case PERF_RECORD_SWITCH:
+            if (pd->size + hdr->size > pd->capacity) {
+                size_t  capacity = pd->capacity ? pd->capacity * 2 : 1024 * 1024;
+                char *  records;
+                if ((records = realloc(pd->records, capacity)) == NULL) {
+                    ++pd->nlost;
+                    break ;
+                }
+                pd->records = records;
+                pd->capacity = capacity;
+            }
+            perfevent_record_copy(rec, 0, pd->records + pd->size, hdr->size);
+            pd->size += hdr->size;
+            if (hdr->type == PERF_RECORD_SAMPLE)
+                ++pd->nsamples;
+            break ;
+    }
+}
+
+static void * perfprof_thread(void * data) {
+    perfprof_t *    pp = data;
+    struct timespec ts = { 0, PERFPROF_READ_MS * 1000000L };
+
+    while (1) {
+        int stop = pp->stop;
+
+        for (unsigned int i = 0; i < pp->nfds; ++i)
+            perfevent_read_ring(pp->rings[i], pp->ringsize, perfprof_record, &pp->data[pp->fdmodes[i]]);
+        if (stop)
+            break ;
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+/* event attributes of the mode index, with mappings and tasks records if sideband */
+static int perfprof_attr(perfprof_t * pp, int index, int sideband, struct perf_event_attr * attr) {
+    uint64_t id;
+
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN;
+    if ((1 << index) == PERFPROF_OFFCPU) {
+        /* every switch out of a thread, with its kernel stack for the wait reason,
+         * and switch in records to measure the time off cpu */
+        if (perfprof_sched_switch(pp, &id) != 0)
+            return -1;
+        attr->type = PERF_TYPE_TRACEPOINT;
+        attr->config = id;
+        attr->sample_period = 1;
+        attr->sample_type |= PERF_SAMPLE_RAW;
+        attr->context_switch = 1;
+    } else {
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_CPU_CYCLES;
+        attr->freq = 1;
+        attr->sample_freq = pp->freq;
+        attr->exclude_callchain_kernel = 1;
+    }
+    attr->disabled = 1;
+    attr->enable_on_exec = 1;
+    attr->inherit = 1;              /* children and threads created later */
+    if (sideband) {
+        attr->mmap = 1;             /* executable mappings, to symbolize */
+        attr->mmap2 = 1;
+        attr->comm = 1;
+        attr->comm_exec = 1;
+        attr->task = 1;
+    }
+    attr->sample_id_all = 1;
+    attr->exclude_hv = 1;
+    return 0;
+}
+
+int perfprof_start(perfprof_t * pp, pid_t pid) {
+    struct perf_event_attr  attr;
+    long                    ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    long                    pagesize = sysconf(_SC_PAGESIZE);
+    size_t                  npages = PERFPROF_RING_PAGES;
+    int                     errno_first = 0, errno_mode = 0;
+
+    if (ncpus <= 0)
+        ncpus = 1;
+    if ((pp->fds = calloc(ncpus * PERFPROF_NMODES, sizeof(*pp->fds))) == NULL
+    ||  (pp->fdmodes = calloc(ncpus * PERFPROF_NMODES, sizeof(*pp->fdmodes))) == NULL
+    ||  (pp->rings = calloc(ncpus * PERFPROF_NMODES, sizeof(*pp->rings))) == NULL) {
+        perfevent_sync_release(pp->syncfd);
+        return -1;
+    }
+    for (int index = 0; index < PERFPROF_NMODES; ++index) {
+        unsigned int nfds = pp->nfds;
+
+        if ((pp->modes & (1 << index)) == 0)
+            continue ;
+        /* mappings and tasks are recorded once, by the first mode opened */
+        if (perfprof_attr(pp, index, pp->active == 0, &attr) != 0) {
+            if (errno_mode == 0)
+                errno_mode = errno;
+            continue ;
+        }
+        /* inherited events cannot share a ring if not bound to a cpu: one per cpu */
+        for (int cpu = 0; cpu < ncpus; ++cpu) {
+            void *  ring;
+            int     fd;
+
+            if ((fd = perfevent_open(&attr, pid, cpu)) < 0) {
+                if (errno_first == 0)
+                    errno_first = errno;
+                continue ;
+            }
+            if ((ring = perfevent_mmap(fd, &npages, pp->nfds == 0)) == NULL) {
+                if (errno_first == 0)
+                    errno_first = errno;
+                close(fd);
+                continue ;
+            }
+            pp->fds[pp->nfds] = fd;
+            pp->fdmodes[pp->nfds] = index;
+            pp->rings[pp->nfds] = ring;
+            pp->ringsize = npages * pagesize;
+            ++pp->nfds;
+        }
+        if (pp->nfds == nfds) {
+            if (errno_mode == 0)
+                errno_mode = errno_first;
+            continue ;
+        }
+        pp->active |= 1 << index;
+        if ((1 << index) == PERFPROF_CPU)
+            pp->event = attr.type == PERF_TYPE_HARDWARE ? "cycles" : "cpu-clock";
+    }
+    perfevent_sync_release(pp->syncfd);
+    if (pp->nfds == 0) {
+        errno = errno_mode;
+        return -1;
+    }
+    pp->stop = 0;
+    if ((errno = pthread_create(&pp->thread, NULL, perfprof_thread, pp)) != 0)
+        return -1;
+    pp->running = 1;
+    if (pp->active != (pp->modes & PERFPROF_EVENTS)) {
+        errno = errno_mode;
+        return -1;
+    }
+    return 0;
+}
+
+void perfprof_stop(perfprof_t * pp) {
+    if (pp->running) {
+        pp->stop = 1;
+        pthread_join(pp->thread, NULL);
+        pp->running = 0;
+    }
+    for (unsigned int i = 0; i < pp->nfds; ++i) {
+        perfevent_munmap(pp->rings[i], pp->ringsize);
+        close(pp->fds[i]);
+    }
+    pp->nfds = 0;
+}
+
+/* time of a record other than a sample: last field of sample_id (sample_id_all) */
+static uint64_t perfprof_record_time(const struct perf_event_header * hdr) {
+    return *(const uint64_t *) ((const char *) hdr + hdr->size - sizeof(uint64_t));
+}
+
+static int perfprof_collect(const perfprof_data_t * pd, perfprof_symctx_t * ctx) {
+    for (size_t off = 0; off + sizeof(struct perf_event_header) <= pd->size; ) {
+        const struct perf_event_header *    hdr = (const struct perf_event_header *) (pd->records + off);
+        const uint32_t *                    u32 = (const uint32_t *) (hdr + 1);
+        const uint64_t *                    u64 = (const uint64_t *) (hdr + 1);
+
+        switch (hdr->type) {
+            case PERF_RECORD_MMAP2: {
+                /* pid, tid, addr, len, pgoff, maj/min/ino/ino_gen or build id, prot, flags, filename */
+                perfprof_map_t * map = perfprof_push(&ctx->maps, &ctx->nmaps, &ctx->mapcapacity, sizeof(*map));
+                if (map == NULL)
+                    return -1;
+                map->time = perfprof_record_time(hdr);
+                map->pid = u32[0];
+                map->start = u64[1];
+                map->len = u64[2];
+                map->pgoff = u64[3];
+                map->path = (const char *) (u64 + 8);
+                break ;
+            }
+            case PERF_RECORD_COMM: {
+                perfprof_comm_t * comm = perfprof_push(&ctx->comms, &ctx->ncomms, &ctx->commcapacity, sizeof(*comm));
+                if (comm == NULL)
+                    return -1;
+                comm->time = perfprof_record_time(hdr);
+                comm->pid = u32[0];
+                comm->tid = u32[1];
+                comm->comm = (const char *) (u32 + 2);
+                if ((hdr->misc & PERF_RECORD_MISC_COMM_EXEC) != 0) {
+                    perfprof_task_t * exec = perfprof_push(&ctx->execs, &ctx->nexecs, &ctx->execcapacity, sizeof(*exec));
+                    if (exec == NULL)
+                        return -1;
+                    exec->time = comm->time;
+                    exec->pid = comm->pid;
+                }
+                break ;
+            }
+            case PERF_RECORD_FORK: {
+                /* pid, ppid, tid, ptid, time: only new processes, threads share the mappings */
+                perfprof_task_t * fork;
+                if (u32[0] == u32[1])
+                    break ;
+                if ((fork = perfprof_push(&ctx->forks, &ctx->nforks, &ctx->forkcapacity, sizeof(*fork))) == NULL)
+                    return -1;
+                fork->time = u64[2];
+                fork->pid = u32[0];
+                fork->ppid = u32[1];
+                break ;
+            }
+        }
+        off += hdr->size;
+    }
+    return 0;
+}
+
+/* last exec of pid before time, 0 if none */
+static uint64_t perfprof_exec_time(const perfprof_symctx_t * ctx, uint32_t pid, uint64_t time) {
+    uint64_t exec_time = 0;
+
+    for (unsigned int i = 0; i < ctx->nexecs && ctx->execs[i].time <= time; ++i) {
+        if (ctx->execs[i].pid == pid)
+            exec_time = ctx->execs[i].time;
+    }
+    return exec_time;
+}
+
+static const perfprof_task_t * perfprof_fork(const perfprof_symctx_t * ctx, uint32_t pid, uint64_t time) {
+    for (unsigned int i = ctx->nforks; i-- > 0; ) {
+        if (ctx->forks[i].pid == pid && ctx->forks[i].time <= time)
+            return &ctx->forks[i];
+    }
+    return NULL;
+}
+
+/* mapping of pid containing ip at time: mapped since the last exec, or inherited at fork */
+static const perfprof_map_t * perfprof_find_map(const perfprof_symctx_t * ctx, uint32_t pid,
+                                                uint64_t ip, uint64_t time, int depth) {
+    uint64_t                exec_time = perfprof_exec_time(ctx, pid, time);
+    const perfprof_task_t * fork;
+
+    for (unsigned int i = ctx->nmaps; i-- > 0; ) {
+        const perfprof_map_t * map = &ctx->maps[i];
+        if (map->pid == pid && map->time <= time && map->time >= exec_time
+        &&  ip >= map->start && ip < map->start + map->len)
+            return map;
+    }
+    if (exec_time == 0 && depth < PERFPROF_MAX_DEPTH && (fork = perfprof_fork(ctx, pid, time)) != NULL)
+        return perfprof_find_map(ctx, fork->ppid, ip, fork->time, depth + 1);
+    return NULL;
+}
+
+/* name of the thread tid at time, or of its process, or inherited at fork */
+static const char * perfprof_find_comm(const perfprof_symctx_t * ctx, uint32_t pid, uint32_t tid,
+                                       uint64_t time, int depth) {
+    const char *            comm = NULL, * pcomm = NULL;
+    const perfprof_task_t * fork;
+
+    for (unsigned int i = 0; i < ctx->ncomms && ctx->comms[i].time <= time; ++i) {
+        if (ctx->comms[i].tid == tid)
+            comm = ctx->comms[i].comm;
+        else if (ctx->comms[i].tid == pid)
+            pcomm = ctx->comms[i].comm;
+    }
+    if (comm != NULL || pcomm != NULL)
+        return comm != NULL ? comm : pcomm;
+    if (depth < PERFPROF_MAX_DEPTH && (fork = perfprof_fork(ctx, pid, time)) != NULL)
+        return perfprof_find_comm(ctx, fork->ppid, fork->ppid, fork->time, depth + 1);
+    return NULL;
+}
+
+static const elf_symtab_t * perfprof_symtab(perfprof_symctx_t * ctx, const char * path) {
+    perfprof_object_t * object;
+
+    for (unsigned int i = 0; i < ctx->nobjects; ++i) {
+        if (ctx->objects[i].path == path || strcmp(ctx->objects[i].path, path) == 0)
+            return ctx->objects[i].symtab;
+    }
+    if ((object = perfprof_push(&ctx->objects, &ctx->nobjects, &ctx->objcapacity, sizeof(*object))) == NULL)
+        return NULL;
+    object->path = path;
+    object->symtab = *path == '/' ? elf_symtab_load(path) : NULL;
+    return object->symtab;
+}
+
+/* function symbols of /proc/kallsyms, sorted (addresses are 0 if kernel.kptr_restrict) */
+static void perfprof_load_ksyms(perfprof_symctx_t * ctx) {
+    char                line[512];
+    FILE *              f;
+
+    ctx->ksymloaded = 1;
+    if ((f = fopen("/proc/kallsyms", "r")) == NULL)
+        return ;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        unsigned long long  addr;
+        char                type, name[256];
+        perfprof_ksym_t *   ksym;
+
+        if (sscanf(line, "%llx %c %255s", &addr, &type, name) != 3 || addr == 0
+        ||  (type != 't' && type != 'T' && type != 'w' && type != 'W'))
+            continue ;
+        if ((ksym = perfprof_push(&ctx->ksyms, &ctx->nksyms, &ctx->ksymcapacity, sizeof(*ksym))) == NULL
+        ||  (ksym->name = strdup(name)) == NULL)
+            break ;
+        ksym->addr = addr;
+    }
+    fclose(f);
+    if (ctx->nksyms > 0 && ctx->ksyms[ctx->nksyms - 1].name == NULL)
+        --ctx->nksyms;
+    qsort(ctx->ksyms, ctx->nksyms, sizeof(*ctx->ksyms), perfprof_cmp_time);
+}
+
+static const char * perfprof_ksym(perfprof_symctx_t * ctx, uint64_t ip) {
+    unsigned int lo = 0, hi;
+
+    if (!ctx->ksymloaded)
+        perfprof_load_ksyms(ctx);
+    hi = ctx->nksyms;
+    if (hi == 0 || ip < ctx->ksyms[0].addr)
+        return NULL;
+    while (hi - lo > 1) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (ctx->ksyms[mid].addr <= ip)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return ctx->ksyms[lo].name;
+}
+
+/* append ';frame' to line, ';' being reserved as separator */
+static size_t perfprof_append(char * line, size_t len, const char * prefix, const char * name) {
+    int n = snprintf(line + len, PERFPROF_LINE_MAX - len, "%s%s", prefix, name);
+
+    if (n < 0 || len + n >= PERFPROF_LINE_MAX)
+        return len;
+    for (char * s = line + len + strlen(prefix); *s; ++s) {
+        if (*s == ';')
+            *s = ':';
+    }
+    return len + n;
+}
+
+/* 'comm;caller;...;function' from the user part of a callchain (leaf first, after PERF_CONTEXT_USER) */
+static size_t perfprof_stack(perfprof_symctx_t * ctx, char * line, uint32_t pid, uint32_t tid,
+                             uint64_t time, const uint64_t * ips, uint64_t nr) {
+    const char *    comm;
+    char            pidname[32];
+    size_t          len;
+    uint64_t        first, last;
+
+    if ((comm = perfprof_find_comm(ctx, pid, tid, time, 0)) == NULL) {
+        snprintf(pidname, sizeof(pidname), "%u", pid);
+        comm = pidname;
+    }
+    len = perfprof_append(line, 0, "", comm);
+    for (first = 0; first < nr && ips[first] != (uint64_t) PERF_CONTEXT_USER; ++first)
+        ; /* nothing */
+    for (last = ++first; last < nr && ips[last] < (uint64_t) PERF_CONTEXT_MAX; ++last)
+        ; /* nothing */
+    for (uint64_t i = last; i-- > first; ) {
+        const perfprof_map_t *  map;
+        const char *            name = NULL;
+        uint64_t                ip = ips[i];
+        char                    buf[PATH_MAX + 2];
+
+        /* return addresses: the call is just before */
+        if (i != first)
+            --ip;
+        if ((map = perfprof_find_map(ctx, pid, ip, time, 0)) == NULL) {
+            name = "[unknown]";
+        } else if ((name = elf_symtab_lookup(perfprof_symtab(ctx, map->path),
+                                             ip - map->start + map->pgoff)) == NULL) {
+            const char * base = strrchr(map->path, '/');
+            snprintf(buf, sizeof(buf), "[%s]", base ? base + 1 : map->path);
+            name = buf;
+        }
+        len = perfprof_append(line, len, ";", name);
+    }
+    return len;
+}
+
+/* first kernel function of the callchain which is not the scheduler or the tracer */
+static const char * perfprof_wait_function(perfprof_symctx_t * ctx, const uint64_t * ips, uint64_t nr) {
+    int kernel = 0;
+
+    for (uint64_t i = 0; i < nr; ++i) {
+        const char * name;
+
+        if (ips[i] >= (uint64_t) PERF_CONTEXT_MAX) {
+            kernel = ips[i] == (uint64_t) PERF_CONTEXT_KERNEL;
+            continue ;
+        }
+        if (!kernel || (name = perfprof_ksym(ctx, ips[i] - 1)) == NULL)
+            continue ;
+        if ((strstr(name, "schedule") != NULL && strncmp(name, "io_schedule", 11) != 0)
+        ||  strstr(name, "perf_") != NULL || strstr(name, "trace") != NULL)
+            continue ;
+        return name;
+    }
+    return NULL;
+}
+
+/* state of the thread switched out (prev_state, TASK_REPORT bits) */
+static const char * perfprof_wait_state(const perfprof_t * pp, const uint64_t * ips, uint64_t nr) {
+    const uint32_t *    raw = (const uint32_t *) (ips + nr);
+    uint64_t            state = 0;
+
+    if (pp->statesize == 0 || pp->stateoff + pp->statesize > raw[0])
+        return "unknown";
+    if (pp->statesize == 8) {
+        memcpy(&state, (const char *) (raw + 1) + pp->stateoff, sizeof(state));
+    } else {
+        uint32_t state32;
+        memcpy(&state32, (const char *) (raw + 1) + pp->stateoff, sizeof(state32));
+        state = state32;
+    }
+    if ((state & 0xff) == 0)
+        return "running";       /* preempted, waiting for a cpu */
+    if ((state & 0x01) != 0)
+        return "sleeping";
+    if ((state & 0x02) != 0)
+        return "uninterruptible";
+    if ((state & 0x0c) != 0)
+        return "stopped";
+    if ((state & 0x80) != 0)
+        return "idle";
+    return "other";
+}
+
+static int perfprof_add_stack(perfprof_stacks_t * st, const char * line, const char * leaf, uint64_t value) {
+    perfprof_line_t * slot;
+
+    if ((slot = perfprof_push(&st->lines, &st->nlines, &st->linecapacity, sizeof(*slot))) == NULL
+    ||  (slot->str = strdup(line)) == NULL)
+        return -1;
+    slot->value = value;
+    if ((slot = perfprof_push(&st->leaves, &st->nleaves, &st->leafcapacity, sizeof(*slot))) == NULL
+    ||  (slot->str = strdup(leaf)) == NULL)
+        return -1;
+    slot->value = value;
+    return 0;
+}
+
+static int perfprof_cpu_stacks(perfprof_t * pp, perfprof_symctx_t * ctx, perfprof_stacks_t * st, char * line) {
+    const perfprof_data_t * pd = &pp->data[0];
+
+    for (size_t off = 0; off + sizeof(struct perf_event_header) <= pd->size; ) {
+        const struct perf_event_header *    hdr = (const struct perf_event_header *) (pd->records + off);
+        /* ip, pid, tid, time, nr, ips[nr] */
+        const uint64_t *                    sample = (const uint64_t *) (hdr + 1);
+        const uint32_t *                    ids = (const uint32_t *) (sample + 1);
+        const char *                        leaf;
+        size_t                              len;
+
+        off += hdr->size;
+        if (hdr->type != PERF_RECORD_SAMPLE)
+            continue ;
+        len = perfprof_stack(ctx, line, ids[0], ids[1], sample[2], sample + 4, sample[3]);
+        if ((hdr->misc & PERF_RECORD_MISC_CPUMODE_MASK) == PERF_RECORD_MISC_KERNEL)
+            len = perfprof_append(line, len, ";", "[kernel]");
+        leaf = (leaf = strrchr(line, ';')) != NULL ? leaf + 1 : line;
+        if (perfprof_add_stack(st, line, leaf, 1) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* time between the switch out of a thread (sched_switch sample) and its next switch in */
+static int perfprof_offcpu_stacks(perfprof_t * pp, perfprof_symctx_t * ctx, perfprof_stacks_t * st, char * line) {
+    const perfprof_data_t * pd = &pp->data[1];
+    perfprof_switch_t *     switches = NULL, * pending = NULL;
+    unsigned int            nswitches = 0, capacity = 0, npending = 0, pendingcapacity = 0;
+    int                     ret = -1;
+
+    for (size_t off = 0; off + sizeof(struct perf_event_header) <= pd->size; ) {
+        const struct perf_event_header *    hdr = (const struct perf_event_header *) (pd->records + off);
+        const uint32_t *                    u32 = (const uint32_t *) (hdr + 1);
+        perfprof_switch_t *                 sw;
+
+        off += hdr->size;
+        if (hdr->type != PERF_RECORD_SAMPLE
+        &&  (hdr->type != PERF_RECORD_SWITCH || (hdr->misc & PERF_RECORD_MISC_SWITCH_OUT) != 0))
+            continue ;
+        if ((sw = perfprof_push(&switches, &nswitches, &capacity, sizeof(*sw))) == NULL)
+            goto end;
+        /* sample: ip, pid, tid, time, ...; switch: sample_id pid, tid, time */
+        sw->hdr = hdr;
+        if (hdr->type == PERF_RECORD_SAMPLE) {
+            sw->tid = u32[3];
+            sw->time = ((const uint64_t *) (hdr + 1))[2];
+        } else {
+            sw->tid = u32[1];
+            sw->time = perfprof_record_time(hdr);
+        }
+    }
+    /* a thread can be switched out on a cpu and in on another one */
+    qsort(switches, nswitches, sizeof(*switches), perfprof_cmp_time);
+
+    for (unsigned int i = 0; i < nswitches; ++i) {
+        const perfprof_switch_t *   sw = &switches[i];
+        unsigned int                j;
+
+        for (j = 0; j < npending && pending[j].tid != sw->tid; ++j)
+            ; /* nothing */
+        if (sw->hdr->type == PERF_RECORD_SAMPLE) {
+            if (j == npending && perfprof_push(&pending, &npending, &pendingcapacity, sizeof(*pending)) == NULL)
+                goto end;
+            pending[j] = *sw;
+        } else if (j < npending) {
+            const uint64_t *    sample = (const uint64_t *) (pending[j].hdr + 1);
+            const uint32_t *    ids = (const uint32_t *) (sample + 1);
+            const char *        function, * state;
+            uint64_t            blocked = sw->time - pending[j].time;
+            char                reason[256];
+            size_t              len;
+
+            len = perfprof_stack(ctx, line, ids[0], ids[1], sample[2], sample + 4, sample[3]);
+            state = perfprof_wait_state(pp, sample + 4, sample[3]);
+            if ((function = perfprof_wait_function(ctx, sample + 4, sample[3])) != NULL)
+                snprintf(reason, sizeof(reason), "[%s:%s]", state, function);
+            else
+                snprintf(reason, sizeof(reason), "[%s]", state);
+            perfprof_append(line, len, ";", reason);
+            if (perfprof_add_stack(st, line, reason, blocked) != 0)
+                goto end;
+            pending[j] = pending[--npending];
+        }
+    }
+    ret = 0;
+end:
+    free(switches);
+    free(pending);
+    return ret;
+}
+
+static int perfprof_cmp_line(const void * a, const void * b) {
+    return strcmp(((const perfprof_line_t *) a)->str, ((const perfprof_line_t *) b)->str);
+}
+
+/* sort lines and sum the values of identical ones, returns the new count */
+static unsigned int perfprof_merge(perfprof_line_t * lines, unsigned int count) {
+    unsigned int n = 0;
+
+    qsort(lines, count, sizeof(*lines), perfprof_cmp_line);
+    for (unsigned int i = 0; i < count; ++i) {
+        if (n > 0 && strcmp(lines[n - 1].str, lines[i].str) == 0) {
+            lines[n - 1].value += lines[i].value;
+            free(lines[i].str);
+        } else {
+            lines[n++] = lines[i];
+        }
+    }
+    return n;
+}
+
+static void perfprof_hotspots(perfprof_data_t * pd, perfprof_line_t * leaves, unsigned int count) {
+    pd->total = 0;
+    for (unsigned int i = 0; i < count; ++i) {
+        unsigned int n;
+
+        pd->total += leaves[i].value;
+        for (n = PERFPROF_HOTSPOTS; n > 0 && (pd->hotspots[n - 1].name == NULL
+                                              || pd->hotspots[n - 1].count < leaves[i].value); --n)
+            ; /* nothing */
+        if (n >= PERFPROF_HOTSPOTS)
+            continue ;
+        free(pd->hotspots[PERFPROF_HOTSPOTS - 1].name);
+        memmove(&pd->hotspots[n + 1], &pd->hotspots[n], (PERFPROF_HOTSPOTS - n - 1) * sizeof(*pd->hotspots));
+        pd->hotspots[n].name = strdup(leaves[i].str);
+        pd->hotspots[n].count = leaves[i].value;
+    }
+}
+
+static void perfprof_free_stacks(perfprof_stacks_t * st) {
+    for (unsigned int i = 0; i < st->nlines; ++i)
+        free(st->lines[i].str);
+    for (unsigned int i = 0; i < st->nleaves; ++i)
+        free(st->leaves[i].str);
+    free(st->lines);
+    free(st->leaves);
+    memset(st, 0, sizeof(*st));
+}
+
+/* a new file (O_EXCL) next to path, written then renamed to it: a symlink or a file
+ * there is not followed. tmp receives its name */
+static FILE * perfprof_create(const char * path, char * tmp, size_t size) {
+    FILE *  out;
+    int     fd, errno_bak;
+
+    if ((size_t) snprintf(tmp, size, "%s.XXXXXX", path) >= size) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    if ((fd = mkstemp(tmp)) < 0)
+        return NULL;
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) != 0 || fchmod(fd, 0644) != 0
+    ||  (out = fdopen(fd, "w")) == NULL) {
+        errno_bak = errno;
+        close(fd);
+        unlink(tmp);
+        errno = errno_bak;
+        return NULL;
+    }
+    return out;
+}
+
+static int perfprof_commit(FILE * out, const char * tmp, const char * path) {
+    int ret, errno_bak;
+
+    ret = fflush(out) != 0 || ferror(out) ? -1 : 0;
+    errno_bak = errno;
+    if (fclose(out) != 0 && ret == 0 && (ret = -1))
+        errno_bak = errno;
+    if (ret == 0 && rename(tmp, path) != 0 && (ret = -1))
+        errno_bak = errno;
+    if (ret != 0)
+        unlink(tmp);
+    errno = errno_bak;
+    return ret;
+}
+
+int perfprof_write(perfprof_t * pp) {
+    perfprof_symctx_t   ctx;
+    perfprof_stacks_t   st;
+    char                path[PATH_MAX];
+    char                tmp[PATH_MAX];
+    char *              line;
+    FILE *              out;
+    int                 ret = -1, errno_bak;
+
+    if (pp->active == 0)
+        return 0;
+    memset(&ctx, 0, sizeof(ctx));
+    memset(&st, 0, sizeof(st));
+    if ((line = malloc(PERFPROF_LINE_MAX)) == NULL)
+        goto end;
+    for (int index = 0; index < PERFPROF_NMODES; ++index) {
+        if (perfprof_collect(&pp->data[index], &ctx) != 0)
+            goto end;
+    }
+    /* records of different cpus are not ordered */
+    qsort(ctx.maps, ctx.nmaps, sizeof(*ctx.maps), perfprof_cmp_time);
+    qsort(ctx.comms, ctx.ncomms, sizeof(*ctx.comms), perfprof_cmp_time);
+    qsort(ctx.execs, ctx.nexecs, sizeof(*ctx.execs), perfprof_cmp_time);
+    qsort(ctx.forks, ctx.nforks, sizeof(*ctx.forks), perfprof_cmp_time);
+
+    for (int index = 0; index < PERFPROF_NMODES; ++index) {
+        perfprof_data_t * pd = &pp->data[index];
+
+        if ((pp->active & (1 << index)) == 0)
+            continue ;
+        if (((1 << index) == PERFPROF_OFFCPU ? perfprof_offcpu_stacks(pp, &ctx, &st, line)
+                                             : perfprof_cpu_stacks(pp, &ctx, &st, line)) != 0)
+            goto end;
+        st.nlines = perfprof_merge(st.lines, st.nlines);
+        st.nleaves = perfprof_merge(st.leaves, st.nleaves);
+
+        snprintf(path, sizeof(path), "%s.%s.folded", pp->prefix, s_perfprof_modes[index]);
+        if ((out = perfprof_create(path, tmp, sizeof(tmp))) == NULL)
+            goto end;
+        pd->nstacks = 0;
+        for (unsigned int i = 0; i < st.nlines; ++i) {
+            /* off cpu: microseconds */
+            uint64_t value = (1 << index) == PERFPROF_OFFCPU ? (st.lines[i].value + 500) / 1000
+                                                             : st.lines[i].value;
+            if (value == 0)
+                continue ;
+            fprintf(out, "%s %llu\n", st.lines[i].str, (unsigned long long) value);
+            ++pd->nstacks;
+        }
+        if (perfprof_commit(out, tmp, path) != 0)
+            goto end;
+        perfprof_hotspots(pd, st.leaves, st.nleaves);
+        perfprof_free_stacks(&st);
+    }
+    ret = 0;
+
+end:
+    errno_bak = errno;
+    perfprof_free_stacks(&st);
+    for (unsigned int i = 0; i < ctx.nobjects; ++i)
+        elf_symtab_free(ctx.objects[i].symtab);
+    for (unsigned int i = 0; i < ctx.nksyms; ++i)
+        free(ctx.ksyms[i].name);
+    free(line);
+    free(ctx.maps);
+    free(ctx.forks);
+    free(ctx.execs);
+    free(ctx.comms);
+    free(ctx.objects);
+    free(ctx.ksyms);
+    errno = errno_bak;
+    return ret;
+}
+
+#endif /* __linux__ */
+
+void perfprof_free(perfprof_t * pp) {
+    if (pp == NULL)
+        return ;
+    perfprof_stop(pp);
+    perfevent_sync_release(pp->syncfd);
+    for (int index = 0; index < PERFPROF_NMODES; ++index) {
+        perfprof_data_t * pd = &pp->data[index];
+
+        for (unsigned int i = 0; i < PERFPROF_HOTSPOTS; ++i) {
+            free(pd->hotspots[i].name);
+            pd->hotspots[i].name = NULL;
+        }
+        free(pd->records);
+        pd->records = NULL;
+        pd->size = pd->capacity = 0;
+    }
+    free(pp->fds);
+    free(pp->fdmodes);
+    free(pp->rings);
+    pp->fds = NULL;
+    pp->fdmodes = NULL;
+    pp->rings = NULL;
+}
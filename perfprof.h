@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Sampling profiler of a process tree with linux perf_event_open(), on cpu
+ * or off cpu (sched_switch), writing folded stacks for flamegraph tools.
+ */
+#ifndef VRUNAS_PERFPROF_H
+#define VRUNAS_PERFPROF_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define PERFPROF_DEFAULT_FREQ   99
+#define PERFPROF_DEFAULT_PREFIX "vrunas"
+#define PERFPROF_HOTSPOTS       5
+
+enum {
+    PERFPROF_CPU        = 1 << 0,   /* on-cpu sampling */
+    PERFPROF_OFFCPU     = 1 << 1,   /* blocked time from sched_switch tracepoint (root) */
+    PERFPROF_HEAP       = 1 << 2,   /* allocations, see heapprof.h (no perf event) */
+};
+#define PERFPROF_EVENTS         (PERFPROF_CPU | PERFPROF_OFFCPU)
+#define PERFPROF_NMODES         2
+
+typedef struct {
+    char *              name;
+    uint64_t            count;
+} perfprof_hotspot_t;
+
+typedef struct {
+    char *              records;        /* records copied from the rings */
+    size_t              size;
+    size_t              capacity;
+    unsigned long       nsamples;
+    unsigned long       nlost;
+    unsigned long       nstacks;        /* distinct folded stacks written */
+    uint64_t            total;          /* samples (cpu) or blocked nanoseconds (offcpu) */
+    perfprof_hotspot_t  hotspots[PERFPROF_HOTSPOTS];   /* functions (cpu, self) or wait reasons */
+} perfprof_data_t;
+
+typedef struct {
+    int                 modes;          /* PERFPROF_CPU, ... */
+    int                 active;         /* modes whose events could be opened */
+    int                 freq;           /* sampling frequency in Hz */
+    const char *        prefix;         /* stacks written to <prefix>.<mode>.folded */
+    int                 syncfd[2];      /* the child waits for the events before execve() */
+    int *               fds;            /* one event per cpu and mode, following the tree (inherit) */
+    int *               fdmodes;        /* index of the mode of each event */
+    void **             rings;
+    unsigned int        nfds;
+    size_t              ringsize;
+    const char *        event;          /* name of the sampling event */
+    unsigned int        stateoff;       /* prev_state in sched_switch raw data */
+    unsigned int        statesize;
+    perfprof_data_t     data[PERFPROF_NMODES];  /* indexed by mode bit */
+    int                 running;
+    volatile int        stop;
+    pthread_t           thread;
+} perfprof_t;
+
+#define PERFPROF_INITIALIZER { 0, 0, PERFPROF_DEFAULT_FREQ, PERFPROF_DEFAULT_PREFIX, { -1, -1 }, \
+                               NULL, NULL, NULL, 0, 0, NULL, 0, 0, \
+                               { { NULL, 0, 0, 0, 0, 0, 0, { { NULL, 0 }, } }, }, 0, 0, }
+
+/** perfprof_parse_modes() : parse a comma separated list of modes ('cpu', 'offcpu', 'heap').
+ * @return 0 or -1 on error */
+int perfprof_parse_modes(const char * str, int * modes);
+
+/** perfprof_init() : to be called before fork() */
+int perfprof_init(perfprof_t * pp);
+
+/** perfprof_child() : to be called by the child before execve(): wait for the father
+ * to have set up the events */
+int perfprof_child(perfprof_t * pp);
+
+/** perfprof_start() : open the sampling events on pid (enabled on its execve()),
+ * release the child and start collecting. The child is released even on error,
+ * and the modes which could be opened are collected.
+ * @return 0 on success, -1 if a mode could not be opened (errno set) */
+int perfprof_start(perfprof_t * pp, pid_t pid);
+
+/** perfprof_stop() : to be called once pid is terminated: collect remaining records */
+void perfprof_stop(perfprof_t * pp);
+
+/** perfprof_write() : symbolize stacks from ELF symbol tables and the mappings recorded
+ * during the run, and write the folded stacks '<comm>;<caller>;...;<function> <count>'.
+ * Off-cpu stacks end with the wait reason '[<state>:<kernel function>]' and count
+ * microseconds of blocked time. Each file is a new one renamed to <prefix>.<mode>.folded,
+ * created with the current effective identity.
+ * @return 0 on success, -1 on error (errno set) */
+int perfprof_write(perfprof_t * pp);
+
+/** perfprof_report() : print profiling summary (extended timings format) */
+void perfprof_report(FILE * out, const perfprof_t * pp);
+
+/** perfprof_free() : release resources of pp (not pp itself) */
+void perfprof_free(perfprof_t * pp);
+
+#endif /* ! ifndef VRUNAS_PERFPROF_H */
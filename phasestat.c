@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Phases and counters of a program instrumented with sdk/vrunas_sdk.h, through a
+ * shared region created by vrunas and inherited by the program.
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "phasestat.h"
+
+/* region file descriptor, close-on-exec until phasestat_child() */
+static int phasestat_create(void) {
+    FILE *  tmp;
+    int     fd = -1;
+
+#   if defined(__linux__) && defined(MFD_CLOEXEC)
+    if ((fd = memfd_create("vrunas-phases", MFD_CLOEXEC)) >= 0)
+        return fd;
+#   endif
+    /* tmpfile() is already unlinked */
+    if ((tmp = tmpfile()) == NULL)
+        return -1;
+    if ((fd = dup(fileno(tmp))) >= 0)
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fclose(tmp);
+    return fd;
+}
+
+int phasestat_init(phasestat_t * ps) {
+    void * p;
+
+    if (ps == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ((ps->fd = phasestat_create()) < 0)
+        return -1;
+    if (ftruncate(ps->fd, sizeof(*ps->region)) != 0)
+        return -1;
+    if ((p = mmap(NULL, sizeof(*ps->region), PROT_READ | PROT_WRITE, MAP_SHARED, ps->fd, 0)) == MAP_FAILED)
+        return -1;
+    ps->region = p;
+    /* the file is zeroed: names and slots are free */
+    ps->region->magic = VRUNAS_SDK_MAGIC;
+    ps->region->size = sizeof(*ps->region);
+    return 0;
+}
+
+int phasestat_child(phasestat_t * ps) {
+    char buf[32];
+
+    if (ps == NULL || ps->fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (fcntl(ps->fd, F_SETFD, 0) != 0)
+        return -1;
+    snprintf(buf, sizeof(buf), "%d", ps->fd);
+    return setenv(VRUNAS_SDK_ENV, buf, 1);
+}
+
+static void phasestat_name(char * dst, const vrunas_sdk_name_t * src) {
+    memcpy(dst, src->name, VRUNAS_SDK_NAMELEN);
+    dst[VRUNAS_SDK_NAMELEN] = 0;
+}
+
+void phasestat_read(phasestat_t * ps) {
+    vrunas_sdk_region_t *   region;
+    struct timespec         ts;
+    uint64_t                now;
+
+    if (ps == NULL || (region = ps->region) == NULL)
+        return ;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+
+    for (ps->nphases = 0; ps->nphases < VRUNAS_SDK_PHASES
+                          && region->phases[ps->nphases].state == VRUNAS_SDK_READY; ++ps->nphases)
+        phasestat_name(ps->phases[ps->nphases].name, &region->phases[ps->nphases]);
+    for (ps->ncounters = 0; ps->ncounters < VRUNAS_SDK_COUNTERS
+                            && region->counters[ps->ncounters].state == VRUNAS_SDK_READY; ++ps->ncounters)
+        phasestat_name(ps->counters[ps->ncounters], &region->counters[ps->ncounters]);
+    ps->overflow = region->overflow;
+    /* a slot released by an exited thread is reused by the next one */
+    ps->nthreads = region->nslots;
+
+    for (unsigned int i = 0; i < VRUNAS_SDK_SLOTS; ++i) {
+        const vrunas_sdk_slot_data_t * slot = &region->slots[i].d;
+
+        if (slot->tid == 0)
+            continue ;
+        for (unsigned int p = 0; p < ps->nphases; ++p) {
+            ps->phases[p].count += slot->count[p];
+            for (unsigned int m = 0; m < VRUNAS_SDK_METRICS; ++m)
+                ps->phases[p].values[m] += slot->total[p][m];
+        }
+        /* the thread ended without closing its phase: only its wall time is known */
+        if (slot->phase > 0 && slot->phase <= ps->nphases && now > slot->start[VRUNAS_SDK_WALL]) {
+            ps->phases[slot->phase - 1].values[VRUNAS_SDK_WALL] += now - slot->start[VRUNAS_SDK_WALL];
+            ++ps->phases[slot->phase - 1].count;
+            ++ps->phases[slot->phase - 1].open;
+        }
+        for (unsigned int c = 0; c < ps->ncounters; ++c)
+            ps->values[c] += slot->counters[c];
+    }
+}
+
+void phasestat_report(FILE * out, const phasestat_t * ps) {
+    fprintf(out, "phases   %13u (phases in %u threads", ps->nphases, ps->nthreads);
+    if (ps->overflow > 0)
+        fprintf(out, ", %u threads not measured", ps->overflow);
+    fprintf(out, ")\n");
+    for (unsigned int p = 0; p < ps->nphases; ++p) {
+        const uint64_t * v = ps->phases[p].values;
+
+        fprintf(out, "phase    % 3ld.%09ld (%s: %llu times, user %ld.%03ld, sys %ld.%03ld, "
+                     "%llu minflt, %llu majflt, %llu vcsw, %llu ivcsw",
+                (long) (v[VRUNAS_SDK_WALL] / 1000000000ULL), (long) (v[VRUNAS_SDK_WALL] % 1000000000ULL),
+                ps->phases[p].name, (unsigned long long) ps->phases[p].count,
+                (long) (v[VRUNAS_SDK_UTIME] / 1000000000ULL), (long) (v[VRUNAS_SDK_UTIME] % 1000000000ULL / 1000000),
+                (long) (v[VRUNAS_SDK_STIME] / 1000000000ULL), (long) (v[VRUNAS_SDK_STIME] % 1000000000ULL / 1000000),
+                (unsigned long long) v[VRUNAS_SDK_MINFLT], (unsigned long long) v[VRUNAS_SDK_MAJFLT],
+                (unsigned long long) v[VRUNAS_SDK_NVCSW], (unsigned long long) v[VRUNAS_SDK_NIVCSW]);
+        if (ps->phases[p].open > 0)
+            fprintf(out, ", %llu open at exit", (unsigned long long) ps->phases[p].open);
+        fprintf(out, ")\n");
+    }
+    for (unsigned int c = 0; c < ps->ncounters; ++c)
+        fprintf(out, "counter  %13lld (%s)\n", (long long) ps->values[c], ps->counters[c]);
+}
+
+void phasestat_free(phasestat_t * ps) {
+    if (ps == NULL)
+        return ;
+    if (ps->region != NULL)
+        munmap(ps->region, sizeof(*ps->region));
+    if (ps->fd >= 0)
+        close(ps->fd);
+    ps->region = NULL;
+    ps->fd = -1;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Phases and counters of a program instrumented with sdk/vrunas_sdk.h, through a
+ * shared region created by vrunas and inherited by the program.
+ */
+#ifndef VRUNAS_PHASESTAT_H
+#define VRUNAS_PHASESTAT_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "sdk/vrunas_sdk.h"
+
+typedef struct {
+    char                name[VRUNAS_SDK_NAMELEN + 1];
+    uint64_t            count;          /* phases ended, including the ones open at exit */
+    uint64_t            open;           /* phases still open when the program terminated */
+    uint64_t            values[VRUNAS_SDK_METRICS];
+} phasestat_phase_t;
+
+typedef struct {
+    int                     fd;         /* shared region inherited by the program */
+    vrunas_sdk_region_t *   region;
+    phasestat_phase_t       phases[VRUNAS_SDK_PHASES];
+    unsigned int            nphases;
+    char                    counters[VRUNAS_SDK_COUNTERS][VRUNAS_SDK_NAMELEN + 1];
+    int64_t                 values[VRUNAS_SDK_COUNTERS];
+    unsigned int            ncounters;
+    unsigned int            nthreads;   /* threads which used the region */
+    unsigned int            overflow;   /* threads not measured */
+} phasestat_t;
+
+#define PHASESTAT_INITIALIZER { -1, NULL, { { { 0 }, 0, 0, { 0, } }, }, 0, { { 0 }, }, { 0, }, 0, 0, 0 }
+
+/** phasestat_init() : create the shared region. To be called before fork().
+ * @return 0 on success, -1 on error (errno set) */
+int phasestat_init(phasestat_t * ps);
+
+/** phasestat_child() : to be called by the child before execve(): pass the region
+ * to the program (VRUNAS_SHM_FD).
+ * @return 0 on success, -1 on error (errno set) */
+int phasestat_child(phasestat_t * ps);
+
+/** phasestat_read() : sum up the slots of the threads, once the program is terminated.
+ * The wall time of phases still open is counted up to now */
+void phasestat_read(phasestat_t * ps);
+
+/** phasestat_report() : print the time, rusage and count of each phase, and the counters
+ * (extended timings format) */
+void phasestat_report(FILE * out, const phasestat_t * ps);
+
+/** phasestat_free() : release resources of ps (not ps itself) */
+void phasestat_free(phasestat_t * ps);
+
+#endif /* ! ifndef VRUNAS_PHASESTAT_H */
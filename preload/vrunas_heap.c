@@ -0,0 +1,568 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Library injected by vrunas in the program with --profile heap (LD_PRELOAD): heap
+ * allocations counted with per-thread counters, and forwarded to the next allocator
+ * (the libc one, or another preloaded allocator).
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+
+#if defined(__linux__) && defined(__GLIBC__)
+# include <sys/syscall.h>
+# include <dlfcn.h>
+# include <malloc.h>
+# include <pthread.h>
+
+#ifndef PATH_MAX
+# define PATH_MAX 4096
+#endif
+
+/* "<fd>:<dev>:<ino>": statistics of each process are written to fd at exit, if
+ * it is still the file of vrunas */
+#define PRELOAD_HEAP_ENV        "VRUNAS_HEAP"
+#define PRELOAD_HEAP_SLOTS      256             /* threads with their own counters, others share the last */
+#define PRELOAD_HEAP_CLASSES    32              /* log2 of requested sizes */
+#define PRELOAD_HEAP_SITES      4096            /* sampled call sites, power of 2 */
+#define PRELOAD_HEAP_SAMPLE     (512 * 1024)    /* a call site is sampled every 512KB allocated */
+#define PRELOAD_HEAP_FLUSH      (64 * 1024)     /* live bytes of a thread added to the process count */
+#define PRELOAD_HEAP_REPORT_SITES 64
+#define PRELOAD_HEAP_ARENA      (64 * 1024)     /* bootstrap allocations of dlsym() */
+
+enum { PH_MALLOC = 0, PH_CALLOC, PH_REALLOC, PH_FREE, PH_MMAP, PH_MUNMAP, PH_NCALLS };
+
+typedef struct {
+    uint64_t            calls[PH_NCALLS];
+    uint64_t            bytes;          /* requested */
+    uint64_t            mmap_bytes;
+    int64_t             live;           /* usable bytes not yet added to s_heap_live */
+    int64_t             sample_left;
+    uint64_t            classes[PRELOAD_HEAP_CLASSES];
+} preload_heap_thread_t;
+
+typedef struct {
+    uintptr_t           addr;           /* return address of the allocation */
+    uint64_t            samples;
+} preload_heap_site_t;
+
+typedef void * (*preload_mmap_t)(void *, size_t, int, int, int, off_t);
+typedef int (*preload_munmap_t)(void *, size_t);
+
+/* the next allocator: the libc one, or another preloaded allocator */
+typedef struct {
+    void *              (*malloc)(size_t);
+    void *              (*calloc)(size_t, size_t);
+    void *              (*realloc)(void *, size_t);
+    void                (*free)(void *);
+    void *              (*memalign)(size_t, size_t);
+    void *              (*aligned_alloc)(size_t, size_t);
+    int                 (*posix_memalign)(void **, size_t, size_t);
+    void *              (*valloc)(size_t);
+    void *              (*pvalloc)(size_t);
+    size_t              (*usable_size)(void *);
+    void                (*exit)(int);
+    void                (*exit2)(int);
+} preload_heap_next_t;
+
+typedef struct {
+    size_t              size;
+    size_t              pad;            /* blocks aligned on 16 bytes */
+} preload_heap_block_t;
+
+static int                      s_heap_state = 0;       /* 0 unknown, 1 enabled, -1 disabled */
+static int                      s_heap_fd = -1;
+static dev_t                    s_heap_dev;
+static ino_t                    s_heap_ino;
+static preload_heap_thread_t    s_heap_threads[PRELOAD_HEAP_SLOTS];
+static unsigned int             s_heap_nthreads = 0;
+static int64_t                  s_heap_live = 0;
+static int64_t                  s_heap_peak = 0;
+static preload_heap_site_t      s_heap_sites[PRELOAD_HEAP_SITES];
+static uint64_t                 s_heap_dropped = 0;     /* samples of sites not in the table */
+static preload_mmap_t           s_mmap = NULL;
+static preload_munmap_t         s_munmap = NULL;
+static preload_heap_next_t      s_next;
+static int                      s_heap_resolved = 0;
+static pid_t                    s_heap_pid = 0;         /* process of the counters (not a vfork child) */
+static int                      s_heap_reported = 0;
+/* allocations of dlsym() while the next allocator is resolved, never released */
+static char                     s_heap_arena[PRELOAD_HEAP_ARENA] __attribute__((aligned(16)));
+static size_t                   s_heap_arena_used = 0;
+/* initial-exec: the dynamic model could allocate with malloc() */
+static __thread preload_heap_thread_t * t_heap __attribute__((tls_model("initial-exec"))) = NULL;
+static __thread int             t_heap_resolving __attribute__((tls_model("initial-exec"))) = 0;
+
+#define PRELOAD_HEAP_SHARED (&s_heap_threads[PRELOAD_HEAP_SLOTS - 1])
+
+#define PRELOAD_HEAP_IN_ARENA(ptr) \
+    ((const char *) (ptr) >= s_heap_arena && (const char *) (ptr) < s_heap_arena + sizeof(s_heap_arena))
+
+/* the counters of a thread are only written by this thread, but the shared ones */
+#define PRELOAD_HEAP_ADD(t, field, value) \
+    ((t) == PRELOAD_HEAP_SHARED ? __atomic_add_fetch(&(t)->field, (value), __ATOMIC_RELAXED) \
+                                : ((t)->field += (value)))
+
+static void * preload_heap_arena(size_t size) {
+    size_t                  len = sizeof(preload_heap_block_t) + ((size + 15) & ~(size_t) 15);
+    size_t                  used = __atomic_fetch_add(&s_heap_arena_used, len, __ATOMIC_RELAXED);
+    preload_heap_block_t *  block = (preload_heap_block_t *) (s_heap_arena + used);
+
+    if (used + len > sizeof(s_heap_arena) || len < size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    block->size = size;
+    return block + 1;
+}
+
+static size_t preload_heap_arena_size(const void * ptr) {
+    return ((const preload_heap_block_t *) ptr - 1)->size;
+}
+
+#define PRELOAD_HEAP_RESOLVE(name) (*(void **) (&s_next.name) = dlsym(RTLD_NEXT, #name))
+
+/* the next allocator, resolved on the first call: dlsym() can allocate, it gets the arena.
+ * @return 0 if it can be called */
+static int preload_heap_resolve(void) {
+    if (__atomic_load_n(&s_heap_resolved, __ATOMIC_ACQUIRE))
+        return 0;
+    if (t_heap_resolving)
+        return -1;
+    t_heap_resolving = 1;
+    PRELOAD_HEAP_RESOLVE(malloc);
+    PRELOAD_HEAP_RESOLVE(calloc);
+    PRELOAD_HEAP_RESOLVE(realloc);
+    PRELOAD_HEAP_RESOLVE(free);
+    PRELOAD_HEAP_RESOLVE(memalign);
+    PRELOAD_HEAP_RESOLVE(aligned_alloc);
+    PRELOAD_HEAP_RESOLVE(posix_memalign);
+    PRELOAD_HEAP_RESOLVE(valloc);
+    PRELOAD_HEAP_RESOLVE(pvalloc);
+    *(void **) (&s_next.usable_size) = dlsym(RTLD_NEXT, "malloc_usable_size");
+    *(void **) (&s_next.exit) = dlsym(RTLD_NEXT, "_exit");
+    *(void **) (&s_next.exit2) = dlsym(RTLD_NEXT, "_Exit");
+    t_heap_resolving = 0;
+    if (s_next.malloc == NULL || s_next.calloc == NULL || s_next.realloc == NULL || s_next.free == NULL
+    ||  s_next.usable_size == NULL)
+        return -1;
+    __atomic_store_n(&s_heap_resolved, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int preload_heap_enabled(void) {
+    const char *    value;
+    char *          end;
+    struct stat     st;
+    long            fd;
+
+    if (s_heap_state != 0)
+        return s_heap_state > 0;
+    if ((value = getenv(PRELOAD_HEAP_ENV)) == NULL
+    ||  (fd = strtol(value, &end, 10)) < 0 || *end != ':') {
+        s_heap_state = -1;
+        return 0;
+    }
+    s_heap_dev = (dev_t) strtoull(end + 1, &end, 10);
+    s_heap_ino = (ino_t) strtoull(*end == ':' ? end + 1 : end, NULL, 10);
+    if (fstat((int) fd, &st) != 0 || st.st_dev != s_heap_dev || st.st_ino != s_heap_ino) {
+        s_heap_state = -1;
+        return 0;
+    }
+    s_heap_fd = (int) fd;
+    s_heap_pid = getpid();
+    s_heap_state = 1;
+    return 1;
+}
+
+static preload_heap_thread_t * preload_heap_thread(void) {
+    if (t_heap == NULL) {
+        unsigned int n = __atomic_fetch_add(&s_heap_nthreads, 1, __ATOMIC_RELAXED);
+        t_heap = n < PRELOAD_HEAP_SLOTS ? &s_heap_threads[n] : PRELOAD_HEAP_SHARED;
+        /* the first sample after a full period, not on the first allocation */
+        if (t_heap != PRELOAD_HEAP_SHARED)
+            t_heap->sample_left = PRELOAD_HEAP_SAMPLE;
+    }
+    return t_heap;
+}
+
+static void preload_heap_live(preload_heap_thread_t * t, int64_t delta) {
+    int64_t live, peak;
+
+    if (t != PRELOAD_HEAP_SHARED) {
+        t->live += delta;
+        if (t->live < PRELOAD_HEAP_FLUSH && t->live > -PRELOAD_HEAP_FLUSH)
+            return ;
+        delta = t->live;
+        t->live = 0;
+    }
+    live = __atomic_add_fetch(&s_heap_live, delta, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&s_heap_peak, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&s_heap_peak, &peak, live, 1,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ; /* nothing */
+}
+
+static void preload_heap_site(uintptr_t addr, uint64_t samples) {
+    unsigned int hash = (unsigned int) ((addr >> 2) * 2654435761U);
+
+    for (unsigned int i = 0; i < PRELOAD_HEAP_SITES; ++i) {
+        preload_heap_site_t *   site = &s_heap_sites[(hash + i) & (PRELOAD_HEAP_SITES - 1)];
+        uintptr_t               cur = __atomic_load_n(&site->addr, __ATOMIC_RELAXED);
+
+        if (cur == 0 && !__atomic_compare_exchange_n(&site->addr, &cur, addr, 0,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+        &&  cur != addr)
+            continue ;
+        if (cur == 0 || cur == addr) {
+            __atomic_add_fetch(&site->samples, samples, __ATOMIC_RELAXED);
+            return ;
+        }
+    }
+    __atomic_add_fetch(&s_heap_dropped, samples, __ATOMIC_RELAXED);
+}
+
+static void preload_heap_alloc(int call, size_t size, void * ptr, const void * caller) {
+    preload_heap_thread_t * t;
+    unsigned int            class = 0;
+    int64_t                 left;
+
+    if (ptr == NULL || !preload_heap_enabled())
+        return ;
+    t = preload_heap_thread();
+    PRELOAD_HEAP_ADD(t, calls[call], 1);
+    PRELOAD_HEAP_ADD(t, bytes, size);
+    for (size_t n = size; (n >>= 1) != 0 && class < PRELOAD_HEAP_CLASSES - 1; )
+        ++class;
+    PRELOAD_HEAP_ADD(t, classes[class], 1);
+    preload_heap_live(t, s_next.usable_size(ptr));
+    /* one sample for each period of bytes allocated */
+    if ((left = PRELOAD_HEAP_ADD(t, sample_left, -(int64_t) size)) <= 0) {
+        uint64_t samples = 1 + (uint64_t) -left / PRELOAD_HEAP_SAMPLE;
+        PRELOAD_HEAP_ADD(t, sample_left, (int64_t) (samples * PRELOAD_HEAP_SAMPLE));
+        preload_heap_site((uintptr_t) caller, samples);
+    }
+}
+
+static void preload_heap_free(void * ptr, size_t usable) {
+    preload_heap_thread_t * t;
+
+    if (ptr == NULL || !preload_heap_enabled())
+        return ;
+    t = preload_heap_thread();
+    PRELOAD_HEAP_ADD(t, calls[PH_FREE], 1);
+    preload_heap_live(t, -(int64_t) usable);
+}
+
+void * malloc(size_t size) {
+    void * ptr;
+
+    if (preload_heap_resolve() != 0)
+        return preload_heap_arena(size);
+    ptr = s_next.malloc(size);
+    preload_heap_alloc(PH_MALLOC, size, ptr, __builtin_return_address(0));
+    return ptr;
+}
+
+void * calloc(size_t n, size_t size) {
+    void * ptr;
+
+    if (preload_heap_resolve() != 0)
+        return size != 0 && n > (size_t) -1 / size ? NULL : preload_heap_arena(n * size);
+    ptr = s_next.calloc(n, size);
+    preload_heap_alloc(PH_CALLOC, n * size, ptr, __builtin_return_address(0));
+    return ptr;
+}
+
+void * realloc(void * ptr, size_t size) {
+    void *  newptr;
+    size_t  usable = 0;
+
+    if (PRELOAD_HEAP_IN_ARENA(ptr)) {
+        /* a block of the arena moves to the next allocator */
+        if ((newptr = malloc(size)) != NULL)
+            memcpy(newptr, ptr, preload_heap_arena_size(ptr) < size ? preload_heap_arena_size(ptr) : size);
+        return newptr;
+    }
+    if (preload_heap_resolve() != 0)
+        return ptr == NULL ? preload_heap_arena(size) : NULL;
+    if (ptr != NULL && preload_heap_enabled())
+        usable = s_next.usable_size(ptr);
+    newptr = s_next.realloc(ptr, size);
+    if (ptr != NULL && size == 0 && newptr == NULL) {
+        /* realloc(ptr, 0) released ptr */
+        preload_heap_free(ptr, usable);
+        return NULL;
+    }
+    /* the old block is released only on success */
+    if (newptr != NULL && usable != 0)
+        preload_heap_live(preload_heap_thread(), -(int64_t) usable);
+    preload_heap_alloc(PH_REALLOC, size, newptr, __builtin_return_address(0));
+    return newptr;
+}
+
+void free(void * ptr) {
+    if (ptr == NULL || PRELOAD_HEAP_IN_ARENA(ptr) || preload_heap_resolve() != 0)
+        return ;
+    if (preload_heap_enabled())
+        preload_heap_free(ptr, s_next.usable_size(ptr));
+    s_next.free(ptr);
+}
+
+size_t malloc_usable_size(void * ptr) {
+    if (PRELOAD_HEAP_IN_ARENA(ptr))
+        return preload_heap_arena_size(ptr);
+    if (ptr == NULL || preload_heap_resolve() != 0)
+        return 0;
+    return s_next.usable_size(ptr);
+}
+
+void * memalign(size_t alignment, size_t size) {
+    void * ptr;
+
+    if (preload_heap_resolve() != 0 || s_next.memalign == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    ptr = s_next.memalign(alignment, size);
+    preload_heap_alloc(PH_MALLOC, size, ptr, __builtin_return_address(0));
+    return ptr;
+}
+
+void * aligned_alloc(size_t alignment, size_t size) {
+    void * ptr;
+
+    if (preload_heap_resolve() != 0 || s_next.aligned_alloc == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    ptr = s_next.aligned_alloc(alignment, size);
+    preload_heap_alloc(PH_MALLOC, size, ptr, __builtin_return_address(0));
+    return ptr;
+}
+
+int posix_memalign(void ** pptr, size_t alignment, size_t size) {
+    int ret;
+
+    if (preload_heap_resolve() != 0 || s_next.posix_memalign == NULL)
+        return ENOMEM;
+    if ((ret = s_next.posix_memalign(pptr, alignment, size)) == 0)
+        preload_heap_alloc(PH_MALLOC, size, *pptr, __builtin_return_address(0));
+    return ret;
+}
+
+void * valloc(size_t size) {
+    void * ptr;
+
+    if (preload_heap_resolve() != 0 || s_next.valloc == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    ptr = s_next.valloc(size);
+    preload_heap_alloc(PH_MALLOC, size, ptr, __builtin_return_address(0));
+    return ptr;
+}
+
+void * pvalloc(size_t size) {
+    void * ptr;
+
+    if (preload_heap_resolve() != 0 || s_next.pvalloc == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    ptr = s_next.pvalloc(size);
+    preload_heap_alloc(PH_MALLOC, size, ptr, __builtin_return_address(0));
+    return ptr;
+}
+
+void * mmap(void * addr, size_t len, int prot, int flags, int fd, off_t offset) {
+    void * ptr;
+
+    if (s_mmap == NULL)
+        *(void **) (&s_mmap) = dlsym(RTLD_NEXT, "mmap");
+    if (s_mmap == NULL) {
+        errno = ENOSYS;
+        return MAP_FAILED;
+    }
+    if ((ptr = s_mmap(addr, len, prot, flags, fd, offset)) != MAP_FAILED && preload_heap_enabled()) {
+        preload_heap_thread_t * t = preload_heap_thread();
+        PRELOAD_HEAP_ADD(t, calls[PH_MMAP], 1);
+        PRELOAD_HEAP_ADD(t, mmap_bytes, len);
+    }
+    return ptr;
+}
+
+int munmap(void * addr, size_t len) {
+    if (s_munmap == NULL)
+        *(void **) (&s_munmap) = dlsym(RTLD_NEXT, "munmap");
+    if (s_munmap == NULL) {
+        errno = ENOSYS;
+        return -1;
+    }
+    if (preload_heap_enabled())
+        PRELOAD_HEAP_ADD(preload_heap_thread(), calls[PH_MUNMAP], 1);
+    return s_munmap(addr, len);
+}
+
+/* a forked process reports its own allocations, its live heap being inherited */
+static void preload_heap_atfork_child(void) {
+    int64_t live = s_heap_live;
+
+    for (unsigned int i = 0; i < PRELOAD_HEAP_SLOTS; ++i)
+        live += s_heap_threads[i].live;
+    memset(s_heap_threads, 0, sizeof(s_heap_threads));
+    memset(s_heap_sites, 0, sizeof(s_heap_sites));
+    s_heap_nthreads = 0;
+    s_heap_dropped = 0;
+    s_heap_live = s_heap_peak = live;
+    s_heap_pid = getpid();
+    s_heap_reported = 0;
+    t_heap = NULL;
+}
+
+__attribute__((constructor)) static void preload_heap_init(void) {
+    preload_heap_resolve();
+    if (preload_heap_enabled())
+        pthread_atfork(NULL, NULL, preload_heap_atfork_child);
+}
+
+/* file offset of addr in its mapping, from /proc/self/maps (without allocating) */
+static const char * preload_heap_mapping(uintptr_t addr, unsigned long long * offset,
+                                         const char * maps, size_t size) {
+    for (const char * line = maps; line < maps + size; ) {
+        const char *        eol = memchr(line, '\n', maps + size - line);
+        unsigned long long  start, end, pgoff;
+        char                fields[128];
+        size_t              len;
+        int                 pos = 0;
+
+        if (eol == NULL)
+            break ;
+        /* the path is not needed by sscanf(), maps is not terminated */
+        len = (size_t) (eol - line) < sizeof(fields) - 1 ? (size_t) (eol - line) : sizeof(fields) - 1;
+        memcpy(fields, line, len);
+        fields[len] = 0;
+        if (sscanf(fields, "%llx-%llx %*s %llx %*s %*s %n", &start, &end, &pgoff, &pos) >= 3
+        &&  pos > 0 && (size_t) pos < len && addr >= start && addr < end && line[pos] == '/') {
+            *offset = addr - start + pgoff;
+            return line + pos;
+        }
+        line = eol + 1;
+    }
+    return NULL;
+}
+
+/* statistics of the process, written once at exit. A process killed by a signal, or
+ * terminated by a raw exit_group syscall, is not counted */
+__attribute__((destructor)) static void preload_heap_exit(void) {
+    static char                 buf[PRELOAD_HEAP_REPORT_SITES * (PATH_MAX + 64) + 4096];
+    static char                 maps[1024 * 1024];
+    preload_heap_thread_t       total;
+    struct stat                 st;
+    int64_t                     live = __atomic_load_n(&s_heap_live, __ATOMIC_RELAXED);
+    size_t                      len = 0, mapsize = 0;
+    ssize_t                     n;
+    int                         fd, pid = (int) getpid(), nsites = 0;
+    uint64_t                    samples = s_heap_dropped;
+
+    /* a vfork child shares the counters of its father */
+    if (s_heap_state <= 0 || s_heap_reported || pid != (int) s_heap_pid
+    ||  fstat(s_heap_fd, &st) != 0 || st.st_dev != s_heap_dev || st.st_ino != s_heap_ino)
+        return ;
+    s_heap_reported = 1;
+    memset(&total, 0, sizeof(total));
+    for (unsigned int i = 0; i < PRELOAD_HEAP_SLOTS; ++i) {
+        const preload_heap_thread_t * t = &s_heap_threads[i];
+        for (unsigned int c = 0; c < PH_NCALLS; ++c)
+            total.calls[c] += __atomic_load_n(&t->calls[c], __ATOMIC_RELAXED);
+        for (unsigned int c = 0; c < PRELOAD_HEAP_CLASSES; ++c)
+            total.classes[c] += __atomic_load_n(&t->classes[c], __ATOMIC_RELAXED);
+        total.bytes += __atomic_load_n(&t->bytes, __ATOMIC_RELAXED);
+        total.mmap_bytes += __atomic_load_n(&t->mmap_bytes, __ATOMIC_RELAXED);
+        live += __atomic_load_n(&t->live, __ATOMIC_RELAXED);
+    }
+    if ((fd = open("/proc/self/maps", O_RDONLY)) >= 0) {
+        while (mapsize < sizeof(maps) && (n = read(fd, maps + mapsize, sizeof(maps) - mapsize)) > 0)
+            mapsize += n;
+        close(fd);
+    }
+    len += snprintf(buf + len, sizeof(buf) - len, "calls %d %llu %llu %llu %llu %llu %llu\n", pid,
+                    (unsigned long long) total.calls[PH_MALLOC], (unsigned long long) total.calls[PH_CALLOC],
+                    (unsigned long long) total.calls[PH_REALLOC], (unsigned long long) total.calls[PH_FREE],
+                    (unsigned long long) total.calls[PH_MMAP], (unsigned long long) total.calls[PH_MUNMAP]);
+    len += snprintf(buf + len, sizeof(buf) - len, "bytes %d %llu %llu %lld %lld\n", pid,
+                    (unsigned long long) total.bytes, (unsigned long long) total.mmap_bytes,
+                    (long long) (s_heap_peak > live ? s_heap_peak : live), (long long) live);
+    len += snprintf(buf + len, sizeof(buf) - len, "classes %d", pid);
+    for (unsigned int c = 0; c < PRELOAD_HEAP_CLASSES; ++c)
+        len += snprintf(buf + len, sizeof(buf) - len, " %llu", (unsigned long long) total.classes[c]);
+    len += snprintf(buf + len, sizeof(buf) - len, "\n");
+    for (unsigned int i = 0; i < PRELOAD_HEAP_SITES; ++i) {
+        const preload_heap_site_t * site = &s_heap_sites[i];
+        const char *                path;
+        unsigned long long          offset = 0;
+
+        if (site->samples == 0)
+            continue ;
+        samples += site->samples;
+        /* the sites beyond are counted with the unknown ones */
+        if (nsites >= PRELOAD_HEAP_REPORT_SITES || len + PATH_MAX + 64 > sizeof(buf)
+        ||  (path = preload_heap_mapping(site->addr - 1, &offset, maps, mapsize)) == NULL)
+            continue ;
+        len += snprintf(buf + len, sizeof(buf) - len, "site %d %llu %llx %.*s\n", pid,
+                        (unsigned long long) site->samples, offset,
+                        (int) ((const char *) memchr(path, '\n', maps + mapsize - path) - path), path);
+        ++nsites;
+    }
+    len += snprintf(buf + len, sizeof(buf) - len, "samples %d %llu %d\n", pid,
+                    (unsigned long long) samples, PRELOAD_HEAP_SAMPLE);
+    /* one write, processes of the tree share the file offset */
+    if (write(s_heap_fd, buf, len) != (ssize_t) len) {
+        /* nothing, the process will be missing */
+    }
+}
+
+/* _exit() skips the destructors: the statistics are written before */
+void _exit(int status) {
+    preload_heap_exit();
+    if (preload_heap_resolve() == 0 && s_next.exit != NULL)
+        s_next.exit(status);
+    syscall(SYS_exit_group, status);
+    for (;;)
+        ; /* nothing */
+}
+
+void _Exit(int status) {
+    preload_heap_exit();
+    if (preload_heap_resolve() == 0 && s_next.exit2 != NULL)
+        s_next.exit2(status);
+    syscall(SYS_exit_group, status);
+    for (;;)
+        ; /* nothing */
+}
+
+#endif /* __linux__ && __GLIBC__ */
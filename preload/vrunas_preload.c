@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Library injected by vrunas in the program with --loader (LD_AUDIT, LD_PRELOAD):
+ * loader phases. The heap allocations are counted by libvrunas_heap.so.
+ */
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+
+#if defined(__linux__) && defined(__GLIBC__)
+# include <link.h>
+# include <dlfcn.h>
+
+#ifndef PATH_MAX
+# define PATH_MAX 4096
+#endif
+
+/* "<fd>:<pid>": records are written to fd, only by process pid */
+#define PRELOAD_LDSTAT_ENV  "VRUNAS_LDSTAT"
+
+typedef int (*preload_main_t)(int, char **, char **);
+typedef int (*preload_start_main_t)(preload_main_t, int, char **, void (*)(void), void (*)(void),
+                                    void (*)(void), void *);
+
+static int              s_ldstat_fd = -1;
+static preload_main_t   s_main = NULL;
+
+static int preload_ldstat_fd(const char * value) {
+    char *  end;
+    long    fd;
+
+    if (value == NULL)
+        return -1;
+    fd = strtol(value, &end, 10);
+    if (*end != ':' || fd < 0 || strtol(end + 1, NULL, 10) != (long) getpid())
+        return -1;
+    return (int) fd;
+}
+
+static void preload_ldstat_write(const char * event, const char * arg) {
+    char            buf[PATH_MAX + 64];
+    struct timespec ts;
+    int             errno_bak = errno;
+    int             n;
+
+    if (s_ldstat_fd < 0)
+        return ;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    n = snprintf(buf, sizeof(buf), "%s %lld%s%s\n", event,
+                 (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec, arg ? " " : "", arg ? arg : "");
+    if (n >= (int) sizeof(buf)) {
+        n = sizeof(buf) - 1;
+        buf[n - 1] = '\n';
+    }
+    if (n > 0 && write(s_ldstat_fd, buf, n) != n) {
+        s_ldstat_fd = -1;
+    }
+    errno = errno_bak;
+}
+
+/* ************************************************************************ */
+/* rtld-audit(7) interface, when loaded with LD_AUDIT                        */
+/* ************************************************************************ */
+
+unsigned int la_version(unsigned int version) {
+    s_ldstat_fd = preload_ldstat_fd(getenv(PRELOAD_LDSTAT_ENV));
+    preload_ldstat_write("audit", NULL);
+    return version < LAV_CURRENT ? version : LAV_CURRENT;
+}
+
+char * la_objsearch(const char * name, uintptr_t * cookie, unsigned int flag) {
+    (void) cookie;
+    if (flag == LA_SER_ORIG)
+        preload_ldstat_write("search", name);
+    return (char *) name;
+}
+
+unsigned int la_objopen(struct link_map * map, Lmid_t lmid, uintptr_t * cookie) {
+    (void) cookie;
+    /* the program has an empty name */
+    if (lmid == LM_ID_BASE)
+        preload_ldstat_write("open", map->l_name != NULL && *map->l_name ? map->l_name : "-");
+    return 0;
+}
+
+void la_activity(uintptr_t * cookie, unsigned int flag) {
+    (void) cookie;
+    if (flag == LA_ACT_CONSISTENT)
+        preload_ldstat_write("consistent", NULL);
+}
+
+/* ************************************************************************ */
+/* program start, when loaded with LD_PRELOAD                                */
+/* ************************************************************************ */
+
+static int preload_main(int argc, char ** argv, char ** envp) {
+    preload_ldstat_write("main", NULL);
+    return s_main(argc, argv, envp);
+}
+
+/* called by the program entry point, after constructors of shared objects: the ones
+ * of the program are called by the real __libc_start_main(), just before main() */
+int __libc_start_main(preload_main_t main, int argc, char ** argv, void (*init)(void),
+                      void (*fini)(void), void (*rtld_fini)(void), void * stack_end) {
+    preload_start_main_t    start_main;
+    size_t                  len = sizeof(PRELOAD_LDSTAT_ENV) - 1;
+
+    *(void **) (&start_main) = dlsym(RTLD_NEXT, "__libc_start_main");
+    if (start_main == NULL)
+        _exit(127);
+    for (char ** env = argv + argc + 1; *env != NULL; ++env) {
+        if (strncmp(*env, PRELOAD_LDSTAT_ENV, len) == 0 && (*env)[len] == '=') {
+            s_ldstat_fd = preload_ldstat_fd(*env + len + 1);
+            break ;
+        }
+    }
+    preload_ldstat_write("startmain", NULL);
+    s_main = main;
+    return start_main(preload_main, argc, argv, init, fini, rtld_fini, stack_end);
+}
+
+#endif /* __linux__ && __GLIBC__ */
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Exit-time snapshot of the program from linux /proc: memory breakdown read at
+ * the ptrace exit stop (the memory is released before the zombie state), final
+ * context switches, I/O and scheduler counters read from the zombie. Only the
+ * process of the program is covered, not its children.
+ */
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#ifdef __linux__
+# include <sys/ptrace.h>
+#endif
+
+#include "procsnap.h"
+
+static ssize_t procsnap_read(pid_t pid, const char * file, char * buf, size_t size) {
+    char    path[64];
+    ssize_t n;
+    int     fd;
+
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int) pid, file);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    buf[n > 0 ? n : 0] = 0;
+    return n;
+}
+
+/* value of the line '<name><separator> <value>' of buf */
+static int procsnap_field(const char * buf, const char * name, uint64_t * value) {
+    size_t          len = strlen(name);
+    const char *    s;
+
+    for (s = buf; (s = strstr(s, name)) != NULL; s += len) {
+        if ((s == buf || s[-1] == '\n') && s[len] == ':') {
+            *value = strtoull(s + len + 1, NULL, 10);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* memory, at the exit stop */
+static void procsnap_memory(procsnap_t * ps, pid_t pid) {
+    char buf[4096];
+
+    if (procsnap_read(pid, "status", buf, sizeof(buf)) <= 0
+    ||  procsnap_field(buf, "VmHWM", &ps->vmhwm) != 0)
+        return ;
+    procsnap_field(buf, "VmRSS", &ps->vmrss);
+    procsnap_field(buf, "RssAnon", &ps->rssanon);
+    procsnap_field(buf, "RssFile", &ps->rssfile);
+    procsnap_field(buf, "RssShmem", &ps->rssshmem);
+    procsnap_field(buf, "VmSwap", &ps->swap);
+    /* smaps_rollup: linux 4.14 */
+    if (procsnap_read(pid, "smaps_rollup", buf, sizeof(buf)) > 0)
+        procsnap_field(buf, "AnonHugePages", &ps->anonhuge);
+    ps->memory = 1;
+}
+
+/* counters, final once pid is a zombie */
+static void procsnap_counters(procsnap_t * ps, pid_t pid) {
+    char        buf[8192];
+    const char *s;
+
+    if (procsnap_read(pid, "status", buf, sizeof(buf)) > 0) {
+        procsnap_field(buf, "voluntary_ctxt_switches", &ps->nvcsw);
+        procsnap_field(buf, "nonvoluntary_ctxt_switches", &ps->nivcsw);
+        ps->final = 1;
+    }
+    /* readable by the owner or root */
+    if (procsnap_read(pid, "io", buf, sizeof(buf)) > 0) {
+        procsnap_field(buf, "rchar", &ps->rchar);
+        procsnap_field(buf, "wchar", &ps->wchar);
+        procsnap_field(buf, "syscr", &ps->syscr);
+        procsnap_field(buf, "syscw", &ps->syscw);
+        procsnap_field(buf, "read_bytes", &ps->read_bytes);
+        procsnap_field(buf, "write_bytes", &ps->write_bytes);
+    }
+    /* 'se.sum_exec_runtime                :          1.234567' (CONFIG_SCHED_DEBUG) */
+    if (procsnap_read(pid, "sched", buf, sizeof(buf)) > 0) {
+        if ((s = strstr(buf, "se.sum_exec_runtime")) != NULL && (s = strchr(s, ':')) != NULL)
+            ps->runtime_ms = strtod(s + 1, NULL);
+        if ((s = strstr(buf, "se.nr_migrations")) != NULL && (s = strchr(s, ':')) != NULL)
+            ps->migrations = strtoull(s + 1, NULL, 10);
+    }
+}
+
+#ifndef __linux__
+
+int procsnap_start(procsnap_t * ps, pid_t pid) {
+    (void) ps;
+    (void) pid;
+    errno = ENOSYS;
+    return -1;
+}
+
+#else /* __linux__ */
+
+int procsnap_start(procsnap_t * ps, pid_t pid) {
+    if (ptrace(PTRACE_SEIZE, pid, NULL, (void *) PTRACE_O_TRACEEXIT) != 0)
+        return -1;
+    ps->traced = 1;
+    return 0;
+}
+
+#endif /* __linux__ */
+
+int procsnap_wait(procsnap_t * ps, pid_t pid) {
+    while (1) {
+        siginfo_t   si;
+        int         st;
+
+        memset(&si, 0, sizeof(si));
+        if (waitid(P_PID, pid, &si, WEXITED | (ps->traced ? WSTOPPED : 0) | WNOWAIT) != 0) {
+            if (errno == EINTR)
+                continue ;
+            return -1;
+        }
+        if (si.si_code == CLD_EXITED || si.si_code == CLD_KILLED || si.si_code == CLD_DUMPED) {
+            procsnap_counters(ps, pid);
+            return 0;
+        }
+#       ifdef __linux__
+        /* ptrace stops of pid, consumed */
+        if (waitpid(pid, &st, 0) != pid || !WIFSTOPPED(st))
+            continue ;
+        if (st >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8))) {
+            procsnap_memory(ps, pid);
+            ptrace(PTRACE_CONT, pid, NULL, NULL);
+        } else if (st >> 16 == PTRACE_EVENT_STOP && WSTOPSIG(st) != SIGTRAP) {
+            /* group-stop (SIGSTOP, SIGTSTP...): pid stays stopped until SIGCONT */
+            ptrace(PTRACE_LISTEN, pid, NULL, NULL);
+        } else if (st >> 16 == PTRACE_EVENT_STOP) {
+            /* end of the group-stop */
+            ptrace(PTRACE_CONT, pid, NULL, NULL);
+        } else {
+            /* signal-delivery-stop: deliver it */
+            ptrace(PTRACE_CONT, pid, NULL, (void *) (long) WSTOPSIG(st));
+        }
+#       else
+        (void) st;
+#       endif
+    }
+}
+
+void procsnap_report(FILE * out, const procsnap_t * ps) {
+    if (ps->memory) {
+        fprintf(out, "vmhwm    %13llu (peak resident set size of the program, in bytes, at its exit)\n"
+                     "vmrss    %13llu (resident set size of the program, in bytes, at its exit: "
+                                        "anonymous %llu, file %llu, shared memory %llu, "
+                                        "anonymous huge pages %llu, swapped %llu)\n",
+                (unsigned long long) ps->vmhwm * 1024, (unsigned long long) ps->vmrss * 1024,
+                (unsigned long long) ps->rssanon * 1024, (unsigned long long) ps->rssfile * 1024,
+                (unsigned long long) ps->rssshmem * 1024, (unsigned long long) ps->anonhuge * 1024,
+                (unsigned long long) ps->swap * 1024);
+    }
+    if (ps->final) {
+        fprintf(out, "exitcsw  %13llu (context switches of the program process: %llu voluntary, "
+                                        "%llu involuntary)\n"
+                     "exitio   %13llu (bytes read by the program process with %llu syscalls, "
+                                        "%llu written with %llu syscalls, storage %llu read %llu written)\n",
+                (unsigned long long) (ps->nvcsw + ps->nivcsw),
+                (unsigned long long) ps->nvcsw, (unsigned long long) ps->nivcsw,
+                (unsigned long long) ps->rchar, (unsigned long long) ps->syscr,
+                (unsigned long long) ps->wchar, (unsigned long long) ps->syscw,
+                (unsigned long long) ps->read_bytes, (unsigned long long) ps->write_bytes);
+        if (ps->runtime_ms > 0) {
+            fprintf(out, "exitcpu  % 13.3f (milliseconds on cpu of the program process, %llu cpu migrations)\n",
+                    ps->runtime_ms, (unsigned long long) ps->migrations);
+        }
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Exit-time snapshot of the program from linux /proc: memory breakdown read at
+ * the ptrace exit stop (the memory is released before the zombie state), final
+ * context switches, I/O and scheduler counters read from the zombie. Only the
+ * process of the program is covered, not its children.
+ */
+#ifndef VRUNAS_PROCSNAP_H
+#define VRUNAS_PROCSNAP_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct {
+    int                 traced;         /* exit stop requested with ptrace */
+    int                 memory;         /* memory read at the exit stop */
+    int                 final;          /* counters read from the zombie */
+    /* status and smaps_rollup at the exit stop, in kB */
+    uint64_t            vmhwm;
+    uint64_t            vmrss;
+    uint64_t            rssanon;
+    uint64_t            rssfile;
+    uint64_t            rssshmem;
+    uint64_t            anonhuge;
+    uint64_t            swap;
+    /* status, io and sched of the zombie */
+    uint64_t            nvcsw;
+    uint64_t            nivcsw;
+    uint64_t            rchar;
+    uint64_t            wchar;
+    uint64_t            syscr;
+    uint64_t            syscw;
+    uint64_t            read_bytes;
+    uint64_t            write_bytes;
+    double              runtime_ms;     /* se.sum_exec_runtime */
+    uint64_t            migrations;
+} procsnap_t;
+
+#define PROCSNAP_INITIALIZER { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0.0, 0 }
+
+/** procsnap_start() : request a stop of pid at its exit (PTRACE_SEIZE, PTRACE_O_TRACEEXIT),
+ * to be called by the father just after fork(). Set-user-ID programs run then without
+ * their privileges if the caller is not root: not to be called for them.
+ * @return 0 on success, -1 on error (errno set): only the zombie counters are read */
+int procsnap_start(procsnap_t * ps, pid_t pid);
+
+/** procsnap_wait() : wait for the termination of pid, forwarding its signals and
+ * reading the snapshot. pid is not reaped: waitpid() is to be called next.
+ * @return 0 on success, -1 on error (errno set) */
+int procsnap_wait(procsnap_t * ps, pid_t pid);
+
+/** procsnap_report() : print the snapshot (extended timings format) */
+void procsnap_report(FILE * out, const procsnap_t * ps);
+
+#endif /* ! ifndef VRUNAS_PROCSNAP_H */
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Membership of processes in the tree of a process (linux /proc).
+ */
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "proctree.h"
+
+#define PROCTREE_MAX_DEPTH  128
+
+int proctree_add(proctree_t * tree, pid_t pid) {
+    pid_t * pids;
+
+    if (tree->count >= tree->capacity) {
+        unsigned int capacity = tree->capacity ? tree->capacity * 2 : 64;
+        if ((pids = realloc(tree->pids, capacity * sizeof(*pids))) == NULL)
+            return -1;
+        tree->pids = pids;
+        tree->capacity = capacity;
+    }
+    tree->pids[tree->count++] = pid;
+    return 0;
+}
+
+int proctree_getppid(pid_t pid, pid_t * ppid) {
+    char    path[64];
+    char    buf[512];
+    char *  s;
+    FILE *  f;
+    int     n;
+
+    /* /proc/<pid>/stat: pid (comm) state ppid ..., comm can contain spaces and ')' */
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    if ((f = fopen(path, "r")) == NULL)
+        return -1;
+    n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n > 0 ? n : 0] = 0;
+    if ((s = strrchr(buf, ')')) == NULL || sscanf(s + 1, " %*c %d", ppid) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int proctree_contains(proctree_t * tree, pid_t pid) {
+    pid_t p = pid;
+
+    for (int depth = 0; depth < PROCTREE_MAX_DEPTH && p > 1; ++depth) {
+        for (unsigned int i = 0; i < tree->count; ++i) {
+            if (tree->pids[i] == p) {
+                if (p != pid)
+                    proctree_add(tree, pid);
+                return 1;
+            }
+        }
+        if (proctree_getppid(p, &p) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+void proctree_free(proctree_t * tree) {
+    if (tree == NULL)
+        return ;
+    free(tree->pids);
+    tree->pids = NULL;
+    tree->count = tree->capacity = 0;
+}
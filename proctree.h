@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Membership of processes in the tree of a process (linux /proc).
+ */
+#ifndef VRUNAS_PROCTREE_H
+#define VRUNAS_PROCTREE_H
+
+#include <sys/types.h>
+
+typedef struct {
+    pid_t *             pids;       /* processes known to be in the tree */
+    unsigned int        count;
+    unsigned int        capacity;
+} proctree_t;
+
+#define PROCTREE_INITIALIZER { NULL, 0, 0 }
+
+/** proctree_add() : add pid to the tree (root, or processes adopted by a subreaper).
+ * @return 0 on success, -1 on error (errno set) */
+int proctree_add(proctree_t * tree, pid_t pid);
+
+/** proctree_getppid() : get parent of pid from /proc/<pid>/stat. @return 0 or -1 on error */
+int proctree_getppid(pid_t pid, pid_t * ppid);
+
+/** proctree_contains() : check whether pid or one of its ancestors is in the tree,
+ * pid is then added to the tree.
+ * @return 1 if yes, 0 if no, -1 if unknown (ancestors not readable in /proc) */
+int proctree_contains(proctree_t * tree, pid_t pid);
+
+/** proctree_free() : release resources of tree (not tree itself) */
+void proctree_free(proctree_t * tree);
+
+#endif /* ! ifndef VRUNAS_PROCTREE_H */
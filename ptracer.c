@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Syscall tracing of a process tree with ptrace (linux).
+ */
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#ifdef __linux__
+# include <sys/ptrace.h>
+#endif
+
+#include "ptracer.h"
+
+#ifndef __linux__
+
+int ptracer_child_init(void) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int ptracer_run(pid_t pid, ptracer_callback_t callback, void * user_data) {
+    (void) pid;
+    (void) callback;
+    (void) user_data;
+    errno = ENOSYS;
+    return -1;
+}
+
+#else /* __linux__ */
+
+/* PTRACE_GET_SYSCALL_INFO (linux 5.3) is used to stay independent of the architecture.
+ * The structure is redefined as <linux/ptrace.h> conflicts with <sys/ptrace.h> */
+#define PTRACER_GET_SYSCALL_INFO    0x420e
+#define PTRACER_SYSCALL_INFO_ENTRY  1
+#define PTRACER_SYSCALL_INFO_EXIT   2
+
+typedef struct {
+    uint8_t             op;
+    uint8_t             pad[3];
+    uint32_t            arch;
+    uint64_t            instruction_pointer;
+    uint64_t            stack_pointer;
+    union {
+        struct {
+            uint64_t    nr;
+            uint64_t    args[6];
+        } entry;
+        struct {
+            int64_t     rval;
+            uint8_t     is_error;
+        } exit;
+    } u;
+} ptracer_sysinfo_t;
+
+typedef struct {
+    pid_t               tid;
+    pid_t               tgid;
+    int                 in_syscall;
+    long                nr;
+    uint64_t            args[6];
+    struct timespec     ts_entry;
+} ptracer_task_t;
+
+typedef struct {
+    ptracer_task_t *    tasks;
+    unsigned int        count;
+    unsigned int        capacity;
+    int                 no_sysinfo;     /* PTRACE_GET_SYSCALL_INFO not supported */
+} ptracer_t;
+
+#define PTRACER_OPTIONS (PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK \
+                         | PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC)
+
+int ptracer_child_init(void) {
+    /* seized by the tracer while stopped, PTRACE_TRACEME does not allow PTRACE_LISTEN */
+    return raise(SIGSTOP);
+}
+
+static pid_t ptracer_get_tgid(pid_t tid) {
+    char    path[64];
+    char    line[128];
+    FILE *  f;
+    pid_t   tgid = tid;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int) tid);
+    if ((f = fopen(path, "r")) == NULL)
+        return tid;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "Tgid:", 5) == 0) {
+            tgid = strtol(line + 5, NULL, 10);
+            break ;
+        }
+    }
+    fclose(f);
+    return tgid;
+}
+
+static ptracer_task_t * ptracer_get_task(ptracer_t * tracer, pid_t tid) {
+    ptracer_task_t * task;
+
+    for (unsigned int i = 0; i < tracer->count; ++i) {
+        if (tracer->tasks[i].tid == tid)
+            return &tracer->tasks[i];
+    }
+    if (tracer->count >= tracer->capacity) {
+        unsigned int capacity = tracer->capacity ? tracer->capacity * 2 : 16;
+        if ((task = realloc(tracer->tasks, capacity * sizeof(*task))) == NULL)
+            return NULL;
+        tracer->tasks = task;
+        tracer->capacity = capacity;
+    }
+    task = &tracer->tasks[tracer->count++];
+    memset(task, 0, sizeof(*task));
+    task->tid = tid;
+    task->tgid = ptracer_get_tgid(tid);
+    return task;
+}
+
+static void ptracer_del_task(ptracer_t * tracer, pid_t tid) {
+    for (unsigned int i = 0; i < tracer->count; ++i) {
+        if (tracer->tasks[i].tid == tid) {
+            tracer->tasks[i] = tracer->tasks[--tracer->count];
+            return ;
+        }
+    }
+}
+
+static void ptracer_syscall_stop(ptracer_t * tracer, ptracer_task_t * task,
+                                 ptracer_callback_t callback, void * user_data) {
+    ptracer_sysinfo_t info;
+
+    if (tracer->no_sysinfo
+    ||  ptrace(PTRACER_GET_SYSCALL_INFO, task->tid, (void *) sizeof(info), &info) <= 0) {
+        tracer->no_sysinfo = 1;
+        return ;
+    }
+    if (info.op == PTRACER_SYSCALL_INFO_ENTRY) {
+        task->in_syscall = 1;
+        task->nr = (long) info.u.entry.nr;
+        memcpy(task->args, info.u.entry.args, sizeof(task->args));
+        clock_gettime(CLOCK_MONOTONIC, &task->ts_entry);
+    } else if (info.op == PTRACER_SYSCALL_INFO_EXIT && task->in_syscall) {
+        ptracer_syscall_t   syscall;
+        struct timespec     ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        task->in_syscall = 0;
+        syscall.tid = task->tid;
+        syscall.tgid = task->tgid;
+        syscall.nr = task->nr;
+        memcpy(syscall.args, task->args, sizeof(syscall.args));
+        syscall.ret = info.u.exit.rval;
+        syscall.is_error = info.u.exit.is_error;
+        syscall.duration_ns = (ts.tv_sec - task->ts_entry.tv_sec) * 1000000000ULL
+                              + ts.tv_nsec - task->ts_entry.tv_nsec;
+        if (callback != NULL)
+            callback(&syscall, user_data);
+    }
+}
+
+/* the new task of a fork, vfork or clone event, attached by the kernel */
+static void ptracer_add_child(ptracer_t * tracer, pid_t tid) {
+    unsigned long child;
+
+    if (ptrace(PTRACE_GETEVENTMSG, tid, NULL, &child) == 0 && child != 0)
+        ptracer_get_task(tracer, (pid_t) child);
+}
+
+/* the root of the tree terminated: its descendants go on untraced. They are
+ * interrupted to be detached, keeping their pending signal or their group-stop.
+ * Each one is waited for by its id, the root is not to be reaped. */
+static void ptracer_detach_all(ptracer_t * tracer) {
+    pid_t   tid;
+    int     st;
+
+    for (unsigned int i = 0; i < tracer->count; ++i)
+        ptrace(PTRACE_INTERRUPT, tracer->tasks[i].tid, NULL, NULL);
+    while (tracer->count > 0) {
+        int sig, event;
+
+        if ((tid = waitpid(tracer->tasks[0].tid, &st, __WALL)) < 0) {
+            if (errno == EINTR)
+                continue ;
+            ptracer_del_task(tracer, tracer->tasks[0].tid);
+            continue ;
+        }
+        if (!WIFSTOPPED(st)) {
+            ptracer_del_task(tracer, tid);
+            continue ;
+        }
+        sig = WSTOPSIG(st);
+        event = (unsigned int) st >> 16;
+        if (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK || event == PTRACE_EVENT_CLONE)
+            ptracer_add_child(tracer, tid);
+        ptrace(PTRACE_DETACH, tid, NULL, (void *) (long) (event == 0 && sig != (SIGTRAP | 0x80) ? sig : 0));
+        ptracer_del_task(tracer, tid);
+    }
+}
+
+/* next event of the tree, consumed unless it is the termination of the root */
+static pid_t ptracer_wait(pid_t pid, idtype_t idtype, int * st) {
+    siginfo_t si;
+
+    memset(&si, 0, sizeof(si));
+    if (waitid(idtype, idtype == P_PID ? (id_t) pid : 0, &si, WEXITED | WSTOPPED | WNOWAIT | __WALL) != 0)
+        return -1;
+    if (si.si_pid == pid && (si.si_code == CLD_EXITED || si.si_code == CLD_KILLED || si.si_code == CLD_DUMPED))
+        return 0;
+    return waitpid(si.si_pid, st, WUNTRACED | __WALL);
+}
+
+int ptracer_run(pid_t pid, ptracer_callback_t callback, void * user_data) {
+    ptracer_t           tracer = { .tasks = NULL, .count = 0, .capacity = 0, .no_sysinfo = 0 };
+    ptracer_task_t *    task;
+    pid_t               tid;
+    int                 st, ret = 0;
+
+    /* initial stop of pid, raised by ptracer_child_init() */
+    while ((tid = ptracer_wait(pid, P_PID, &st)) < 0 && errno == EINTR)
+        ; /* nothing */
+    if (tid == 0)
+        return 0;
+    if (tid != pid)
+        return -1;
+    if (!WIFSTOPPED(st)) {
+        errno = ECHILD;
+        return -1;
+    }
+    /* seized, the tree reports its group-stops, which are kept with PTRACE_LISTEN */
+    if (ptrace(PTRACE_SEIZE, pid, NULL, (void *) PTRACER_OPTIONS) != 0) {
+        ret = errno;
+        kill(pid, SIGCONT);
+        errno = ret;
+        return -1;
+    }
+    if (ptracer_get_task(&tracer, pid) == NULL)
+        return -1;
+    ptrace(PTRACE_INTERRUPT, pid, NULL, NULL);
+    kill(pid, SIGCONT);
+
+    while (1) {
+        int sig, event, inject = 0;
+
+        if ((tid = ptracer_wait(pid, P_ALL, &st)) < 0) {
+            if (errno == EINTR)
+                continue ;
+            ret = -1;
+            break ;
+        }
+        if (tid == 0) {
+            /* termination of pid, left to its father */
+            ptracer_del_task(&tracer, pid);
+            break ;
+        }
+        if (WIFEXITED(st) || WIFSIGNALED(st)) {
+            ptracer_del_task(&tracer, tid);
+            continue ;
+        }
+        if (!WIFSTOPPED(st) || (task = ptracer_get_task(&tracer, tid)) == NULL)
+            continue ;
+        sig = WSTOPSIG(st);
+        event = (unsigned int) st >> 16;
+        if (sig == (SIGTRAP | 0x80)) {
+            ptracer_syscall_stop(&tracer, task, callback, user_data);
+        } else if (event == PTRACE_EVENT_STOP && sig != SIGTRAP) {
+            /* group-stop: the task stays stopped until SIGCONT, as without tracer */
+            ptrace(PTRACE_LISTEN, tid, NULL, NULL);
+            continue ;
+        } else if (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK || event == PTRACE_EVENT_CLONE) {
+            ptracer_add_child(&tracer, tid);
+        } else if (event == 0) {
+            /* signal-delivery-stop */
+            inject = sig;
+        }
+        /* exec events, initial stops of new tasks and ends of group-stops resume */
+        ptrace(PTRACE_SYSCALL, tid, NULL, (void *) (long) inject);
+    }
+    ptracer_detach_all(&tracer);
+    free(tracer.tasks);
+    if (ret == 0 && tracer.no_sysinfo) {
+        errno = ENOSYS;
+        ret = -1;
+    }
+    return ret;
+}
+
+#endif /* __linux__ */
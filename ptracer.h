@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Syscall tracing of a process tree with ptrace (linux).
+ */
+#ifndef VRUNAS_PTRACER_H
+#define VRUNAS_PTRACER_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/** a completed syscall, given to ptracer_callback_t on syscall exit */
+typedef struct {
+    pid_t           tid;            /* thread doing the syscall */
+    pid_t           tgid;           /* its process */
+    long            nr;             /* syscall number (see <sys/syscall.h>) */
+    uint64_t        args[6];        /* syscall arguments, from syscall entry */
+    int64_t         ret;            /* return value, -errno if is_error */
+    int             is_error;
+    uint64_t        duration_ns;    /* time between syscall entry and exit stops */
+} ptracer_syscall_t;
+
+/** callback called on each syscall exit of the traced tree */
+typedef void (*ptracer_callback_t)(const ptracer_syscall_t * syscall, void * user_data);
+
+/** ptracer_child_init() : to be called by the process to be traced, just before
+ * execve(): it stops itself until the tracer has seized it.
+ * @return 0 on success, -1 on error (errno set) */
+int ptracer_child_init(void);
+
+/** ptracer_run() : trace syscalls of pid (which called ptracer_child_init()) and of
+ * its future children and threads, until pid terminates. The remaining tracees are
+ * then detached. The group-stops of the tree are kept (PTRACE_LISTEN), so that the
+ * job control of the program works as without tracer.
+ * pid is not reaped: its zombie can still be read, waitpid() is to be called next.
+ * @return 0 on success, -1 on error (errno set) */
+int ptracer_run(pid_t pid, ptracer_callback_t callback, void * user_data);
+
+#endif /* ! ifndef VRUNAS_PTRACER_H */
@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Reproducibility profile of a run: address space randomization disabled,
+ * argument and environment strings padded to a fixed size, cpu pinning, fixed
+ * timer slack and seeds of the common random generators (linux). Sweep of
+ * stack layouts, to separate their effect from the noise of the runs.
+ */
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#ifdef __linux__
+# include <sys/personality.h>
+# include <sys/prctl.h>
+#endif
+
+#include "repro.h"
+
+extern char ** environ;
+
+/* random generators seeded from the environment */
+static const char * const s_seed_vars[] = {
+    "PYTHONHASHSEED", "PERL_HASH_SEED", "RANDOM_SEED", NULL
+};
+
+int repro_parse_sweep(const char * str, repro_t * rp) {
+    char *          end;
+    unsigned long   layouts, repeats = REPRO_SWEEP_REPEATS;
+
+    errno = 0;
+    layouts = strtoul(str, &end, 10);
+    if (*end == 'x')
+        repeats = strtoul(end + 1, &end, 10);
+    if (errno != 0 || *end != 0 || *str < '0' || *str > '9'
+    ||  layouts < 2 || layouts > 1000 || repeats < 2 || repeats > 1000)
+        return -1;
+    rp->sweep = layouts;
+    rp->repeats = repeats;
+    return 0;
+}
+
+int repro_init(repro_t * rp) {
+#ifdef __linux__
+    cpu_set_t   set;
+    void *      p;
+
+    if (rp->sweep > 0) {
+        struct timespec ts;
+        uint64_t        x;
+
+        if ((rp->offsets = calloc(rp->sweep, sizeof(*rp->offsets))) == NULL
+        ||  (rp->nruns = calloc(rp->sweep, sizeof(*rp->nruns))) == NULL
+        ||  (rp->seconds = calloc(rp->sweep * rp->repeats, sizeof(*rp->seconds))) == NULL)
+            return -1;
+        /* the first layout is the one of --reproducible, the others are drawn from
+         * the seed (FNV-1a) so that the same layouts can be run again, else at random */
+        if (rp->seed != NULL) {
+            x = 0xcbf29ce484222325ULL;
+            for (const char * s = rp->seed; *s; ++s)
+                x = (x ^ (unsigned char) *s) * 0x100000001b3ULL;
+        } else {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            x = (uint64_t) ts.tv_nsec ^ ((uint64_t) getpid() << 32) ^ (uint64_t) ts.tv_sec;
+        }
+        for (unsigned int l = 1; l < rp->sweep; ++l) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            rp->offsets[l] = ((x >> 33) % (REPRO_SWEEP_MAX_OFFSET / 16)) * 16;
+        }
+    }
+
+    if (rp->enabled) {
+        if (sched_getaffinity(0, sizeof(set), &set) != 0)
+            return -1;
+        if (rp->cpu < 0) {
+            /* the last cpu, the first ones taking usually more interrupts */
+            for (int cpu = CPU_SETSIZE - 1; cpu >= 0 && rp->cpu < 0; --cpu) {
+                if (CPU_ISSET(cpu, &set))
+                    rp->cpu = cpu;
+            }
+        }
+        if (rp->cpu < 0 || rp->cpu >= CPU_SETSIZE || !CPU_ISSET(rp->cpu, &set)) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    if ((p = mmap(NULL, sizeof(*rp->shared), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        return -1;
+    rp->shared = p;
+    return 0;
+#else
+    (void) rp;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* pad the environment so that the strings and the pointers to them at the top of the
+ * stack of the program have the same size whatever its arguments and the environment
+ * of the caller: REPRO_PAD_ENV<n>= variables, then REPRO_PAD_ENV=<pad> */
+static int repro_pad(repro_shared_t * sh, char * const * argv, size_t offset) {
+    char    name[sizeof(REPRO_PAD_ENV) + 16];
+    size_t  size = 0, pad;
+    char *  value;
+    int     ret;
+
+    /* padding of a vrunas running this one */
+    for (char ** s = environ; s != NULL && *s != NULL; ) {
+        if (strncmp(*s, REPRO_PAD_ENV, sizeof(REPRO_PAD_ENV) - 1) == 0) {
+            snprintf(name, sizeof(name), "%.*s", (int) strcspn(*s, "="), *s);
+            unsetenv(name);
+            s = environ;
+        } else {
+            ++s;
+        }
+    }
+    sh->entries = 0;
+    for (char * const * s = argv; *s != NULL; ++s, ++sh->entries)
+        size += strlen(*s) + 1;
+    for (char ** s = environ; s != NULL && *s != NULL; ++s, ++sh->entries)
+        size += strlen(*s) + 1;
+    sh->strings = size;
+    sh->padentries = (sh->entries + REPRO_STACK_ENTRIES) / REPRO_STACK_ENTRIES * REPRO_STACK_ENTRIES;
+    for (unsigned int i = sh->entries + 1; i < sh->padentries; ++i) {
+        snprintf(name, sizeof(name), "%s%u", REPRO_PAD_ENV, i);
+        if (setenv(name, "", 1) != 0)
+            return -1;
+        size += strlen(name) + 2;
+    }
+    size += sizeof(REPRO_PAD_ENV) + 1;
+    sh->padded = (size + REPRO_STACK_SIZE - 1) / REPRO_STACK_SIZE * REPRO_STACK_SIZE + offset;
+    pad = sh->padded - size;
+    if ((value = malloc(pad + 1)) == NULL)
+        return -1;
+    memset(value, '.', pad);
+    value[pad] = 0;
+    ret = setenv(REPRO_PAD_ENV, value, 1);
+    free(value);
+    return ret;
+}
+
+static void repro_step(repro_shared_t * sh, int step, int ok, int * errno_bak) {
+    if (ok) {
+        sh->applied |= step;
+    } else {
+        sh->failed |= step;
+        *errno_bak = errno;
+    }
+}
+
+int repro_child(repro_t * rp, char * const * argv) {
+#ifdef __linux__
+    repro_shared_t  local = { 0, 0, 0, 0, 0, 0, { 0, 0 } };
+    repro_shared_t *sh = rp->shared != NULL ? rp->shared : &local;
+    int             errno_bak = 0;
+
+    if (rp->seed != NULL) {
+        int ok = 1;
+
+        for (const char * const * var = s_seed_vars; *var != NULL; ++var)
+            ok = setenv(*var, rp->seed, 1) == 0 && ok;
+        /* the seed of perl is used only without its per-hash perturbation */
+        ok = setenv("PERL_PERTURB_KEYS", "0", 1) == 0 && ok;
+        repro_step(sh, REPRO_SEED, ok, &errno_bak);
+    }
+    if (rp->enabled) {
+        cpu_set_t   set;
+
+        repro_step(sh, REPRO_TIMERSLACK, prctl(PR_SET_TIMERSLACK, REPRO_TIMERSLACK_NS, 0, 0, 0) == 0, &errno_bak);
+        CPU_ZERO(&set);
+        CPU_SET(rp->cpu, &set);
+        repro_step(sh, REPRO_CPU, sched_setaffinity(0, sizeof(set), &set) == 0, &errno_bak);
+    }
+    if (rp->enabled || rp->sweep > 0) {
+        int pers = personality(0xffffffff);
+
+        repro_step(sh, REPRO_ASLR, pers != -1 && personality(pers | ADDR_NO_RANDOMIZE) != -1, &errno_bak);
+        /* last, the environment being complete */
+        repro_step(sh, REPRO_PAD, repro_pad(sh, argv, rp->offset) == 0, &errno_bak);
+    }
+    if (errno_bak != 0) {
+        errno = errno_bak;
+        return -1;
+    }
+    return 0;
+#else
+    (void) rp;
+    (void) argv;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static const char * repro_state(const repro_shared_t * sh, int step, const char * on, const char * off) {
+    return (sh->applied & step) != 0 ? on : (sh->failed & step) != 0 ? "failed" : off;
+}
+
+void repro_exec(repro_t * rp) {
+    if (rp->sweep > 0 && rp->shared != NULL && clock_gettime(CLOCK_MONOTONIC_RAW, &rp->shared->exec) != 0)
+        memset(&rp->shared->exec, 0, sizeof(rp->shared->exec));
+}
+
+void repro_report(FILE * out, const repro_t * rp) {
+    const repro_shared_t * sh = rp->shared;
+
+    if (sh == NULL)
+        return ;
+    if (rp->enabled) {
+        fprintf(out, "repro    %13d (cpu of the program with --reproducible, pinning %s, address space "
+                                       "randomization %s, timer slack %d ns %s)\n"
+                     "repropad %13lu (bytes of argument and environment strings of the program, %lu "
+                                       "before padding, in %u strings, %u before padding, padding %s)\n",
+                rp->cpu, repro_state(sh, REPRO_CPU, "done", "not done"),
+                repro_state(sh, REPRO_ASLR, "off", "on"),
+                REPRO_TIMERSLACK_NS, repro_state(sh, REPRO_TIMERSLACK, "set", "not set"),
+                (unsigned long) sh->padded, (unsigned long) sh->strings, sh->padentries, sh->entries,
+                repro_state(sh, REPRO_PAD, "done", "not done"));
+    }
+    if (rp->seed != NULL) {
+        fprintf(out, "seed     %13s (value of PYTHONHASHSEED, PERL_HASH_SEED and RANDOM_SEED of the "
+                                       "program, %s)\n",
+                rp->seed, repro_state(sh, REPRO_SEED, "set", "not set"));
+    }
+}
+
+void repro_sweep_record(repro_t * rp, unsigned int layout, const struct timespec * begin,
+                        const struct timespec * end) {
+    if (rp->shared != NULL && (rp->shared->exec.tv_sec != 0 || rp->shared->exec.tv_nsec != 0))
+        begin = &rp->shared->exec;
+    if (layout < rp->sweep && rp->nruns[layout] < rp->repeats)
+        rp->seconds[layout * rp->repeats + rp->nruns[layout]++] = (end->tv_sec - begin->tv_sec)
+                                                                  + (end->tv_nsec - begin->tv_nsec) / 1e9;
+    /* the next run records its own */
+    if (rp->shared != NULL)
+        memset(&rp->shared->exec, 0, sizeof(rp->shared->exec));
+}
+
+/* one-way analysis of variance of the real times by layout: the variance of the
+ * means of the layouts minus the part expected from the noise of the runs */
+void repro_sweep_report(FILE * out, const repro_t * rp) {
+    double          mean = 0, within = 0, between = 0, layout, lmin = 0, lmax = 0;
+    unsigned int    n = 0, nlayouts = 0, lbest = 0, lworst = 0, runs = rp->repeats;
+
+    for (unsigned int l = 0; l < rp->sweep; ++l) {
+        if (rp->nruns[l] < runs)
+            runs = rp->nruns[l];
+    }
+    if (runs < 2) {
+        fprintf(out, "sweep    %13u (runs of each layout: not enough to separate layout and noise)\n", runs);
+        return ;
+    }
+    for (unsigned int l = 0; l < rp->sweep; ++l, ++nlayouts) {
+        double lmean = 0;
+
+        for (unsigned int r = 0; r < runs; ++r)
+            lmean += rp->seconds[l * rp->repeats + r];
+        lmean /= runs;
+        for (unsigned int r = 0; r < runs; ++r)
+            within += (rp->seconds[l * rp->repeats + r] - lmean) * (rp->seconds[l * rp->repeats + r] - lmean);
+        if (l == 0 || lmean < lmin)
+            lmin = lmean, lbest = l;
+        if (l == 0 || lmean > lmax)
+            lmax = lmean, lworst = l;
+        mean += lmean;
+        n += runs;
+    }
+    mean /= nlayouts;
+    for (unsigned int l = 0; l < nlayouts; ++l) {
+        double lmean = 0;
+
+        for (unsigned int r = 0; r < runs; ++r)
+            lmean += rp->seconds[l * rp->repeats + r];
+        lmean /= runs;
+        between += (lmean - mean) * (lmean - mean);
+    }
+    within /= n - nlayouts;
+    between = between * runs / (nlayouts - 1);
+    layout = between > within ? (between - within) / runs : 0.0;
+    fprintf(out, "sweep    % 13.9f (mean real time in seconds, from execve() to the termination of the program, "
+                                    "of %u layouts of the stack run %u times each, address space randomization off)\n"
+                 "layoutsd % 13.3f (percent of the mean: standard deviation due to the layout, layout means "
+                                    "from %.9f (offset %lu) to %.9f (offset %lu), %.3f%% apart)\n"
+                 "noisesd  % 13.3f (percent of the mean: standard deviation of the runs of a same layout)\n"
+                 "layoutvar% 13.1f (percent of the variance of the runs due to the layout: a difference "
+                                    "of less than %.3f%% between two versions may be a layout artefact)\n",
+            mean, nlayouts, runs,
+            mean > 0 ? 100.0 * sqrt(layout) / mean : 0.0, lmin, (unsigned long) rp->offsets[lbest],
+            lmax, (unsigned long) rp->offsets[lworst], mean > 0 ? 100.0 * (lmax - lmin) / mean : 0.0,
+            mean > 0 ? 100.0 * sqrt(within) / mean : 0.0,
+            layout + within > 0 ? 100.0 * layout / (layout + within) : 0.0,
+            mean > 0 ? 200.0 * sqrt(layout) / mean : 0.0);
+    fprintf(out, "layouts  %13u (stack offsets of the layouts in bytes, %s:", rp->sweep,
+            rp->seed != NULL ? "drawn from --seed" : "drawn at random (--seed N draws them from N)");
+    for (unsigned int l = 0; l < rp->sweep; ++l)
+        fprintf(out, " %lu", (unsigned long) rp->offsets[l]);
+    fprintf(out, ")\n");
+}
+
+void repro_free(repro_t * rp) {
+    free(rp->offsets);
+    rp->offsets = NULL;
+    free(rp->seconds);
+    rp->seconds = NULL;
+    free(rp->nruns);
+    rp->nruns = NULL;
+    if (rp->shared != NULL)
+        munmap(rp->shared, sizeof(*rp->shared));
+    rp->shared = NULL;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Reproducibility profile of a run: address space randomization disabled,
+ * argument and environment strings padded to a fixed size, cpu pinning, fixed
+ * timer slack and seeds of the common random generators (linux). Sweep of
+ * stack layouts, to separate their effect from the noise of the runs.
+ */
+#ifndef VRUNAS_REPRO_H
+#define VRUNAS_REPRO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+
+#define REPRO_STACK_SIZE        8192    /* argument and environment strings, padded to a multiple */
+#define REPRO_STACK_ENTRIES     64      /* arguments and variables, padded to a multiple */
+#define REPRO_PAD_ENV           "VRUNAS_PAD"
+#define REPRO_TIMERSLACK_NS     50000   /* default of the kernel, whatever the one of the caller */
+#define REPRO_SWEEP_REPEATS     3       /* runs of each layout */
+#define REPRO_SWEEP_MAX_OFFSET  4096    /* stack offsets of the layouts, multiple of 16 bytes */
+
+enum {
+    REPRO_ASLR          = 1 << 0,       /* personality(ADDR_NO_RANDOMIZE) */
+    REPRO_PAD           = 1 << 1,
+    REPRO_CPU           = 1 << 2,
+    REPRO_TIMERSLACK    = 1 << 3,
+    REPRO_SEED          = 1 << 4,
+};
+
+/* what the child applied before its execve() */
+typedef struct {
+    int                 applied;        /* REPRO_* */
+    int                 failed;
+    size_t              strings;        /* bytes of argument and environment strings, before padding */
+    size_t              padded;
+    unsigned int        entries;        /* arguments and variables, before padding */
+    unsigned int        padentries;
+    struct timespec     exec;           /* just before execve() in a run of the sweep (CLOCK_MONOTONIC_RAW) */
+} repro_shared_t;
+
+typedef struct {
+    int                 enabled;        /* --reproducible */
+    int                 cpu;            /* cpu of the program, -1 for the last one allowed */
+    const char *        seed;           /* value of the seed variables, NULL if not set */
+    repro_shared_t *    shared;
+    unsigned int        sweep;          /* layouts of --layout-sweep, 0 if none */
+    unsigned int        repeats;        /* runs of each layout */
+    size_t              offset;         /* bytes added to the padding of the next run */
+    size_t *            offsets;        /* of each layout */
+    double *            seconds;        /* real time of each run, by layout */
+    unsigned int *      nruns;          /* runs of each layout */
+} repro_t;
+
+#define REPRO_INITIALIZER { 0, -1, NULL, NULL, 0, REPRO_SWEEP_REPEATS, 0, NULL, NULL, NULL }
+
+/** repro_parse_sweep() : parse 'L' or 'LxR', L layouts (2 at least) of R runs (2 at least).
+ * @return 0 or -1 on error */
+int repro_parse_sweep(const char * str, repro_t * rp);
+
+/** repro_init() : choose the cpu if not given, check that it is allowed, draw the
+ * stack offsets of the layouts (from rp->seed if set, so that they can be drawn
+ * again) and create the state shared with the child.
+ * To be called before fork().
+ * @return 0 on success, -1 on error (errno set, EINVAL if the cpu is not allowed) */
+int repro_init(repro_t * rp);
+
+/** repro_child() : apply the profile in the process which is going to execute argv,
+ * the environment being complete. Each step is applied even if another one failed.
+ * With a sweep, the address space randomization is off and rp->offset is added
+ * to the padding.
+ * @return 0 on success, -1 if a step failed (errno set) */
+int repro_child(repro_t * rp, char * const * argv);
+
+/** repro_exec() : with a sweep, record the time just before execve(), the start of
+ * the run in repro_sweep_record() */
+void repro_exec(repro_t * rp);
+
+/** repro_report() : print what was applied (extended timings format) */
+void repro_report(FILE * out, const repro_t * rp);
+
+/** repro_sweep_record() : record the real time of a run of layout, from execve() if
+ * repro_exec() was called since the previous run, else from begin, to end (the
+ * termination of the program, CLOCK_MONOTONIC_RAW) */
+void repro_sweep_record(repro_t * rp, unsigned int layout, const struct timespec * begin,
+                        const struct timespec * end);
+
+/** repro_sweep_report() : print the mean real time of the runs, the deviations due to
+ * the layout and to the noise, the share of the variance due to the layout and the
+ * stack offsets of the layouts (extended timings format) */
+void repro_sweep_report(FILE * out, const repro_t * rp);
+
+/** repro_free() : release resources of rp (not rp itself) */
+void repro_free(repro_t * rp);
+
+#endif /* ! ifndef VRUNAS_REPRO_H */
@@ -0,0 +1,439 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Scheduler locality of a process tree: cpu migrations, runqueue wait and
+ * NUMA placement of memory, and per-thread breakdown, sampled from linux /proc.
+ */
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "schedinfo.h"
+
+#define SCHEDINFO_MAX_DEPTH     64
+
+static ssize_t schedinfo_read(const char * path, char * buf, size_t size) {
+    ssize_t n;
+    int     fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    buf[n > 0 ? n : 0] = 0;
+    return n;
+}
+
+static int schedinfo_parse_cpulist(schedinfo_t * si, const char * list, int node) {
+    const char * s = list;
+
+    while (*s >= '0' && *s <= '9') {
+        char *  end;
+        long    first = strtol(s, &end, 10), last = first;
+
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (long cpu = first; cpu <= last && cpu < si->ncpus; ++cpu)
+            si->cpunode[cpu] = node;
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return 0;
+}
+
+int schedinfo_init(schedinfo_t * si, int numa) {
+    char path[128];
+    char buf[1024];
+
+    si->numa = numa;
+    if ((si->ncpus = sysconf(_SC_NPROCESSORS_CONF)) <= 0)
+        si->ncpus = 1;
+    if ((si->cpunode = calloc(si->ncpus, sizeof(*si->cpunode))) == NULL)
+        return -1;
+    si->nnodes = 1;
+    for (int node = 0; node < SCHEDINFO_MAX_NODES; ++node) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (schedinfo_read(path, buf, sizeof(buf)) <= 0)
+            continue ;
+        schedinfo_parse_cpulist(si, buf, node);
+        si->nnodes = node + 1;
+    }
+    return 0;
+}
+
+static schedinfo_thread_t * schedinfo_get_thread(schedinfo_t * si, pid_t tid) {
+    schedinfo_thread_t * thread;
+
+    for (unsigned int i = 0; i < si->count; ++i) {
+        if (si->threads[i].tid == tid)
+            return &si->threads[i];
+    }
+    if (si->count >= si->capacity) {
+        unsigned int capacity = si->capacity ? si->capacity * 2 : 32;
+        if ((thread = realloc(si->threads, capacity * sizeof(*thread))) == NULL)
+            return NULL;
+        si->threads = thread;
+        si->capacity = capacity;
+    }
+    thread = &si->threads[si->count++];
+    memset(thread, 0, sizeof(*thread));
+    thread->tid = tid;
+    thread->cpu = -1;
+    return thread;
+}
+
+static schedinfo_proc_t * schedinfo_get_proc(schedinfo_t * si, pid_t pid) {
+    schedinfo_proc_t * proc;
+
+    for (unsigned int i = 0; i < si->nprocs; ++i) {
+        if (si->procs[i].pid == pid)
+            return &si->procs[i];
+    }
+    if (si->nprocs >= si->proccapacity) {
+        unsigned int capacity = si->proccapacity ? si->proccapacity * 2 : 16;
+        if ((proc = realloc(si->procs, capacity * sizeof(*proc))) == NULL)
+            return NULL;
+        si->procs = proc;
+        si->proccapacity = capacity;
+    }
+    proc = &si->procs[si->nprocs++];
+    memset(proc, 0, sizeof(*proc));
+    proc->pid = pid;
+    return proc;
+}
+
+static void schedinfo_sample_thread(schedinfo_t * si, pid_t pid, pid_t tid) {
+    schedinfo_thread_t *    thread;
+    char                    path[128];
+    char                    buf[4096];
+    char *                  s, * end, * tok;
+    unsigned long long      exec_ns, wait_ns, timeslices;
+    uint64_t                tick_ns = 1000000000ULL / sysconf(_SC_CLK_TCK);
+    int                     field, has_switches = 0;
+
+    /* stat: tid (comm) state ppid ... see proc(5) for field numbers */
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", (int) pid, (int) tid);
+    if (schedinfo_read(path, buf, sizeof(buf)) <= 0
+    ||  (s = strchr(buf, '(')) == NULL || (end = strrchr(buf, ')')) == NULL
+    ||  (thread = schedinfo_get_thread(si, tid)) == NULL)
+        return ;
+    thread->tgid = pid;
+    *end = 0;
+    strncpy(thread->comm, s + 1, sizeof(thread->comm) - 1);
+    for (tok = strtok_r(end + 1, " ", &s), field = 3; tok != NULL && field <= 39;
+         tok = strtok_r(NULL, " ", &s), ++field) {
+        switch (field) {
+            case 10: thread->minflt = strtoull(tok, NULL, 10); break ;
+            case 12: thread->majflt = strtoull(tok, NULL, 10); break ;
+            case 14: thread->utime_ns = strtoull(tok, NULL, 10) * tick_ns; break ;
+            case 15: thread->stime_ns = strtoull(tok, NULL, 10) * tick_ns; break ;
+            case 39: thread->cpu = strtol(tok, NULL, 10); break ;
+        }
+    }
+
+    /* schedstat: time on cpu, time waiting on a runqueue (ns), timeslices */
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/schedstat", (int) pid, (int) tid);
+    if (schedinfo_read(path, buf, sizeof(buf)) > 0
+    &&  sscanf(buf, "%llu %llu %llu", &exec_ns, &wait_ns, &timeslices) == 3) {
+        thread->exec_ns = exec_ns;
+        thread->wait_ns = wait_ns;
+        thread->timeslices = timeslices;
+    }
+
+    /* sched: '<name> : <value>' lines (CONFIG_SCHED_DEBUG) */
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/sched", (int) pid, (int) tid);
+    if (schedinfo_read(path, buf, sizeof(buf)) > 0) {
+        for (s = buf; s != NULL && *s; s = (end = strchr(s, '\n')) ? end + 1 : NULL) {
+            char *      colon = strchr(s, ':');
+            uint64_t *  value = NULL;
+
+            if (strncmp(s, "se.nr_migrations ", 17) == 0)
+                value = &thread->migrations;
+            else if (strncmp(s, "nr_voluntary_switches ", 22) == 0)
+                value = &thread->nvcsw;
+            else if (strncmp(s, "nr_involuntary_switches ", 24) == 0)
+                value = &thread->nivcsw;
+            if (value != NULL && colon != NULL) {
+                *value = strtoull(colon + 1, NULL, 10);
+                has_switches += (value != &thread->migrations);
+            }
+        }
+    }
+    if (has_switches)
+        return ;
+
+    /* status: context switches are always there */
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/status", (int) pid, (int) tid);
+    if (schedinfo_read(path, buf, sizeof(buf)) <= 0)
+        return ;
+    if ((s = strstr(buf, "\nvoluntary_ctxt_switches:")) != NULL)
+        thread->nvcsw = strtoull(s + 26, NULL, 10);
+    if ((s = strstr(buf, "\nnonvoluntary_ctxt_switches:")) != NULL)
+        thread->nivcsw = strtoull(s + 29, NULL, 10);
+}
+
+static void schedinfo_sample_numa(schedinfo_t * si, pid_t pid) {
+    uint64_t            node_kb[SCHEDINFO_MAX_NODES];
+    uint64_t            total = 0;
+    schedinfo_proc_t *  proc;
+    char                path[128];
+    char                line[4096];
+    FILE *              f;
+
+    /* numa_maps: '<addr> <policy> ... N<node>=<pages> ... kernelpagesize_kB=<kB>' */
+    snprintf(path, sizeof(path), "/proc/%d/numa_maps", (int) pid);
+    if ((f = fopen(path, "r")) == NULL)
+        return ;
+    memset(node_kb, 0, sizeof(node_kb));
+    while (fgets(line, sizeof(line), f) != NULL) {
+        uint64_t    pages[SCHEDINFO_MAX_NODES];
+        uint64_t    page_kb = 4;
+        int         maxnode = -1;
+        char *      s;
+
+        for (char * tok = strtok_r(line, " \n", &s); tok != NULL; tok = strtok_r(NULL, " \n", &s)) {
+            if (tok[0] == 'N' && tok[1] >= '0' && tok[1] <= '9') {
+                char *  end;
+                long    node = strtol(tok + 1, &end, 10);
+
+                if (*end != '=' || node >= SCHEDINFO_MAX_NODES)
+                    continue ;
+                while (maxnode < node)
+                    pages[++maxnode] = 0;
+                pages[node] += strtoull(end + 1, NULL, 10);
+            } else if (strncmp(tok, "kernelpagesize_kB=", 18) == 0) {
+                page_kb = strtoull(tok + 18, NULL, 10);
+            }
+        }
+        for (int node = 0; node <= maxnode; ++node) {
+            node_kb[node] += pages[node] * page_kb;
+            total += pages[node] * page_kb;
+        }
+    }
+    fclose(f);
+    /* nothing is mapped anymore when the process has exited: keep the last sample */
+    if (total > 0 && (proc = schedinfo_get_proc(si, pid)) != NULL)
+        memcpy(proc->node_kb, node_kb, sizeof(node_kb));
+}
+
+static void schedinfo_sample_tree(schedinfo_t * si, pid_t pid, int numa, int depth) {
+    char            path[128];
+    char            buf[4096];
+    DIR *           dir;
+    struct dirent * ent;
+
+    snprintf(path, sizeof(path), "/proc/%d/task", (int) pid);
+    if ((dir = opendir(path)) == NULL)
+        return ;
+    while ((ent = readdir(dir)) != NULL) {
+        pid_t tid;
+
+        if (*ent->d_name < '0' || *ent->d_name > '9')
+            continue ;
+        tid = strtol(ent->d_name, NULL, 10);
+        schedinfo_sample_thread(si, pid, tid);
+
+        /* children of the thread (linux 3.5, CONFIG_PROC_CHILDREN) */
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/children", (int) pid, (int) tid);
+        if (depth < SCHEDINFO_MAX_DEPTH && schedinfo_read(path, buf, sizeof(buf)) > 0) {
+            char * s = buf, * end;
+            long   child;
+
+            while ((child = strtol(s, &end, 10)) > 0 && end != s) {
+                schedinfo_sample_tree(si, child, numa, depth + 1);
+                s = end;
+            }
+        }
+    }
+    closedir(dir);
+    if (numa)
+        schedinfo_sample_numa(si, pid);
+}
+
+static void * schedinfo_thread(void * data) {
+    schedinfo_t *   si = data;
+    struct timespec ts = { 0, SCHEDINFO_INTERVAL_MS * 1000000L };
+
+    while (!si->stop) {
+        nanosleep(&ts, NULL);
+        if (si->stop)
+            break ;
+        schedinfo_sample_tree(si, si->root,
+                              si->numa && (si->nsamples % SCHEDINFO_NUMA_PERIOD) == 0, 0);
+        ++si->nsamples;
+    }
+    return NULL;
+}
+
+int schedinfo_start(schedinfo_t * si, pid_t pid) {
+    si->root = pid;
+    si->stop = 0;
+    if ((errno = pthread_create(&si->thread, NULL, schedinfo_thread, si)) != 0)
+        return -1;
+    si->running = 1;
+    return 0;
+}
+
+void schedinfo_stop(schedinfo_t * si) {
+    if (!si->running)
+        return ;
+    si->stop = 1;
+    pthread_join(si->thread, NULL);
+    si->running = 0;
+    schedinfo_sample_tree(si, si->root, si->numa, 0);
+    ++si->nsamples;
+}
+
+void schedinfo_report(FILE * out, const schedinfo_t * si) {
+    const schedinfo_thread_t *  most = NULL;
+    uint64_t                    migrations = 0, nvcsw = 0, nivcsw = 0;
+    uint64_t                    exec_ns = 0, wait_ns = 0, timeslices = 0;
+    uint64_t                    total_kb = 0, remote_kb = 0;
+
+    for (unsigned int i = 0; i < si->count; ++i) {
+        const schedinfo_thread_t * thread = &si->threads[i];
+
+        migrations += thread->migrations;
+        nvcsw += thread->nvcsw;
+        nivcsw += thread->nivcsw;
+        exec_ns += thread->exec_ns;
+        wait_ns += thread->wait_ns;
+        timeslices += thread->timeslices;
+        if (most == NULL || thread->migrations > most->migrations)
+            most = thread;
+    }
+    fprintf(out, "sched    %13u (threads of the tree, sampled %lu times from /proc)\n",
+            si->count, si->nsamples);
+    if (si->count == 0)
+        return ;
+    fprintf(out, "migrate  %13llu (cpu migrations, %.1f per thread, at most %llu by %d '%s')\n",
+            (unsigned long long) migrations, (double) migrations / si->count,
+            (unsigned long long) most->migrations, (int) most->tid, most->comm);
+    fprintf(out, "runwait  % 3ld.%09ld (%.1f%% of runnable time waiting for a cpu, %llu timeslices)\n",
+            (long) (wait_ns / 1000000000ULL), (long) (wait_ns % 1000000000ULL),
+            exec_ns + wait_ns ? 100.0 * wait_ns / (exec_ns + wait_ns) : 0.0,
+            (unsigned long long) timeslices);
+    fprintf(out, "preempt  %13llu (involuntary context switches, %llu voluntary)\n",
+            (unsigned long long) nivcsw, (unsigned long long) nvcsw);
+
+    /* remote memory: on another node than the one where the threads of the process ran most */
+    for (unsigned int i = 0; i < si->nprocs; ++i) {
+        const schedinfo_proc_t *    proc = &si->procs[i];
+        uint64_t                    node_ns[SCHEDINFO_MAX_NODES];
+        uint64_t                    kb = 0;
+        const char *                comm = "";
+        int                         home = 0;
+
+        memset(node_ns, 0, sizeof(node_ns));
+        for (unsigned int t = 0; t < si->count; ++t) {
+            const schedinfo_thread_t * thread = &si->threads[t];
+            if (thread->tgid != proc->pid)
+                continue ;
+            if (thread->tid == proc->pid)
+                comm = thread->comm;
+            if (thread->cpu >= 0 && thread->cpu < si->ncpus)
+                node_ns[si->cpunode[thread->cpu]] += thread->exec_ns;
+        }
+        for (int node = 0; node < si->nnodes; ++node) {
+            kb += proc->node_kb[node];
+            if (node_ns[node] > node_ns[home])
+                home = node;
+        }
+        total_kb += kb;
+        remote_kb += kb - proc->node_kb[home];
+        if (si->nnodes <= 1)
+            continue ;
+        fprintf(out, "numaproc %13llu (kB of %d '%s', home node %d:",
+                (unsigned long long) kb, (int) proc->pid, comm, home);
+        for (int node = 0; node < si->nnodes; ++node)
+            fprintf(out, " N%d=%llu", node, (unsigned long long) proc->node_kb[node]);
+        fprintf(out, ")\n");
+    }
+    if (si->nprocs == 0)
+        fprintf(out, "numa               n/a (memory placement not sampled, run too short)\n");
+    else
+        fprintf(out, "numa     %13llu (kB resident, %.1f%% on a remote node, %d node%s)\n",
+                (unsigned long long) total_kb, total_kb ? 100.0 * remote_kb / total_kb : 0.0,
+                si->nnodes, si->nnodes > 1 ? "s" : "");
+}
+
+static int schedinfo_cmp_cpu(const void * a, const void * b) {
+    const schedinfo_thread_t * ta = *(const schedinfo_thread_t * const *) a;
+    const schedinfo_thread_t * tb = *(const schedinfo_thread_t * const *) b;
+    uint64_t                   ca = ta->utime_ns + ta->stime_ns, cb = tb->utime_ns + tb->stime_ns;
+
+    if (ca != cb)
+        return ca < cb ? 1 : -1;
+    return ta->exec_ns < tb->exec_ns ? 1 : (ta->exec_ns > tb->exec_ns ? -1 : 0);
+}
+
+void schedinfo_threads_report(FILE * out, const schedinfo_t * si) {
+    const schedinfo_thread_t ** sorted;
+    uint64_t                    total = 0;
+    unsigned int                i;
+
+    fprintf(out, "threads  %13u (threads of the tree, by cpu time, sampled %lu times from /proc)\n",
+            si->count, si->nsamples);
+    if (si->count == 0 || (sorted = malloc(si->count * sizeof(*sorted))) == NULL)
+        return ;
+    for (i = 0; i < si->count; ++i) {
+        sorted[i] = &si->threads[i];
+        total += si->threads[i].utime_ns + si->threads[i].stime_ns;
+    }
+    qsort(sorted, si->count, sizeof(*sorted), schedinfo_cmp_cpu);
+    for (i = 0; i < si->count && i < SCHEDINFO_THREADS_MAX; ++i) {
+        const schedinfo_thread_t *  thread = sorted[i];
+        uint64_t                    cpu = thread->utime_ns + thread->stime_ns;
+
+        fprintf(out, "thread   % 3ld.%09ld (%5.1f%%, %d/%d '%s', user %ld.%02ld sys %ld.%02ld, "
+                     "%llu+%llu csw, %llu+%llu flt)\n",
+                (long) (cpu / 1000000000ULL), (long) (cpu % 1000000000ULL),
+                total ? 100.0 * cpu / total : 0.0, (int) thread->tgid, (int) thread->tid, thread->comm,
+                (long) (thread->utime_ns / 1000000000ULL), (long) (thread->utime_ns % 1000000000ULL / 10000000),
+                (long) (thread->stime_ns / 1000000000ULL), (long) (thread->stime_ns % 1000000000ULL / 10000000),
+                (unsigned long long) thread->nvcsw, (unsigned long long) thread->nivcsw,
+                (unsigned long long) thread->minflt, (unsigned long long) thread->majflt);
+    }
+    if (i < si->count)
+        fprintf(out, "thread   %13s (%u more threads not shown)\n", "...", si->count - i);
+    free(sorted);
+}
+
+void schedinfo_free(schedinfo_t * si) {
+    if (si == NULL)
+        return ;
+    if (si->running) {
+        si->stop = 1;
+        pthread_join(si->thread, NULL);
+        si->running = 0;
+    }
+    free(si->threads);
+    free(si->procs);
+    free(si->cpunode);
+    si->threads = NULL;
+    si->procs = NULL;
+    si->cpunode = NULL;
+    si->count = si->capacity = si->nprocs = si->proccapacity = 0;
+}
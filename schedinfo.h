@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Scheduler locality of a process tree: cpu migrations, runqueue wait and
+ * NUMA placement of memory, and per-thread breakdown, sampled from linux /proc.
+ */
+#ifndef VRUNAS_SCHEDINFO_H
+#define VRUNAS_SCHEDINFO_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define SCHEDINFO_MAX_NODES     64
+#define SCHEDINFO_INTERVAL_MS   100     /* sampling period of threads */
+#define SCHEDINFO_NUMA_PERIOD   5       /* numa_maps is sampled every 5 periods */
+#define SCHEDINFO_THREADS_MAX   20      /* threads listed by schedinfo_threads_report() */
+
+typedef struct {
+    pid_t               tid;
+    pid_t               tgid;
+    char                comm[16];
+    int                 cpu;            /* last cpu the thread ran on */
+    uint64_t            migrations;
+    uint64_t            nvcsw;
+    uint64_t            nivcsw;
+    uint64_t            exec_ns;        /* time on cpu */
+    uint64_t            wait_ns;        /* time waiting on a runqueue */
+    uint64_t            timeslices;
+    uint64_t            utime_ns;
+    uint64_t            stime_ns;
+    uint64_t            minflt;
+    uint64_t            majflt;
+} schedinfo_thread_t;
+
+typedef struct {
+    pid_t               pid;
+    char                comm[16];
+    uint64_t            node_kb[SCHEDINFO_MAX_NODES];   /* resident memory per node */
+} schedinfo_proc_t;
+
+typedef struct {
+    schedinfo_thread_t *threads;
+    unsigned int        count;
+    unsigned int        capacity;
+    schedinfo_proc_t *  procs;          /* last numa_maps of each process */
+    unsigned int        nprocs;
+    unsigned int        proccapacity;
+    short *             cpunode;        /* node of each cpu */
+    int                 ncpus;
+    int                 nnodes;
+    int                 numa;           /* sample numa_maps */
+    pid_t               root;
+    unsigned long       nsamples;
+    int                 running;
+    volatile int        stop;
+    pthread_t           thread;
+} schedinfo_t;
+
+#define SCHEDINFO_INITIALIZER { NULL, 0, 0, NULL, 0, 0, NULL, 0, 1, 0, -1, 0, 0, 0, }
+
+/** schedinfo_init() : get the cpu/node topology.
+ * @param numa if not 0, the NUMA placement of memory is sampled too
+ * @return 0 on success, -1 on error (errno set) */
+int schedinfo_init(schedinfo_t * si, int numa);
+
+/** schedinfo_start() : start sampling the threads of pid and of its children */
+int schedinfo_start(schedinfo_t * si, pid_t pid);
+
+/** schedinfo_stop() : stop sampling after a last sample. To be called once pid is
+ * terminated but not reaped yet (waitid(WNOWAIT)), so that /proc/<pid> is readable */
+void schedinfo_stop(schedinfo_t * si);
+
+/** schedinfo_report() : print migrations, runqueue wait and remote memory
+ * (extended timings format) */
+void schedinfo_report(FILE * out, const schedinfo_t * si);
+
+/** schedinfo_threads_report() : print the busiest threads with their user/sys time,
+ * context switches and page faults (extended timings format) */
+void schedinfo_threads_report(FILE * out, const schedinfo_t * si);
+
+/** schedinfo_free() : release resources of si (not si itself) */
+void schedinfo_free(schedinfo_t * si);
+
+#endif /* ! ifndef VRUNAS_SCHEDINFO_H */
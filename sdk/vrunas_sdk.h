@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Header-only instrumentation of a program run by 'vrunas --phases' (C and C++):
+ * phase markers and named counters, written to the shared region inherited from
+ * vrunas (VRUNAS_SHM_FD) and reported by vrunas -T. Without vrunas, all calls do
+ * nothing.
+ *
+ *   #define VRUNAS_SDK_IMPLEMENTATION   (in one source file of the program, before the include)
+ *   #include "vrunas_sdk.h"
+ *
+ *   vrunas_phase_begin("load");     ...     vrunas_phase_begin("compute");
+ *   vrunas_counter_add("items", n); ...     vrunas_phase_end();
+ *
+ * The state of the sdk is defined once, by the file defining VRUNAS_SDK_IMPLEMENTATION.
+ * The header is to be included before the system headers, or the program built with
+ * -D_GNU_SOURCE (it needs POSIX and GNU declarations, also with -std=c99), and linked
+ * with -pthread on systems where the threads are not in the libc.
+ *
+ * A phase is per thread: beginning a phase ends the current one of the thread.
+ * Each thread has its own cache-line aligned slot of the region, updated without
+ * lock; each phase boundary costs a clock_gettime() and a getrusage(RUSAGE_THREAD).
+ * The slot of a thread is released when it exits, the child of a fork() gets its own.
+ * Names are looked up on each call, use vrunas_phase_id()/vrunas_counter_id() and
+ * the *_id() variants in hot paths.
+ */
+#ifndef VRUNAS_SDK_H
+#define VRUNAS_SDK_H
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VRUNAS_SDK_ENV          "VRUNAS_SHM_FD"         /* "<fd>" of the region */
+#define VRUNAS_SDK_MAGIC        0x7672756e61737331ULL   /* "vrunass1" */
+#define VRUNAS_SDK_PHASES       16
+#define VRUNAS_SDK_COUNTERS     16
+#define VRUNAS_SDK_NAMELEN      24
+#define VRUNAS_SDK_SLOTS        128     /* threads, the following ones are not measured */
+
+enum {
+    VRUNAS_SDK_WALL = 0,                /* nanoseconds, CLOCK_MONOTONIC */
+    VRUNAS_SDK_UTIME,                   /* nanoseconds */
+    VRUNAS_SDK_STIME,
+    VRUNAS_SDK_MINFLT,
+    VRUNAS_SDK_MAJFLT,
+    VRUNAS_SDK_NVCSW,
+    VRUNAS_SDK_NIVCSW,
+    VRUNAS_SDK_METRICS
+};
+
+enum { VRUNAS_SDK_FREE = 0, VRUNAS_SDK_BUSY, VRUNAS_SDK_READY };
+
+#define VRUNAS_SDK_RELEASED     0xffffffffU     /* tid of a slot whose thread exited */
+
+typedef struct {
+    volatile uint32_t   state;                  /* VRUNAS_SDK_FREE, _BUSY while written, _READY */
+    char                name[VRUNAS_SDK_NAMELEN + 4];
+} vrunas_sdk_name_t;
+
+typedef struct {
+    volatile uint32_t   tid;                    /* owner thread, 0 if free, VRUNAS_SDK_RELEASED */
+    volatile uint32_t   phase;                  /* current phase + 1, 0 if none */
+    uint64_t            start[VRUNAS_SDK_METRICS];                      /* at begin of phase */
+    uint64_t            total[VRUNAS_SDK_PHASES][VRUNAS_SDK_METRICS];
+    uint64_t            count[VRUNAS_SDK_PHASES];
+    int64_t             counters[VRUNAS_SDK_COUNTERS];
+} vrunas_sdk_slot_data_t;
+
+/* one slot per cache line(s), so that threads do not share lines */
+typedef union {
+    vrunas_sdk_slot_data_t  d;
+    char                    pad[(sizeof(vrunas_sdk_slot_data_t) + 63) & ~(size_t) 63];
+} vrunas_sdk_slot_t;
+
+typedef struct {
+    uint64_t            magic;
+    uint32_t            size;                   /* of the region */
+    volatile uint32_t   nslots;                 /* slots claimed, by as many threads */
+    volatile uint32_t   overflow;               /* threads which got no slot */
+    uint32_t            reserved[11];
+    vrunas_sdk_name_t   phases[VRUNAS_SDK_PHASES];
+    vrunas_sdk_name_t   counters[VRUNAS_SDK_COUNTERS];
+    vrunas_sdk_slot_t   slots[VRUNAS_SDK_SLOTS];
+} vrunas_sdk_region_t;
+
+#ifdef VRUNAS_SDK_IMPLEMENTATION
+/* -1 not attached yet, 0 no region, 1 attached */
+int                             vrunas_sdk_state_ = -1;
+vrunas_sdk_region_t *           vrunas_sdk_region_ = NULL;
+pthread_key_t                   vrunas_sdk_key_;                /* releases the slot at thread exit */
+__thread vrunas_sdk_slot_data_t * vrunas_sdk_tslot_ = NULL;
+__thread uint32_t               vrunas_sdk_ttid_ = 0;
+#else
+extern int                      vrunas_sdk_state_;
+extern vrunas_sdk_region_t *    vrunas_sdk_region_;
+extern pthread_key_t            vrunas_sdk_key_;
+extern __thread vrunas_sdk_slot_data_t * vrunas_sdk_tslot_;
+extern __thread uint32_t        vrunas_sdk_ttid_;
+#endif
+
+static inline void vrunas_sdk_sample(uint64_t * values);
+static inline void vrunas_sdk_phase_close(vrunas_sdk_slot_data_t * slot, const uint64_t * values);
+
+/* the phase of the exiting thread is closed, its slot can be reused by another thread */
+static inline void vrunas_sdk_thread_exit(void * data) {
+    vrunas_sdk_slot_data_t *    slot = (vrunas_sdk_slot_data_t *) data;
+    uint64_t                    values[VRUNAS_SDK_METRICS];
+
+    if (slot == NULL || slot != vrunas_sdk_tslot_)
+        return ;
+    if (slot->phase != 0) {
+        vrunas_sdk_sample(values);
+        vrunas_sdk_phase_close(slot, values);
+    }
+    vrunas_sdk_tslot_ = NULL;
+    __atomic_store_n(&slot->tid, VRUNAS_SDK_RELEASED, __ATOMIC_RELEASE);
+}
+
+/* the thread of the child is not the one of the father: it claims its own slot */
+static inline void vrunas_sdk_fork_child(void) {
+    if (vrunas_sdk_tslot_ != NULL)
+        pthread_setspecific(vrunas_sdk_key_, NULL);
+    vrunas_sdk_tslot_ = NULL;
+    vrunas_sdk_ttid_ = 0;
+}
+
+static inline vrunas_sdk_region_t * vrunas_sdk_region(void) {
+    vrunas_sdk_region_t *   region;
+    struct stat             st;
+    const char *            env;
+    char *                  end;
+    long                    fd;
+    int                     state = __atomic_load_n(&vrunas_sdk_state_, __ATOMIC_ACQUIRE);
+
+    if (state >= 0)
+        return state ? vrunas_sdk_region_ : NULL;
+    region = NULL;
+    if ((env = getenv(VRUNAS_SDK_ENV)) != NULL && *env
+    &&  (fd = strtol(env, &end, 10)) >= 0 && *end == 0
+    &&  fstat((int) fd, &st) == 0 && (size_t) st.st_size >= sizeof(vrunas_sdk_region_t)) {
+        void * p = mmap(NULL, sizeof(vrunas_sdk_region_t), PROT_READ | PROT_WRITE, MAP_SHARED, (int) fd, 0);
+        if (p != MAP_FAILED && ((vrunas_sdk_region_t *) p)->magic == VRUNAS_SDK_MAGIC
+        &&  ((vrunas_sdk_region_t *) p)->size == sizeof(vrunas_sdk_region_t))
+            region = (vrunas_sdk_region_t *) p;
+        else if (p != MAP_FAILED)
+            munmap(p, sizeof(vrunas_sdk_region_t));
+    }
+    state = -1;
+    if (__atomic_compare_exchange_n(&vrunas_sdk_state_, &state, region != NULL ? 2 : 0, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* 2 while the pointer is published */
+        if (region != NULL && (pthread_key_create(&vrunas_sdk_key_, vrunas_sdk_thread_exit) != 0
+                               || pthread_atfork(NULL, NULL, vrunas_sdk_fork_child) != 0)) {
+            munmap(region, sizeof(vrunas_sdk_region_t));
+            region = NULL;
+        }
+        vrunas_sdk_region_ = region;
+        __atomic_store_n(&vrunas_sdk_state_, region != NULL ? 1 : 0, __ATOMIC_RELEASE);
+        return region;
+    }
+    /* another thread attached first */
+    if (region != NULL)
+        munmap(region, sizeof(vrunas_sdk_region_t));
+    while ((state = __atomic_load_n(&vrunas_sdk_state_, __ATOMIC_ACQUIRE)) == 2)
+        ; /* nothing */
+    return state ? vrunas_sdk_region_ : NULL;
+}
+
+static inline uint32_t vrunas_sdk_gettid(void) {
+#ifdef SYS_gettid
+    return (uint32_t) syscall(SYS_gettid);
+#else
+    return (uint32_t) getpid();
+#endif
+}
+
+/* slot of the calling thread, claimed on first use */
+static inline vrunas_sdk_slot_data_t * vrunas_sdk_slot(void) {
+    vrunas_sdk_region_t *   region;
+    uint32_t                tid;
+
+    if (vrunas_sdk_tslot_ != NULL || vrunas_sdk_ttid_ != 0)
+        return vrunas_sdk_tslot_;
+    if ((region = vrunas_sdk_region()) == NULL)
+        return NULL;
+    vrunas_sdk_ttid_ = tid = vrunas_sdk_gettid();
+    /* the id of a thread which exited without releasing its slot can be reused */
+    for (unsigned int i = 0; i < VRUNAS_SDK_SLOTS; ++i) {
+        uint32_t owner = __atomic_load_n(&region->slots[i].d.tid, __ATOMIC_ACQUIRE);
+        /* a released slot keeps its totals, added to the ones of the next thread */
+        if (owner == tid || ((owner == 0 || owner == VRUNAS_SDK_RELEASED)
+                             && __atomic_compare_exchange_n(&region->slots[i].d.tid, &owner, tid, 0,
+                                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))) {
+            if (owner != tid)
+                __atomic_add_fetch(&region->nslots, 1, __ATOMIC_RELAXED);
+            vrunas_sdk_tslot_ = &region->slots[i].d;
+            pthread_setspecific(vrunas_sdk_key_, vrunas_sdk_tslot_);
+            return vrunas_sdk_tslot_;
+        }
+    }
+    __atomic_add_fetch(&region->overflow, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/* index of name in table, registered if not found, or -1 if the table is full */
+static inline int vrunas_sdk_name_id(vrunas_sdk_name_t * table, unsigned int size, const char * name) {
+    if (name == NULL)
+        return -1;
+    for (unsigned int i = 0; i < size; ++i) {
+        uint32_t state = __atomic_load_n(&table[i].state, __ATOMIC_ACQUIRE);
+
+        if (state == VRUNAS_SDK_FREE && __atomic_compare_exchange_n(&table[i].state, &state,
+                                            VRUNAS_SDK_BUSY, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            strncpy(table[i].name, name, VRUNAS_SDK_NAMELEN);
+            table[i].name[VRUNAS_SDK_NAMELEN] = 0;
+            __atomic_store_n(&table[i].state, VRUNAS_SDK_READY, __ATOMIC_RELEASE);
+            return (int) i;
+        }
+        while (state == VRUNAS_SDK_BUSY)
+            state = __atomic_load_n(&table[i].state, __ATOMIC_ACQUIRE);
+        if (strncmp(table[i].name, name, VRUNAS_SDK_NAMELEN) == 0)
+            return (int) i;
+    }
+    return -1;
+}
+
+static inline void vrunas_sdk_sample(uint64_t * values) {
+    struct timespec ts;
+    struct rusage   ru;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    values[VRUNAS_SDK_WALL] = (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#ifdef RUSAGE_THREAD
+    if (getrusage(RUSAGE_THREAD, &ru) != 0)
+#else
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+#endif
+        memset(&ru, 0, sizeof(ru));
+    values[VRUNAS_SDK_UTIME] = (uint64_t) ru.ru_utime.tv_sec * 1000000000ULL + (uint64_t) ru.ru_utime.tv_usec * 1000ULL;
+    values[VRUNAS_SDK_STIME] = (uint64_t) ru.ru_stime.tv_sec * 1000000000ULL + (uint64_t) ru.ru_stime.tv_usec * 1000ULL;
+    values[VRUNAS_SDK_MINFLT] = (uint64_t) ru.ru_minflt;
+    values[VRUNAS_SDK_MAJFLT] = (uint64_t) ru.ru_majflt;
+    values[VRUNAS_SDK_NVCSW] = (uint64_t) ru.ru_nvcsw;
+    values[VRUNAS_SDK_NIVCSW] = (uint64_t) ru.ru_nivcsw;
+}
+
+/* account the current phase of slot up to now (values). A slot is written only by its thread */
+static inline void vrunas_sdk_phase_close(vrunas_sdk_slot_data_t * slot, const uint64_t * values) {
+    uint32_t phase = slot->phase;
+
+    if (phase == 0 || phase > VRUNAS_SDK_PHASES)
+        return ;
+    for (unsigned int m = 0; m < VRUNAS_SDK_METRICS; ++m)
+        slot->total[phase - 1][m] += values[m] - slot->start[m];
+    ++slot->count[phase - 1];
+    __atomic_store_n(&slot->phase, 0, __ATOMIC_RELEASE);
+}
+
+/** vrunas_phase_id() : index of the phase name, or -1 if not run by vrunas --phases,
+ * or if VRUNAS_SDK_PHASES phases are already used */
+static inline int vrunas_phase_id(const char * name) {
+    vrunas_sdk_region_t * region = vrunas_sdk_region();
+    return region != NULL ? vrunas_sdk_name_id(region->phases, VRUNAS_SDK_PHASES, name) : -1;
+}
+
+/** vrunas_counter_id() : index of the counter name, or -1 (see vrunas_phase_id()) */
+static inline int vrunas_counter_id(const char * name) {
+    vrunas_sdk_region_t * region = vrunas_sdk_region();
+    return region != NULL ? vrunas_sdk_name_id(region->counters, VRUNAS_SDK_COUNTERS, name) : -1;
+}
+
+/** vrunas_phase_begin_id() : end the current phase of the thread and begin phase id */
+static inline void vrunas_phase_begin_id(int id) {
+    vrunas_sdk_slot_data_t *    slot;
+    uint64_t                    values[VRUNAS_SDK_METRICS];
+
+    if (id < 0 || id >= VRUNAS_SDK_PHASES || (slot = vrunas_sdk_slot()) == NULL)
+        return ;
+    vrunas_sdk_sample(values);
+    vrunas_sdk_phase_close(slot, values);
+    memcpy(slot->start, values, sizeof(slot->start));
+    __atomic_store_n(&slot->phase, (uint32_t) id + 1, __ATOMIC_RELEASE);
+}
+
+/** vrunas_phase_begin() : end the current phase of the thread and begin phase name */
+static inline void vrunas_phase_begin(const char * name) {
+    vrunas_phase_begin_id(vrunas_phase_id(name));
+}
+
+/** vrunas_phase_end() : end the current phase of the thread */
+static inline void vrunas_phase_end(void) {
+    vrunas_sdk_slot_data_t *    slot;
+    uint64_t                    values[VRUNAS_SDK_METRICS];
+
+    if ((slot = vrunas_sdk_slot()) == NULL || slot->phase == 0)
+        return ;
+    vrunas_sdk_sample(values);
+    vrunas_sdk_phase_close(slot, values);
+}
+
+/** vrunas_counter_add_id() : add value to counter id */
+static inline void vrunas_counter_add_id(int id, int64_t value) {
+    vrunas_sdk_slot_data_t * slot;
+
+    if (id >= 0 && id < VRUNAS_SDK_COUNTERS && (slot = vrunas_sdk_slot()) != NULL)
+        slot->counters[id] += value;
+}
+
+/** vrunas_counter_add() : add value to counter name */
+static inline void vrunas_counter_add(const char * name, int64_t value) {
+    vrunas_counter_add_id(vrunas_counter_id(name), value);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! ifndef VRUNAS_SDK_H */
@@ -0,0 +1,877 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Syscall counts, errors and latencies of a process tree, with the linux
+ * raw_syscalls tracepoints (root) or with ptrace.
+ */
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+#endif
+
+#include "perfevent.h"
+#include "ptracer.h"
+#include "syscount.h"
+
+#define SYSCOUNT_RING_PAGES     256     /* data pages of the ring of each cpu, power of 2 */
+#define SYSCOUNT_READ_MS        10
+
+/* names of the usual syscalls, others are reported by number */
+static const struct { long nr; const char * name; } s_syscount_names[] = {
+#ifdef __linux__
+#ifdef SYS_read
+    { SYS_read, "read" },
+#endif
+#ifdef SYS_write
+    { SYS_write, "write" },
+#endif
+#ifdef SYS_open
+    { SYS_open, "open" },
+#endif
+#ifdef SYS_close
+    { SYS_close, "close" },
+#endif
+#ifdef SYS_stat
+    { SYS_stat, "stat" },
+#endif
+#ifdef SYS_fstat
+    { SYS_fstat, "fstat" },
+#endif
+#ifdef SYS_lstat
+    { SYS_lstat, "lstat" },
+#endif
+#ifdef SYS_poll
+    { SYS_poll, "poll" },
+#endif
+#ifdef SYS_lseek
+    { SYS_lseek, "lseek" },
+#endif
+#ifdef SYS_mmap
+    { SYS_mmap, "mmap" },
+#endif
+#ifdef SYS_mprotect
+    { SYS_mprotect, "mprotect" },
+#endif
+#ifdef SYS_munmap
+    { SYS_munmap, "munmap" },
+#endif
+#ifdef SYS_brk
+    { SYS_brk, "brk" },
+#endif
+#ifdef SYS_rt_sigaction
+    { SYS_rt_sigaction, "rt_sigaction" },
+#endif
+#ifdef SYS_rt_sigprocmask
+    { SYS_rt_sigprocmask, "rt_sigprocmask" },
+#endif
+#ifdef SYS_rt_sigreturn
+    { SYS_rt_sigreturn, "rt_sigreturn" },
+#endif
+#ifdef SYS_ioctl
+    { SYS_ioctl, "ioctl" },
+#endif
+#ifdef SYS_pread64
+    { SYS_pread64, "pread64" },
+#endif
+#ifdef SYS_pwrite64
+    { SYS_pwrite64, "pwrite64" },
+#endif
+#ifdef SYS_readv
+    { SYS_readv, "readv" },
+#endif
+#ifdef SYS_writev
+    { SYS_writev, "writev" },
+#endif
+#ifdef SYS_access
+    { SYS_access, "access" },
+#endif
+#ifdef SYS_pipe
+    { SYS_pipe, "pipe" },
+#endif
+#ifdef SYS_select
+    { SYS_select, "select" },
+#endif
+#ifdef SYS_sched_yield
+    { SYS_sched_yield, "sched_yield" },
+#endif
+#ifdef SYS_mremap
+    { SYS_mremap, "mremap" },
+#endif
+#ifdef SYS_msync
+    { SYS_msync, "msync" },
+#endif
+#ifdef SYS_mincore
+    { SYS_mincore, "mincore" },
+#endif
+#ifdef SYS_madvise
+    { SYS_madvise, "madvise" },
+#endif
+#ifdef SYS_dup
+    { SYS_dup, "dup" },
+#endif
+#ifdef SYS_dup2
+    { SYS_dup2, "dup2" },
+#endif
+#ifdef SYS_nanosleep
+    { SYS_nanosleep, "nanosleep" },
+#endif
+#ifdef SYS_getpid
+    { SYS_getpid, "getpid" },
+#endif
+#ifdef SYS_sendfile
+    { SYS_sendfile, "sendfile" },
+#endif
+#ifdef SYS_socket
+    { SYS_socket, "socket" },
+#endif
+#ifdef SYS_connect
+    { SYS_connect, "connect" },
+#endif
+#ifdef SYS_accept
+    { SYS_accept, "accept" },
+#endif
+#ifdef SYS_sendto
+    { SYS_sendto, "sendto" },
+#endif
+#ifdef SYS_recvfrom
+    { SYS_recvfrom, "recvfrom" },
+#endif
+#ifdef SYS_sendmsg
+    { SYS_sendmsg, "sendmsg" },
+#endif
+#ifdef SYS_recvmsg
+    { SYS_recvmsg, "recvmsg" },
+#endif
+#ifdef SYS_shutdown
+    { SYS_shutdown, "shutdown" },
+#endif
+#ifdef SYS_bind
+    { SYS_bind, "bind" },
+#endif
+#ifdef SYS_listen
+    { SYS_listen, "listen" },
+#endif
+#ifdef SYS_socketpair
+    { SYS_socketpair, "socketpair" },
+#endif
+#ifdef SYS_setsockopt
+    { SYS_setsockopt, "setsockopt" },
+#endif
+#ifdef SYS_getsockopt
+    { SYS_getsockopt, "getsockopt" },
+#endif
+#ifdef SYS_clone
+    { SYS_clone, "clone" },
+#endif
+#ifdef SYS_fork
+    { SYS_fork, "fork" },
+#endif
+#ifdef SYS_vfork
+    { SYS_vfork, "vfork" },
+#endif
+#ifdef SYS_execve
+    { SYS_execve, "execve" },
+#endif
+#ifdef SYS_exit
+    { SYS_exit, "exit" },
+#endif
+#ifdef SYS_wait4
+    { SYS_wait4, "wait4" },
+#endif
+#ifdef SYS_kill
+    { SYS_kill, "kill" },
+#endif
+#ifdef SYS_uname
+    { SYS_uname, "uname" },
+#endif
+#ifdef SYS_fcntl
+    { SYS_fcntl, "fcntl" },
+#endif
+#ifdef SYS_flock
+    { SYS_flock, "flock" },
+#endif
+#ifdef SYS_fsync
+    { SYS_fsync, "fsync" },
+#endif
+#ifdef SYS_fdatasync
+    { SYS_fdatasync, "fdatasync" },
+#endif
+#ifdef SYS_truncate
+    { SYS_truncate, "truncate" },
+#endif
+#ifdef SYS_ftruncate
+    { SYS_ftruncate, "ftruncate" },
+#endif
+#ifdef SYS_getdents
+    { SYS_getdents, "getdents" },
+#endif
+#ifdef SYS_chdir
+    { SYS_chdir, "chdir" },
+#endif
+#ifdef SYS_fchdir
+    { SYS_fchdir, "fchdir" },
+#endif
+#ifdef SYS_rename
+    { SYS_rename, "rename" },
+#endif
+#ifdef SYS_mkdir
+    { SYS_mkdir, "mkdir" },
+#endif
+#ifdef SYS_rmdir
+    { SYS_rmdir, "rmdir" },
+#endif
+#ifdef SYS_creat
+    { SYS_creat, "creat" },
+#endif
+#ifdef SYS_link
+    { SYS_link, "link" },
+#endif
+#ifdef SYS_unlink
+    { SYS_unlink, "unlink" },
+#endif
+#ifdef SYS_symlink
+    { SYS_symlink, "symlink" },
+#endif
+#ifdef SYS_readlink
+    { SYS_readlink, "readlink" },
+#endif
+#ifdef SYS_chmod
+    { SYS_chmod, "chmod" },
+#endif
+#ifdef SYS_fchmod
+    { SYS_fchmod, "fchmod" },
+#endif
+#ifdef SYS_chown
+    { SYS_chown, "chown" },
+#endif
+#ifdef SYS_fchown
+    { SYS_fchown, "fchown" },
+#endif
+#ifdef SYS_umask
+    { SYS_umask, "umask" },
+#endif
+#ifdef SYS_gettimeofday
+    { SYS_gettimeofday, "gettimeofday" },
+#endif
+#ifdef SYS_getrlimit
+    { SYS_getrlimit, "getrlimit" },
+#endif
+#ifdef SYS_getrusage
+    { SYS_getrusage, "getrusage" },
+#endif
+#ifdef SYS_sysinfo
+    { SYS_sysinfo, "sysinfo" },
+#endif
+#ifdef SYS_getuid
+    { SYS_getuid, "getuid" },
+#endif
+#ifdef SYS_getgid
+    { SYS_getgid, "getgid" },
+#endif
+#ifdef SYS_geteuid
+    { SYS_geteuid, "geteuid" },
+#endif
+#ifdef SYS_getegid
+    { SYS_getegid, "getegid" },
+#endif
+#ifdef SYS_getppid
+    { SYS_getppid, "getppid" },
+#endif
+#ifdef SYS_setsid
+    { SYS_setsid, "setsid" },
+#endif
+#ifdef SYS_statfs
+    { SYS_statfs, "statfs" },
+#endif
+#ifdef SYS_fstatfs
+    { SYS_fstatfs, "fstatfs" },
+#endif
+#ifdef SYS_prctl
+    { SYS_prctl, "prctl" },
+#endif
+#ifdef SYS_arch_prctl
+    { SYS_arch_prctl, "arch_prctl" },
+#endif
+#ifdef SYS_sync
+    { SYS_sync, "sync" },
+#endif
+#ifdef SYS_gettid
+    { SYS_gettid, "gettid" },
+#endif
+#ifdef SYS_readahead
+    { SYS_readahead, "readahead" },
+#endif
+#ifdef SYS_futex
+    { SYS_futex, "futex" },
+#endif
+#ifdef SYS_sched_setaffinity
+    { SYS_sched_setaffinity, "sched_setaffinity" },
+#endif
+#ifdef SYS_sched_getaffinity
+    { SYS_sched_getaffinity, "sched_getaffinity" },
+#endif
+#ifdef SYS_getdents64
+    { SYS_getdents64, "getdents64" },
+#endif
+#ifdef SYS_set_tid_address
+    { SYS_set_tid_address, "set_tid_address" },
+#endif
+#ifdef SYS_fadvise64
+    { SYS_fadvise64, "fadvise64" },
+#endif
+#ifdef SYS_clock_gettime
+    { SYS_clock_gettime, "clock_gettime" },
+#endif
+#ifdef SYS_clock_nanosleep
+    { SYS_clock_nanosleep, "clock_nanosleep" },
+#endif
+#ifdef SYS_exit_group
+    { SYS_exit_group, "exit_group" },
+#endif
+#ifdef SYS_epoll_wait
+    { SYS_epoll_wait, "epoll_wait" },
+#endif
+#ifdef SYS_epoll_ctl
+    { SYS_epoll_ctl, "epoll_ctl" },
+#endif
+#ifdef SYS_tgkill
+    { SYS_tgkill, "tgkill" },
+#endif
+#ifdef SYS_waitid
+    { SYS_waitid, "waitid" },
+#endif
+#ifdef SYS_openat
+    { SYS_openat, "openat" },
+#endif
+#ifdef SYS_mkdirat
+    { SYS_mkdirat, "mkdirat" },
+#endif
+#ifdef SYS_newfstatat
+    { SYS_newfstatat, "newfstatat" },
+#endif
+#ifdef SYS_unlinkat
+    { SYS_unlinkat, "unlinkat" },
+#endif
+#ifdef SYS_renameat
+    { SYS_renameat, "renameat" },
+#endif
+#ifdef SYS_faccessat
+    { SYS_faccessat, "faccessat" },
+#endif
+#ifdef SYS_pselect6
+    { SYS_pselect6, "pselect6" },
+#endif
+#ifdef SYS_ppoll
+    { SYS_ppoll, "ppoll" },
+#endif
+#ifdef SYS_set_robust_list
+    { SYS_set_robust_list, "set_robust_list" },
+#endif
+#ifdef SYS_splice
+    { SYS_splice, "splice" },
+#endif
+#ifdef SYS_sync_file_range
+    { SYS_sync_file_range, "sync_file_range" },
+#endif
+#ifdef SYS_utimensat
+    { SYS_utimensat, "utimensat" },
+#endif
+#ifdef SYS_epoll_pwait
+    { SYS_epoll_pwait, "epoll_pwait" },
+#endif
+#ifdef SYS_eventfd2
+    { SYS_eventfd2, "eventfd2" },
+#endif
+#ifdef SYS_fallocate
+    { SYS_fallocate, "fallocate" },
+#endif
+#ifdef SYS_accept4
+    { SYS_accept4, "accept4" },
+#endif
+#ifdef SYS_epoll_create1
+    { SYS_epoll_create1, "epoll_create1" },
+#endif
+#ifdef SYS_dup3
+    { SYS_dup3, "dup3" },
+#endif
+#ifdef SYS_pipe2
+    { SYS_pipe2, "pipe2" },
+#endif
+#ifdef SYS_prlimit64
+    { SYS_prlimit64, "prlimit64" },
+#endif
+#ifdef SYS_sendmmsg
+    { SYS_sendmmsg, "sendmmsg" },
+#endif
+#ifdef SYS_recvmmsg
+    { SYS_recvmmsg, "recvmmsg" },
+#endif
+#ifdef SYS_getrandom
+    { SYS_getrandom, "getrandom" },
+#endif
+#ifdef SYS_memfd_create
+    { SYS_memfd_create, "memfd_create" },
+#endif
+#ifdef SYS_execveat
+    { SYS_execveat, "execveat" },
+#endif
+#ifdef SYS_copy_file_range
+    { SYS_copy_file_range, "copy_file_range" },
+#endif
+#ifdef SYS_statx
+    { SYS_statx, "statx" },
+#endif
+#ifdef SYS_io_submit
+    { SYS_io_submit, "io_submit" },
+#endif
+#ifdef SYS_io_getevents
+    { SYS_io_getevents, "io_getevents" },
+#endif
+#ifdef SYS_io_uring_enter
+    { SYS_io_uring_enter, "io_uring_enter" },
+#endif
+#ifdef SYS_clone3
+    { SYS_clone3, "clone3" },
+#endif
+#ifdef SYS_close_range
+    { SYS_close_range, "close_range" },
+#endif
+#ifdef SYS_rseq
+    { SYS_rseq, "rseq" },
+#endif
+#ifdef SYS_faccessat2
+    { SYS_faccessat2, "faccessat2" },
+#endif
+#ifdef SYS_readlinkat
+    { SYS_readlinkat, "readlinkat" },
+#endif
+#ifdef SYS_fchmodat
+    { SYS_fchmodat, "fchmodat" },
+#endif
+#ifdef SYS_fchownat
+    { SYS_fchownat, "fchownat" },
+#endif
+#endif
+    { -1, NULL }
+};
+
+static const char * syscount_name(long nr, char * buf, size_t size) {
+    for (unsigned int i = 0; s_syscount_names[i].name != NULL; ++i) {
+        if (s_syscount_names[i].nr == nr)
+            return s_syscount_names[i].name;
+    }
+    snprintf(buf, size, "syscall_%ld", nr);
+    return buf;
+}
+
+static uint64_t syscount_thread_ns(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* account a syscall, latency_ns being -1 if unknown (entry or exit not seen) */
+static void syscount_account(syscount_t * sc, int64_t nr, int is_error, int64_t latency_ns) {
+    syscount_stat_t * stat;
+
+    if (nr < 0)
+        return ;
+    stat = &sc->stats[nr < SYSCOUNT_MAX_NR ? nr : SYSCOUNT_MAX_NR];
+    ++stat->calls;
+    if (is_error)
+        ++stat->errors;
+    if (latency_ns >= 0) {
+        unsigned int bucket = 0;
+
+        ++stat->timed;
+        stat->total_ns += latency_ns;
+        if ((uint64_t) latency_ns > stat->max_ns)
+            stat->max_ns = latency_ns;
+        while ((latency_ns >>= 1) != 0 && bucket < SYSCOUNT_BUCKETS - 1)
+            ++bucket;
+        ++stat->hist[bucket];
+    }
+}
+
+static void syscount_ptrace_syscall(const ptracer_syscall_t * syscall, void * user_data) {
+    syscount_account(user_data, syscall->nr, syscall->is_error, syscall->duration_ns);
+}
+
+/* upper bound in microseconds of the latency of the given ratio of timed calls */
+static double syscount_percentile(const syscount_stat_t * stat, double ratio) {
+    uint64_t count = 0;
+
+    for (unsigned int i = 0; i < SYSCOUNT_BUCKETS; ++i) {
+        count += stat->hist[i];
+        if (count > 0 && count >= ratio * stat->timed)
+            return (double) (2ULL << i) / 1000.0;
+    }
+    return 0.0;
+}
+
+static void syscount_print_ns(FILE * out, const char * name, uint64_t ns) {
+    fprintf(out, "%-8s % 3ld.%09ld", name, (long) (ns / 1000000000ULL), (long) (ns % 1000000000ULL));
+}
+
+void syscount_report(FILE * out, const syscount_t * sc) {
+    uint64_t                calls = 0, errors = 0, total_ns = 0;
+    const syscount_stat_t * top[SYSCOUNT_TOP];
+    unsigned int            ntop = 0;
+
+    if (sc->stats == NULL)
+        return ;
+    for (unsigned int nr = 0; nr <= SYSCOUNT_MAX_NR; ++nr) {
+        const syscount_stat_t * stat = &sc->stats[nr];
+        unsigned int            n;
+
+        if (stat->calls == 0)
+            continue ;
+        calls += stat->calls;
+        errors += stat->errors;
+        total_ns += stat->total_ns;
+        /* keep the syscalls with most time, then most calls */
+        for (n = ntop; n > 0 && (top[n - 1]->total_ns < stat->total_ns
+                                 || (top[n - 1]->total_ns == stat->total_ns && top[n - 1]->calls < stat->calls)); --n)
+            ; /* nothing */
+        if (n >= SYSCOUNT_TOP)
+            continue ;
+        if (ntop < SYSCOUNT_TOP)
+            ++ntop;
+        memmove(&top[n + 1], &top[n], (ntop - n - 1) * sizeof(*top));
+        top[n] = stat;
+    }
+    fprintf(out, "syscalls %13llu (calls traced with %s, %llu errors, %llu lost)\n",
+            (unsigned long long) calls, sc->method == SYSC_PTRACE ? "ptrace" : "raw_syscalls tracepoints",
+            (unsigned long long) errors, (unsigned long long) sc->nlost);
+    syscount_print_ns(out, "systime", total_ns);
+    fprintf(out, " (time in syscalls from entry to exit%s)\n",
+            sc->method == SYSC_PTRACE ? ", including ptrace stops" : "");
+    syscount_print_ns(out, "overhead", sc->tracer_ns);
+    fprintf(out, " (cpu time of vrunas tracing syscalls, %.2f us per call)\n",
+            calls ? sc->tracer_ns / 1000.0 / calls : 0.0);
+    for (unsigned int i = 0; i < ntop; ++i) {
+        const syscount_stat_t * stat = top[i];
+        char                    buf[32];
+        const char *            name = stat - sc->stats < SYSCOUNT_MAX_NR
+                                       ? syscount_name(stat - sc->stats, buf, sizeof(buf)) : "other";
+
+        syscount_print_ns(out, "syscall", stat->total_ns);
+        fprintf(out, " (%s: %llu calls, %llu errors", name,
+                (unsigned long long) stat->calls, (unsigned long long) stat->errors);
+        if (stat->timed > 0) {
+            fprintf(out, ", avg %.1f us, p50 < %.1f us, p99 < %.1f us, max %.1f us",
+                    stat->total_ns / 1000.0 / stat->timed, syscount_percentile(stat, 0.5),
+                    syscount_percentile(stat, 0.99), stat->max_ns / 1000.0);
+        }
+        fprintf(out, ")\n");
+    }
+}
+
+int syscount_child(syscount_t * sc) {
+    if (sc->method == SYSC_PTRACE)
+        return ptracer_child_init();
+    return perfevent_sync_wait(sc->syncfd);
+}
+
+int syscount_wait(syscount_t * sc, pid_t pid) {
+    uint64_t    ns = syscount_thread_ns();
+    int         ret;
+
+    if (sc->method != SYSC_PTRACE) {
+        errno = ECHILD;
+        return -1;
+    }
+    ret = ptracer_run(pid, syscount_ptrace_syscall, sc);
+    sc->tracer_ns += syscount_thread_ns() - ns;
+    return ret;
+}
+
+#ifndef __linux__
+
+int syscount_init(syscount_t * sc) {
+    (void) sc;
+    errno = ENOSYS;
+    return -1;
+}
+
+int syscount_start(syscount_t * sc, pid_t pid) {
+    (void) pid;
+    perfevent_sync_release(sc->syncfd);
+    return 0;
+}
+
+void syscount_stop(syscount_t * sc) {
+    (void) sc;
+}
+
+#else /* __linux__ */
+
+int syscount_init(syscount_t * sc) {
+    if ((sc->stats = calloc(SYSCOUNT_MAX_NR + 1, sizeof(*sc->stats))) == NULL)
+        return -1;
+    if (geteuid() == 0
+    &&  perfevent_tracepoint("raw_syscalls/sys_enter", &sc->enter_id, " id", &sc->nroff, NULL) == 0
+    &&  perfevent_tracepoint("raw_syscalls/sys_exit", &sc->exit_id, " ret", &sc->retoff, NULL) == 0
+    &&  perfevent_sync_init(sc->syncfd) == 0) {
+        sc->method = SYSC_TRACEPOINT;
+        return 0;
+    }
+    sc->method = SYSC_PTRACE;
+    return 0;
+}
+
+static void syscount_record(const struct perf_event_header * hdr, const perfevent_record_t * rec, void * user_data) {
+    syscount_t *        sc = user_data;
+    /* pid, tid, time, raw size, raw data: common_type, ..., id, (args or ret) */
+    char                record[128];
+    const uint32_t *    u32 = (const uint32_t *) (record + sizeof(*hdr));
+    const char *        raw = record + sizeof(*hdr) + 4 * sizeof(uint32_t) + sizeof(uint32_t);
+    syscount_event_t *  event;
+    uint16_t            type;
+
+    if (hdr->type == PERF_RECORD_LOST) {
+        uint64_t lost[2]; /* id, lost */
+        perfevent_record_copy(rec, sizeof(*hdr), lost, sizeof(lost));
+        sc->nlost += lost[1];
+        return ;
+    }
+    if (hdr->type != PERF_RECORD_SAMPLE || hdr->size > sizeof(record))
+        return ;
+    perfevent_record_copy(rec, 0, record, hdr->size);
+    if (sc->nevents >= sc->capacity) {
+        size_t capacity = sc->capacity ? sc->capacity * 2 : 65536;
+        if ((event = realloc(sc->events, capacity * sizeof(*event))) == NULL) {
+            ++sc->nlost;
+            return ;
+        }
+        sc->events = event;
+        sc->capacity = capacity;
+    }
+    event = &sc->events[sc->nevents++];
+    memcpy(&type, raw, sizeof(type));
+    event->tid = u32[1];
+    memcpy(&event->time, u32 + 2, sizeof(event->time));
+    if (event->time > sc->seen)
+        sc->seen = event->time;
+    event->exit = type == sc->exit_id;
+    memcpy(&event->nr, raw + sc->nroff, sizeof(event->nr));
+    if (event->exit)
+        memcpy(&event->ret, raw + sc->retoff, sizeof(event->ret));
+    else
+        event->ret = 0;
+}
+
+static int syscount_cmp_event(const void * a, const void * b) {
+    const syscount_event_t * ea = a, * eb = b;
+    return ea->time < eb->time ? -1 : (ea->time > eb->time ? 1 : 0);
+}
+
+/* pairs an event with the pending sys_enter of its thread */
+static void syscount_pair(syscount_t * sc, const syscount_event_t * event) {
+    size_t j;
+
+    for (j = 0; j < sc->npending && sc->pending[j].tid != event->tid; ++j)
+        ; /* nothing */
+    if (!event->exit) {
+        if (j < sc->npending) {
+            /* previous syscall without exit (exit_group, execve, lost) */
+            syscount_account(sc, sc->pending[j].nr, 0, -1);
+        } else {
+            if (sc->npending >= sc->pcapacity) {
+                size_t              capacity = sc->pcapacity ? sc->pcapacity * 2 : 64;
+                syscount_event_t *  pending = realloc(sc->pending, capacity * sizeof(*pending));
+                if (pending == NULL) {
+                    syscount_account(sc, event->nr, 0, -1);
+                    return ;
+                }
+                sc->pending = pending;
+                sc->pcapacity = capacity;
+            }
+            ++sc->npending;
+        }
+        sc->pending[j] = *event;
+    } else if (j < sc->npending && sc->pending[j].nr == event->nr) {
+        syscount_account(sc, event->nr, event->ret < 0 && event->ret >= -4095, event->time - sc->pending[j].time);
+        sc->pending[j] = sc->pending[--sc->npending];
+    }
+    /* other exits have no entry: return of a new task from fork/clone, or
+     * execve of the program, done before the events are enabled */
+}
+
+/* pairs the events older than cutoff in time order, as the rings of the cpus are not
+ * ordered between them, and keeps the others for the next read */
+static void syscount_settle(syscount_t * sc, uint64_t cutoff) {
+    size_t n;
+
+    qsort(sc->events, sc->nevents, sizeof(*sc->events), syscount_cmp_event);
+    for (n = 0; n < sc->nevents && sc->events[n].time < cutoff; ++n)
+        syscount_pair(sc, &sc->events[n]);
+    memmove(sc->events, sc->events + n, (sc->nevents - n) * sizeof(*sc->events));
+    sc->nevents -= n;
+}
+
+/* The events are paired while they are read and only the statistics are kept. An event
+ * older than the latest one seen at the previous read of all the rings happened before
+ * the current read started: it is read, whatever its cpu */
+static void * syscount_thread(void * data) {
+    syscount_t *    sc = data;
+    struct timespec ts = { 0, SYSCOUNT_READ_MS * 1000000L };
+    uint64_t        cutoff = 0;
+
+    while (1) {
+        int stop = sc->stop;
+
+        for (unsigned int i = 0; i < sc->nrings; ++i)
+            perfevent_read_ring(sc->rings[i], sc->ringsize, syscount_record, sc);
+        if (stop)
+            break ;
+        if (sc->stats != NULL)
+            syscount_settle(sc, cutoff);
+        cutoff = sc->seen;
+        nanosleep(&ts, NULL);
+    }
+    sc->tracer_ns += syscount_thread_ns();
+    return NULL;
+}
+
+int syscount_start(syscount_t * sc, pid_t pid) {
+    struct perf_event_attr  attr;
+    long                    ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    long                    pagesize = sysconf(_SC_PAGESIZE);
+    size_t                  npages = SYSCOUNT_RING_PAGES;
+    int                     errno_first = 0;
+
+    if (sc->method != SYSC_TRACEPOINT)
+        return 0;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.sample_period = 1;
+    attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;               /* children and threads created later */
+
+    if (ncpus <= 0)
+        ncpus = 1;
+    if ((sc->fds = calloc(ncpus * 2, sizeof(*sc->fds))) == NULL
+    ||  (sc->rings = calloc(ncpus, sizeof(*sc->rings))) == NULL) {
+        perfevent_sync_release(sc->syncfd);
+        return -1;
+    }
+    /* sys_exit of a cpu is written to the ring of its sys_enter */
+    for (int cpu = 0; cpu < ncpus; ++cpu) {
+        void *  ring;
+        int     fd, fdexit;
+
+        attr.config = sc->enter_id;
+        if ((fd = perfevent_open(&attr, pid, cpu)) < 0) {
+            if (errno_first == 0)
+                errno_first = errno;
+            continue ;
+        }
+        if ((ring = perfevent_mmap(fd, &npages, sc->nrings == 0)) == NULL) {
+            if (errno_first == 0)
+                errno_first = errno;
+            close(fd);
+            continue ;
+        }
+        sc->fds[sc->nfds++] = fd;
+        sc->rings[sc->nrings++] = ring;
+        sc->ringsize = npages * pagesize;
+        attr.config = sc->exit_id;
+        if ((fdexit = perfevent_open(&attr, pid, cpu)) < 0
+        ||  ioctl(fdexit, PERF_EVENT_IOC_SET_OUTPUT, fd) != 0) {
+            if (errno_first == 0)
+                errno_first = errno;
+            if (fdexit >= 0)
+                close(fdexit);
+            continue ;
+        }
+        sc->fds[sc->nfds++] = fdexit;
+    }
+    perfevent_sync_release(sc->syncfd);
+    if (sc->nrings == 0 || sc->nfds != 2 * sc->nrings) {
+        errno = errno_first;
+        return -1;
+    }
+    sc->stop = 0;
+    if ((errno = pthread_create(&sc->thread, NULL, syscount_thread, sc)) != 0)
+        return -1;
+    sc->running = 1;
+    return 0;
+}
+
+void syscount_stop(syscount_t * sc) {
+    if (!sc->running)
+        return ;
+    sc->stop = 1;
+    pthread_join(sc->thread, NULL);
+    sc->running = 0;
+    for (unsigned int i = 0; i < sc->nfds; ++i)
+        close(sc->fds[i]);
+    for (unsigned int i = 0; i < sc->nrings; ++i)
+        perfevent_munmap(sc->rings[i], sc->ringsize);
+    sc->nfds = sc->nrings = 0;
+    if (sc->stats != NULL) {
+        uint64_t ns = syscount_thread_ns();
+        syscount_settle(sc, UINT64_MAX);
+        for (size_t j = 0; j < sc->npending; ++j)
+            syscount_account(sc, sc->pending[j].nr, 0, -1);
+        sc->tracer_ns += syscount_thread_ns() - ns;
+    }
+    free(sc->events);
+    free(sc->pending);
+    sc->events = sc->pending = NULL;
+    sc->nevents = sc->capacity = sc->npending = sc->pcapacity = 0;
+}
+
+#endif /* __linux__ */
+
+void syscount_free(syscount_t * sc) {
+    if (sc == NULL)
+        return ;
+    syscount_stop(sc);
+    perfevent_sync_release(sc->syncfd);
+    free(sc->stats);
+    free(sc->fds);
+    free(sc->rings);
+    free(sc->events);
+    free(sc->pending);
+    sc->pending = NULL;
+    sc->stats = NULL;
+    sc->fds = NULL;
+    sc->rings = NULL;
+    sc->events = NULL;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Syscall counts, errors and latencies of a process tree, with the linux
+ * raw_syscalls tracepoints (root) or with ptrace.
+ */
+#ifndef VRUNAS_SYSCOUNT_H
+#define VRUNAS_SYSCOUNT_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define SYSCOUNT_MAX_NR     1024    /* syscall numbers above are counted as one */
+#define SYSCOUNT_BUCKETS    40      /* log2 latency histogram, in nanoseconds */
+#define SYSCOUNT_TOP        15      /* syscalls listed by syscount_report() */
+
+typedef enum {
+    SYSC_NONE = 0,
+    SYSC_TRACEPOINT,            /* raw_syscalls:sys_enter/sys_exit with perf_event_open() */
+    SYSC_PTRACE,                /* syscall stops of ptrace, slower */
+} syscount_method_t;
+
+typedef struct {
+    uint64_t            calls;
+    uint64_t            errors;
+    uint64_t            timed;          /* calls with an entry and an exit */
+    uint64_t            total_ns;
+    uint64_t            max_ns;
+    uint64_t            hist[SYSCOUNT_BUCKETS]; /* hist[i]: latency in [2^i, 2^(i+1)[ ns */
+} syscount_stat_t;
+
+/* event of the tracepoints, see syscount_start() */
+typedef struct {
+    uint64_t            time;
+    uint32_t            tid;
+    int32_t             exit;
+    int64_t             nr;
+    int64_t             ret;
+} syscount_event_t;
+
+typedef struct {
+    syscount_method_t   method;
+    syscount_stat_t *   stats;          /* indexed by syscall number */
+    int                 syncfd[2];      /* the child waits for the events before execve() */
+    uint64_t            enter_id;       /* tracepoint ids */
+    uint64_t            exit_id;
+    unsigned int        nroff;          /* offsets of id and ret in raw data */
+    unsigned int        retoff;
+    int *               fds;            /* sys_enter and sys_exit of each cpu, in one ring per cpu */
+    void **             rings;
+    unsigned int        nfds;
+    unsigned int        nrings;
+    size_t              ringsize;
+    syscount_event_t *  events;         /* read from the rings, not yet paired */
+    size_t              nevents;
+    size_t              capacity;
+    syscount_event_t *  pending;        /* sys_enter of each thread waiting for its sys_exit */
+    size_t              npending;
+    size_t              pcapacity;
+    uint64_t            seen;           /* latest event time read */
+    uint64_t            nlost;
+    uint64_t            tracer_ns;      /* cpu time used by vrunas to trace */
+    int                 running;
+    volatile int        stop;
+    pthread_t           thread;
+} syscount_t;
+
+#define SYSCOUNT_INITIALIZER { SYSC_NONE, NULL, { -1, -1 }, 0, 0, 8, 16, NULL, NULL, 0, 0, 0, \
+                               NULL, 0, 0, NULL, 0, 0, 0, 0, 0, 0, 0, }
+
+/** syscount_init() : choose the method (tracepoints if root and tracefs is available,
+ * ptrace otherwise). To be called before fork().
+ * @return 0 on success, -1 on error (errno set) */
+int syscount_init(syscount_t * sc);
+
+/** syscount_child() : to be called by the child before execve(): wait for the events
+ * (tracepoints) or request to be traced (ptrace) */
+int syscount_child(syscount_t * sc);
+
+/** syscount_start() : tracepoints: open the events on pid (enabled on its execve()),
+ * release the child and start collecting. The child is released even on error.
+ * Nothing to do with ptrace, see syscount_wait().
+ * @return 0 on success, -1 on error (errno set) */
+int syscount_start(syscount_t * sc, pid_t pid);
+
+/** syscount_wait() : ptrace: trace pid and its children until pid terminates.
+ * pid is not reaped: waitpid() is to be called next.
+ * @return 0 on success, -1 on error (errno set) */
+int syscount_wait(syscount_t * sc, pid_t pid);
+
+/** syscount_stop() : to be called once pid is terminated: collect remaining events
+ * and compute the statistics */
+void syscount_stop(syscount_t * sc);
+
+/** syscount_report() : print counts, errors and latencies of the syscalls taking most
+ * time, and the cpu time used to trace them (extended timings format) */
+void syscount_report(FILE * out, const syscount_t * sc);
+
+/** syscount_free() : release resources of sc (not sc itself) */
+void syscount_free(syscount_t * sc);
+
+#endif /* ! ifndef VRUNAS_SYSCOUNT_H */
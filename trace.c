@@ -0,0 +1,458 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Timeline of a run in the Chrome trace event format (Perfetto, chrome://tracing):
+ * steps of vrunas and of the child before execve(), lifetimes of the processes
+ * and threads of the program, sampled counters and phases of the SDK.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "livestat.h"
+#include "trace.h"
+
+static int64_t trace_ns(const trace_t * tr, const struct timespec * ts) {
+    return (int64_t) (ts->tv_sec - tr->origin.tv_sec) * 1000000000LL + (ts->tv_nsec - tr->origin.tv_nsec);
+}
+
+static int64_t trace_now(const trace_t * tr) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return trace_ns(tr, &ts);
+}
+
+/* grow an array of elemsize elements to hold one more. @return 0 or -1 (ENOMEM) */
+static int trace_grow(void * parray, unsigned int count, unsigned int * capacity, size_t elemsize) {
+    void ** array = parray;
+    void *  p;
+
+    if (count < *capacity)
+        return 0;
+    if ((p = realloc(*array, (*capacity ? *capacity * 2 : 64) * elemsize)) == NULL)
+        return -1;
+    *array = p;
+    *capacity = *capacity ? *capacity * 2 : 64;
+    return 0;
+}
+
+static void trace_task(trace_t * tr, pid_t pid, pid_t tid, const char * comm, int64_t now) {
+    trace_task_t * task = NULL;
+
+    for (unsigned int i = tr->ntasks; i > 0; --i) {
+        if (tr->tasks[i - 1].tid == tid) {
+            task = &tr->tasks[i - 1];
+            break ;
+        }
+    }
+    if (task == NULL) {
+        if (trace_grow(&tr->tasks, tr->ntasks, &tr->taskcapacity, sizeof(*tr->tasks)) != 0)
+            return ;
+        task = &tr->tasks[tr->ntasks++];
+        task->pid = pid;
+        task->tid = tid;
+        task->first = now;
+    }
+    /* the last name, the one given by execve() */
+    snprintf(task->comm, sizeof(task->comm), "%s", comm);
+    task->last = now;
+}
+
+typedef struct {
+    trace_t *   tr;
+    int64_t     now;
+} trace_sample_data_t;
+
+/* /proc/<pid>/task/<tid>/stat: the command name is between the first '(' and the last ')' */
+static void trace_sample_task(pid_t pid, pid_t tid, const char * stat, void * data) {
+    trace_sample_data_t *   sd = data;
+    const char *            name = strchr(stat, '(');
+    const char *            end = strrchr(stat, ')');
+    char                    comm[16];
+
+    if (name == NULL || end == NULL || end < name)
+        return ;
+    snprintf(comm, sizeof(comm), "%.*s", (int) (end - name - 1), name + 1);
+    trace_task(sd->tr, pid, tid, comm, sd->now);
+}
+
+/* record the phase of the SDK seen at previous sample if it has ended since */
+static void trace_sample_phases(trace_t * tr, int64_t now, int final) {
+    for (unsigned int i = 0; i < VRUNAS_SDK_SLOTS; ++i) {
+        const vrunas_sdk_slot_data_t *  slot = &tr->region->slots[i].d;
+        trace_slot_t *                  seen = &tr->slots[i];
+        uint32_t                        phase;
+        uint64_t                        start;
+        pid_t                           tid;
+
+        if ((tid = (pid_t) __atomic_load_n(&slot->tid, __ATOMIC_ACQUIRE)) == 0)
+            continue ;
+        phase = __atomic_load_n(&slot->phase, __ATOMIC_ACQUIRE);
+        start = slot->start[VRUNAS_SDK_WALL];
+        if (phase > VRUNAS_SDK_PHASES)
+            continue ;
+        if (seen->phase != 0 && (final || phase != seen->phase || start != seen->start)
+        &&  trace_grow(&tr->phases, tr->nphases, &tr->phasecapacity, sizeof(*tr->phases)) == 0) {
+            trace_phase_t * rec = &tr->phases[tr->nphases++];
+            uint64_t        count = slot->count[seen->phase - 1] - seen->count;
+            uint64_t        total = slot->total[seen->phase - 1][VRUNAS_SDK_WALL] - seen->total;
+
+            rec->tid = tid;
+            rec->phase = seen->phase;
+            rec->begin = (int64_t) seen->start - ((int64_t) tr->origin.tv_sec * 1000000000LL + tr->origin.tv_nsec);
+            rec->open = (count == 0);
+            /* time of this phase, or mean time of the ones of this id ended meanwhile */
+            rec->end = count == 0 ? now : rec->begin + (int64_t) (total / count);
+        }
+        /* phase begun since previous sample and still open at exit */
+        if (final && phase != 0 && (phase != seen->phase || start != seen->start)
+        &&  trace_grow(&tr->phases, tr->nphases, &tr->phasecapacity, sizeof(*tr->phases)) == 0) {
+            trace_phase_t * rec = &tr->phases[tr->nphases++];
+
+            rec->tid = tid;
+            rec->phase = phase;
+            rec->begin = (int64_t) start - ((int64_t) tr->origin.tv_sec * 1000000000LL + tr->origin.tv_nsec);
+            rec->end = now;
+            rec->open = 1;
+        }
+        seen->phase = final ? 0 : phase;
+        if (phase != 0 && !final) {
+            seen->start = start;
+            seen->count = slot->count[phase - 1];
+            seen->total = slot->total[phase - 1][VRUNAS_SDK_WALL];
+        }
+    }
+}
+
+static void trace_sample(trace_t * tr, int final) {
+    trace_counter_t     counter = { trace_now(tr), 0.0, 0, 0 };
+    trace_sample_data_t sd = { tr, counter.time };
+    livestat_sample_t   sample;
+    uint64_t            ticks;
+
+    livestat_sample_tasks(tr->root, &sample, trace_sample_task, &sd);
+    ticks = sample.cpu_ticks;
+    counter.rss = sample.rss_pages * (uint64_t) sysconf(_SC_PAGESIZE);
+    counter.nthreads = sample.nthreads;
+    if (tr->region != NULL)
+        trace_sample_phases(tr, counter.time, final);
+    if (counter.nthreads == 0)
+        return ;
+    if (tr->ncounters > 0) {
+        int64_t elapsed = counter.time - tr->counters[tr->ncounters - 1].time;
+
+        if (elapsed > 0 && ticks >= tr->ticks)
+            counter.cpu = (ticks - tr->ticks) * 1e11 / sysconf(_SC_CLK_TCK) / elapsed;
+    }
+    tr->ticks = ticks;
+    if (trace_grow(&tr->counters, tr->ncounters, &tr->countercapacity, sizeof(*tr->counters)) == 0)
+        tr->counters[tr->ncounters++] = counter;
+}
+
+static void * trace_thread(void * data) {
+    trace_t *       tr = data;
+    struct pollfd   pfd = { tr->execpipe[0], POLLIN, 0 };
+
+    while (!tr->stop) {
+        char c;
+
+        /* the end of the exec pipe is the execve() of the child */
+        if (pfd.fd >= 0 && poll(&pfd, 1, TRACE_INTERVAL_MS) > 0 && read(pfd.fd, &c, 1) <= 0) {
+            tr->exec = tr->shared->exec != 0 ? trace_now(tr) : 0;
+            pfd.fd = -1;
+            continue ;
+        } else if (pfd.fd < 0) {
+            struct timespec ts = { 0, TRACE_INTERVAL_MS * 1000000L };
+            nanosleep(&ts, NULL);
+        }
+        if (!tr->stop)
+            trace_sample(tr, 0);
+    }
+    return NULL;
+}
+
+int trace_init(trace_t * tr, const char * path, const struct timespec * origin) {
+    void *  p;
+    size_t  size = strlen(path) + 32;
+    int     fd;
+
+    tr->path = path;
+    tr->origin = *origin;
+    tr->self = getpid();
+    /* a new file (O_EXCL), not a symlink or a file which would be there already */
+    if ((tr->tmppath = malloc(size)) == NULL)
+        return -1;
+    snprintf(tr->tmppath, size, "%s.XXXXXX", path);
+    if ((fd = mkstemp(tr->tmppath)) < 0) {
+        free(tr->tmppath);
+        tr->tmppath = NULL;
+        return -1;
+    }
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) != 0 || fchmod(fd, 0644) != 0
+    ||  (tr->file = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        return -1;
+    }
+    if ((p = mmap(NULL, sizeof(*tr->shared), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        return -1;
+    tr->shared = p;
+    if (pipe(tr->execpipe) != 0)
+        return -1;
+    for (unsigned int i = 0; i < 2; ++i)
+        fcntl(tr->execpipe[i], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+void trace_span(trace_t * tr, const char * name, const struct timespec * begin, const struct timespec * end) {
+    uint32_t        i;
+    trace_span_t *  span;
+
+    if (tr->shared == NULL
+    ||  (i = __atomic_fetch_add(&tr->shared->nspans, 1, __ATOMIC_RELAXED)) >= TRACE_MAX_SPANS)
+        return ;
+    span = &tr->shared->spans[i];
+    snprintf(span->name, sizeof(span->name), "%s", name);
+    span->pid = getpid();
+    span->begin = trace_ns(tr, begin);
+    span->end = trace_ns(tr, end);
+}
+
+void trace_child(trace_t * tr) {
+    if (tr->execpipe[0] >= 0)
+        close(tr->execpipe[0]);
+    tr->execpipe[0] = -1;
+}
+
+void trace_exec(trace_t * tr) {
+    if (tr->shared != NULL)
+        tr->shared->exec = trace_now(tr);
+}
+
+void trace_exec_failed(trace_t * tr) {
+    struct timespec begin, end;
+    int64_t         exec;
+
+    if (tr->shared == NULL || (exec = tr->shared->exec) == 0)
+        return ;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    begin.tv_sec = tr->origin.tv_sec + (exec + tr->origin.tv_nsec) / 1000000000LL;
+    begin.tv_nsec = (exec + tr->origin.tv_nsec) % 1000000000LL;
+    trace_span(tr, "execve failed", &begin, &end);
+    /* before the end of the exec pipe at exit */
+    tr->shared->exec = 0;
+}
+
+int trace_start(trace_t * tr, pid_t pid, const vrunas_sdk_region_t * region) {
+    int ret;
+
+    tr->root = pid;
+    if (tr->execpipe[1] >= 0)
+        close(tr->execpipe[1]);
+    tr->execpipe[1] = -1;
+    if (region != NULL && (tr->slots = calloc(VRUNAS_SDK_SLOTS, sizeof(*tr->slots))) != NULL)
+        tr->region = region;
+    tr->stop = 0;
+    if ((ret = pthread_create(&tr->thread, NULL, trace_thread, tr)) != 0) {
+        errno = ret;
+        return -1;
+    }
+    tr->running = 1;
+    return 0;
+}
+
+void trace_stop(trace_t * tr, int status) {
+    if (!tr->running)
+        return ;
+    tr->stop = 1;
+    pthread_join(tr->thread, NULL);
+    tr->running = 0;
+    tr->exit = trace_now(tr);
+    tr->status = status;
+    trace_sample(tr, 1);
+}
+
+/* str as a JSON string */
+static void trace_json_string(FILE * out, const char * str) {
+    fputc('"', out);
+    for (; *str; ++str) {
+        unsigned char c = (unsigned char) *str;
+
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+/* microseconds of the trace from nanoseconds */
+#define TRACE_US(ns)    ((ns) / 1000LL), (int) ((ns) % 1000LL)
+
+static void trace_complete(FILE * out, const char * cat, const char * name, pid_t pid, pid_t tid,
+                           int64_t begin, int64_t end) {
+    if (end < begin)
+        end = begin;
+    fprintf(out, ",\n{\"ph\":\"X\",\"cat\":\"%s\",\"name\":", cat);
+    trace_json_string(out, name);
+    fprintf(out, ",\"pid\":%d,\"tid\":%d,\"ts\":%lld.%03d,\"dur\":%lld.%03d}",
+            (int) pid, (int) tid, TRACE_US((long long) begin), TRACE_US((long long) (end - begin)));
+}
+
+static void trace_metadata(FILE * out, const char * what, pid_t pid, pid_t tid, const char * name) {
+    fprintf(out, ",\n{\"ph\":\"M\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+            what, (int) pid, (int) tid);
+    trace_json_string(out, name);
+    fputs("}}", out);
+}
+
+int trace_write(trace_t * tr) {
+    FILE *      out = tr->file;
+    uint32_t    nspans;
+    int         ret = 0;
+
+    if (out == NULL || tr->shared == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                 "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"vrunas\"}}",
+            (int) tr->self, (int) tr->self);
+
+    /* steps of vrunas and of the child before execve() */
+    nspans = tr->shared->nspans < TRACE_MAX_SPANS ? tr->shared->nspans : TRACE_MAX_SPANS;
+    for (uint32_t i = 0; i < nspans; ++i) {
+        const trace_span_t * span = &tr->shared->spans[i];
+
+        trace_complete(out, "vrunas", span->name, span->pid, span->pid, span->begin, span->end);
+    }
+    if (tr->shared->exec != 0 && tr->root != 0) {
+        trace_complete(out, "vrunas", "execve", tr->root, tr->root, tr->shared->exec,
+                       tr->exec != 0 ? tr->exec : tr->exit);
+    }
+
+    /* lifetimes of processes and threads, the program lives until it is reaped */
+    for (unsigned int i = 0; i < tr->ntasks; ++i) {
+        const trace_task_t * task = &tr->tasks[i];
+        int64_t              end = task->tid == tr->root ? tr->exit : task->last;
+
+        if (task->pid == task->tid)
+            trace_metadata(out, "process_name", task->pid, task->tid, task->comm);
+        trace_metadata(out, "thread_name", task->pid, task->tid, task->comm);
+        trace_complete(out, "task", task->comm, task->pid, task->tid,
+                       task->tid == tr->root && tr->exec != 0 ? tr->exec : task->first, end);
+    }
+
+    /* phases of the SDK, on the threads which ran them */
+    for (unsigned int i = 0; i < tr->nphases; ++i) {
+        const trace_phase_t *   phase = &tr->phases[i];
+        const vrunas_sdk_name_t * name = &tr->region->phases[phase->phase - 1];
+        char                    buf[VRUNAS_SDK_NAMELEN + 16];
+        pid_t                   pid = tr->root;
+
+        for (unsigned int t = 0; t < tr->ntasks; ++t) {
+            if (tr->tasks[t].tid == phase->tid) {
+                pid = tr->tasks[t].pid;
+                break ;
+            }
+        }
+        snprintf(buf, sizeof(buf), "%.*s%s", VRUNAS_SDK_NAMELEN,
+                 name->state == VRUNAS_SDK_READY ? name->name : "?", phase->open ? " (open)" : "");
+        trace_complete(out, "phase", buf, pid, phase->tid, phase->begin, phase->end);
+    }
+
+    /* counters of the tree of processes */
+    for (unsigned int i = 0; i < tr->ncounters; ++i) {
+        const trace_counter_t * counter = &tr->counters[i];
+
+        fprintf(out, ",\n{\"ph\":\"C\",\"name\":\"cpu\",\"pid\":%d,\"ts\":%lld.%03d,\"args\":{\"percent\":%.1f}}"
+                     ",\n{\"ph\":\"C\",\"name\":\"rss\",\"pid\":%d,\"ts\":%lld.%03d,\"args\":{\"bytes\":%llu}}"
+                     ",\n{\"ph\":\"C\",\"name\":\"threads\",\"pid\":%d,\"ts\":%lld.%03d,\"args\":{\"count\":%u}}",
+                (int) tr->root, TRACE_US((long long) counter->time), counter->cpu,
+                (int) tr->root, TRACE_US((long long) counter->time), (unsigned long long) counter->rss,
+                (int) tr->root, TRACE_US((long long) counter->time), counter->nthreads);
+    }
+
+    /* markers */
+    if (tr->exec != 0) {
+        fprintf(out, ",\n{\"ph\":\"i\",\"s\":\"p\",\"name\":\"exec\",\"pid\":%d,\"tid\":%d,\"ts\":%lld.%03d}",
+                (int) tr->root, (int) tr->root, TRACE_US((long long) tr->exec));
+    }
+    if (tr->exit != 0) {
+        fprintf(out, ",\n{\"ph\":\"i\",\"s\":\"p\",\"name\":\"exit\",\"pid\":%d,\"tid\":%d,\"ts\":%lld.%03d,"
+                     "\"args\":{\"%s\":%d}}",
+                (int) tr->root, (int) tr->root, TRACE_US((long long) tr->exit),
+                WIFSIGNALED(tr->status) ? "signal" : "code",
+                WIFSIGNALED(tr->status) ? WTERMSIG(tr->status) : WEXITSTATUS(tr->status));
+    }
+    fputs("\n]}\n", out);
+
+    if (fflush(out) != 0 || ferror(out)
+    ||  (tr->tmppath != NULL && rename(tr->tmppath, tr->path) != 0))
+        return -1;
+    free(tr->tmppath);
+    tr->tmppath = NULL;
+    return ret;
+}
+
+void trace_free(trace_t * tr) {
+    if (tr->running) {
+        tr->stop = 1;
+        pthread_join(tr->thread, NULL);
+        tr->running = 0;
+    }
+    for (unsigned int i = 0; i < 2; ++i) {
+        if (tr->execpipe[i] >= 0)
+            close(tr->execpipe[i]);
+        tr->execpipe[i] = -1;
+    }
+    if (tr->shared != NULL)
+        munmap(tr->shared, sizeof(*tr->shared));
+    tr->shared = NULL;
+    if (tr->file != NULL)
+        fclose(tr->file);
+    tr->file = NULL;
+    /* not written: removed, by the process which created it only */
+    if (tr->tmppath != NULL && tr->self == getpid())
+        unlink(tr->tmppath);
+    free(tr->tmppath);
+    tr->tmppath = NULL;
+    free(tr->tasks);
+    free(tr->counters);
+    free(tr->slots);
+    free(tr->phases);
+    tr->tasks = NULL;
+    tr->counters = NULL;
+    tr->slots = NULL;
+    tr->phases = NULL;
+    tr->region = NULL;
+}
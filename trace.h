@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2018-2020 Vincent Sallaberry
+ * vrunas <https://github.com/vsallaberry/vrunas>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * -------------------------------------------------------------------------
+ * Timeline of a run in the Chrome trace event format (Perfetto, chrome://tracing):
+ * steps of vrunas and of the child before execve(), lifetimes of the processes
+ * and threads of the program, sampled counters and phases of the SDK.
+ */
+#ifndef VRUNAS_TRACE_H
+#define VRUNAS_TRACE_H
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sdk/vrunas_sdk.h"
+
+#define TRACE_INTERVAL_MS       100     /* sampling period of processes, threads and counters */
+#define TRACE_MAX_SPANS         32
+#define TRACE_NAMELEN           24
+
+typedef struct {
+    char                name[TRACE_NAMELEN];
+    pid_t               pid;            /* process which recorded the step */
+    int64_t             begin;          /* nanoseconds since the origin */
+    int64_t             end;
+} trace_span_t;
+
+/* steps of vrunas, shared with the child until its execve() */
+typedef struct {
+    volatile uint32_t   nspans;
+    int64_t             exec;           /* execve() called by the child, 0 if not yet */
+    trace_span_t        spans[TRACE_MAX_SPANS];
+} trace_shared_t;
+
+typedef struct {
+    pid_t               pid;
+    pid_t               tid;
+    char                comm[16];
+    int64_t             first;          /* first and last time seen */
+    int64_t             last;
+} trace_task_t;
+
+typedef struct {
+    int64_t             time;
+    double              cpu;            /* percent of one cpu since previous sample */
+    uint64_t            rss;            /* bytes */
+    unsigned int        nthreads;
+} trace_counter_t;
+
+typedef struct {
+    pid_t               tid;
+    uint32_t            phase;          /* phase + 1 */
+    int64_t             begin;
+    int64_t             end;
+    int                 open;           /* still open when the program terminated */
+} trace_phase_t;
+
+/* phase of a slot of the SDK region, as seen at previous sample */
+typedef struct {
+    uint32_t            phase;          /* phase + 1, 0 if none */
+    uint64_t            start;
+    uint64_t            count;          /* count and total wall time of phase when it was seen open */
+    uint64_t            total;
+} trace_slot_t;
+
+typedef struct {
+    const char *        path;
+    FILE *              file;
+    char *              tmppath;        /* of file, renamed to path by trace_write() */
+    struct timespec     origin;         /* CLOCK_MONOTONIC, start of vrunas */
+    trace_shared_t *    shared;
+    int                 execpipe[2];    /* closed by the execve() of the child */
+    pid_t               self;
+    pid_t               root;
+    int64_t             exec;           /* end of execve() */
+    int64_t             exit;
+    int                 status;
+    trace_task_t *      tasks;
+    unsigned int        ntasks;
+    unsigned int        taskcapacity;
+    trace_counter_t *   counters;
+    unsigned int        ncounters;
+    unsigned int        countercapacity;
+    uint64_t            ticks;          /* cpu ticks of the tree at previous sample */
+    const vrunas_sdk_region_t * region; /* of --phases, or NULL */
+    trace_slot_t *      slots;
+    trace_phase_t *     phases;
+    unsigned int        nphases;
+    unsigned int        phasecapacity;
+    int                 running;
+    volatile int        stop;
+    pthread_t           thread;
+} trace_t;
+
+#define TRACE_INITIALIZER { NULL, NULL, NULL, { 0, 0 }, NULL, { -1, -1 }, 0, 0, 0, 0, 0, \
+                            NULL, 0, 0, NULL, 0, 0, 0, NULL, NULL, NULL, 0, 0, 0, 0, }
+
+/** trace_init() : create a new file next to path (renamed to path once written, with
+ * the current effective identity) and the steps shared with the child. To be called
+ * before fork().
+ * @param origin start of vrunas (CLOCK_MONOTONIC), the time 0 of the trace
+ * @return 0 on success, -1 on error (errno set) */
+int trace_init(trace_t * tr, const char * path, const struct timespec * origin);
+
+/** trace_span() : record a step of vrunas or of the child (CLOCK_MONOTONIC times) */
+void trace_span(trace_t * tr, const char * name, const struct timespec * begin, const struct timespec * end);
+
+/** trace_child() : to be called by the child after fork() */
+void trace_child(trace_t * tr);
+
+/** trace_exec() : to be called by the child just before execve() */
+void trace_exec(trace_t * tr);
+
+/** trace_exec_failed() : to be called by the child if execve() failed */
+void trace_exec_failed(trace_t * tr);
+
+/** trace_start() : start sampling pid and its descendants.
+ * @param region shared region of --phases whose phases are sampled, or NULL
+ * @return 0 on success, -1 on error (errno set) */
+int trace_start(trace_t * tr, pid_t pid, const vrunas_sdk_region_t * region);
+
+/** trace_stop() : stop sampling, once pid is terminated with status */
+void trace_stop(trace_t * tr, int status);
+
+/** trace_write() : write the trace. Phases of the SDK shorter than the sampling
+ * period may be missing.
+ * @return 0 on success, -1 on error (errno set) */
+int trace_write(trace_t * tr);
+
+/** trace_free() : release resources of tr (not tr itself), stopping it if needed */
+void trace_free(trace_t * tr);
+
+#endif /* ! ifndef VRUNAS_TRACE_H */
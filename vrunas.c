@@ -46,9 +46,74 @@
 #include "vlib/util.h"
 #include "vlib/term.h"
 
+#include "elfutil.h"
+#include "pagecache.h"
+#include "iotrace.h"
+#include "ldstat.h"
+#include "delayacct.h"
+#include "schedinfo.h"
+#include "perfprof.h"
+#include "syscount.h"
+#include "heapprof.h"
+#include "phasestat.h"
+#include "energy.h"
+#include "livestat.h"
+#include "events.h"
+#include "trace.h"
+#include "metrics.h"
+#include "fleetstat.h"
+#include "admission.h"
+#include "procsnap.h"
+#include "noisestat.h"
+#include "hostinfo.h"
+#include "repro.h"
+#include "freqpin.h"
+#include "coresched.h"
+
 #define VERSION_STRING(lic) lic(BUILD_APPNAME, APP_VERSION, \
                                 "git:" BUILD_GITREV, "Vincent Sallaberry", "2018-2020")
 
+/* ids of options without short form */
+enum {
+    OPT_CACHE = OPT_ID_USER,
+    OPT_CACHE_FILE,
+    OPT_PROFILE_IO,
+    OPT_PREFETCH,
+    OPT_LOADER,
+    OPT_DELAYS,
+    OPT_SCHED,
+    OPT_THREADS,
+    OPT_PROFILE,
+    OPT_FREQ,
+    OPT_FOLDED,
+    OPT_SYSCALLS,
+    OPT_PHASES,
+    OPT_ENERGY,
+    OPT_SYSFS,
+    OPT_LIVE,
+    OPT_EVENTS,
+    OPT_CONTROL,
+    OPT_TRACE,
+    OPT_METRICS,
+    OPT_STATS_FILE,
+    OPT_STATS,
+    OPT_MAX_CONCURRENT,
+    OPT_RATE,
+    OPT_NOWAIT,
+    OPT_ADMISSION_FILE,
+    OPT_EXIT_SNAPSHOT,
+    OPT_NOISE,
+    OPT_NOISE_RERUN,
+    OPT_REPRODUCIBLE,
+    OPT_SEED,
+    OPT_LAYOUT_SWEEP,
+    OPT_FIXED_FREQ,
+    OPT_NO_TURBO,
+    OPT_FREQ_RECORD,
+    OPT_FREQ_RESTORE,
+    OPT_CORE_SCHED,
+};
+
 static const opt_options_desc_t s_opt_desc[] = {
     { OPT_ID_SECTION, NULL, "options", "\nOptions:" },
     { 'h', "help",          "[filter[,...]]","summary or full usage of filter, use '-hh'\r" },
@@ -81,6 +146,114 @@ static const opt_options_desc_t s_opt_desc[] = {
     { 'N', "new-identity",  NULL,           "create/open in/out file with New identity, after uid/gid switch" },
     { 'i', "input",         "file",         "program receives input from file instead of stdin." },
     { 'p', "priority",      "priority",     "set program priority (nice value from -20 to 20)." },
+    { OPT_CACHE, "cache",   "cold|warm|asis","page cache state of input file, program, its libraries\r"
+                                            "and --cache-file files before run: cold evicts them\r"
+                                            "(+drop_caches if root), warm loads them.\r"
+                                            "With -T, their residency is reported." },
+    { OPT_CACHE_FILE, "cache-file", "file", "add file to the ones handled by --cache" },
+    { OPT_PROFILE_IO, "profile-io", "file", "record files opened and ranges read by program and its\r"
+                                            "children (fanotify if root, ptrace otherwise), and\r"
+                                            "write them to the prefetch list file.\r"
+                                            "With -T, a summary is reported." },
+    { OPT_PREFETCH, "prefetch",     "list", "load in page cache, with several threads, the ranges\r"
+                                            "of the prefetch list written by --profile-io, before run" },
+    { OPT_LOADER, "loader",         NULL,   "measure dynamic loader phases before main() (execve, loading,\r"
+                                            "relocations, constructors) with " LDSTAT_PRELOAD_LIB "\r"
+                                            "(LD_AUDIT). With -T, they are reported with loaded libraries." },
+    { OPT_DELAYS, "delays",         NULL,   "with -T, report delays of program and its children at exit\r"
+                                            "(cpu runqueue, block I/O, swapin, reclaim, thrashing,\r"
+                                            "compaction) with linux taskstats. Requires root." },
+    { OPT_SCHED, "sched",           NULL,   "with -T, report cpu migrations and runqueue wait of the\r"
+                                            "threads of program and its children, and the part of\r"
+                                            "their memory on remote NUMA nodes (/proc sampling)." },
+    { OPT_THREADS, "threads",       NULL,   "with -T, report the busiest threads of program and its\r"
+                                            "children with their user/sys time, context switches\r"
+                                            "and page faults (/proc sampling)." },
+    { OPT_PROFILE, "profile",       "cpu|offcpu|heap", "sample the stacks of program and its children with\r"
+                                            "perf_event_open() and write them as folded stacks\r"
+                                            "(flamegraph) to <prefix>.<mode>.folded, see --folded.\r"
+                                            "'offcpu' records where threads block and for how long\r"
+                                            "(sched_switch, root and tracefs), in microseconds.\r"
+                                            "With -T, the functions with most samples and the main\r"
+                                            "wait reasons are reported.\r"
+                                            "'heap' counts allocations of the program with " HEAPPROF_PRELOAD_LIB "\r"
+                                            "and reports with -T sizes, peak live heap and sampled\r"
+                                            "call sites." },
+    { OPT_FREQ, "freq",             "hz",   "sampling frequency of --profile (default 99)" },
+    { OPT_FOLDED, "folded",         "prefix","prefix of --profile files (default '" PERFPROF_DEFAULT_PREFIX "')" },
+    { OPT_SYSCALLS, "syscalls",     NULL,   "with -T, report the counts, errors and latencies of the\r"
+                                            "syscalls of program and its children, and the cpu time\r"
+                                            "spent to trace them (raw_syscalls tracepoints if root,\r"
+                                            "ptrace otherwise)." },
+    { OPT_PHASES, "phases",         NULL,   "with -T, report the phases and counters that program\r"
+                                            "marks with sdk/vrunas_sdk.h, with their time and rusage\r"
+                                            "(shared region passed in " VRUNAS_SDK_ENV ")." },
+    { OPT_ENERGY, "energy",         NULL,   "with -T, report the joules and average watts of the RAPL\r"
+                                            "domains (powercap: package, core, dram) during the run,\r"
+                                            "when available and readable (root on recent kernels)." },
+    { OPT_SYSFS, "sysfs",           "dir",  "root of sysfs used by --energy and the fingerprint of\r"
+                                            "the host (default '" ENERGY_DEFAULT_SYSFS "')" },
+    { OPT_LIVE, "live",             NULL,   "while program runs, show at the bottom of the terminal\r"
+                                            "its elapsed time, cpu usage, rss, threads, storage I/O\r"
+                                            "and output rates, refreshed every second (on stderr, or\r"
+                                            "stdout with -2)." },
+    { OPT_EVENTS, "events",         "fd|path", "write the lifecycle events of program as JSON lines\r"
+                                            "to the file descriptor or file: spawned, exec_ok,\r"
+                                            "exec_failed, sample (every second), signal, exited,\r"
+                                            "metrics, and snapshot on SIGUSR1 (not forwarded)." },
+    { OPT_CONTROL, "control",       "fifo", "with --events, read commands from this FIFO (created\r"
+                                            "if needed, else a FIFO of the user not writable by\r"
+                                            "others): 'snapshot' emits a snapshot event." },
+    { OPT_TRACE, "trace",           "file", "write the timeline of the run in the Chrome trace\r"
+                                            "format (Perfetto, chrome://tracing): steps of vrunas,\r"
+                                            "processes and threads, cpu/rss/threads counters and\r"
+                                            "phases of --phases (sampled every 100ms)." },
+    { OPT_METRICS, "metrics-textfile", "file", "write the final metrics of the run in the OpenMetrics\r"
+                                            "text format, for the textfile collector of node_exporter\r"
+                                            "(written atomically, with counters of enabled options)." },
+    { OPT_STATS_FILE, "stats-file", "file", "account the run in this statistics file shared by all\r"
+                                            "the instances (launches, failures, cpu, peak rss per\r"
+                                            "user and program), created if needed." },
+    { OPT_STATS, "stats",           "[file]", "print the statistics file (default " FLEETSTAT_DEFAULT_PATH ",\r"
+                                            VRUNAS_USER_RUNDIR "/<uid>/vrunas.stats if not root)." },
+    { OPT_MAX_CONCURRENT, "max-concurrent", "N", "wait until less than N programs run as the target\r"
+                                            "user through vrunas on this host (FIFO queue)." },
+    { OPT_RATE, "rate",             "R[/s|/m]", "wait so that the target user launches at most R\r"
+                                            "programs per second (or minute) on this host." },
+    { OPT_NOWAIT, "no-wait",        NULL,   "fail instead of waiting for --max-concurrent/--rate." },
+    { OPT_ADMISSION_FILE, "admission-file", "file", "file shared by the instances for --max-concurrent\r"
+                                            "and --rate (default " ADMISSION_DEFAULT_PATH ",\r"
+                                            VRUNAS_USER_RUNDIR "/<uid>/vrunas.admission if not root)." },
+    { OPT_EXIT_SNAPSHOT, "exit-snapshot", NULL, "with -T, report the memory breakdown of program at\r"
+                                            "its exit (ptrace exit stop, not for set-ID programs\r"
+                                            "when not root), and its final switches, I/O and cpu.\r"
+                                            "Only the process of program, not its children." },
+    { OPT_NOISE, "noise",           "[max]", "with -T, report the cpu used by other tasks on the cpus of\r"
+                                            "program, the load, pressure stalls and interrupts of the\r"
+                                            "host. The run is contaminated over max percent of the cpus\r"
+                                            "(default 5)." },
+    { OPT_NOISE_RERUN, "noise-rerun", "N", "run program again, up to N times, while contaminated." },
+    { OPT_REPRODUCIBLE, "reproducible", "[cpu]", "run program without address space randomization,\r"
+                                            "its argument and environment strings padded to a fixed\r"
+                                            "size, pinned on cpu (default: the last one allowed), with\r"
+                                            "a fixed timer slack." },
+    { OPT_SEED, "seed",             "N",    "set PYTHONHASHSEED, PERL_HASH_SEED and RANDOM_SEED of\r"
+                                            "program to N." },
+    { OPT_LAYOUT_SWEEP, "layout-sweep", "L[xR]", "run program R times (default 3) for each of L stack\r"
+                                            "layouts, without address space randomization, and report\r"
+                                            "the part of the real time variations due to the layout\r"
+                                            "(timed from execve()). The layouts are drawn from --seed." },
+    { OPT_FIXED_FREQ, "fixed-freq", "F",    "fix the frequency of the cpus of program (with\r"
+                                            "--reproducible, its cpu) to F (kHz, or with unit MHz, GHz)\r"
+                                            "during the run (root, linux cpufreq)." },
+    { OPT_NO_TURBO, "no-turbo",     NULL,   "disable the turbo of the host during the run (root)." },
+    { OPT_FREQ_RECORD, "freq-record", "file", "record of the cpufreq values to restore, for a later run\r"
+                                            "if vrunas could not (default " FREQPIN_DEFAULT_RECORD ")." },
+    { OPT_FREQ_RESTORE, "freq-restore", NULL, "restore the cpufreq values left by an interrupted run." },
+    { OPT_CORE_SCHED, "core-sched", "[reserve]", "give the process tree of program its own core scheduling\r"
+                                            "cookie, so that no other task runs on the SMT siblings of\r"
+                                            "its cpus (linux 5.14). With reserve, program uses one cpu\r"
+                                            "of each core, the siblings being left idle." },
 #   ifdef _TEST
     /* nothing */
 #   endif
@@ -101,7 +274,34 @@ enum FLAGS {
     WARN_MOREREDIRS = 1 << 8,
     FILE_NEWIDENTITY= 1 << 9,
     HAVE_PRIORITY   = 1 << 10,
+    PAGECACHE       = 1 << 11,
+    PROFILE_IO      = 1 << 12,
+    PREFETCH        = 1 << 13,
+    LDSTAT          = 1 << 14,
+    DELAYACCT       = 1 << 15,
+    SCHEDINFO       = 1 << 16,
+    THREADS         = 1 << 17,
+    PERFPROF        = 1 << 18,
+    SYSCOUNT        = 1 << 19,
+    HEAPPROF        = 1 << 20,
+    PHASESTAT       = 1 << 21,
+    ENERGY          = 1 << 22,
+    LIVE            = 1 << 23,
+    EVENTS          = 1 << 24,
+    TRACE           = 1 << 25,
+    METRICS         = 1 << 26,
+    FLEETSTAT       = 1 << 27,
+    ADMISSION       = 1 << 28,
+    PROCSNAP        = 1 << 29,
+    NOISE           = 1 << 30,
 };
+/* features whose father needs the initial identity during or after the run (root
+ * interfaces, files shared with other users, values to restore) */
+#define FATHER_IDENTITY (PAGECACHE | PROFILE_IO | DELAYACCT | PERFPROF | SYSCOUNT | ENERGY | METRICS \
+                         | FLEETSTAT | ADMISSION | PROCSNAP)
+/* the father traces the syscalls of the program (ptrace): there can be no other tracer */
+#define PTRACED(ctx)    ((((ctx)->flags & PROFILE_IO) != 0 && (ctx)->iotrace.method == IOT_PTRACE) \
+                         || (((ctx)->flags & SYSCOUNT) != 0 && (ctx)->syscount.method == SYSC_PTRACE))
 
 enum {
     OK                  = 0,
@@ -114,6 +314,22 @@ enum {
     ERR_BENCH           = 8,
     ERR_SETIN           = 9,
     ERR_PRIORITY        = 10,
+    ERR_PAGECACHE       = 11,
+    ERR_PROFILE_IO      = 12,
+    ERR_PREFETCH        = 13,
+    ERR_LDSTAT          = 14,
+    ERR_DELAYACCT       = 15,
+    ERR_SCHEDINFO       = 16,
+    ERR_PERFPROF        = 17,
+    ERR_SYSCOUNT        = 18,
+    ERR_HEAPPROF        = 19,
+    ERR_PHASESTAT       = 20,
+    ERR_EVENTS          = 21,
+    ERR_TRACE           = 22,
+    ERR_ADMISSION       = 23,
+    ERR_REPRO           = 24,
+    ERR_FREQPIN         = 25,
+    ERR_CORESCHED       = 26,
     ERR_OPTION          = 30,
     ERR                 = -1,
     ERR_NOT_REACHABLE   = -128,
@@ -129,12 +345,45 @@ typedef struct {
     FILE *              alternatefile;  /* file not used for application output, can be used to display bench */
     int                 outfd;          /* fd of file receving program output, -1 if stdout or stderr */
     int                 infd;           /* fd of file replacing program input, -1 if stdin */
+    int                 setupfd[2];     /* the child writes there if its identity or redirections failed */
     const char *        outfile;
     const char *        infile;
     uid_t               uid;
     gid_t               gid;
     int                 priority;
     int                 i_argv_program;
+    pagecache_t         pagecache;      /* files handled by --cache */
+    iotrace_t           iotrace;        /* file accesses recorded by --profile-io */
+    const char *        prefetchfile;
+    iotrace_prefetch_t  prefetch;       /* statistics of --prefetch */
+    ldstat_t            ldstat;         /* loader phases of --loader */
+    delayacct_t         delayacct;      /* task delays of --delays */
+    schedinfo_t         schedinfo;      /* scheduler locality of --sched, threads of --threads */
+    perfprof_t          perfprof;       /* sampling profiler of --profile */
+    syscount_t          syscount;       /* syscall summary of --syscalls */
+    heapprof_t          heapprof;       /* allocations of --profile heap */
+    phasestat_t         phasestat;      /* program phases of --phases */
+    const char *        sysfs;          /* root of sysfs, NULL for the default one */
+    energy_t            energy;         /* RAPL energy of --energy */
+    livestat_t          livestat;       /* status panel of --live */
+    const char *        eventsfile;
+    const char *        controlfifo;
+    events_t            events;         /* JSON lines of --events */
+    const char *        tracefile;
+    trace_t             trace;          /* timeline of --trace */
+    const char *        metricsfile;    /* OpenMetrics of --metrics-textfile */
+    fleetstat_t         fleetstat;      /* host-wide accounting of --stats-file */
+    admission_t         admission;      /* --max-concurrent and --rate */
+    procsnap_t          procsnap;       /* /proc of the program at exit, --exit-snapshot */
+    noisestat_t         noisestat;      /* activity of the host during the run, --noise */
+    hostinfo_t          hostinfo;       /* environment of the run, with -T and --metrics-textfile */
+    repro_t             repro;          /* --reproducible and --seed */
+    freqpin_t           freqpin;        /* --fixed-freq and --no-turbo */
+    coresched_t         coresched;      /* smt isolation of --core-sched */
+    struct timespec     tsstart;        /* steps of vrunas for --trace (CLOCK_MONOTONIC) */
+    struct timespec     tsoptions;
+    struct timespec     tslookup[2];    /* user and group names, zero if none */
+    struct timespec     tschild;
 } ctx_t;
 
 static int clean_ctx(int ret, ctx_t * ctx) {
@@ -159,12 +408,57 @@ static int clean_ctx(int ret, ctx_t * ctx) {
             close(ctx->infd);
             ctx->infd = -1;
         }
+        for (unsigned int i = 0; i < 2; ++i) {
+            if (ctx->setupfd[i] >= 0)
+                close(ctx->setupfd[i]);
+            ctx->setupfd[i] = -1;
+        }
+        pagecache_free(&ctx->pagecache);
+        iotrace_free(&ctx->iotrace);
+        ldstat_free(&ctx->ldstat);
+        delayacct_free(&ctx->delayacct);
+        schedinfo_free(&ctx->schedinfo);
+        perfprof_free(&ctx->perfprof);
+        syscount_free(&ctx->syscount);
+        heapprof_free(&ctx->heapprof);
+        trace_free(&ctx->trace);
+        fleetstat_close(&ctx->fleetstat);
+        admission_free(&ctx->admission);
+        phasestat_free(&ctx->phasestat);
+        energy_free(&ctx->energy);
+        livestat_free(&ctx->livestat);
+        events_free(&ctx->events);
+        noisestat_free(&ctx->noisestat);
+        repro_free(&ctx->repro);
+        freqpin_free(&ctx->freqpin);
+        coresched_free(&ctx->coresched);
     }
     return ret;
 }
 
+/** trace_time() : time of a step of vrunas for --trace */
+static struct timespec * trace_time(struct timespec * ts) {
+    if (vclock_gettime(CLOCK_MONOTONIC, ts) < 0)
+        memset(ts, 0, sizeof(*ts));
+    return ts;
+}
+
+/** lookup_time() : time of user and group lookups for --trace (option not known yet) */
+static int lookup_time(ctx_t * ctx, int ret) {
+    if (ctx->tslookup[0].tv_sec == 0 && ctx->tslookup[0].tv_nsec == 0)
+        trace_time(&ctx->tslookup[0]);
+    else
+        trace_time(&ctx->tslookup[1]);
+    return ret;
+}
+#define LOOKUP_TIME(ctx, lookup) (lookup_time(ctx, 0), lookup_time(ctx, lookup))
+
 int set_uidgid(uid_t uid, gid_t gid, ctx_t * ctx) {
-    int errno_bak;
+    struct timespec ts[2];
+    int             errno_bak;
+
+    if ((ctx->flags & TRACE) != 0)
+        trace_time(&ts[0]);
 
     /* set gid if given */
     if ((ctx->flags & HAVE_GID) != 0) {
@@ -186,6 +480,34 @@ int set_uidgid(uid_t uid, gid_t gid, ctx_t * ctx) {
             return ERR_SETID;
         }
     }
+    if ((ctx->flags & TRACE) != 0 && (ctx->flags & (HAVE_UID | HAVE_GID)) != 0)
+        trace_span(&ctx->trace, "setuid", &ts[0], trace_time(&ts[1]));
+    return 0;
+}
+
+/* with -N, the files written by the father for the results are created with the new
+ * identity, as the in/out files of the child: effective ids switched (enter != 0) and back */
+static int set_file_identity(ctx_t * ctx, int enter) {
+    static uid_t    euid;
+    static gid_t    egid;
+    int             errno_bak;
+
+    if ((ctx->flags & FILE_NEWIDENTITY) == 0 || (ctx->flags & (HAVE_UID | HAVE_GID)) == 0)
+        return 0;
+    if (!enter)
+        return seteuid(euid) != 0 || setegid(egid) != 0 ? -1 : 0;
+    euid = geteuid();
+    egid = getegid();
+    if (((ctx->flags & HAVE_GID) != 0 && setegid(ctx->gid) != 0)
+    ||  ((ctx->flags & HAVE_UID) != 0 && seteuid(ctx->uid) != 0)) {
+        errno_bak = errno;
+        setegid(egid);
+        vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+        fprintf(stderr, "error%s: `%lu:%lu` (seteuid): %s\n", vterm_color(STDERR_FILENO, VCOLOR_RESET),
+                (unsigned long) ctx->uid, (unsigned long) ctx->gid, strerror(errno_bak));
+        errno = errno_bak;
+        return -1;
+    }
     return 0;
 }
 
@@ -194,7 +516,7 @@ char ** build_argv(int argc, char * const * argv, ctx_t * ctx) {
     int errno_bak;
     (void)ctx;
 
-    if ((tmp = newargv = malloc(argc + 1)) == NULL) {
+    if ((tmp = newargv = malloc((argc + 1) * sizeof(*newargv))) == NULL) {
         errno_bak = errno;
         vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
         fprintf(stderr, "error%s: build_argv(malloc) : %s\n",
@@ -229,7 +551,7 @@ int set_redirections(ctx_t * ctx) {
     }
     /* Else, with '-1' or if bench is ON, stderr is redirected to stdout, and
      * bench is displayed on the real stderr (ctx->alternatefile) */
-    else if ((ctx->flags & TO_STDOUT) != 0  || (ctx->flags & (TIME_POSIX | TIME_EXT)) != 0) {
+    else if ((ctx->flags & TO_STDOUT) != 0  || (ctx->flags & (TIME_POSIX | TIME_EXT | LIVE)) != 0) {
         dupfd = STDOUT_FILENO;
         redirectedfd = STDERR_FILENO;
     }
@@ -317,41 +639,252 @@ int set_in(const char * file, ctx_t * ctx) {
     return fd;
 }
 
+static int pagecache_add_dependency(const char * path, void * user_data) {
+    return pagecache_add((pagecache_t *) user_data, path);
+}
+
+int set_pagecache(ctx_t * ctx) {
+    char    path[PATH_MAX];
+    int     nerrors;
+
+    if ((ctx->flags & PAGECACHE) == 0)
+        return 0;
+
+    /* files handled: input file, program and its libraries, and the --cache-file ones */
+    if (ctx->infile != NULL && pagecache_add(&ctx->pagecache, ctx->infile) != 0)
+        return -1;
+    if (elf_find_program(ctx->argv[ctx->i_argv_program], path, sizeof(path)) == 0
+    &&  (pagecache_add(&ctx->pagecache, path) != 0
+         || elf_foreach_dependency(path, pagecache_add_dependency, &ctx->pagecache) < 0)) {
+        return -1;
+    }
+
+    pagecache_residency(&ctx->pagecache, PGC_INITIAL);
+    if ((nerrors = pagecache_prepare(&ctx->pagecache)) != 0) {
+        vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+        fprintf(stderr, "warning%s, page cache: %d file(s) could not be %s\n",
+                vterm_color(STDERR_FILENO, VCOLOR_RESET), nerrors,
+                ctx->pagecache.mode == PGC_COLD ? "evicted" : "loaded");
+    }
+    pagecache_residency(&ctx->pagecache, PGC_START);
+    return 0;
+}
+
 /* signal handler for do_bench(), ignoring and forwarding signals to child */
+static events_t * s_events = NULL;   /* signals are reported by --events */
+
 static void sig_handler(int sig) {
     static pid_t pid = 0;
     if (pid == 0) {
         pid = (pid_t) sig;
         return ;
     }
+    /* with --events, SIGUSR1 requests a snapshot instead of being forwarded */
+    if (s_events != NULL) {
+        events_signal(s_events, sig);
+        if (sig == SIGUSR1)
+            return ;
+    }
     kill(pid, sig);
 }
 
+/** program_setid() : tell whether the program found in PATH is set-user-ID or set-group-ID */
+static int program_setid(const ctx_t * ctx) {
+    char        path[PATH_MAX];
+    struct stat st;
+
+    return elf_find_program(ctx->argv[ctx->i_argv_program], path, sizeof(path)) == 0
+        && stat(path, &st) == 0 && (st.st_mode & (S_ISUID | S_ISGID)) != 0;
+}
+
+/** run_again() : run vrunas again in this process after a contaminated run of --noise,
+ * giving back the redirected output, the run taken for --max-concurrent and the
+ * cpufreq values of --fixed-freq.
+ * Returns only on error */
+static void run_again(ctx_t * ctx) {
+    char run[16];
+
+    fflush(stdout);
+    fflush(stderr);
+    if (ctx->alternatefile != NULL) {
+        fflush(ctx->alternatefile);
+        dup2(fileno(ctx->alternatefile), (ctx->flags & TO_STDERR) != 0 ? STDOUT_FILENO : STDERR_FILENO);
+        fclose(ctx->alternatefile);
+        ctx->alternatefile = NULL;
+    }
+    admission_free(&ctx->admission);
+    freqpin_restore(&ctx->freqpin);
+    snprintf(run, sizeof(run), "%u", ctx->noisestat.run + 1);
+    if (setenv(NOISESTAT_RUN_ENV, run, 1) == 0)
+        execv("/proc/self/exe", ctx->argv);
+}
+
+/** layout_sweep() : run program for each layout of --layout-sweep, alternating the
+ * layouts, and report the part of the variations of the real time due to the layout */
+static int layout_sweep(ctx_t * ctx) {
+    FILE *  out = ctx->alternatefile != NULL ? ctx->alternatefile : stderr;
+    int     status = 0;
+
+    for (unsigned int r = 0; r < ctx->repro.repeats; ++r) {
+        for (unsigned int l = 0; l < ctx->repro.sweep; ++l) {
+            struct timespec ts0, ts1;
+            pid_t           pid;
+
+            /* the run is timed from the execve() of the son (repro_exec()), which
+             * follows the setup of vrunas, to the termination of the program.
+             * nothing buffered must be written twice (son and father) */
+            fflush(stdout);
+            ctx->repro.offset = ctx->repro.offsets[l];
+            if (vclock_gettime(CLOCK_MONOTONIC_RAW, &ts0) < 0)
+                memset(&ts0, 0, sizeof(ts0));
+            if ((pid = fork()) < 0) {
+                perror("fork");
+                return ERR_BENCH;
+            } else if (pid == 0) {
+                /* son : continue execution with the layout */
+                return 0;
+            }
+            if (waitpid(pid, &status, 0) <= 0)
+                perror("waitpid");
+            if (vclock_gettime(CLOCK_MONOTONIC_RAW, &ts1) < 0)
+                memset(&ts1, 0, sizeof(ts1));
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, layout-sweep: program failed, sweep stopped\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET));
+                r = ctx->repro.repeats;
+                break ;
+            }
+            repro_sweep_record(&ctx->repro, l, &ts0, &ts1);
+        }
+    }
+    repro_sweep_report(out, &ctx->repro);
+
+    /* Terminate with status of the last run */
+    if (WIFEXITED(status))
+        exit(clean_ctx(WEXITSTATUS(status), ctx));
+    fprintf(stderr, "child terminated by signal %d\n", WTERMSIG(status));
+    exit(clean_ctx(-100-WTERMSIG(status), ctx));
+}
+
 static int do_bench(ctx_t * ctx) {
-    if ((ctx->flags & (TIME_POSIX | TIME_EXT)) != 0) {
+    if (ctx->repro.sweep > 0)
+        return layout_sweep(ctx);
+    /* the program is run in a child when it has to be monitored. The child switches
+     * uid/gid and sets redirections, the father switches uid/gid too unless one of the
+     * FATHER_IDENTITY features needs the initial identity */
+    if ((ctx->flags & (TIME_POSIX | TIME_EXT | PROFILE_IO | LDSTAT | DELAYACCT | SCHEDINFO | THREADS
+                       | PERFPROF | SYSCOUNT | HEAPPROF | PHASESTAT | ENERGY | LIVE | EVENTS | TRACE | METRICS | FLEETSTAT | ADMISSION | PROCSNAP
+                       | NOISE)) != 0) {
         pid_t           wpid, pid;
-        struct timespec ts0;
+        struct timespec ts0, tsfork;
 
+        /* nothing buffered must be written twice (son and father) */
+        fflush(stdout);
+        if ((ctx->flags & ENERGY) != 0)
+            energy_start(&ctx->energy);
         if (vclock_gettime(CLOCK_MONOTONIC_RAW, &ts0) < 0) {
             fprintf(stderr, "bench: vclock_gettime#1 error: %s\n", strerror(errno));
             memset(&ts0, 0, sizeof(ts0));
         }
+        if ((ctx->flags & TRACE) != 0)
+            trace_span(&ctx->trace, "setup", &ctx->tsoptions, trace_time(&tsfork));
+        /* closed by execve(): the father tells a program run from a child which failed before it,
+         * and does not report the run */
+        if (pipe2(ctx->setupfd, O_CLOEXEC) != 0)
+            ctx->setupfd[0] = ctx->setupfd[1] = -1;
         if ((pid = fork()) < 0) {
             perror("fork");
             return ERR_BENCH;
         } else if (pid == 0) {
             /* son : give to hand to father, and continue execution */
+            if (ctx->setupfd[0] >= 0)
+                close(ctx->setupfd[0]);
+            ctx->setupfd[0] = -1;
+            if ((ctx->flags & EVENTS) != 0)
+                events_child(&ctx->events);
+            if ((ctx->flags & TRACE) != 0) {
+                trace_time(&ctx->tschild);
+                trace_child(&ctx->trace);
+            }
             sched_yield();
             return 0;
         } else {
             /* father */
             struct          rusage rusage;
             FILE *          out = ctx->alternatefile;
-            int             status;
-            struct timespec ts1;
+            int             status = 0;
+            int             errno_bak;
+            struct timespec ts1, tsstep[2];
             int     sigs[] = { SIGINT, SIGHUP, SIGTERM, SIGQUIT, SIGUSR1, SIGUSR2, SIGPIPE };
             struct sigaction sa = { .sa_handler = sig_handler, .sa_flags = SA_RESTART };
 
+            if (ctx->setupfd[1] >= 0)
+                close(ctx->setupfd[1]);
+            ctx->setupfd[1] = -1;
+            /* the father drops its privileges as the child, unless a feature needs them */
+            if ((ctx->flags & FATHER_IDENTITY) == 0 && ctx->freqpin.owner == 0 && ctx->noisestat.reruns == 0
+            && (ctx->flags & (HAVE_UID | HAVE_GID)) != 0 && set_uidgid(ctx->uid, ctx->gid, ctx) != 0) {
+                kill(pid, SIGKILL);
+                waitpid(pid, NULL, 0);
+                return ERR_SETID;
+            }
+            /* before the program can terminate, unless it is traced for its syscalls: zombie only.
+             * Not a set-ID program when not root, which would run without its privileges */
+            if ((ctx->flags & PROCSNAP) != 0 && !PTRACED(ctx) && geteuid() != 0 && program_setid(ctx)) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, exit-snapshot: no memory at exit of a set-ID program when not root\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET));
+            } else if ((ctx->flags & PROCSNAP) != 0 && !PTRACED(ctx) && procsnap_start(&ctx->procsnap, pid) != 0) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, exit-snapshot: ptrace(): %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            }
+            if ((ctx->flags & TRACE) != 0) {
+                trace_span(&ctx->trace, "fork", &tsfork, trace_time(&tsstep[0]));
+                if (trace_start(&ctx->trace, pid, (ctx->flags & PHASESTAT) != 0 ? ctx->phasestat.region : NULL) != 0) {
+                    errno_bak = errno;
+                    vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                    fprintf(stderr, "warning%s, trace: %s\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+                }
+            }
+            if ((ctx->flags & EVENTS) != 0
+            && events_start(&ctx->events, pid, ctx->argv + ctx->i_argv_program,
+                            (ctx->flags & HAVE_UID) != 0 ? ctx->uid : getuid(),
+                            (ctx->flags & HAVE_GID) != 0 ? ctx->gid : getgid()) != 0) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, events: %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            }
+            if ((ctx->flags & EVENTS) != 0)
+                s_events = &ctx->events;
+            if ((ctx->flags & ENERGY) != 0 && energy_watch(&ctx->energy) != 0) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, energy: %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            }
+            /* first, as the program waits for its profiling events before execve() */
+            if ((ctx->flags & PERFPROF) != 0 && perfprof_start(&ctx->perfprof, pid) != 0) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, profile: perf_event_open(): %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            }
+            if ((ctx->flags & SYSCOUNT) != 0 && syscount_start(&ctx->syscount, pid) != 0) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, syscalls: perf_event_open(): %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            }
+            /* the program waited for its events before execve(): its time starts once released */
+            if (((ctx->flags & PERFPROF) != 0 || ((ctx->flags & SYSCOUNT) != 0 && ctx->syscount.method != SYSC_PTRACE))
+            && vclock_gettime(CLOCK_MONOTONIC_RAW, &ts0) < 0)
+                memset(&ts0, 0, sizeof(ts0));
+
             /* install signal handler and give to him the program pid */
             sig_handler(pid);
             sigemptyset(&sa.sa_mask);
@@ -360,9 +893,83 @@ static int do_bench(ctx_t * ctx) {
                     fprintf(stderr, "bench sigaction(%s): %s\n", strsignal(sigs[i]), strerror(errno));
             }
 
-            /* wait for termination of program */
+            if ((ctx->flags & DELAYACCT) != 0 && delayacct_start(&ctx->delayacct, pid) != 0) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, delays: %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            }
+            if ((ctx->flags & (SCHEDINFO | THREADS)) != 0 && schedinfo_start(&ctx->schedinfo, pid) != 0) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, sched: %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            }
+            if ((ctx->flags & LIVE) != 0 && (fflush(out), 1) && livestat_start(&ctx->livestat, pid) != 0) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, live: %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            }
+            if ((ctx->flags & NOISE) != 0 && noisestat_start(&ctx->noisestat, pid) != 0) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, noise: %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            }
+            if ((ctx->flags & TRACE) != 0)
+                trace_span(&ctx->trace, "monitors", &tsstep[0], trace_time(&tsstep[1]));
+
+            /* wait for termination of program, recording its file accesses with --profile-io */
+            if ((ctx->flags & PROFILE_IO) != 0) {
+                if (iotrace_wait(&ctx->iotrace, pid) != 0) {
+                    errno_bak = errno;
+                    vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                    fprintf(stderr, "warning%s, profile-io: %s\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+                }
+            } else if ((ctx->flags & SYSCOUNT) != 0 && ctx->syscount.method == SYSC_PTRACE) {
+                if (syscount_wait(&ctx->syscount, pid) != 0) {
+                    errno_bak = errno;
+                    vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                    fprintf(stderr, "warning%s, syscalls: %s\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+                }
+            }
+            /* exit stop and zombie of the program, not reaped */
+            if ((ctx->flags & PROCSNAP) != 0 && procsnap_wait(&ctx->procsnap, pid) != 0)
+                perror("procsnap_wait");
+            if ((ctx->flags & (SCHEDINFO | THREADS | NOISE)) != 0) {
+                siginfo_t si;
+                /* last sample while the terminated program is not reaped, /proc/<pid> is readable */
+                if (waitid(P_PID, pid, &si, WEXITED | WNOWAIT) == 0) {
+                    schedinfo_stop(&ctx->schedinfo);
+                    noisestat_stop(&ctx->noisestat);
+                }
+            }
             if ((wpid = waitpid(pid, &status, 0 /* options */)) <= 0)
                 perror("waitpid");
+            if ((ctx->flags & (SCHEDINFO | THREADS)) != 0)
+                schedinfo_stop(&ctx->schedinfo);
+            if ((ctx->flags & NOISE) != 0)
+                noisestat_stop(&ctx->noisestat);
+            if ((ctx->flags & ENERGY) != 0)
+                energy_stop(&ctx->energy);
+            if ((ctx->flags & LIVE) != 0)
+                livestat_stop(&ctx->livestat);
+            if ((ctx->flags & TRACE) != 0) {
+                trace_stop(&ctx->trace, status);
+                trace_span(&ctx->trace, "wait", &tsstep[1], trace_time(&tsstep[0]));
+            }
+            /* the child printed its error before execve(), the program did not run: no results,
+             * as when the identity and redirections were checked before the fork */
+            if (ctx->setupfd[0] >= 0 && read(ctx->setupfd[0], &errno_bak, sizeof(errno_bak)) == sizeof(errno_bak)) {
+                if ((ctx->flags & EVENTS) != 0) {
+                    s_events = NULL;
+                    events_stop(&ctx->events);
+                }
+                exit(clean_ctx(WIFEXITED(status) ? WEXITSTATUS(status) : errno_bak, ctx));
+            }
 
             /* get timings and other stats */
             if (vclock_gettime(CLOCK_MONOTONIC_RAW, &ts1) < 0) {
@@ -374,6 +981,53 @@ static int do_bench(ctx_t * ctx) {
             if (getrusage(RUSAGE_CHILDREN, &rusage) < 0)
                 perror("getrusage");
 
+            if ((ctx->flags & EVENTS) != 0) {
+                s_events = NULL;
+                events_stop(&ctx->events);
+                events_exited(&ctx->events, status, &ts1, &rusage);
+            }
+
+            if ((ctx->flags & PAGECACHE) != 0)
+                pagecache_residency(&ctx->pagecache, PGC_END);
+
+            if ((ctx->flags & LDSTAT) != 0 && ldstat_read(&ctx->ldstat) != 0)
+                perror("ldstat_read");
+
+            if ((ctx->flags & HEAPPROF) != 0 && heapprof_read(&ctx->heapprof) != 0)
+                perror("heapprof_read");
+
+            if ((ctx->flags & PHASESTAT) != 0)
+                phasestat_read(&ctx->phasestat);
+
+            if ((ctx->flags & DELAYACCT) != 0)
+                delayacct_stop(&ctx->delayacct);
+
+            if ((ctx->flags & SYSCOUNT) != 0)
+                syscount_stop(&ctx->syscount);
+
+            if ((ctx->flags & PERFPROF) != 0 && (perfprof_stop(&ctx->perfprof), 1)
+            &&  set_file_identity(ctx, 1) == 0) {
+                if (perfprof_write(&ctx->perfprof) != 0) {
+                    errno_bak = errno;
+                    vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                    fprintf(stderr, "error%s: perfprof_write(%s): %s\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx->perfprof.prefix, strerror(errno_bak));
+                }
+                if (set_file_identity(ctx, 0) != 0)
+                    perror("set_file_identity");
+            }
+
+            if ((ctx->flags & PROFILE_IO) != 0 && set_file_identity(ctx, 1) == 0) {
+                if (iotrace_write(&ctx->iotrace) != 0) {
+                    errno_bak = errno;
+                    vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                    fprintf(stderr, "error%s: iotrace_write(%s): %s\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx->iotrace.listfile, strerror(errno_bak));
+                }
+                if (set_file_identity(ctx, 0) != 0)
+                    perror("set_file_identity");
+            }
+
             if ((ctx->flags & TIME_POSIX) != 0) {
                 fprintf(out, "real %ld.%02d\nuser %ld.%02d\nsys %ld.%02d\n",
                         (long)ts1.tv_sec, (int)(ts1.tv_nsec / 10000000),
@@ -421,6 +1075,101 @@ static int do_bench(ctx_t * ctx) {
                         rusage.ru_nsignals,
                         rusage.ru_nvcsw, rusage.ru_nivcsw
                         );
+                if ((ctx->flags & PROCSNAP) != 0)
+                    procsnap_report(out, &ctx->procsnap);
+                if ((ctx->flags & PAGECACHE) != 0)
+                    pagecache_report(out, &ctx->pagecache);
+                if ((ctx->flags & PREFETCH) != 0)
+                    iotrace_prefetch_report(out, ctx->prefetchfile, &ctx->prefetch);
+                if ((ctx->flags & LDSTAT) != 0)
+                    ldstat_report(out, &ctx->ldstat);
+                if ((ctx->flags & DELAYACCT) != 0)
+                    delayacct_report(out, &ctx->delayacct);
+                if ((ctx->flags & SCHEDINFO) != 0)
+                    schedinfo_report(out, &ctx->schedinfo);
+                if ((ctx->flags & THREADS) != 0)
+                    schedinfo_threads_report(out, &ctx->schedinfo);
+                if ((ctx->flags & PERFPROF) != 0)
+                    perfprof_report(out, &ctx->perfprof);
+                if ((ctx->flags & SYSCOUNT) != 0)
+                    syscount_report(out, &ctx->syscount);
+                if ((ctx->flags & HEAPPROF) != 0)
+                    heapprof_report(out, &ctx->heapprof);
+                if ((ctx->flags & PHASESTAT) != 0)
+                    phasestat_report(out, &ctx->phasestat);
+                if ((ctx->flags & ENERGY) != 0)
+                    energy_report(out, &ctx->energy);
+                if ((ctx->flags & PROFILE_IO) != 0)
+                    iotrace_report(out, &ctx->iotrace);
+                if ((ctx->flags & ADMISSION) != 0)
+                    admission_report(out, &ctx->admission);
+                if ((ctx->flags & NOISE) != 0)
+                    noisestat_report(out, &ctx->noisestat);
+                repro_report(out, &ctx->repro);
+                coresched_report(out, &ctx->coresched);
+                freqpin_report(out, &ctx->freqpin);
+                hostinfo_report(out, &ctx->hostinfo);
+            }
+
+            if ((ctx->flags & METRICS) != 0) {
+                metrics_run_t run = {
+                    .program = ctx->argv[ctx->i_argv_program],
+                    .uid = (ctx->flags & HAVE_UID) != 0 ? ctx->uid : getuid(),
+                    .gid = (ctx->flags & HAVE_GID) != 0 ? ctx->gid : getgid(),
+                    .status = status, .real = ts1, .rusage = &rusage,
+                    .delayacct = (ctx->flags & DELAYACCT) != 0 ? &ctx->delayacct : NULL,
+                    .syscount = (ctx->flags & SYSCOUNT) != 0 ? &ctx->syscount : NULL,
+                    .heapprof = (ctx->flags & HEAPPROF) != 0 ? &ctx->heapprof : NULL,
+                    .phasestat = (ctx->flags & PHASESTAT) != 0 ? &ctx->phasestat : NULL,
+                    .energy = (ctx->flags & ENERGY) != 0 ? &ctx->energy : NULL,
+                    .host = &ctx->hostinfo,
+                };
+                if (metrics_write(ctx->metricsfile, &run) != 0) {
+                    errno_bak = errno;
+                    vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                    fprintf(stderr, "error%s: metrics_write(%s): %s\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx->metricsfile, strerror(errno_bak));
+                }
+            }
+
+            if ((ctx->flags & FLEETSTAT) != 0
+            && fleetstat_account(&ctx->fleetstat, (ctx->flags & HAVE_UID) != 0 ? ctx->uid : getuid(),
+                                 ctx->argv[ctx->i_argv_program], !WIFEXITED(status) || WEXITSTATUS(status) != 0,
+                                 rusage.ru_utime.tv_sec * 1000000ULL + rusage.ru_utime.tv_usec
+                                 + rusage.ru_stime.tv_sec * 1000000ULL + rusage.ru_stime.tv_usec,
+                                 ts1.tv_sec * 1000000ULL + ts1.tv_nsec / 1000, rusage.ru_maxrss * 1024ULL) != 0) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, stats-file %s: %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx->fleetstat.path, strerror(errno_bak));
+            }
+
+            if ((ctx->flags & TRACE) != 0
+            && (trace_span(&ctx->trace, "results", &tsstep[0], trace_time(&tsstep[1])), 1)
+            && set_file_identity(ctx, 1) == 0) {
+                if (trace_write(&ctx->trace) != 0) {
+                    errno_bak = errno;
+                    vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                    fprintf(stderr, "error%s: trace_write(%s): %s\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx->tracefile, strerror(errno_bak));
+                }
+                if (set_file_identity(ctx, 0) != 0)
+                    perror("set_file_identity");
+            }
+
+            /* the host disturbed the run: measure it again */
+            if ((ctx->flags & NOISE) != 0 && noisestat_contaminated(&ctx->noisestat)
+            && ctx->noisestat.run <= ctx->noisestat.reruns) {
+                fflush(out);
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, noise: run %u contaminated (%.2f%% of the cpus, max %g), "
+                                "running program again\n", vterm_color(STDERR_FILENO, VCOLOR_RESET),
+                        ctx->noisestat.run, noisestat_noise(&ctx->noisestat), ctx->noisestat.max);
+                run_again(ctx);
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+                fprintf(stderr, "warning%s, noise-rerun: execv(): %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
             }
 
             /* Terminate with child status */
@@ -438,6 +1187,71 @@ static int do_bench(ctx_t * ctx) {
     return 0;
 }
 
+/** prepare_exec() : last steps of the process which is going to execute the program */
+static int prepare_exec(ctx_t * ctx) {
+    int errno_bak;
+
+    if ((ctx->flags & PERFPROF) != 0 && perfprof_child(&ctx->perfprof) != 0) {
+        errno_bak = errno;
+        vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+        fprintf(stderr, "error%s: perfprof_child(): %s\n",
+                vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+        return ERR_PERFPROF;
+    }
+    if ((ctx->flags & PROFILE_IO) != 0 && iotrace_child(&ctx->iotrace) != 0) {
+        errno_bak = errno;
+        vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+        fprintf(stderr, "error%s: iotrace_child(): %s\n",
+                vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+        return ERR_PROFILE_IO;
+    }
+    if ((ctx->flags & SYSCOUNT) != 0 && syscount_child(&ctx->syscount) != 0) {
+        errno_bak = errno;
+        vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+        fprintf(stderr, "error%s: syscount_child(): %s\n",
+                vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+        return ERR_SYSCOUNT;
+    }
+    if ((ctx->flags & HEAPPROF) != 0 && heapprof_child(&ctx->heapprof) != 0) {
+        errno_bak = errno;
+        vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+        fprintf(stderr, "error%s: heapprof_child(): %s\n",
+                vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+        return ERR_HEAPPROF;
+    }
+    if ((ctx->flags & PHASESTAT) != 0 && phasestat_child(&ctx->phasestat) != 0) {
+        errno_bak = errno;
+        vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+        fprintf(stderr, "error%s: phasestat_child(): %s\n",
+                vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+        return ERR_PHASESTAT;
+    }
+    /* the program runs anyway, with its siblings shared */
+    if (ctx->coresched.enabled && coresched_child(&ctx->coresched) != 0) {
+        errno_bak = errno;
+        vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+        fprintf(stderr, "warning%s, core-sched: %s\n",
+                vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+    }
+    /* the program runs anyway, only less reproducible */
+    if ((ctx->repro.enabled || ctx->repro.seed != NULL || ctx->repro.sweep > 0)
+    && repro_child(&ctx->repro, ctx->argv + ctx->i_argv_program) != 0) {
+        errno_bak = errno;
+        vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+        fprintf(stderr, "warning%s, reproducible: %s\n",
+                vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+    }
+    /* last one, as it takes the time just before execve() */
+    if ((ctx->flags & LDSTAT) != 0 && ldstat_child(&ctx->ldstat) != 0) {
+        errno_bak = errno;
+        vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+        fprintf(stderr, "error%s: ldstat_child(): %s\n",
+                vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+        return ERR_LDSTAT;
+    }
+    return 0;
+}
+
 /** parse_option_first_pass() : option callback of type opt_option_callback_t. see vlib/options.h */
 static int parse_option_first_pass(int opt, const char *arg, int *i_argv, opt_config_t * opt_config) {
     ctx_t * ctx = opt_config ? (ctx_t *) opt_config->user_data : NULL;
@@ -448,6 +1262,8 @@ static int parse_option_first_pass(int opt, const char *arg, int *i_argv, opt_co
     switch (opt) {
         case 't': ctx->flags |= TIME_POSIX;  break ;
         case 'T': ctx->flags |= TIME_EXT;    break ;
+        /* before set_redirections(), as the panel is displayed on the alternate output */
+        case OPT_LIVE: ctx->flags |= LIVE;   break ;
         case '1':
             if ((ctx->flags & TO_STDERR) != 0)
                 ctx->flags |= WARN_MOREREDIRS;
@@ -542,6 +1358,199 @@ static int parse_option(int opt, const char *arg, int *i_argv, opt_config_t * op
             ctx->infile = arg;
             break ;
         case 'N': ctx->flags |= FILE_NEWIDENTITY; break ;
+        case OPT_CACHE:
+            if (pagecache_parse_mode(arg, &ctx->pagecache.mode) != 0) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s, bad cache mode '%s'\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
+                return OPT_ERROR(ERR_OPTION+13);
+            }
+            ctx->flags |= PAGECACHE;
+            break ;
+        case OPT_PROFILE_IO:
+            ctx->iotrace.listfile = arg;
+            ctx->flags |= PROFILE_IO;
+            break ;
+        case OPT_PREFETCH:
+            ctx->prefetchfile = arg;
+            ctx->flags |= PREFETCH;
+            break ;
+        case OPT_LOADER: ctx->flags |= LDSTAT; break ;
+        case OPT_DELAYS: ctx->flags |= DELAYACCT; break ;
+        case OPT_SCHED: ctx->flags |= SCHEDINFO; break ;
+        case OPT_THREADS: ctx->flags |= THREADS; break ;
+        case OPT_PROFILE:
+            if (perfprof_parse_modes(arg, &ctx->perfprof.modes) != 0) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s, bad profile mode '%s'\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
+                return OPT_ERROR(ERR_OPTION+17);
+            }
+            if ((ctx->perfprof.modes & PERFPROF_EVENTS) != 0)
+                ctx->flags |= PERFPROF;
+            if ((ctx->perfprof.modes & PERFPROF_HEAP) != 0)
+                ctx->flags |= HEAPPROF;
+            break ;
+        case OPT_FREQ:
+            errno = 0;
+            tmp = strtol(arg, &endptr, 0);
+            if (errno != 0 || *endptr != 0 || tmp <= 0) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s, bad frequency '%s'\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
+                return OPT_ERROR(ERR_OPTION+19);
+            }
+            ctx->perfprof.freq = tmp;
+            break ;
+        case OPT_FOLDED: ctx->perfprof.prefix = arg; break ;
+        case OPT_SYSCALLS: ctx->flags |= SYSCOUNT; break ;
+        case OPT_PHASES: ctx->flags |= PHASESTAT; break ;
+        case OPT_ENERGY: ctx->flags |= ENERGY; break ;
+        case OPT_SYSFS: ctx->sysfs = arg; break ;
+        case OPT_EVENTS:
+            ctx->eventsfile = arg;
+            ctx->flags |= EVENTS;
+            break ;
+        case OPT_CONTROL: ctx->controlfifo = arg; break ;
+        case OPT_TRACE:
+            ctx->tracefile = arg;
+            ctx->flags |= TRACE;
+            break ;
+        case OPT_METRICS:
+            ctx->metricsfile = arg;
+            ctx->flags |= METRICS;
+            break ;
+        case OPT_STATS_FILE:
+            ctx->fleetstat.path = arg;
+            ctx->flags |= FLEETSTAT;
+            break ;
+        case OPT_STATS:
+            if (fleetstat_open(&ctx->fleetstat, arg, 0) != 0) {
+                tmp = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s: fleetstat_open(%s): %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx->fleetstat.path, strerror(tmp));
+                return OPT_ERROR(ERR_OPTION+21);
+            }
+            fleetstat_report(stdout, &ctx->fleetstat);
+            fleetstat_close(&ctx->fleetstat);
+            ctx->fleetstat.path = NULL;
+            ctx->flags |= OPTIONAL_ARGS;
+            break ;
+        case OPT_MAX_CONCURRENT:
+            errno = 0;
+            tmp = strtol(arg, &endptr, 0);
+            if (errno != 0 || *endptr != 0 || tmp <= 0 || tmp > ADMISSION_MAX_CONCURRENT) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s, bad max-concurrent '%s' (1..%d)\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), arg, ADMISSION_MAX_CONCURRENT);
+                return OPT_ERROR(ERR_OPTION+23);
+            }
+            ctx->admission.max_concurrent = tmp;
+            ctx->flags |= ADMISSION;
+            break ;
+        case OPT_RATE:
+            if (admission_parse_rate(arg, &ctx->admission.rate) != 0) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s, bad rate '%s'\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
+                return OPT_ERROR(ERR_OPTION+25);
+            }
+            ctx->flags |= ADMISSION;
+            break ;
+        case OPT_NOWAIT: ctx->admission.nowait = 1; break ;
+        case OPT_ADMISSION_FILE: ctx->admission.path = arg; break ;
+        case OPT_EXIT_SNAPSHOT: ctx->flags |= PROCSNAP; break ;
+        case OPT_NOISE:
+            if (arg != NULL) {
+                errno = 0;
+                ctx->noisestat.max = strtod(arg, &endptr);
+                if (errno != 0 || *endptr != 0 || ctx->noisestat.max < 0 || ctx->noisestat.max > 100) {
+                    vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                    fprintf(stderr, "error%s, bad noise max '%s' (percent)\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
+                    return OPT_ERROR(ERR_OPTION+27);
+                }
+            }
+            ctx->flags |= NOISE;
+            break ;
+        case OPT_NOISE_RERUN:
+            errno = 0;
+            tmp = strtol(arg, &endptr, 0);
+            if (errno != 0 || *endptr != 0 || tmp < 0) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s, bad noise-rerun '%s'\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
+                return OPT_ERROR(ERR_OPTION+29);
+            }
+            ctx->noisestat.reruns = tmp;
+            ctx->flags |= NOISE;
+            break ;
+        case OPT_REPRODUCIBLE:
+            if (arg != NULL) {
+                errno = 0;
+                tmp = strtol(arg, &endptr, 0);
+                if (errno != 0 || *endptr != 0 || tmp < 0) {
+                    vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                    fprintf(stderr, "error%s, bad reproducible cpu '%s'\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
+                    return OPT_ERROR(ERR_OPTION+31);
+                }
+                ctx->repro.cpu = tmp;
+            }
+            ctx->repro.enabled = 1;
+            break ;
+        case OPT_SEED:
+            errno = 0;
+            if (*arg < '0' || *arg > '9' || strtoul(arg, &endptr, 10) > 4294967295UL || errno != 0 || *endptr != 0) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s, bad seed '%s' (0..4294967295)\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
+                return OPT_ERROR(ERR_OPTION+33);
+            }
+            ctx->repro.seed = arg;
+            break ;
+        case OPT_LAYOUT_SWEEP:
+            if (repro_parse_sweep(arg, &ctx->repro) != 0) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s, bad layout-sweep '%s' (L[xR], 2 to 1000)\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
+                return OPT_ERROR(ERR_OPTION+35);
+            }
+            break ;
+        case OPT_FIXED_FREQ:
+            if (freqpin_parse(arg, &ctx->freqpin.khz) != 0) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s, bad frequency '%s' (F[GHz|MHz|kHz])\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
+                return OPT_ERROR(ERR_OPTION+37);
+            }
+            break ;
+        case OPT_NO_TURBO: ctx->freqpin.noturbo = 1; break ;
+        case OPT_FREQ_RECORD: ctx->freqpin.record = arg; break ;
+        case OPT_FREQ_RESTORE:
+            /* done once all the options are parsed, see freq_restore() */
+            ctx->freqpin.recover = 1;
+            ctx->flags |= OPTIONAL_ARGS;
+            break ;
+        case OPT_CORE_SCHED:
+            if (arg != NULL && strcmp(arg, "reserve") != 0) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s, bad core-sched '%s' (reserve)\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
+                return OPT_ERROR(ERR_OPTION+41);
+            }
+            ctx->coresched.enabled = 1;
+            ctx->coresched.reserve = arg != NULL;
+            break ;
+        case OPT_CACHE_FILE:
+            if (pagecache_add(&ctx->pagecache, arg) != 0) {
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s: pagecache_add(%s): %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), arg, strerror(errno));
+                return OPT_ERROR(ERR_OPTION+15);
+            }
+            break ;
         case 'o':
         case 'O':
             if (ctx->outfile != NULL) {
@@ -565,7 +1574,7 @@ static int parse_option(int opt, const char *arg, int *i_argv, opt_config_t * op
             errno = 0;
             tmpuid = strtol(arg, &endptr, 0);
             if ((errno != 0 || !endptr || *endptr != 0)
-            &&  pwfindid_r(arg, &tmpuid, &ctx->buf, &ctx->bufsz) != 0) {
+            &&  LOOKUP_TIME(ctx, pwfindid_r(arg, &tmpuid, &ctx->buf, &ctx->bufsz)) != 0) {
                 vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
                 fprintf(stderr, "error%s: pwfindid_r(%s): invalid user\n",
                         vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
@@ -593,7 +1602,7 @@ static int parse_option(int opt, const char *arg, int *i_argv, opt_config_t * op
             errno = 0;
             tmpgid = strtol(arg, &endptr, 0);
             if ((errno != 0 || !endptr || *endptr != 0)
-            &&  grfindid_r(arg, &tmpgid, &ctx->buf, &ctx->bufsz) != 0) {
+            &&  LOOKUP_TIME(ctx, grfindid_r(arg, &tmpgid, &ctx->buf, &ctx->bufsz)) != 0) {
                 vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
                 fprintf(stderr, "error%s: grfindid_r(%s): invalid group\n",
                         vterm_color(STDERR_FILENO, VCOLOR_RESET), arg);
@@ -630,11 +1639,44 @@ static int parse_option(int opt, const char *arg, int *i_argv, opt_config_t * op
     return OPT_CONTINUE(0);
 }
 
+/** freq_restore() : --freq-restore, after the parsing of all the options so that
+ * --freq-record and --sysfs are taken whatever their order */
+static int freq_restore(ctx_t * ctx) {
+    int ret, errno_bak;
+
+    if ((ret = freqpin_recover(ctx->sysfs != NULL ? ctx->sysfs : ctx->freqpin.sysfs,
+                               ctx->freqpin.record)) < 0) {
+        errno_bak = errno;
+        vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+        if (errno_bak == EBUSY)
+            fprintf(stderr, "error%s: freq-restore: the run of %s is still running\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx->freqpin.record);
+        else
+            fprintf(stderr, "error%s: freqpin_recover(%s): %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx->freqpin.record, strerror(errno_bak));
+        return ERR_OPTION+39;
+    }
+    fprintf(stdout, "%s: %s\n", ctx->freqpin.record, ret > 0 ? "restored" : "nothing to restore");
+    fflush(stdout);
+    return 0;
+}
+
 int main(int argc, char *const* argv) {
     ctx_t           ctx = {
         .flags = 0, .argc = argc, .argv = argv, .buf = NULL, .bufsz = 0,
-        .alternatefile = NULL, .outfd = -1, .infd = -1, .outfile = NULL, .infile = NULL,
+        .alternatefile = NULL, .outfd = -1, .infd = -1, .setupfd = { -1, -1 }, .outfile = NULL, .infile = NULL,
         .logs = logpool_create(), .uid = 0, .gid = 0, .priority = 0, .i_argv_program = 0,
+        .pagecache = PAGECACHE_INITIALIZER, .iotrace = IOTRACE_INITIALIZER, .prefetchfile = NULL,
+        .ldstat = LDSTAT_INITIALIZER, .delayacct = DELAYACCT_INITIALIZER,
+        .schedinfo = SCHEDINFO_INITIALIZER, .perfprof = PERFPROF_INITIALIZER,
+        .syscount = SYSCOUNT_INITIALIZER, .heapprof = HEAPPROF_INITIALIZER,
+        .phasestat = PHASESTAT_INITIALIZER, .sysfs = NULL, .energy = ENERGY_INITIALIZER,
+        .livestat = LIVESTAT_INITIALIZER, .eventsfile = NULL, .controlfifo = NULL,
+        .events = EVENTS_INITIALIZER, .tracefile = NULL, .trace = TRACE_INITIALIZER,
+        .metricsfile = NULL, .fleetstat = FLEETSTAT_INITIALIZER,
+        .admission = ADMISSION_INITIALIZER, .procsnap = PROCSNAP_INITIALIZER,
+        .noisestat = NOISESTAT_INITIALIZER, .hostinfo = HOSTINFO_INITIALIZER,
+        .repro = REPRO_INITIALIZER, .freqpin = FREQPIN_INITIALIZER, .coresched = CORESCHED_INITIALIZER,
     };
     opt_config_t    opt_config  = OPT_INITIALIZER(argc, argv, parse_option_first_pass, s_opt_desc,
                                                   VERSION_STRING(OPT_VERSION_STRING_GPL3PLUS), &ctx);
@@ -642,11 +1684,13 @@ int main(int argc, char *const* argv) {
     int             ret = 0;
     int             errno_bak;
 
+    trace_time(&ctx.tsstart);
     /* Manage program options: first pass on command line to set redirections, in silent mode:
      * nothing has to be written on stdout/stderr until set_redirections() is called */
     if (OPT_IS_EXIT(ret = opt_parse_options_2pass(&opt_config, parse_option))) {
         return clean_ctx(OPT_EXIT_CODE(ret), &ctx);
     }
+    trace_time(&ctx.tsoptions);
 
     /* clean now unnecessary resources */
     if (ctx.buf) {
@@ -654,6 +1698,8 @@ int main(int argc, char *const* argv) {
         ctx.buf = NULL;
     }
     do {
+        if (ctx.freqpin.recover && (ret = freq_restore(&ctx)) != 0)
+            break ;
         /* error if program is mandatory */
         if (ctx.i_argv_program == 0 || ctx.i_argv_program >= argc) {
             if ((ctx.flags & OPTIONAL_ARGS) != 0 && ((ret = 0) || 1))
@@ -665,6 +1711,16 @@ int main(int argc, char *const* argv) {
         }
         /* program header */
         fprintf(stdout, "%s\n\n", opt_config.version_string);
+        /* the runs of a sweep are only timed */
+        if (ctx.repro.sweep > 0 && (ctx.flags & (PROFILE_IO | LDSTAT | DELAYACCT | SCHEDINFO | THREADS | PERFPROF
+                                                 | SYSCOUNT | HEAPPROF | PHASESTAT | ENERGY | LIVE | EVENTS | TRACE
+                                                 | METRICS | FLEETSTAT | PROCSNAP | NOISE)) != 0) {
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+            fprintf(stderr, "warning%s, layout-sweep: monitoring options are ignored\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET));
+            ctx.flags &= ~(PROFILE_IO | LDSTAT | DELAYACCT | SCHEDINFO | THREADS | PERFPROF | SYSCOUNT | HEAPPROF
+                           | PHASESTAT | ENERGY | LIVE | EVENTS | TRACE | METRICS | FLEETSTAT | PROCSNAP | NOISE);
+        }
         /* prepare priority, uid, gid, newargv, outfile, bench for excvp */
         if ((ctx.flags & HAVE_PRIORITY) != 0 && setpriority(PRIO_PROCESS, getpid(), ctx.priority) < 0) {
             errno_bak = errno;
@@ -674,6 +1730,259 @@ int main(int argc, char *const* argv) {
                     vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx.priority, strerror(errno_bak));
             break ;
         }
+        if (set_pagecache(&ctx) != 0 && ((ret = ERR_PAGECACHE) || 1)) {
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            fprintf(stderr, "error%s: set_pagecache(): %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno));
+            break ;
+        }
+        if ((ctx.flags & PREFETCH) != 0 && iotrace_prefetch(ctx.prefetchfile, &ctx.prefetch) != 0
+        && ((ret = ERR_PREFETCH) || 1)) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            fprintf(stderr, "error%s: iotrace_prefetch(%s): %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx.prefetchfile, strerror(errno_bak));
+            break ;
+        }
+        if ((ctx.flags & LDSTAT) != 0 && ldstat_init(&ctx.ldstat, argv[ctx.i_argv_program],
+                                                       (ctx.flags & HAVE_UID) != 0 ? ctx.uid : getuid()) != 0
+        && ((ret = ERR_LDSTAT) || 1)) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            if (errno_bak == ENOENT)
+                fprintf(stderr, "error%s: ldstat_init(): %s not found, see VRUNAS_PRELOAD\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), LDSTAT_PRELOAD_LIB);
+            else
+                fprintf(stderr, "error%s: ldstat_init(): %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            break ;
+        }
+        if ((ctx.flags & PROFILE_IO) != 0 && iotrace_init(&ctx.iotrace) != 0 && ((ret = ERR_PROFILE_IO) || 1)) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            fprintf(stderr, "error%s: iotrace_init(): %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            break ;
+        }
+        if ((ctx.flags & DELAYACCT) != 0 && delayacct_init(&ctx.delayacct) != 0
+        && ((ret = ERR_DELAYACCT) || 1)) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            fprintf(stderr, "error%s: delayacct_init(): %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            break ;
+        }
+        if ((ctx.flags & (SCHEDINFO | THREADS)) != 0
+        && schedinfo_init(&ctx.schedinfo, (ctx.flags & SCHEDINFO) != 0) != 0
+        && ((ret = ERR_SCHEDINFO) || 1)) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            fprintf(stderr, "error%s: schedinfo_init(): %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            break ;
+        }
+        if ((ctx.flags & PERFPROF) != 0 && perfprof_init(&ctx.perfprof) != 0
+        && ((ret = ERR_PERFPROF) || 1)) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            fprintf(stderr, "error%s: perfprof_init(): %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            break ;
+        }
+        if ((ctx.flags & SYSCOUNT) != 0 && syscount_init(&ctx.syscount) != 0
+        && ((ret = ERR_SYSCOUNT) || 1)) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            fprintf(stderr, "error%s: syscount_init(): %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            break ;
+        }
+        if ((ctx.flags & HEAPPROF) != 0 && heapprof_init(&ctx.heapprof,
+                        (ctx.flags & HAVE_UID) != 0 ? ctx.uid : getuid(),
+                        (ctx.flags & HAVE_GID) != 0 ? ctx.gid : getgid()) != 0
+        && ((ret = ERR_HEAPPROF) || 1)) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            if (errno_bak == ENOENT)
+                fprintf(stderr, "error%s: heapprof_init(): %s not found, see VRUNAS_PRELOAD\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), HEAPPROF_PRELOAD_LIB);
+            else
+                fprintf(stderr, "error%s: heapprof_init(): %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            break ;
+        }
+        if ((ctx.flags & PHASESTAT) != 0 && phasestat_init(&ctx.phasestat) != 0
+        && ((ret = ERR_PHASESTAT) || 1)) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            fprintf(stderr, "error%s: phasestat_init(): %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            break ;
+        }
+        /* energy is not available on all hosts: the program is run without it */
+        if (ctx.sysfs != NULL)
+            ctx.energy.sysfs = ctx.sysfs;
+        if ((ctx.flags & ENERGY) != 0 && energy_init(&ctx.energy) != 0) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+            if (errno_bak == ENOENT)
+                fprintf(stderr, "warning%s, energy: no RAPL domain in %s/class/powercap\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx.energy.sysfs);
+            else
+                fprintf(stderr, "warning%s, energy: %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            ctx.flags &= ~ENERGY;
+        }
+        if ((ctx.flags & LIVE) != 0
+        && livestat_init(&ctx.livestat, ctx.alternatefile ? fileno(ctx.alternatefile) : STDERR_FILENO) != 0) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+            fprintf(stderr, "warning%s, live: %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            ctx.flags &= ~LIVE;
+        }
+        if ((ctx.flags & NOISE) != 0 && noisestat_init(&ctx.noisestat) != 0) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+            fprintf(stderr, "warning%s, noise: %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            ctx.flags &= ~NOISE;
+        }
+        if ((ctx.flags & EVENTS) != 0 && set_file_identity(&ctx, 1) != 0 && ((ret = ERR_SETID) || 1))
+            break ;
+        if ((ctx.flags & EVENTS) != 0 && events_init(&ctx.events, ctx.eventsfile, ctx.controlfifo) != 0
+        && ((ret = ERR_EVENTS) || 1)) {
+            errno_bak = errno;
+            set_file_identity(&ctx, 0);
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            fprintf(stderr, "error%s: events_init(%s): %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET),
+                    ctx.controlfifo != NULL && ctx.events.fd >= 0 ? ctx.controlfifo : ctx.eventsfile,
+                    strerror(errno_bak));
+            break ;
+        }
+        if ((ctx.flags & EVENTS) != 0 && set_file_identity(&ctx, 0) != 0 && ((ret = ERR_SETID) || 1)) {
+            perror("set_file_identity");
+            break ;
+        }
+        if ((ctx.flags & TRACE) != 0 && set_file_identity(&ctx, 1) != 0 && ((ret = ERR_SETID) || 1))
+            break ;
+        if ((ctx.flags & TRACE) != 0 && trace_init(&ctx.trace, ctx.tracefile, &ctx.tsstart) != 0
+        && ((ret = ERR_TRACE) || 1)) {
+            errno_bak = errno;
+            set_file_identity(&ctx, 0);
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            fprintf(stderr, "error%s: trace_init(%s): %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx.tracefile, strerror(errno_bak));
+            break ;
+        }
+        if ((ctx.flags & TRACE) != 0 && set_file_identity(&ctx, 0) != 0 && ((ret = ERR_SETID) || 1)) {
+            perror("set_file_identity");
+            break ;
+        }
+        if ((ctx.flags & TRACE) != 0) {
+            trace_span(&ctx.trace, "options", &ctx.tsstart, &ctx.tsoptions);
+            if (ctx.tslookup[0].tv_sec != 0 || ctx.tslookup[0].tv_nsec != 0)
+                trace_span(&ctx.trace, "lookups", &ctx.tslookup[0], &ctx.tslookup[1]);
+        }
+        if ((ctx.flags & FLEETSTAT) != 0 && fleetstat_open(&ctx.fleetstat, ctx.fleetstat.path, 1) != 0) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+            fprintf(stderr, "warning%s, stats-file %s: %s\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx.fleetstat.path, strerror(errno_bak));
+            ctx.flags &= ~FLEETSTAT;
+        }
+        /* a process has only one ptrace tracer */
+        if ((ctx.flags & (SYSCOUNT | PROFILE_IO)) == (SYSCOUNT | PROFILE_IO)
+        && ctx.syscount.method == SYSC_PTRACE && ctx.iotrace.method == IOT_PTRACE
+        && ((ret = ERR_SYSCOUNT) || 1)) {
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            fprintf(stderr, "error%s: --syscalls and --profile-io both need ptrace when not root\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET));
+            break ;
+        }
+        if ((ctx.flags & PROCSNAP) != 0 && PTRACED(&ctx)) {
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_YELLOW, VCOLOR_EMPTY, VCOLOR_EMPTY));
+            fprintf(stderr, "warning%s, exit-snapshot: no memory at exit with ptrace of --profile-io or --syscalls\n",
+                    vterm_color(STDERR_FILENO, VCOLOR_RESET));
+        }
+        if ((ctx.repro.enabled || ctx.repro.seed != NULL || ctx.repro.sweep > 0) && repro_init(&ctx.repro) != 0
+        && ((ret = ERR_REPRO) || 1)) {
+            errno_bak = errno;
+            vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+            if (errno_bak == EINVAL)
+                fprintf(stderr, "error%s: reproducible: cpu %d not allowed\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx.repro.cpu);
+            else
+                fprintf(stderr, "error%s: repro_init(): %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+            break ;
+        }
+        if (ctx.coresched.enabled) {
+            /* the cpu of --reproducible is already alone */
+            if (ctx.repro.enabled)
+                ctx.coresched.reserve = 0;
+            if (ctx.sysfs != NULL)
+                ctx.coresched.sysfs = ctx.sysfs;
+            if (coresched_init(&ctx.coresched) != 0 && ((ret = ERR_CORESCHED) || 1)) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                fprintf(stderr, "error%s: coresched_init(): %s\n",
+                        vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+                break ;
+            }
+        }
+        /* before the fingerprint, which records the frequency of the run */
+        if (ctx.freqpin.khz > 0 || ctx.freqpin.noturbo) {
+            if (ctx.sysfs != NULL)
+                ctx.freqpin.sysfs = ctx.sysfs;
+            if (freqpin_apply(&ctx.freqpin, ctx.repro.enabled ? ctx.repro.cpu : -1) != 0
+            && ((ret = ERR_FREQPIN) || 1)) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                if (errno_bak == EBUSY)
+                    fprintf(stderr, "error%s: fixed-freq: %s is used by a running vrunas\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx.freqpin.record);
+                else if (errno_bak == ERANGE)
+                    fprintf(stderr, "error%s: fixed-freq: %lu kHz not supported by the cpus\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx.freqpin.khz);
+                else
+                    fprintf(stderr, "error%s: freqpin_apply(): %s\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), strerror(errno_bak));
+                break ;
+            }
+        }
+        /* fingerprint of the environment, to compare the results of comparable hosts */
+        if ((ctx.flags & (TIME_EXT | METRICS)) != 0) {
+            char version[HOSTINFO_STR_MAX];
+            const char * vlib = vlib_get_version();
+
+            snprintf(version, sizeof(version), "%s %s git:%s, %.*s", BUILD_APPNAME, APP_VERSION,
+                     BUILD_GITREV, (int) strcspn(vlib, "\n"), vlib);
+            hostinfo_collect(&ctx.hostinfo, ctx.sysfs != NULL ? ctx.sysfs : ENERGY_DEFAULT_SYSFS, version);
+        }
+        /* last, the wait for admission does not count in the run */
+        if ((ctx.flags & ADMISSION) != 0) {
+            struct timespec ts[2];
+
+            trace_time(&ts[0]);
+            if (admission_acquire(&ctx.admission, (ctx.flags & HAVE_UID) != 0 ? ctx.uid : getuid()) != 0
+            && ((ret = ERR_ADMISSION) || 1)) {
+                errno_bak = errno;
+                vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
+                if (errno_bak == EAGAIN)
+                    fprintf(stderr, "error%s: admission: uid %lu over its limits\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), (unsigned long) ctx.admission.uid);
+                else
+                    fprintf(stderr, "error%s: admission_acquire(%s): %s\n",
+                            vterm_color(STDERR_FILENO, VCOLOR_RESET), ctx.admission.path, strerror(errno_bak));
+                break ;
+            }
+            if ((ctx.flags & TRACE) != 0)
+                trace_span(&ctx.trace, "admission", &ts[0], trace_time(&ts[1]));
+        }
+        if (do_bench(&ctx) != 0 && ((ret = ERR_BENCH) || 1))
+            break ;
         if ((ctx.flags & FILE_NEWIDENTITY) != 0 && set_uidgid(ctx.uid, ctx.gid, &ctx) != 0 && ((ret = ERR_SETID) || 1))
             break ;
         if ((ctx.outfd = set_out(ctx.outfile, &ctx)) < 0 && ((ret = ERR_SETOUT) || 1))
@@ -682,14 +1991,24 @@ int main(int argc, char *const* argv) {
             break ;
         if ((ctx.flags & FILE_NEWIDENTITY) == 0 && set_uidgid(ctx.uid, ctx.gid, &ctx) != 0 && ((ret = ERR_SETID) || 1))
             break ;
-        if (do_bench(&ctx) != 0 && ((ret = ERR_BENCH) || 1))
-            break ;
         if ((newargv = build_argv(argc - ctx.i_argv_program, argv + ctx.i_argv_program, &ctx)) == NULL && ((ret = ERR_BUILDARGV) || 1))
             break ;
+        if ((ret = prepare_exec(&ctx)) != 0)
+            break ;
+        if ((ctx.flags & TRACE) != 0) {
+            struct timespec ts;
+            trace_span(&ctx.trace, "child setup", &ctx.tschild, trace_time(&ts));
+            trace_exec(&ctx.trace);
+        }
         /* execvp, in, if needed, a forked process */
+        repro_exec(&ctx.repro);
         if (execvp(*newargv, newargv) < 0) {
             errno_bak = errno;
             ret = ERR_EXEC;
+            if ((ctx.flags & EVENTS) != 0)
+                events_child_failed(&ctx.events, ret, errno_bak);
+            if ((ctx.flags & TRACE) != 0)
+                trace_exec_failed(&ctx.trace);
             vterm_putcolor(stderr, VCOLOR_BUILD(VCOLOR_RED, VCOLOR_EMPTY, VCOLOR_BOLD));
             fprintf(stderr, "error%s: `%s` (execvp): %s\n",
                     vterm_color(STDERR_FILENO, VCOLOR_RESET), *newargv, strerror(errno_bak));
@@ -698,6 +2017,12 @@ int main(int argc, char *const* argv) {
         /* not reachable */
         return ERR_NOT_REACHABLE;
     } while (0);
+    /* the child could not execute the program (nothing done if not the child) */
+    if (ret != 0 && (ctx.flags & EVENTS) != 0)
+        events_child_failed(&ctx.events, ret, errno);
+    if ((ret == ERR_SETID || ret == ERR_SETOUT || ret == ERR_SETIN) && ctx.setupfd[1] >= 0
+    &&  write(ctx.setupfd[1], &ret, sizeof(ret)) != sizeof(ret))
+        perror("write setup status");
     if (newargv)
         free(newargv);
     return clean_ctx(ret, &ctx);